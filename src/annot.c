@@ -67,6 +67,31 @@ done:	return;
 }
 
 
+static inline size_t
+annotStrMemSize(const es_str_t *const str)
+{
+	return (str == NULL) ? 0 : sizeof(es_str_t) + str->lenBuf;
+}
+
+size_t
+ln_annotSetMemSize(const ln_annotSet *as)
+{
+	size_t size = 0;
+	if(as == NULL)
+		goto done;
+
+	size = sizeof(struct ln_annotSet_s);
+	for(const ln_annot *annot = as->aroot ; annot != NULL ; annot = annot->next) {
+		size += sizeof(struct ln_annot_s) + annotStrMemSize(annot->tag);
+		for(const ln_annot_op *op = annot->oproot ; op != NULL ; op = op->next) {
+			size += sizeof(struct ln_annot_op_s) + annotStrMemSize(op->name)
+				+ annotStrMemSize(op->value);
+		}
+	}
+done:	return size;
+}
+
+
 ln_annot*
 ln_findAnnot(ln_annotSet *as, es_str_t *tag)
 {
@@ -237,3 +262,97 @@ ln_annotate(ln_ctx ctx, struct json_object *json, struct json_object *tagbucket)
 
 done:	return r;
 }
+
+
+int
+ln_annotCompile(ln_ctx ctx, struct json_object *tagbucket, struct ln_annot_kv **kv_p, int *nkv_p)
+{
+	int r = 0;
+	struct ln_annot_kv *kv = NULL;
+	int nkv = 0;
+	int maxkv = 0;
+	es_str_t *tag = NULL;
+	ln_annot *annot;
+	ln_annot_op *op;
+	const char *tagCstr;
+	char *cstr;
+
+	if(ctx->pas == NULL || ctx->pas->aroot == NULL)
+		goto done;
+
+	/* same order as in ln_annotate(), so later fields win in the same way */
+	for(int i = json_object_array_length(tagbucket) - 1; i >= 0; i--) {
+		CHKN(tagCstr = json_object_get_string(json_object_array_get_idx(tagbucket, i)));
+		CHKN(tag = es_newStrFromCStr(tagCstr, strlen(tagCstr)));
+		annot = ln_findAnnot(ctx->pas, tag);
+		es_deleteStr(tag);
+		tag = NULL;
+		if(annot == NULL)
+			continue;
+		/* removals are refused when the rulebase is loaded, and
+		 * ln_annotate() ignores them just as well
+		 */
+		for(op = annot->oproot ; op != NULL ; op = op->next) {
+			if(op->opc != ln_annot_ADD)
+				continue;
+			if(nkv == maxkv) {
+				const int newmax = (maxkv == 0) ? 4 : 2 * maxkv;
+				struct ln_annot_kv *const newkv = realloc(kv, newmax * sizeof(struct ln_annot_kv));
+				CHKN(newkv);
+				kv = newkv;
+				maxkv = newmax;
+			}
+			CHKN(cstr = ln_es_str2cstr(&op->value));
+			CHKN(kv[nkv].value = json_object_new_string(cstr));
+			if((kv[nkv].name = ln_strtabAdd(ctx, (char*) es_getBufAddr(op->name),
+				es_strlen(op->name))) == NULL) {
+				json_object_put(kv[nkv].value);
+				r = -1;
+				goto done;
+			}
+			++nkv;
+		}
+	}
+
+done:
+	if(r != 0) {
+		ln_annotFreeCompiled(kv, nkv);
+		kv = NULL;
+		nkv = 0;
+	}
+	*kv_p = kv;
+	*nkv_p = nkv;
+	return r;
+}
+
+
+void
+ln_annotFreeCompiled(struct ln_annot_kv *kv, int nkv)
+{
+	if(kv == NULL)
+		goto done;
+	for(int i = 0 ; i < nkv ; ++i)
+		json_object_put(kv[i].value);
+	free(kv);
+done:	return;
+}
+
+
+int
+ln_annotateCompiled(const struct ln_annot_kv *kv, int nkv, struct json_object *json, int threadsafe)
+{
+	int r = 0;
+	struct json_object *field;
+
+	for(int i = 0 ; i < nkv ; ++i) {
+		if(threadsafe) {
+			CHKN(field = json_object_new_string_len(json_object_get_string(kv[i].value),
+				json_object_get_string_len(kv[i].value)));
+		} else {
+			field = json_object_get(kv[i].value);
+		}
+		json_object_object_add(json, kv[i].name, field);
+	}
+
+done:	return r;
+}
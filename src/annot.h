@@ -68,6 +68,17 @@ struct ln_annotSet_s {
 	ln_ctx ctx;	/**< save our context for easy dbgprintf et al... */
 };
 
+/**
+ * precompiled annotation.
+ * The optimizer resolves the annotations of each terminal pdag node
+ * into a flat list of these, so that no lookup and string building
+ * is necessary when an event is annotated.
+ */
+struct ln_annot_kv {
+	const char *name;		/**< field name, from the ctx string table */
+	struct json_object *value;	/**< string value, shared by all events */
+};
+
 /* Methods */
 
 
@@ -92,6 +103,17 @@ ln_annotSet* ln_newAnnotSet(ln_ctx ctx);
 void ln_deleteAnnotSet(ln_annotSet *as);
 
 
+/**
+ * Obtain the memory used by an annotation set.
+ * @memberof ln_annot
+ *
+ * @param[in] as annotation set, may be NULL
+ *
+ * @return bytes used by the set and all of its members
+ */
+size_t ln_annotSetMemSize(const ln_annotSet *as);
+
+
 /**
  * Find annotation inside set based on given tag name.
  * @memberof ln_annot
@@ -169,4 +191,45 @@ int ln_addAnnotOp(ln_annot *anot, ln_annot_opcode opc, es_str_t *name, es_str_t
  */
 int ln_annotate(ln_ctx ctx, struct json_object *json, struct json_object *tags);
 
+
+/**
+ * Precompile the annotations for a tag bucket.
+ * The result contains the same fields, in the same order, that
+ * ln_annotate() would add for this tag bucket.
+ * @memberof ln_annot
+ *
+ * @param[in] ctx current context
+ * @param[in] tags tag bucket
+ * @param[out] kv precompiled list, NULL if there is nothing to add
+ * @param[out] nkv number of list entries
+ * @returns 0 on success, something else otherwise
+ */
+int ln_annotCompile(ln_ctx ctx, struct json_object *tags, struct ln_annot_kv **kv, int *nkv);
+
+
+/**
+ * Free a precompiled annotation list.
+ * @memberof ln_annot
+ *
+ * @param[in] kv list to free, may be NULL
+ * @param[in] nkv number of list entries
+ */
+void ln_annotFreeCompiled(struct ln_annot_kv *kv, int nkv);
+
+
+/**
+ * Annotate an event with a precompiled annotation list.
+ * In thread-safe mode, the shared values must not be referenced by
+ * events (the refcount is not atomic), so they are copied. Otherwise
+ * only their refcount is incremented.
+ * @memberof ln_annot
+ *
+ * @param[in] kv precompiled list
+ * @param[in] nkv number of list entries
+ * @param[in] json event to annotate
+ * @param[in] threadsafe non-zero if in thread-safe mode
+ * @returns 0 on success, something else otherwise
+ */
+int ln_annotateCompiled(const struct ln_annot_kv *kv, int nkv, struct json_object *json, int threadsafe);
+
 #endif /* #ifndef LOGNORM_ANNOT_H_INCLUDED */
@@ -0,0 +1,645 @@
+/**
+ * @file compiled_rb.c
+ * @brief Save and load compiled (binary) rulebases.
+ *
+ * A compiled rulebase is a snapshot of the optimized parse dag of a
+ * context, including user-defined types, tags and annotations. Loading
+ * it avoids rulebase parsing, pdag building (which includes expensive
+ * parser merging) and most of the optimization step.
+ *
+ * The file format is simple: the graph is written in DFS order. Each
+ * node is written in full when it is first seen, later references to
+ * the same node (the ALTERNATIVE parser creates those) are written as
+ * node ids, so the DAG structure is preserved. Parsers are stored as
+ * their json configuration, which is passed to the regular parser
+ * constructors on load. All integers are little endian 32 bit,
+ * strings are prefixed by their length (NO_STR for NULL strings).
+ *//*
+ * Copyright 2026 by Rainer Gerhards and Adiscon GmbH.
+ *
+ * Released under ASL 2.0.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <libestr.h>
+
+#include "liblognorm.h"
+#include "lognorm.h"
+#include "pdag.h"
+#include "annot.h"
+#include "internal.h"
+#include "parser.h"
+
+#define CRB_MAGIC "LNCRB"
+#define CRB_MAGIC_LEN 5
+#define CRB_FORMAT_VERSION 1
+#define NO_STR 0xffffffff
+
+#define CRB_NODE_DEF 0	/**< node definition follows */
+#define CRB_NODE_REF 1	/**< reference to already defined node follows */
+#define CRB_MAX_DEPTH 10000	/**< max nesting of node definitions on load */
+
+struct crb_writer {
+	FILE *fp;
+	struct {			/**< hash table: node ptr -> node id */
+		const struct ln_pdag *node;
+		uint32_t id;
+	} *map;
+	size_t mapsize;			/**< always a power of 2 */
+	uint32_t nextid;
+};
+
+struct crb_reader {
+	const unsigned char *buf;
+	size_t len;
+	size_t offs;
+	struct ln_pdag **nodes;		/**< node id -> node */
+	unsigned char *inProgress;	/**< node id -> are its parsers being read? */
+	uint32_t nnodes;
+	uint32_t maxnodes;
+	unsigned depth;			/**< nesting of the node being read */
+};
+
+
+/* ----------- writer ----------- */
+
+static void
+wrU8(struct crb_writer *const w, const unsigned v)
+{
+	fputc((int) (v & 0xff), w->fp);
+}
+
+static void
+wrU32(struct crb_writer *const w, const uint32_t v)
+{
+	unsigned char b[4];
+	b[0] = v & 0xff;
+	b[1] = (v >> 8) & 0xff;
+	b[2] = (v >> 16) & 0xff;
+	b[3] = (v >> 24) & 0xff;
+	fwrite(b, 1, 4, w->fp);
+}
+
+static void
+wrStr(struct crb_writer *const w, const char *const str, const size_t len)
+{
+	if(str == NULL) {
+		wrU32(w, NO_STR);
+	} else {
+		wrU32(w, (uint32_t) len);
+		fwrite(str, 1, len, w->fp);
+	}
+}
+
+static void
+wrCStr(struct crb_writer *const w, const char *const str)
+{
+	wrStr(w, str, (str == NULL) ? 0 : strlen(str));
+}
+
+static size_t
+mapHash(const struct crb_writer *const w, const struct ln_pdag *const node)
+{
+	return (size_t) (((uintptr_t) node >> 4) * 2654435761u) & (w->mapsize - 1);
+}
+
+/* look up node in id map. Returns 1 and sets *id if found, 0 otherwise */
+static int
+mapLookup(const struct crb_writer *const w, const struct ln_pdag *const node, uint32_t *const id)
+{
+	for(size_t i = mapHash(w, node) ; w->map[i].node != NULL ; i = (i + 1) & (w->mapsize - 1)) {
+		if(w->map[i].node == node) {
+			*id = w->map[i].id;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void
+mapAdd(struct crb_writer *const w, const struct ln_pdag *const node)
+{
+	size_t i;
+	for(i = mapHash(w, node) ; w->map[i].node != NULL ; i = (i + 1) & (w->mapsize - 1))
+		/* just search free slot */;
+	w->map[i].node = node;
+	w->map[i].id = w->nextid++;
+}
+
+/* literals may have been combined by the optimizer, so their original
+ * config is no longer valid. We generate a new one.
+ */
+static int
+writeLiteralConf(ln_ctx ctx, struct crb_writer *const w, const ln_parser_t *const prs)
+{
+	int r = 0;
+	struct json_object *conf;
+
+	CHKN(conf = json_object_new_object());
+	json_object_object_add(conf, "type", json_object_new_string("literal"));
+	json_object_object_add(conf, "text", json_object_new_string(
+		ln_DataForDisplayLiteral(ctx, prs->parser_data)));
+	if(prs->name != NULL)
+		json_object_object_add(conf, "name", json_object_new_string(prs->name));
+	wrCStr(w, json_object_to_json_string(conf));
+	json_object_put(conf);
+done:	return r;
+}
+
+static int
+writeNode(ln_ctx ctx, struct crb_writer *const w, struct ln_pdag *const dag)
+{
+	int r = 0;
+	uint32_t id;
+
+	if(mapLookup(w, dag, &id)) {
+		wrU8(w, CRB_NODE_REF);
+		wrU32(w, id);
+		goto done;
+	}
+	mapAdd(w, dag);
+
+	wrU8(w, CRB_NODE_DEF);
+	wrU8(w, dag->flags.isTerminal);
+	wrCStr(w, (dag->tags == NULL) ? NULL : json_object_to_json_string(dag->tags));
+	wrCStr(w, dag->rb_file);
+	wrU32(w, dag->rb_lineno);
+	wrU32(w, dag->nparsers);
+	for(int i = 0 ; i < dag->nparsers ; ++i) {
+		ln_parser_t *const prs = dag->parsers + i;
+		if(prs->prsid == PRS_LITERAL) {
+			CHKR(writeLiteralConf(ctx, w, prs));
+		} else {
+			wrCStr(w, prs->conf);
+		}
+		wrU32(w, (uint32_t) prs->prio);
+		CHKR(writeNode(ctx, w, prs->node));
+	}
+done:	return r;
+}
+
+static void
+writeAnnots(struct crb_writer *const w, ln_annotSet *const as)
+{
+	uint32_t nannots = 0;
+	for(ln_annot *annot = as->aroot ; annot != NULL ; annot = annot->next)
+		++nannots;
+	wrU32(w, nannots);
+	for(ln_annot *annot = as->aroot ; annot != NULL ; annot = annot->next) {
+		uint32_t nops = 0;
+		for(ln_annot_op *op = annot->oproot ; op != NULL ; op = op->next)
+			++nops;
+		wrStr(w, (char*) es_getBufAddr(annot->tag), es_strlen(annot->tag));
+		wrU32(w, nops);
+		for(ln_annot_op *op = annot->oproot ; op != NULL ; op = op->next) {
+			wrU8(w, op->opc);
+			wrStr(w, (char*) es_getBufAddr(op->name), es_strlen(op->name));
+			if(op->value == NULL)
+				wrStr(w, NULL, 0);
+			else
+				wrStr(w, (char*) es_getBufAddr(op->value), es_strlen(op->value));
+		}
+	}
+}
+
+int
+ln_saveCompiledRulebase(ln_ctx ctx, const char *const file)
+{
+	int r = 0;
+	struct crb_writer w;
+
+	memset(&w, 0, sizeof(w));
+	ctx = ctx->rb; /* the rulebase in use, see ln_ctxReload() */
+	if(ctx->version != 2 || ctx->ptree != NULL) {
+		ln_errprintf(ctx, 0, "only v2 rulebases can be compiled");
+		r = LN_BADCONFIG;
+		goto done;
+	}
+
+	for(w.mapsize = 64 ; w.mapsize < 2 * ((size_t) ctx->nNodes + 1) ; w.mapsize *= 2)
+		/* just compute size */;
+	CHKN(w.map = calloc(w.mapsize, sizeof(*w.map)));
+	if((w.fp = fopen(file, "wb")) == NULL) {
+		ln_errprintf(ctx, errno, "cannot open compiled rulebase '%s' for writing", file);
+		r = LN_BADCONFIG;
+		goto done;
+	}
+
+	fwrite(CRB_MAGIC, 1, CRB_MAGIC_LEN, w.fp);
+	wrU32(&w, CRB_FORMAT_VERSION);
+	wrU32(&w, (uint32_t) ctx->nTypes);
+	for(int i = 0 ; i < ctx->nTypes ; ++i)
+		wrCStr(&w, ctx->type_pdags[i].name);
+	writeAnnots(&w, ctx->pas);
+	for(int i = 0 ; i < ctx->nTypes ; ++i)
+		CHKR(writeNode(ctx, &w, ctx->type_pdags[i].pdag));
+	CHKR(writeNode(ctx, &w, ctx->pdag));
+
+	if(ferror(w.fp)) {
+		ln_errprintf(ctx, errno, "error writing compiled rulebase '%s'", file);
+		r = LN_BADCONFIG;
+	}
+done:
+	if(w.fp != NULL) {
+		if(fclose(w.fp) != 0 && r == 0) {
+			ln_errprintf(ctx, errno, "error writing compiled rulebase '%s'", file);
+			r = LN_BADCONFIG;
+		}
+	}
+	free(w.map);
+	return r;
+}
+
+
+/* ----------- reader ----------- */
+
+static int
+rdU8(struct crb_reader *const rd, unsigned *const v)
+{
+	if(rd->offs + 1 > rd->len)
+		return LN_BADCONFIG;
+	*v = rd->buf[rd->offs++];
+	return 0;
+}
+
+static int
+rdU32(struct crb_reader *const rd, uint32_t *const v)
+{
+	if(rd->offs + 4 > rd->len)
+		return LN_BADCONFIG;
+	const unsigned char *const b = rd->buf + rd->offs;
+	*v = (uint32_t) b[0] | ((uint32_t) b[1] << 8) | ((uint32_t) b[2] << 16) | ((uint32_t) b[3] << 24);
+	rd->offs += 4;
+	return 0;
+}
+
+/* read string. The result points into the read buffer and is NOT
+ * NUL-terminated. *str is NULL if a NULL string was stored.
+ */
+static int
+rdStr(struct crb_reader *const rd, const char **const str, size_t *const len)
+{
+	int r;
+	uint32_t l;
+	CHKR(rdU32(rd, &l));
+	if(l == NO_STR) {
+		*str = NULL;
+		*len = 0;
+		goto done;
+	}
+	if(rd->offs + l > rd->len) {
+		r = LN_BADCONFIG;
+		goto done;
+	}
+	*str = (const char*) rd->buf + rd->offs;
+	*len = l;
+	rd->offs += l;
+done:	return r;
+}
+
+static int
+rdJSON(struct crb_reader *const rd, struct json_object **const json)
+{
+	int r;
+	const char *str;
+	size_t len;
+	struct json_tokener *tokener = NULL;
+
+	*json = NULL;
+	CHKR(rdStr(rd, &str, &len));
+	if(str == NULL)
+		goto done;
+	CHKN(tokener = json_tokener_new());
+	*json = json_tokener_parse_ex(tokener, str, (int) len);
+	if(*json == NULL)
+		r = LN_BADCONFIG;
+done:
+	if(tokener != NULL)
+		json_tokener_free(tokener);
+	return r;
+}
+
+static int
+rdEsStr(struct crb_reader *const rd, es_str_t **const estr)
+{
+	int r;
+	const char *str;
+	size_t len;
+
+	*estr = NULL;
+	CHKR(rdStr(rd, &str, &len));
+	if(str != NULL) {
+		CHKN(*estr = es_newStrFromCStr(str, len));
+	}
+done:	return r;
+}
+
+static int
+readAnnots(struct crb_reader *const rd, ln_annotSet *const as)
+{
+	int r;
+	uint32_t nannots;
+	ln_annot **annots = NULL;
+	uint32_t nread = 0;
+
+	CHKR(rdU32(rd, &nannots));
+	if(nannots > rd->len) { /* sanity check */
+		r = LN_BADCONFIG;
+		goto done;
+	}
+	CHKN(annots = calloc(nannots + 1, sizeof(ln_annot*)));
+	for(nread = 0 ; nread < nannots ; ++nread) {
+		es_str_t *tag;
+		uint32_t nops;
+		CHKR(rdEsStr(rd, &tag));
+		if(tag == NULL) {
+			r = LN_BADCONFIG;
+			goto done;
+		}
+		if((annots[nread] = ln_newAnnot(tag)) == NULL) {
+			es_deleteStr(tag);
+			r = LN_NOMEM;
+			goto done;
+		}
+		CHKR(rdU32(rd, &nops));
+		/* ops are prepended on add, so we need to reverse them */
+		ln_annot_op *prev = NULL;
+		for(uint32_t j = 0 ; j < nops ; ++j) {
+			unsigned opc;
+			es_str_t *name;
+			ln_annot_op *op;
+			CHKR(rdU8(rd, &opc));
+			CHKR(rdEsStr(rd, &name));
+			if(name == NULL) {
+				r = LN_BADCONFIG;
+				goto done;
+			}
+			if((op = calloc(1, sizeof(struct ln_annot_op_s))) == NULL) {
+				es_deleteStr(name);
+				r = LN_NOMEM;
+				goto done;
+			}
+			op->opc = (opc == ln_annot_RM) ? ln_annot_RM : ln_annot_ADD;
+			op->name = name;
+			if(prev == NULL)
+				annots[nread]->oproot = op;
+			else
+				prev->next = op;
+			prev = op;
+			CHKR(rdEsStr(rd, &op->value));
+		}
+	}
+
+	/* annots are prepended to the set, so we add them in reverse order */
+	for(uint32_t i = nannots ; i > 0 ; --i) {
+		ln_annot *const annot = annots[i-1];
+		annots[i-1] = NULL;
+		CHKR(ln_addAnnotToSet(as, annot));
+	}
+done:
+	if(annots != NULL) {
+		for(uint32_t i = 0 ; i <= nread && i < nannots ; ++i)
+			ln_deleteAnnot(annots[i]);
+		free(annots);
+	}
+	return r;
+}
+
+/* assign the next node id to node, which is then in progress */
+static int
+rememberNode(struct crb_reader *const rd, struct ln_pdag *const node, uint32_t *const id)
+{
+	int r = 0;
+	if(rd->nnodes == rd->maxnodes) {
+		const uint32_t newmax = (rd->maxnodes == 0) ? 1024 : rd->maxnodes * 2;
+		struct ln_pdag **const newnodes = realloc(rd->nodes, newmax * sizeof(struct ln_pdag*));
+		CHKN(newnodes);
+		rd->nodes = newnodes;
+		unsigned char *const newInProgress = realloc(rd->inProgress, newmax);
+		CHKN(newInProgress);
+		rd->inProgress = newInProgress;
+		rd->maxnodes = newmax;
+	}
+	*id = rd->nnodes;
+	rd->nodes[rd->nnodes] = node;
+	rd->inProgress[rd->nnodes] = 1;
+	++rd->nnodes;
+done:	return r;
+}
+
+/* read a node. If into is non-NULL, the node is a component root which
+ * already exists and which is filled with the node's content.
+ * On error, the caller is responsible for deleting the node (everything
+ * read so far is properly linked to it).
+ */
+static int
+readNode(ln_ctx ctx, struct crb_reader *const rd, struct ln_pdag *const into,
+	struct ln_pdag **const nodeOut)
+{
+	int r;
+	unsigned kind;
+	unsigned isTerminal;
+	uint32_t u32;
+	const char *str;
+	size_t len;
+	struct ln_pdag *node;
+	uint32_t id;
+
+	CHKR(rdU8(rd, &kind));
+	if(kind == CRB_NODE_REF) {
+		CHKR(rdU32(rd, &u32));
+		/* a node that is still being read is one of our ancestors
+		 * (or ourselves), so referencing it would create a cycle
+		 */
+		if(into != NULL || u32 >= rd->nnodes || rd->inProgress[u32]) {
+			r = LN_BADCONFIG;
+			goto done;
+		}
+		node = rd->nodes[u32];
+		node->refcnt++;
+		*nodeOut = node;
+		goto done;
+	} else if(kind != CRB_NODE_DEF || rd->depth >= CRB_MAX_DEPTH) {
+		r = LN_BADCONFIG;
+		goto done;
+	}
+
+	if(into == NULL) {
+		CHKN(node = ln_newPDAG(ctx));
+	} else {
+		node = into;
+	}
+	*nodeOut = node;
+	CHKR(rememberNode(rd, node, &id));
+
+	CHKR(rdU8(rd, &isTerminal));
+	node->flags.isTerminal = isTerminal ? 1 : 0;
+	CHKR(rdJSON(rd, &node->tags));
+	CHKR(rdStr(rd, &str, &len));
+	if(str != NULL) {
+		CHKN(node->rb_file = ln_strtabAdd(ctx, str, len));
+	}
+	CHKR(rdU32(rd, &u32));
+	node->rb_lineno = u32;
+	CHKR(rdU32(rd, &u32));
+	if(u32 > INT_MAX) { /* nparsers is an int */
+		r = LN_BADCONFIG;
+		goto done;
+	}
+	if(u32 > 0) {
+		CHKN(node->parsers = calloc(u32, sizeof(ln_parser_t)));
+	}
+	const uint32_t nparsers = u32;
+	for(uint32_t i = 0 ; i < nparsers ; ++i) {
+		struct json_object *prscnf;
+		CHKR(rdJSON(rd, &prscnf));
+		if(prscnf == NULL) {
+			r = LN_BADCONFIG;
+			goto done;
+		}
+		ln_parser_t *const parser = ln_newParser(ctx, prscnf);
+		json_object_put(prscnf);
+		if(parser == NULL) {
+			r = LN_BADCONFIG;
+			goto done;
+		}
+		memcpy(node->parsers + i, parser, sizeof(ln_parser_t));
+		free(parser);
+		node->nparsers++;
+		CHKR(rdU32(rd, &u32));
+		node->parsers[i].prio = (int) u32;
+		++rd->depth;
+		r = readNode(ctx, rd, NULL, &node->parsers[i].node);
+		--rd->depth;
+		if(r != 0)
+			goto done;
+	}
+	rd->inProgress[id] = 0;
+done:	return r;
+}
+
+static int
+loadCompiled(ln_ctx ctx, struct crb_reader *const rd)
+{
+	int r;
+	uint32_t u32;
+	uint32_t ntypes;
+	struct ln_pdag *node;
+
+	if(rd->len < CRB_MAGIC_LEN || memcmp(rd->buf, CRB_MAGIC, CRB_MAGIC_LEN)) {
+		ln_errprintf(ctx, 0, "not a compiled rulebase");
+		r = LN_BADCONFIG;
+		goto done;
+	}
+	rd->offs = CRB_MAGIC_LEN;
+	CHKR(rdU32(rd, &u32));
+	if(u32 != CRB_FORMAT_VERSION) {
+		ln_errprintf(ctx, 0, "compiled rulebase has unsupported format "
+			"version %u (expected %u)", (unsigned) u32, CRB_FORMAT_VERSION);
+		r = LN_BADCONFIG;
+		goto done;
+	}
+
+	/* all type entries must exist before the first parser is created,
+	 * because parsers reference their types.
+	 */
+	CHKR(rdU32(rd, &ntypes));
+	for(uint32_t i = 0 ; i < ntypes ; ++i) {
+		const char *str;
+		size_t len;
+		char *name;
+		CHKR(rdStr(rd, &str, &len));
+		if(str == NULL) {
+			r = LN_BADCONFIG;
+			goto done;
+		}
+		CHKN(name = strndup(str, len));
+		struct ln_type_pdag *const td = ln_pdagFindType(ctx, name, 1);
+		free(name);
+		CHKN(td);
+		CHKN(td->pdag);
+	}
+	if((uint32_t) ctx->nTypes != ntypes) { /* duplicate type names */
+		r = LN_BADCONFIG;
+		goto done;
+	}
+
+	CHKR(readAnnots(rd, ctx->pas));
+
+	for(int i = 0 ; i < ctx->nTypes ; ++i)
+		CHKR(readNode(ctx, rd, ctx->type_pdags[i].pdag, &node));
+	CHKR(readNode(ctx, rd, ctx->pdag, &node));
+	if(rd->offs != rd->len) {
+		r = LN_BADCONFIG;
+		goto done;
+	}
+
+	ctx->version = 2;
+	/* graph is already optimized, but for building the runtime
+	 * data (component IDs, dispatch index).
+	 */
+	CHKR(ln_pdagOptimize(ctx));
+done:
+	if(r != 0)
+		ln_errprintf(ctx, 0, "compiled rulebase is invalid or corrupted");
+	return r;
+}
+
+int
+ln_loadCompiledRulebase(ln_ctx ctx, const char *const file)
+{
+	int r = 0;
+	int fd = -1;
+	struct stat st;
+	void *buf = MAP_FAILED;
+	struct crb_reader rd;
+
+	memset(&rd, 0, sizeof(rd));
+	if(   !ln_rbIsPrivate(ctx)
+	   || ctx->pdag->nparsers != 0 || ctx->nTypes != 0
+	   || ctx->ptree != NULL || ctx->pas->aroot != NULL) {
+		ln_errprintf(ctx, 0, "compiled rulebase can only be loaded into "
+			"an empty context");
+		r = LN_BADCONFIG;
+		goto done;
+	}
+
+	if((fd = open(file, O_RDONLY)) == -1 || fstat(fd, &st) != 0) {
+		ln_errprintf(ctx, errno, "cannot open compiled rulebase '%s'", file);
+		r = LN_BADCONFIG;
+		goto done;
+	}
+	if(st.st_size == 0) {
+		ln_errprintf(ctx, 0, "compiled rulebase '%s' is empty", file);
+		r = LN_BADCONFIG;
+		goto done;
+	}
+	buf = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(buf == MAP_FAILED) {
+		ln_errprintf(ctx, errno, "cannot map compiled rulebase '%s'", file);
+		r = LN_BADCONFIG;
+		goto done;
+	}
+	rd.buf = buf;
+	rd.len = (size_t) st.st_size;
+	r = loadCompiled(ctx, &rd);
+
+done:
+	if(buf != MAP_FAILED)
+		munmap(buf, (size_t) st.st_size);
+	if(fd != -1)
+		close(fd);
+	free(rd.nodes);
+	free(rd.inProgress);
+	return r;
+}
@@ -29,11 +29,45 @@
  
 #ifndef LIBLOGNORM_ENC_H_INCLUDED
 #define	LIBLOGNORM_ENC_H_INCLUDED
-	
+	
 int ln_fmtEventToRFC5424(struct json_object *json, es_str_t **str);
 
 int ln_fmtEventToCSV(struct json_object *json, es_str_t **str, es_str_t *extraData);
 
 int ln_fmtEventToXML(struct json_object *json, es_str_t **str);
 
+/* The *Buf encoders append the encoded event to an existing string
+ * instead of creating a new one. So the same buffer can be re-used
+ * for many events (e.g. emptied via es_emptyStr() after it has been
+ * written), which avoids all allocations once it is large enough.
+ * They return 0 on success, something else otherwise.
+ */
+int ln_fmtEventToRFC5424Buf(struct json_object *json, es_str_t **str);
+
+int ln_fmtEventToCSVBuf(struct json_object *json, es_str_t **str, es_str_t *extraData);
+
+int ln_fmtEventToXMLBuf(struct json_object *json, es_str_t **str);
+
+/* JSON, with the same layout as json_object_to_json_string() */
+int ln_fmtEventToJSONBuf(struct json_object *json, es_str_t **str);
+
+/* JSON like ln_fmtEventToJSONBuf(), but with the members of all objects
+ * in name order. So objects with the same members always give the
+ * same string, which is used to compare parser configs.
+ */
+int ln_fmtConfToJSONBuf(struct json_object *json, es_str_t **str);
+
+/* JSON directly from the results of ln_normalizeToSpans(). To be
+ * called from the span callback for each field. *nfields counts the
+ * fields added so far and must be 0 for the first field of an event.
+ * When all fields are added, ln_fmtSpansEndJSONBuf() completes the
+ * object. Like with ln_normalize(), members of fields named "." are
+ * added as top-level fields.
+ */
+struct ln_field_span;
+int ln_fmtSpanToJSONBuf(const char *msg, const struct ln_field_span *span,
+	int *nfields, es_str_t **str);
+
+int ln_fmtSpansEndJSONBuf(int nfields, es_str_t **str);
+
 #endif /* LIBLOGNORM_ENC_H_INCLUDED */
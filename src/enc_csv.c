@@ -49,10 +49,23 @@
 #include "internal.h"
 #include "enc.h"
 
-static char hexdigit[16] =
+static const char hexdigit[16] =
 	{'0', '1', '2', '3', '4', '5', '6', '7', '8',
 	 '9', 'A', 'B', 'C', 'D', 'E', 'F' };
 
+/* escape sequence for each byte: 0 - no need to escape, 'u' - \u00XX,
+ * everything else is the character to use after the backslash. All
+ * bytes above the ones listed do not need escaping.
+ */
+static const char csvEsc[256] = {
+	'0', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\'
+};
+
 /* TODO: CSV encoding for Unicode characters is as of RFC4627 not fully
  * supported. The algorithm is that we must build the wide character from
  * UTF-8 (if char > 127) and build the full 4-octet Unicode character out
@@ -61,69 +74,59 @@ static char hexdigit[16] =
  * rgerhards, 2010-11-09
  */
 static int
-ln_addValue_CSV(const char *buf, es_str_t **str)
+ln_addValue_CSV(const char *buf, const size_t len, es_str_t **str)
 {
-	int r;
-	unsigned char c;
-	es_size_t i;
-	char numbuf[4];
-	int j;
+	int r = 0;
+	size_t start = 0;
+	char seq[6] = { '\\', 'u', '0', '0' };
 
 	assert(str != NULL); 
 	assert(*str != NULL);
 	assert(buf != NULL); 
 
-	for(i = 0; i < strlen(buf); i++) {
-		c = buf[i];
-		if((c >= 0x23 && c <= 0x5b)
-		   || (c >= 0x5d /* && c <= 0x10FFFF*/)
-		   || c == 0x20 || c == 0x21) {
-			/* no need to escape */
-			es_addChar(str, c);
+	/* runs of characters which need no escaping are copied at once */
+	for(size_t i = 0 ; i < len ; ++i) {
+		const unsigned char c = buf[i];
+		const char esc = csvEsc[c];
+		if(esc == 0)
+			continue;
+		if(i > start)
+			CHKR(es_addBuf(str, buf + start, i - start));
+		if(esc == '0') {
+			CHKR(es_addBuf(str, "\\u0000", 6));
+		} else if(esc == 'u') {
+			/* TODO : proper Unicode encoding (see header comment) */
+			seq[4] = hexdigit[c >> 4];
+			seq[5] = hexdigit[c & 0x0f];
+			CHKR(es_addBuf(str, seq, 6));
 		} else {
-			/* we must escape, try RFC4627-defined special sequences first */
-			switch(c) {
-			case '\0':
-				es_addBuf(str, "\\u0000", 6);
-				break;
-			case '\"':
-				es_addBuf(str, "\\\"", 2);
-				break;
-			case '/':
-				es_addBuf(str, "\\/", 2);
-				break;
-			case '\\':
-				es_addBuf(str, "\\\\", 2);
-				break;
-			case '\010':
-				es_addBuf(str, "\\b", 2);
-				break;
-			case '\014':
-				es_addBuf(str, "\\f", 2);
-				break;
-			case '\n':
-				es_addBuf(str, "\\n", 2);
-				break;
-			case '\r':
-				es_addBuf(str, "\\r", 2);
-				break;
-			case '\t':
-				es_addBuf(str, "\\t", 2);
-				break;
-			default:
-				/* TODO : proper Unicode encoding (see header comment) */
-				for(j = 0 ; j < 4 ; ++j) {
-					numbuf[3-j] = hexdigit[c % 16];
-					c = c / 16;
-				}
-				es_addBuf(str, "\\u", 2);
-				es_addBuf(str, numbuf, 4);
-				break;
-			}
+			CHKR(es_addChar(str, '\\'));
+			CHKR(es_addChar(str, esc));
 		}
+		start = i + 1;
 	}
-	r = 0;
+	if(len > start)
+		CHKR(es_addBuf(str, buf + start, len - start));
+
+done:
+	return r;
+}
+
 
+/* add the string representation of a value */
+static int
+ln_addObj_CSV(struct json_object *obj, es_str_t **str)
+{
+	int r;
+	const char *value;
+
+	CHKN(value = json_object_get_string(obj));
+	if(json_object_get_type(obj) == json_type_string) {
+		r = ln_addValue_CSV(value, json_object_get_string_len(obj), str);
+	} else {
+		r = ln_addValue_CSV(value, strlen(value), str);
+	}
+done:
 	return r;
 }
 
@@ -133,8 +136,7 @@ ln_addField_CSV(struct json_object *field, es_str_t **str)
 {
 	int r, i;
 	struct json_object *obj;
-	int needComma;
-	const char *value;
+	int needComma = 0;
 	
 	assert(field != NULL);
 	assert(str != NULL);
@@ -144,20 +146,19 @@ ln_addField_CSV(struct json_object *field, es_str_t **str)
 	case json_type_array:
 		CHKR(es_addChar(str, '['));
 		for (i = json_object_array_length(field) - 1; i >= 0; i--) {
-			if(needComma)
-				es_addChar(str, ',');
-			else
+			if(needComma) {
+				CHKR(es_addChar(str, ','));
+			} else {
 				needComma = 1;
+			}
 			CHKN(obj = json_object_array_get_idx(field, i));
-			CHKN(value = json_object_get_string(obj));
-			CHKR(ln_addValue_CSV(value, str));
+			CHKR(ln_addObj_CSV(obj, str));
 		}
 		CHKR(es_addChar(str, ']'));
 		break;
 	case json_type_string:
 	case json_type_int:
-		CHKN(value = json_object_get_string(field));
-		CHKR(ln_addValue_CSV(value, str));
+		CHKR(ln_addObj_CSV(field, str));
 		break;
 	case json_type_null:
 	case json_type_boolean:
@@ -177,33 +178,44 @@ done:
 
 
 int
-ln_fmtEventToCSV(struct json_object *json, es_str_t **str, es_str_t *extraData)
+ln_fmtEventToCSVBuf(struct json_object *json, es_str_t **str, es_str_t *extraData)
 {
-	int r = -1;
+	int r = 0;
 	int needComma = 0;
 	struct json_object *field;
-	char *namelist = NULL, *name, *nn;
+	char namebuf[256];
+	char *name;
 
 	assert(json != NULL);
 	assert(json_object_is_type(json, json_type_object));
 	
-	if((*str = es_newStr(256)) == NULL)
-		goto done;
-	if(extraData == NULL)
+	if(extraData == NULL) {
+		r = -1;
 		goto done;
+	}
 
-	CHKN(namelist = es_str2cstr(extraData, NULL));
-			
-	for (name = namelist; name != NULL; name = nn) {
-		for (nn = name; *nn != '\0' && *nn != ',' && *nn != ' '; nn++)
-			{ /* do nothing */ }
-		if (*nn == '\0') {
-			nn = NULL;
+	/* the field list is walked in place, names are separated by
+	 * comma or space.
+	 */
+	const char *const list = (const char*) es_getBufAddr(extraData);
+	const size_t lenList = es_strlen(extraData);
+	size_t i = 0;
+	do {
+		const size_t start = i;
+		while(i < lenList && list[i] != ',' && list[i] != ' ')
+			++i;
+		const size_t lenName = i - start;
+		if(lenName < sizeof(namebuf)) {
+			name = namebuf;
 		} else {
-			*nn = '\0';
-			nn++;
+			CHKN(name = malloc(lenName + 1));
 		}
+		memcpy(name, list + start, lenName);
+		name[lenName] = '\0';
+		field = NULL;
 		json_object_object_get_ex(json, name, &field);
+		if(name != namebuf)
+			free(name);
 		if (needComma) {
 			CHKR(es_addChar(str, ','));
 		} else {
@@ -211,13 +223,24 @@ ln_fmtEventToCSV(struct json_object *json, es_str_t **str, es_str_t *extraData)
 		}
 		if (field != NULL) {
 			CHKR(es_addChar(str, '"'));
-			ln_addField_CSV(field, str);
+			CHKR(ln_addField_CSV(field, str));
 			CHKR(es_addChar(str, '"'));
 		}
-	}
-	r = 0;
+	} while(i++ < lenList);
+
+done:
+	return r;
+}
+
+
+int
+ln_fmtEventToCSV(struct json_object *json, es_str_t **str, es_str_t *extraData)
+{
+	int r = -1;
+
+	if((*str = es_newStr(256)) == NULL)
+		goto done;
+	r = ln_fmtEventToCSVBuf(json, str, extraData);
 done:
-	if (namelist != NULL)
-		free(namelist);
 	return r;
 }
@@ -0,0 +1,288 @@
+/**
+ * @file enc_json.c
+ * @brief Encode events as JSON directly into a string buffer.
+ *
+ * This creates the same layout as json_object_to_json_string(), but
+ * appends to a caller-provided (and usually re-used) buffer, so no
+ * memory is allocated per event. It can also encode the results of
+ * ln_normalizeToSpans(), in which case no json object needs to be
+ * built at all.
+ *//*
+ * Copyright 2026 by Rainer Gerhards and Adiscon GmbH.
+ *
+ * Released under ASL 2.0.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <libestr.h>
+
+#include "liblognorm.h"
+#include "lognorm.h"
+#include "internal.h"
+#include "enc.h"
+
+static const char hexdigit[16] =
+	{'0', '1', '2', '3', '4', '5', '6', '7', '8',
+	 '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+
+/* escape sequence for each byte: 0 - no need to escape, 'u' - \u00xx,
+ * everything else is the character to use after the backslash. All
+ * bytes above the ones listed do not need escaping. Like libfastjson,
+ * we escape '/' as well.
+ */
+static const char jsonEsc[256] = {
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '/',
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\'
+};
+
+/* add a quoted and escaped string. Runs of characters which need no
+ * escaping are copied at once.
+ */
+static int
+addString(const char *const buf, const size_t len, es_str_t **str)
+{
+	int r = 0;
+	size_t start = 0;
+	char seq[6] = { '\\', 'u', '0', '0' };
+
+	CHKR(es_addChar(str, '"'));
+	for(size_t i = 0 ; i < len ; ++i) {
+		const unsigned char c = buf[i];
+		const char esc = jsonEsc[c];
+		if(esc == 0)
+			continue;
+		if(i > start)
+			CHKR(es_addBuf(str, buf + start, i - start));
+		if(esc == 'u') {
+			seq[4] = hexdigit[c >> 4];
+			seq[5] = hexdigit[c & 0x0f];
+			CHKR(es_addBuf(str, seq, 6));
+		} else {
+			CHKR(es_addChar(str, '\\'));
+			CHKR(es_addChar(str, esc));
+		}
+		start = i + 1;
+	}
+	if(len > start)
+		CHKR(es_addBuf(str, buf + start, len - start));
+	CHKR(es_addChar(str, '"'));
+done:	return r;
+}
+
+static int
+addInt(const int64_t val, es_str_t **str)
+{
+	char buf[24];
+	char *p = buf + sizeof(buf);
+	uint64_t u = (val < 0) ? -(uint64_t) val : (uint64_t) val;
+	do {
+		*--p = '0' + (u % 10);
+		u /= 10;
+	} while(u != 0);
+	if(val < 0)
+		*--p = '-';
+	return es_addBuf(str, p, buf + sizeof(buf) - p);
+}
+
+static int addValue(struct json_object *const json, es_str_t **str);
+
+/* add a member of an object, sep is inserted before it */
+static int
+addMember(const char *const sep, const char *const name, struct json_object *const val, es_str_t **str)
+{
+	int r;
+	CHKR(es_addBuf(str, sep, strlen(sep)));
+	CHKR(addString(name, strlen(name), str));
+	CHKR(es_addBuf(str, ": ", 2));
+	CHKR(addValue(val, str));
+done:	return r;
+}
+
+static int
+addValue(struct json_object *const json, es_str_t **str)
+{
+	int r = 0;
+	const char *cstr;
+
+	switch(json_object_get_type(json)) {
+	case json_type_null:
+		CHKR(es_addBuf(str, "null", 4));
+		break;
+	case json_type_boolean:
+		if(json_object_get_boolean(json)) {
+			CHKR(es_addBuf(str, "true", 4));
+		} else {
+			CHKR(es_addBuf(str, "false", 5));
+		}
+		break;
+	case json_type_int:
+		CHKR(addInt(json_object_get_int64(json), str));
+		break;
+	case json_type_string:
+		CHKR(addString(json_object_get_string(json), json_object_get_string_len(json), str));
+		break;
+	case json_type_object: {
+		int nmembers = 0;
+		struct json_object_iterator it = json_object_iter_begin(json);
+		struct json_object_iterator itEnd = json_object_iter_end(json);
+		CHKR(es_addChar(str, '{'));
+		while(!json_object_iter_equal(&it, &itEnd)) {
+			CHKR(addMember(nmembers++ ? ", " : " ", json_object_iter_peek_name(&it),
+				json_object_iter_peek_value(&it), str));
+			json_object_iter_next(&it);
+		}
+		CHKR(es_addBuf(str, " }", 2));
+		break;
+	}
+	case json_type_array: {
+		const int n = json_object_array_length(json);
+		CHKR(es_addChar(str, '['));
+		for(int i = 0 ; i < n ; ++i) {
+			CHKR(es_addBuf(str, i ? ", " : " ", i ? 2 : 1));
+			CHKR(addValue(json_object_array_get_idx(json, i), str));
+		}
+		CHKR(es_addBuf(str, " ]", 2));
+		break;
+	}
+	case json_type_double:
+	default:
+		/* number formatting is left to the json library, so that
+		 * we get exactly the same result.
+		 */
+		CHKN(cstr = json_object_to_json_string(json));
+		CHKR(es_addBuf(str, cstr, strlen(cstr)));
+		break;
+	}
+done:	return r;
+}
+
+
+int
+ln_fmtEventToJSONBuf(struct json_object *json, es_str_t **str)
+{
+	return addValue(json, str);
+}
+
+
+static int
+qsort_nameCmp(const void *v1, const void *v2)
+{
+	return strcmp(*(const char *const *) v1, *(const char *const *) v2);
+}
+
+/* like addValue(), but members of objects are added in name order */
+static int
+addValueSorted(struct json_object *const json, es_str_t **str)
+{
+	int r = 0;
+	const char *namebuf[16];
+	const char **names = namebuf;
+
+	switch(json_object_get_type(json)) {
+	case json_type_object: {
+		int n = 0;
+		const int nmembers = json_object_object_length(json);
+		if(nmembers > (int) (sizeof(namebuf) / sizeof(namebuf[0])))
+			CHKN(names = malloc(nmembers * sizeof(char*)));
+		struct json_object_iterator it = json_object_iter_begin(json);
+		struct json_object_iterator itEnd = json_object_iter_end(json);
+		while(!json_object_iter_equal(&it, &itEnd)) {
+			names[n++] = json_object_iter_peek_name(&it);
+			json_object_iter_next(&it);
+		}
+		qsort(names, n, sizeof(char*), qsort_nameCmp);
+		CHKR(es_addChar(str, '{'));
+		for(int i = 0 ; i < n ; ++i) {
+			CHKR(es_addBuf(str, i ? ", " : " ", i ? 2 : 1));
+			CHKR(addString(names[i], strlen(names[i]), str));
+			CHKR(es_addBuf(str, ": ", 2));
+			CHKR(addValueSorted(json_object_object_get(json, names[i]), str));
+		}
+		CHKR(es_addBuf(str, " }", 2));
+		break;
+	}
+	case json_type_array: {
+		const int n = json_object_array_length(json);
+		CHKR(es_addChar(str, '['));
+		for(int i = 0 ; i < n ; ++i) {
+			CHKR(es_addBuf(str, i ? ", " : " ", i ? 2 : 1));
+			CHKR(addValueSorted(json_object_array_get_idx(json, i), str));
+		}
+		CHKR(es_addBuf(str, " ]", 2));
+		break;
+	}
+	default:
+		CHKR(addValue(json, str));
+		break;
+	}
+done:
+	if(names != namebuf)
+		free(names);
+	return r;
+}
+
+int
+ln_fmtConfToJSONBuf(struct json_object *json, es_str_t **str)
+{
+	return addValueSorted(json, str);
+}
+
+
+/* value of a span as it is added to the event by ln_normalize(). A
+ * user-defined type with only a field named ".." provides the value
+ * of that field (see fixJSON()).
+ */
+static struct json_object *
+spanValue(struct json_object *const value)
+{
+	struct json_object *dotdot;
+	if(   json_object_get_type(value) == json_type_object
+	   && json_object_object_length(value) == 1
+	   && json_object_object_get_ex(value, "..", &dotdot))
+		return dotdot;
+	return value;
+}
+
+int
+ln_fmtSpanToJSONBuf(const char *msg, const struct ln_field_span *span,
+	int *nfields, es_str_t **str)
+{
+	int r = 0;
+	const char *const name = span->name;
+
+	if(name[0] == '.' && name[1] == '\0'
+	   && json_object_get_type(span->value) == json_type_object) {
+		struct json_object_iterator it = json_object_iter_begin(span->value);
+		struct json_object_iterator itEnd = json_object_iter_end(span->value);
+		while(!json_object_iter_equal(&it, &itEnd)) {
+			CHKR(addMember((*nfields)++ ? ", " : "{ ", json_object_iter_peek_name(&it),
+				json_object_iter_peek_value(&it), str));
+			json_object_iter_next(&it);
+		}
+	} else {
+		CHKR(es_addBuf(str, (*nfields)++ ? ", " : "{ ", 2));
+		CHKR(addString(name, strlen(name), str));
+		CHKR(es_addBuf(str, ": ", 2));
+		if(span->value == NULL) {
+			CHKR(addString(msg + span->offs, span->len, str));
+		} else {
+			CHKR(addValue(spanValue(span->value), str));
+		}
+	}
+done:	return r;
+}
+
+int
+ln_fmtSpansEndJSONBuf(int nfields, es_str_t **str)
+{
+	if(nfields == 0)
+		return es_addBuf(str, "{ }", 3);
+	return es_addBuf(str, " }", 2);
+}
@@ -43,59 +43,69 @@
 #include "liblognorm.h"
 #include "enc.h"
 
+/* escape sequence for each byte: 0 - no need to escape, everything
+ * else is the character to use after the backslash. All bytes above
+ * the ones listed do not need escaping.
+ */
+static const char syslogEsc[256] = {
+	'0', 0, 0, 0, 0, 0, 0, 0, 0, 0, 'n', 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/* TODO : add rest of control characters here... */
+	0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	',', /* comma is CEE-reserved for lists */
+	0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/* at this layer ... do we need to think about transport
+	 * encoding at all? Or simply leave it to the transport agent?
+	 */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	'\\', ']' /* RFC5424 reserved, as is '"' */
+};
+
 static int
-ln_addValue_Syslog(const char *value, es_str_t **str)
+ln_addValue_Syslog(const char *value, const size_t len, es_str_t **str)
 {
-	int r;
-	es_size_t i;
+	int r = 0;
+	size_t start = 0;
 
 	assert(str != NULL);
 	assert(*str != NULL);
 	assert(value != NULL);
 
-	for(i = 0; i < strlen(value); i++) {
-		switch(value[i]) {
-		case '\0':
-			es_addChar(str, '\\');
-			es_addChar(str, '0');
-			break;
-		case '\n':
-			es_addChar(str, '\\');
-			es_addChar(str, 'n');
-			break;
-		/* TODO : add rest of control characters here... */
-		case ',': /* comma is CEE-reserved for lists */
-			es_addChar(str, '\\');
-			es_addChar(str, ',');
-			break;
-#if 0 /* alternative encoding for discussion */
-		case '^': /* CEE-reserved for lists */
-			es_addChar(str, '\\');
-			es_addChar(str, '^');
-			break;
-#endif
-		/* at this layer ... do we need to think about transport
-		 * encoding at all? Or simply leave it to the transport agent?
-		 */
-		case '\\': /* RFC5424 reserved */
-			es_addChar(str, '\\');
-			es_addChar(str, '\\');
-			break;
-		case ']': /* RFC5424 reserved */
-			es_addChar(str, '\\');
-			es_addChar(str, ']');
-			break;
-		case '\"': /* RFC5424 reserved */
-			es_addChar(str, '\\');
-			es_addChar(str, '\"');
-			break;
-		default:
-			es_addChar(str, value[i]);
-			break;
-		}
+	/* runs of characters which need no escaping are copied at once */
+	for(size_t i = 0 ; i < len ; ++i) {
+		const char esc = syslogEsc[(unsigned char) value[i]];
+		if(esc == 0)
+			continue;
+		if(i > start)
+			CHKR(es_addBuf(str, value + start, i - start));
+		CHKR(es_addChar(str, '\\'));
+		CHKR(es_addChar(str, esc));
+		start = i + 1;
 	}
-	r = 0;
+	if(len > start)
+		CHKR(es_addBuf(str, value + start, len - start));
+
+done:
+	return r;
+}
 
+
+/* add the string representation of a value */
+static int
+ln_addObj_Syslog(struct json_object *obj, es_str_t **str)
+{
+	int r;
+	const char *value;
+
+	CHKN(value = json_object_get_string(obj));
+	if(json_object_get_type(obj) == json_type_string) {
+		r = ln_addValue_Syslog(value, json_object_get_string_len(obj), str);
+	} else {
+		r = ln_addValue_Syslog(value, strlen(value), str);
+	}
+done:
 	return r;
 }
 
@@ -104,7 +114,6 @@ static int
 ln_addField_Syslog(char *name, struct json_object *field, es_str_t **str)
 {
 	int r;
-	const char *value;
 	int needComma = 0;
 	struct json_object *obj;
 	int i;
@@ -118,19 +127,18 @@ ln_addField_Syslog(char *name, struct json_object *field, es_str_t **str)
 	switch(json_object_get_type(field)) {
 	case json_type_array:
 		for (i = json_object_array_length(field) - 1; i >= 0; i--) {
-			if(needComma)
-				es_addChar(str, ',');
-			else
+			if(needComma) {
+				CHKR(es_addChar(str, ','));
+			} else {
 				needComma = 1;
+			}
 			CHKN(obj = json_object_array_get_idx(field, i));
-			CHKN(value = json_object_get_string(obj));
-			CHKR(ln_addValue_Syslog(value, str));
+			CHKR(ln_addObj_Syslog(obj, str));
 		}
 		break;
 	case json_type_string:
 	case json_type_int:
-		CHKN(value = json_object_get_string(field));
-		CHKR(ln_addValue_Syslog(value, str));
+		CHKR(ln_addObj_Syslog(field, str));
 		break;
 	case json_type_null:
 	case json_type_boolean:
@@ -177,17 +185,15 @@ done:	return r;
 
 
 int
-ln_fmtEventToRFC5424(struct json_object *json, es_str_t **str)
+ln_fmtEventToRFC5424Buf(struct json_object *json, es_str_t **str)
 {
-	int r = -1;
+	int r = 0;
 	struct json_object *tags;
 	
 	assert(json != NULL);
 	assert(json_object_is_type(json, json_type_object));
-	if((*str = es_newStr(256)) == NULL)
-		goto done;
 
-	es_addBuf(str, "[cee@115", 8);
+	CHKR(es_addBuf(str, "[cee@115", 8));
 	
 	if(json_object_object_get_ex(json, "event.tags", &tags)) {
 		CHKR(ln_addTags_Syslog(tags, str));
@@ -197,13 +203,26 @@ ln_fmtEventToRFC5424(struct json_object *json, es_str_t **str)
 	while (!json_object_iter_equal(&it, &itEnd)) {
 		char *const name = (char*)json_object_iter_peek_name(&it);
 		if (strcmp(name, "event.tags")) {
-			es_addChar(str, ' ');
-			ln_addField_Syslog(name, json_object_iter_peek_value(&it), str);
+			CHKR(es_addChar(str, ' '));
+			CHKR(ln_addField_Syslog(name, json_object_iter_peek_value(&it), str));
 		}
 		json_object_iter_next(&it);
 	}
-	es_addChar(str, ']');
+	CHKR(es_addChar(str, ']'));
 
 done:
 	return r;
 }
+
+
+int
+ln_fmtEventToRFC5424(struct json_object *json, es_str_t **str)
+{
+	int r = -1;
+
+	if((*str = es_newStr(256)) == NULL)
+		goto done;
+	r = ln_fmtEventToRFC5424Buf(json, str);
+done:
+	return r;
+}
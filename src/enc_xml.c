@@ -57,73 +57,65 @@ static char hexdigit[16] =
  * rgerhards, 2010-11-09
  */
 static int
-ln_addValue_XML(const char *value, es_str_t **str)
+ln_addValue_XML(const char *value, const size_t len, es_str_t **str)
 {
-	int r;
-	unsigned char c;
-	es_size_t i;
-#if 0
-	char numbuf[4];
-	int j;
-#endif
+	int r = 0;
+	size_t start = 0;
+	const char *esc;
+	size_t lenEsc;
 
 	assert(str != NULL); 
 	assert(*str != NULL);
 	assert(value != NULL); 
 	// TODO: support other types!
-	es_addBuf(str, "<value>", 7);
+	CHKR(es_addBuf(str, "<value>", 7));
 
-	for(i = 0 ; i < strlen(value) ; ++i) {
-		c = value[i];
-		switch(c) {
+	/* runs of characters which need no escaping are copied at once */
+	for(size_t i = 0 ; i < len ; ++i) {
+		switch(value[i]) {
 		case '\0':
-			es_addBuf(str, "&#00;", 5);
-			break;
-#if 0
-		case '\n':
-			es_addBuf(str, "&#10;", 5);
-			break;
-		case '\r':
-			es_addBuf(str, "&#13;", 5);
+			esc = "&#00;";
+			lenEsc = 5;
 			break;
-		case '\t':
-			es_addBuf(str, "&x08;", 5);
-			break;
-		case '\"':
-			es_addBuf(str, "&quot;", 6);
-			break;
-#endif
 		case '<':
-			es_addBuf(str, "&lt;", 4);
+			esc = "&lt;";
+			lenEsc = 4;
 			break;
 		case '&':
-			es_addBuf(str, "&amp;", 5);
-			break;
-#if 0
-		case ',':
-			es_addBuf(str, "\\,", 2);
-			break;
-		case '\'':
-			es_addBuf(str, "&apos;", 6);
+			esc = "&amp;";
+			lenEsc = 5;
 			break;
-#endif
 		default:
-			es_addChar(str, c);
-#if 0
-			/* TODO : proper Unicode encoding (see header comment) */
-			for(j = 0 ; j < 4 ; ++j) {
-				numbuf[3-j] = hexdigit[c % 16];
-				c = c / 16;
-			}
-			es_addBuf(str, "\\u", 2);
-			es_addBuf(str, numbuf, 4);
-			break;
-#endif
+			continue;
 		}
+		if(i > start)
+			CHKR(es_addBuf(str, value + start, i - start));
+		CHKR(es_addBuf(str, esc, lenEsc));
+		start = i + 1;
 	}
-	es_addBuf(str, "</value>", 8);
-	r = 0;
+	if(len > start)
+		CHKR(es_addBuf(str, value + start, len - start));
+	CHKR(es_addBuf(str, "</value>", 8));
 
+done:
+	return r;
+}
+
+
+/* add the string representation of a value */
+static int
+ln_addObj_XML(struct json_object *obj, es_str_t **str)
+{
+	int r;
+	const char *value;
+
+	CHKN(value = json_object_get_string(obj));
+	if(json_object_get_type(obj) == json_type_string) {
+		r = ln_addValue_XML(value, json_object_get_string_len(obj), str);
+	} else {
+		r = ln_addValue_XML(value, strlen(value), str);
+	}
+done:
 	return r;
 }
 
@@ -133,7 +125,6 @@ ln_addField_XML(char *name, struct json_object *field, es_str_t **str)
 {
 	int r;
 	int i;
-	const char *value;
 	struct json_object *obj;
 
 	assert(field != NULL);
@@ -148,14 +139,12 @@ ln_addField_XML(char *name, struct json_object *field, es_str_t **str)
 	case json_type_array:
 		for (i = json_object_array_length(field) - 1; i >= 0; i--) {
 			CHKN(obj = json_object_array_get_idx(field, i));
-			CHKN(value = json_object_get_string(obj));
-			CHKR(ln_addValue_XML(value, str));
+			CHKR(ln_addObj_XML(obj, str));
 		}
 		break;
 	case json_type_string:
 	case json_type_int:
-		CHKN(value = json_object_get_string(field));
-		CHKR(ln_addValue_XML(value, str));
+		CHKR(ln_addObj_XML(field, str));
 		break;
 	case json_type_null:
 	case json_type_boolean:
@@ -198,18 +187,15 @@ done:	return r;
 
 
 int
-ln_fmtEventToXML(struct json_object *json, es_str_t **str)
+ln_fmtEventToXMLBuf(struct json_object *json, es_str_t **str)
 {
-	int r = -1;
+	int r = 0;
 	struct json_object *tags;
 
 	assert(json != NULL);
 	assert(json_object_is_type(json, json_type_object));
 	
-	if((*str = es_newStr(256)) == NULL)
-		goto done;
-
-	es_addBuf(str, "<event>", 7);
+	CHKR(es_addBuf(str, "<event>", 7));
 	if(json_object_object_get_ex(json, "event.tags", &tags)) {
 		CHKR(ln_addTags_XML(tags, str));
 	}
@@ -218,13 +204,26 @@ ln_fmtEventToXML(struct json_object *json, es_str_t **str)
 	while (!json_object_iter_equal(&it, &itEnd)) {
 		char *const name = (char*) json_object_iter_peek_name(&it);
 		if (strcmp(name, "event.tags")) {
-			ln_addField_XML(name, json_object_iter_peek_value(&it), str);
+			CHKR(ln_addField_XML(name, json_object_iter_peek_value(&it), str));
 		}
 		json_object_iter_next(&it);
 	}
 
-	es_addBuf(str, "</event>", 8);
+	CHKR(es_addBuf(str, "</event>", 8));
 
 done:
 	return r;
 }
+
+
+int
+ln_fmtEventToXML(struct json_object *json, es_str_t **str)
+{
+	int r = -1;
+
+	if((*str = es_newStr(256)) == NULL)
+		goto done;
+	r = ln_fmtEventToXMLBuf(json, str);
+done:
+	return r;
+}
@@ -27,6 +27,7 @@
 #include "config.h"
 #include <string.h>
 #include <errno.h>
+#include <sched.h>
 
 #include "liblognorm.h"
 #include "lognorm.h"
@@ -34,6 +35,7 @@
 #include "samp.h"
 #include "v1_liblognorm.h"
 #include "v1_ptree.h"
+#include "internal.h"
 
 #define CHECK_CTX \
 	if(ctx->objID != LN_ObjID_CTX) { \
@@ -89,42 +91,302 @@ ln_initCtx(void)
 		ctx = NULL;
 		goto done;
 	}
+	/* we use our own rulebase */
+	ctx->rb = ctx;
+	ctx->rbRefcnt = LN_RB_REF + 1;
 
 done:
 	return ctx;
 }
 
-void
+int
 ln_setCtxOpts(ln_ctx ctx, const unsigned opts) {
+	int r = 0;
+	if((opts & LN_CTXOPT_THREADSAFE) && ln_hasAdvancedStats()) {
+		/* the advanced stats are global counters */
+		ln_errprintf(ctx, 0, "thread-safe mode is not available, the "
+			"library was built with advanced statistics");
+		r = LN_BADCONFIG;
+		goto done;
+	}
+	if(opts & LN_CTXOPT_PROFILE) {
+		if(ctx->prof == NULL)
+			CHKN(ctx->prof = ln_newProfile());
+		CHKR(ln_pdagNodeProfAlloc(ctx->rb));
+	}
 	ctx->opts |= opts;
+done:	return r;
 }
 
-
 int
-ln_exitCtx(ln_ctx ctx)
-{
+ln_clearCtxOpts(ln_ctx ctx, const unsigned opts) {
 	int r = 0;
+	if((opts & LN_CTXOPT_THREADSAFE) && ln_rbIsShared(ctx->rb)) {
+		ln_errprintf(ctx, 0, "rulebase is shared by multiple contexts, "
+			"thread-safe mode cannot be turned off");
+		r = LN_BADCONFIG;
+		goto done;
+	}
+	ctx->opts &= ~opts;
+	if(opts & LN_CTXOPT_PROFILE) {
+		free(ctx->prof);
+		ctx->prof = NULL;
+		/* a shared rulebase keeps its counters for the other contexts */
+		if(!ln_rbIsShared(ctx->rb)) {
+			free(ctx->rb->nodeProf);
+			ctx->rb->nodeProf = NULL;
+		}
+	}
+done:	return r;
+}
 
-	CHECK_CTX;
+void
+ln_setNormalizeBudget(ln_ctx ctx, const unsigned maxParserCalls, const unsigned maxDepth,
+	const unsigned maxUsecs)
+{
+	ctx->budget.maxCalls = maxParserCalls;
+	ctx->budget.maxDepth = maxDepth;
+	ctx->budget.maxNs = (uint64_t) maxUsecs * 1000;
+}
 
-	ln_dbgprintf(ctx, "exitCtx %p", ctx);
-	ctx->objID = LN_ObjID_None; /* prevent double free */
+void
+ln_setReoptimizeInterval(ln_ctx ctx, const unsigned nMsgs)
+{
+	ctx->reoptInterval = nMsgs;
+	ctx->reoptCount = 0;
+}
+
+#define MAX_SHAPE_CACHE_ENTRIES 65536
+void
+ln_setShapeCache(ln_ctx ctx, unsigned nEntries)
+{
+	unsigned size = 0;
+	if(nEntries > MAX_SHAPE_CACHE_ENTRIES)
+		nEntries = MAX_SHAPE_CACHE_ENTRIES;
+	if(nEntries > 0) {
+		for(size = 1 ; size < nEntries ; size <<= 1)
+			;
+	}
+	ctx->shapeCacheSize = size;
+}
+
+
+/* free the rulebase owned by a context */
+static void
+ctxDeleteRulebase(ln_ctx ctx)
+{
 	/* support for old cruft */
 	if(ctx->ptree != NULL)
 		ln_deletePTree(ctx->ptree);
+	ctx->ptree = NULL;
 	/* end support for old cruft */
 	if(ctx->pdag != NULL)
 		ln_pdagDelete(ctx->pdag);
-	for(int i = 0 ; i < ctx->nTypes ; ++i) {
-		free((void*)ctx->type_pdags[i].name);
+	ctx->pdag = NULL;
+	for(int i = 0 ; i < ctx->nTypes ; ++i)
 		ln_pdagDelete(ctx->type_pdags[i].pdag);
-	}
 	free(ctx->type_pdags);
-	if(ctx->rulePrefix != NULL)
-		es_deleteStr(ctx->rulePrefix);
+	ctx->type_pdags = NULL;
+	ctx->nTypes = 0;
+	free(ctx->pdagArena); /* must be after all pdags are deleted */
+	ctx->pdagArena = NULL;
+	ctx->nArenaNodes = 0;
+	free(ctx->nodeProf);
+	ctx->nodeProf = NULL;
+	ln_prefilterDelete(ctx->prefilter);
+	ctx->prefilter = NULL;
+	ln_shapeCacheDelete(ctx->shapeCache);
+	ctx->shapeCache = NULL;
+	ln_strtabDelete(ctx->strtab); /* must be after all pdags are deleted */
+	ctx->strtab = NULL;
 	if(ctx->pas != NULL)
 		ln_deleteAnnotSet(ctx->pas);
-	free(ctx);
+	ctx->pas = NULL;
+}
+
+/* drop a reference to the rulebase owned by a context. The rulebase
+ * is deleted when it is no longer used, the context itself when it
+ * also has been exited (or is an internal one, see ln_ctxReload()).
+ */
+static void
+rbPut(ln_ctx rb, const unsigned n)
+{
+	const unsigned refs = __atomic_sub_fetch(&rb->rbRefcnt, n, __ATOMIC_ACQ_REL);
+	/* events may reference the field names of a context's own
+	 * rulebase, so that one is kept until the context is exited.
+	 * Only rulebases created by a reload are deleted early.
+	 */
+	if((refs < LN_RB_REF && n == LN_RB_REF && rb->rb == NULL) || refs == 0)
+		ctxDeleteRulebase(rb);
+	if(refs == 0) {
+		free(rb->prof);
+		if(rb->tokener != NULL)
+			json_tokener_free(rb->tokener);
+		free(rb->frames);
+		if(rb->rulePrefix != NULL)
+			es_deleteStr(rb->rulePrefix);
+		free(rb);
+	}
+}
+
+/* wait until no normalization uses a rulebase that was replaced
+ * before this call. The epoch is flipped so that new normalizations
+ * use the other counter; this is done twice, because a normalization
+ * may have picked its counter just before the first flip.
+ */
+static void
+rcuSynchronize(ln_ctx ctx)
+{
+	for(int i = 0 ; i < 2 ; ++i) {
+		const unsigned idx = __atomic_fetch_add(&ctx->rcuEpoch, 1, __ATOMIC_SEQ_CST) & 1;
+		while(__atomic_load_n(&ctx->rcuReaders[idx], __ATOMIC_SEQ_CST) != 0)
+			sched_yield();
+	}
+}
+
+/* make ctx use the rulebase owned by rb, the caller must hold a
+ * reference to it, which is passed to ctx.
+ */
+static void
+rbPublish(ln_ctx ctx, ln_ctx rb)
+{
+	ln_ctx const old = ctx->rb;
+	__atomic_store_n(&ctx->rb, rb, __ATOMIC_SEQ_CST);
+	rcuSynchronize(ctx);
+	rbPut(old, LN_RB_REF);
+}
+
+static int
+ctxReload(ln_ctx ctx, const char *const file,
+	int (*const load)(ln_ctx, const char *))
+{
+	int r = 0;
+	ln_ctx nrb = NULL;
+
+	CHECK_CTX;
+	CHKN(nrb = ln_initCtx());
+	nrb->opts = ctx->opts & ~LN_CTXOPT_PROFILE; /* profile data is per context */
+	nrb->dbgCB = ctx->dbgCB;
+	nrb->dbgCookie = ctx->dbgCookie;
+	nrb->errmsgCB = ctx->errmsgCB;
+	nrb->errmsgCookie = ctx->errmsgCookie;
+	nrb->debug = ctx->debug;
+	CHKR(load(nrb, file));
+	if(ctx->opts & LN_CTXOPT_PROFILE)
+		CHKR(ln_pdagNodeProfAlloc(nrb));
+
+	/* nrb is not visible to the caller, its only reference is ours */
+	nrb->rb = NULL;
+	nrb->rbRefcnt = LN_RB_REF;
+	rbPublish(ctx, nrb);
+	nrb = NULL;
+	ln_dbgprintf(ctx, "rulebase reloaded from '%s'", file);
+
+done:
+	if(nrb != NULL)
+		ln_exitCtx(nrb);
+	return r;
+}
+
+int
+ln_ctxReload(ln_ctx ctx, const char *const file)
+{
+	return ctxReload(ctx, file, ln_loadSamples);
+}
+
+int
+ln_ctxReloadCompiled(ln_ctx ctx, const char *const file)
+{
+	return ctxReload(ctx, file, ln_loadCompiledRulebase);
+}
+
+int
+ln_ctxAttachRulebase(ln_ctx ctx, ln_ctx src)
+{
+	int r = 0;
+	unsigned idx;
+
+	CHECK_CTX;
+	if(src->objID != LN_ObjID_CTX) {
+		r = -1;
+		goto done;
+	}
+	if(ln_hasAdvancedStats()) {
+		/* sharing implies thread-safe mode, see ln_setCtxOpts() */
+		ln_errprintf(ctx, 0, "rulebases cannot be shared, the library "
+			"was built with advanced statistics");
+		r = LN_BADCONFIG;
+		goto done;
+	}
+	/* src may be reloaded concurrently, so we must be a reader while
+	 * we take our reference.
+	 */
+	ln_ctx const rb = ln_rbAcquire(src, &idx);
+	if(rb->version == 1) {
+		ln_rbRelease(src, idx);
+		ln_errprintf(ctx, 0, "v1 rulebases cannot be shared");
+		r = LN_BADCONFIG;
+		goto done;
+	}
+	if(rb == ctx->rb) {
+		ln_rbRelease(src, idx);
+		goto done;
+	}
+	__atomic_add_fetch(&rb->rbRefcnt, LN_RB_REF, __ATOMIC_ACQ_REL);
+	ln_rbRelease(src, idx);
+	if((ctx->opts & LN_CTXOPT_PROFILE) && ln_pdagNodeProfAlloc(rb) != 0) {
+		rbPut(rb, LN_RB_REF);
+		r = LN_NOMEM;
+		goto done;
+	}
+
+	/* the rulebase can now be used by multiple threads via different
+	 * contexts, so none of them must write to it.
+	 */
+	__atomic_or_fetch(&src->opts, LN_CTXOPT_THREADSAFE, __ATOMIC_SEQ_CST);
+	__atomic_or_fetch(&ctx->opts, LN_CTXOPT_THREADSAFE, __ATOMIC_SEQ_CST);
+	rbPublish(ctx, rb);
+	ln_dbgprintf(ctx, "attached to rulebase of context %p", src);
+done:
+	return r;
+}
+
+ln_ctx
+ln_inherittedCtx(ln_ctx parent)
+{
+	ln_ctx const child = ln_initCtx();
+	if(child == NULL)
+		goto done;
+	child->dbgCB = parent->dbgCB;
+	child->dbgCookie = parent->dbgCookie;
+	child->errmsgCB = parent->errmsgCB;
+	child->errmsgCookie = parent->errmsgCookie;
+	child->debug = parent->debug;
+	child->budget = parent->budget;
+	child->shapeCacheSize = parent->shapeCacheSize;
+	ln_setCtxOpts(child, parent->opts);
+done:
+	return child;
+}
+
+
+int
+ln_exitCtx(ln_ctx ctx)
+{
+	int r = 0;
+
+	CHECK_CTX;
+
+	ln_dbgprintf(ctx, "exitCtx %p", ctx);
+	ctx->objID = LN_ObjID_None; /* prevent double free */
+	ln_ctx const rb = ctx->rb;
+	ctx->rb = NULL;
+	if(rb != NULL)
+		rbPut(rb, LN_RB_REF);
+	/* in case our rulebase is still in use, it must no longer call back */
+	ctx->dbgCB = NULL;
+	ctx->errmsgCB = NULL;
+	rbPut(ctx, 1);
 done:
 	return r;
 }
@@ -161,6 +423,12 @@ ln_loadSamples(ln_ctx ctx, const char *file)
 	int r = 0;
 	const char *tofree;
 	CHECK_CTX;
+	if(!ln_rbIsPrivate(ctx)) {
+		ln_errprintf(ctx, 0, "rulebase has been replaced or is shared, "
+			"rules can no longer be added");
+		r = LN_BADCONFIG;
+		goto done;
+	}
 	ctx->conf_file = tofree = strdup(file);
 	ctx->conf_ln_nbr = 0;
 	++ctx->include_level;
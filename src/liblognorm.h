@@ -73,6 +73,7 @@
 
 #define LN_RB_LINE_TOO_LONG -1001
 #define LN_OVER_SIZE_LIMIT -1002
+#define LN_BUDGET_EXCEEDED -1003
 
 /**
  * The library context descriptor.
@@ -117,7 +118,9 @@ ln_ctx ln_initCtx(void);
  * Inherit control attributes from a library context.
  *
  * This does not copy the parse-tree, but does copy
- * behaviour-controling attributes such as enableRegex.
+ * behaviour-controling attributes such as enableRegex, the
+ * callbacks and the work budget. The rulebase of the parent can be
+ * shared via ln_ctxAttachRulebase().
  *
  * Just as with ln_initCtx, ln_exitCtx() must be called on a library
  * context that is no longer needed.
@@ -146,15 +149,170 @@ int ln_exitCtx(ln_ctx ctx);
 					          (not just in error case) */
 #define LN_CTXOPT_ADD_RULE		0x08 /**< add mockup rule */
 #define LN_CTXOPT_ADD_RULE_LOCATION	0x10 /**< add rule location (file, lineno) to metadata */
+#define LN_CTXOPT_THREADSAFE		0x20 /**< permit concurrent ln_normalize() calls, see below */
+#define LN_CTXOPT_PROFILE		0x40 /**< collect runtime profile, see ln_getProfile() */
+#define LN_CTXOPT_MEMOIZE_TYPES		0x80 /**< memoize user-defined type matches per message */
+#define LN_CTXOPT_PREFILTER		0x100 /**< skip rules whose literals are not in the message */
+#define LN_CTXOPT_COMPILE_V1		0x200 /**< load v1 rulebases into the v2 engine if possible */
 /**
  * Set options on ctx.
  *
+ * Options should be set before the rulebase is loaded. They MUST NOT
+ * be changed while other threads are normalizing with this context.
+ *
+ * With LN_CTXOPT_MEMOIZE_TYPES, the result of matching a user-defined
+ * type at some offset of the message is remembered until the message is
+ * done. If backtracking tries the same type at the same offset again,
+ * the remembered result is used. This keeps rulebases with nested types
+ * and alternatives linear, at the cost of some memory per message. The
+ * option has no effect together with LN_CTXOPT_ADD_RULE.
+ *
+ * With LN_CTXOPT_PREFILTER, the message is first searched for the
+ * literals which the rules below each branch point of the parse dag
+ * require. Branches whose literal is not contained in the message are
+ * not tried. This does not change which rule matches, but for messages
+ * that cannot be parsed, "unparsed-data" may start earlier, because
+ * parsers are skipped that could have consumed more of the message.
+ * The option must be set before the rulebase is loaded.
+ *
+ * With LN_CTXOPT_COMPILE_V1, v1 rulebases are translated into a v2
+ * parse dag when they are loaded, so that they are processed by the
+ * v2 engine. Rules are tried in the same order as the v1 engine does,
+ * i.e. fields before literal text, in the order they appear in the
+ * rulebase. Some v1 constructs have no v2 equivalent, most notably
+ * the v1-only field types (e.g. "tokenized", "regex", "iptables"),
+ * "cisco-interface-spec" (which is a structured value in v2) and
+ * "rest" fields which are not the last field of a rule. Each such
+ * construct is reported via the error message callback and the
+ * rulebase is then loaded into the v1 engine as usual. The v2 engine
+ * matches fields against empty text at the end of the message; v1
+ * does not, so such messages may be parsed by the compiled rulebase
+ * only. A v1 rulebase can only be loaded into the v1 engine if no
+ * other rulebase is processed by the v2 engine for the same context.
+ *
  * @param ctx The context to be modified.
  * @param opts a potentially or-ed list of options, see LN_CTXOPT_*
+ *
+ * @return Returns zero on success, something else otherwise. In the
+ * latter case, none of the options is set. This is the case for
+ * LN_CTXOPT_THREADSAFE if the library was built with advanced
+ * statistics.
  */
-void
+int
 ln_setCtxOpts(ln_ctx ctx, unsigned opts);
 
+/**
+ * Clear options on ctx.
+ *
+ * This is the counterpart of ln_setCtxOpts() and, like it, MUST NOT
+ * be called while other threads are normalizing with this context.
+ * Options that are applied when the rulebase is loaded (e.g.
+ * LN_CTXOPT_PREFILTER) keep their effect on an already loaded
+ * rulebase. Clearing LN_CTXOPT_PROFILE discards the runtime profile
+ * and, unless the rulebase is shared with other contexts, frees the
+ * per-node counters.
+ *
+ * @param ctx The context to be modified.
+ * @param opts a potentially or-ed list of options, see LN_CTXOPT_*
+ *
+ * @return Returns zero on success, something else otherwise. In the
+ * latter case, none of the options is cleared. This is the case for
+ * LN_CTXOPT_THREADSAFE if the rulebase is shared with other contexts
+ * (see ln_ctxAttachRulebase()).
+ */
+int
+ln_clearCtxOpts(ln_ctx ctx, unsigned opts);
+
+
+/**
+ * Set a work budget for the normalization of a single message.
+ *
+ * Some malformed messages can cause a lot of backtracking. To cap the
+ * time that can be spent on a single message, a budget can be set.
+ * If normalization of a message exceeds it, normalization stops and the
+ * message is treated as not parsed, with "unparsed-data" up to where
+ * parsing got. In this case, ln_normalize() returns LN_BUDGET_EXCEEDED.
+ * How often the budget was exceeded (in total and per parse dag node)
+ * is shown by ln_fullPdagStats() and ln_getProfile().
+ *
+ * This is only supported for v2 rulebases.
+ *
+ * @param ctx The context to be modified.
+ * @param maxParserCalls maximum number of parser invocations, 0 for unlimited
+ * @param maxDepth maximum depth of the parse dag walk, 0 for unlimited
+ * @param maxUsecs maximum time in microseconds, 0 for unlimited. This is
+ *                 only checked every few parser invocations.
+ */
+void
+ln_setNormalizeBudget(ln_ctx ctx, unsigned maxParserCalls, unsigned maxDepth,
+	unsigned maxUsecs);
+
+/**
+ * Re-optimize the parse dag for the traffic seen so far.
+ *
+ * Parsers on the same node with the same priority are tried in the
+ * order they appear in the rulebase. This function reorders them so
+ * that the ones which matched most often are tried first. Only parsers
+ * which cannot both match at the same position (like literals with
+ * different text or parsers that start with different characters) are
+ * reordered, so results do not change. Match counts are taken from the
+ * node statistics or, in LN_CTXOPT_THREADSAFE mode, from the runtime
+ * profile (LN_CTXOPT_PROFILE). Afterwards, the parse dag is optimized
+ * and laid out in memory again.
+ *
+ * This is only supported for v2 rulebases and must not be called while
+ * other threads are normalizing with this context.
+ *
+ * @param ctx The context to be re-optimized.
+ * @return 0 on success, something else otherwise
+ */
+int
+ln_pdagReoptimize(ln_ctx ctx);
+
+/**
+ * Re-optimize the parse dag automatically.
+ *
+ * If set, ln_pdagReoptimize() is called every nMsgs messages, before
+ * the next message is normalized. This is ignored in
+ * LN_CTXOPT_THREADSAFE mode, where the application needs to call
+ * ln_pdagReoptimize() itself while no normalization is in progress.
+ * It is also ignored while the rulebase is shared with other contexts
+ * (see ln_ctxAttachRulebase()), which ln_pdagReoptimize() refuses.
+ *
+ * @param ctx The context to be modified.
+ * @param nMsgs number of messages between re-optimizations, 0 to disable
+ */
+void
+ln_setReoptimizeInterval(ln_ctx ctx, unsigned nMsgs);
+
+/**
+ * Enable the message shape cache.
+ *
+ * Repetitive traffic consists of messages that differ only in a few
+ * values and are parsed by the same path through the parse dag. The
+ * shape cache remembers this path by a fingerprint of the message, in
+ * which all numbers are treated as equal. For the next message with
+ * that fingerprint, only the parsers along the remembered path are
+ * called instead of searching the whole parse dag, together with the
+ * parsers that the full search would try before them at the same
+ * place (but without what follows them). If the message does not match
+ * along that path or one of these other parsers matches, the full
+ * search is done and remembered. So results are the same as without
+ * the cache. How well the cache works is shown by
+ * ln_getShapeCacheStats().
+ *
+ * The cache is not used in LN_CTXOPT_THREADSAFE mode and together with
+ * LN_CTXOPT_ADD_RULE. Messages parsed via the cache are not subject to
+ * the work budget (see ln_setNormalizeBudget()). This is only supported
+ * for v2 rulebases and must not be called while other threads are
+ * normalizing with this context.
+ *
+ * @param ctx The context to be modified.
+ * @param nEntries number of cache entries, rounded up to a power of two
+ *                 (max 65536), 0 to disable
+ */
+void
+ln_setShapeCache(ln_ctx ctx, unsigned nEntries);
 
 /**
  * Set a debug message handler (callback).
@@ -225,6 +383,116 @@ void ln_enableDebug(ln_ctx ctx, int i);
  */
 int ln_loadSamples(ln_ctx ctx, const char *file);
 
+/**
+ * Save the rulebase of a context in compiled (binary) form.
+ *
+ * The compiled rulebase contains the already optimized parse dag
+ * including user-defined types and annotations. It can later be
+ * loaded with ln_loadCompiledRulebase(), which is much faster than
+ * loading the rulebase source, especially for large rulebases.
+ *
+ * Only v2 rulebases can be compiled. The file is not portable between
+ * liblognorm versions with different set of parsers.
+ *
+ * @param[in] ctx The library context with rulebase loaded.
+ * @param[in] file Name of file to be written.
+ *
+ * @return Returns zero on success, something else otherwise.
+ */
+int ln_saveCompiledRulebase(ln_ctx ctx, const char *file);
+
+/**
+ * Load a compiled rulebase.
+ *
+ * The file must have been created by ln_saveCompiledRulebase(). It
+ * is memory-mapped while being loaded. A compiled rulebase can only be
+ * loaded into a context which has no rulebase loaded yet. Also, no
+ * additional rulebases can be loaded via ln_loadSamples() afterwards.
+ *
+ * @param[in] ctx The library context to load the rulebase into.
+ * @param[in] file Name of file to be loaded.
+ *
+ * @return Returns zero on success, something else otherwise.
+ */
+int ln_loadCompiledRulebase(ln_ctx ctx, const char *file);
+
+/**
+ * Replace the rulebase of a context.
+ *
+ * The new rulebase is loaded from the given file into a separate
+ * parse dag and annotation set, while the context can still be used
+ * for normalization. Once it is loaded, it is published atomically:
+ * normalization calls started afterwards use the new rulebase, calls
+ * already in progress finish with the old one. ln_ctxReload() waits
+ * until the last of these calls has returned. Normalization is never
+ * blocked by this. A rulebase loaded by an earlier reload is deleted
+ * at this point. The rulebase originally loaded into the context is
+ * kept until ln_exitCtx(), because events created with it may
+ * reference its field names.
+ *
+ * Options, callbacks, the work budget and the runtime profile
+ * counters of the context are kept. If loading the new rulebase
+ * fails, the context continues to use the old one.
+ *
+ * If LN_CTXOPT_THREADSAFE is set, this may be called while other
+ * threads normalize with the context. Otherwise, it must be called
+ * by the thread that normalizes. It must not be called concurrently
+ * for the same context. After a reload, rules can no longer be added
+ * via ln_loadSamples(); use another reload instead.
+ *
+ * @param[in] ctx The library context.
+ * @param[in] file Name of the rulebase file to be loaded.
+ *
+ * @return Returns zero on success, something else otherwise.
+ */
+int ln_ctxReload(ln_ctx ctx, const char *file);
+
+/**
+ * Replace the rulebase of a context with a compiled rulebase.
+ *
+ * This is the same as ln_ctxReload(), but the new rulebase is loaded
+ * via ln_loadCompiledRulebase().
+ *
+ * @param[in] ctx The library context.
+ * @param[in] file Name of the compiled rulebase file to be loaded.
+ *
+ * @return Returns zero on success, something else otherwise.
+ */
+int ln_ctxReloadCompiled(ln_ctx ctx, const char *file);
+
+/**
+ * Share the rulebase of another context.
+ *
+ * Afterwards, ctx normalizes with the rulebase that src currently
+ * uses. The rulebase (parse dag, user-defined types and annotations)
+ * is not copied, but reference counted: it is deleted when no context
+ * uses it any longer and src has been exited, no matter which context
+ * is exited first. So a
+ * large rulebase needs to be loaded only once, even if many contexts
+ * with different options are needed. Options, callbacks, the work
+ * budget and the runtime profile stay separate per context. Note,
+ * though, that per-node profile counters are part of the rulebase
+ * and thus show the sum over all contexts.
+ *
+ * As the rulebase may now be used by multiple threads via different
+ * contexts, both contexts are put into LN_CTXOPT_THREADSAFE mode, and
+ * the rulebase can no longer be modified (e.g. by ln_loadSamples() or
+ * ln_pdagReoptimize()). Each context can still get a new rulebase via
+ * ln_ctxReload(), which does not affect the other contexts. A rulebase
+ * that was previously used by ctx is released like with
+ * ln_ctxReload().
+ *
+ * This is only supported for v2 rulebases. As thread-safe mode is
+ * needed, it is not available if the library was built with advanced
+ * statistics.
+ *
+ * @param[in] ctx The context which shall use the rulebase.
+ * @param[in] src The context whose rulebase is to be used.
+ *
+ * @return Returns zero on success, something else otherwise.
+ */
+int ln_ctxAttachRulebase(ln_ctx ctx, ln_ctx src);
+
 /**
  * Normalize a message.
  *
@@ -253,6 +521,220 @@ int ln_loadSamples(ln_ctx ctx, const char *file);
  */
 int ln_normalize(ln_ctx ctx, const char *str, const size_t strLen, struct json_object **json_p);
 
+/**
+ * Normalize a batch of messages.
+ *
+ * This works exactly like calling ln_normalize() for each message in
+ * turn, but per-call setup work is done only once for the whole batch.
+ * So it is faster if the caller has multiple messages at hand.
+ *
+ * @param[in] ctx The library context to use.
+ * @param[in] msgs Array of n message strings (see note at ln_normalize()).
+ * @param[in] lens Array of n message lengths, in bytes.
+ * @param[in] n number of messages in batch
+ * @param[out] out Array of n event pointers. Each entry is treated
+ *                 exactly like json_p in ln_normalize(), so it should
+ *                 usually be NULL on entry. The events <b>must be destructed
+ *                 if no longer needed</b>.
+ *
+ * @return Returns zero if all messages were normalized, LN_WRONGPARSER if
+ *         at least one of them could not be (its event then contains
+ *         the unparsed data as usual), or another error code if a
+ *         fatal error occured. In the later case, processing stops
+ *         at the message in error. Events for all messages up to and
+ *         including that one may have been created and must be destructed.
+ */
+int ln_normalizeBatch(ln_ctx ctx, const char **msgs, const size_t *lens, size_t n,
+	struct json_object **out);
+
+/**
+ * A field found by ln_normalizeToSpans().
+ *
+ * Usually a field is just a part of the message, so the data is not
+ * copied but described by offset and length into the caller's message.
+ * There are some field types whose value is not a simple substring
+ * (like json, repeat, user-defined types and similar). For those,
+ * value points to the structured value. It is owned by the library
+ * and only valid during the callback (use json_object_get() to
+ * keep it). Note that for fields named "." (or ".."), the members of
+ * value are to be treated as top-level fields, like ln_normalize() does.
+ */
+struct ln_field_span {
+	const char *name;		/**< field name, as given in rule */
+	size_t offs;			/**< start of field data inside message */
+	size_t len;			/**< length of field data */
+	const char *parser;		/**< name of the parser (field type) */
+	struct json_object *value;	/**< structured value or NULL if just a substring */
+};
+
+/**
+ * Callback for ln_normalizeToSpans().
+ *
+ * @param[in] cookie caller-provided cookie
+ * @param[in] span the field found, only valid during the callback
+ * @return 0 to continue, something else to abort the operation
+ */
+typedef int (*ln_span_cb)(void *cookie, const struct ln_field_span *span);
+
+/**
+ * Normalize a message, without building a json event.
+ *
+ * This does the same matching as ln_normalize(), but instead of
+ * creating an event the callback is called once for each named field
+ * of the matching rule, in the order the fields appear inside the
+ * message. This is a lot faster if the caller does not need a
+ * json_object anyways. Tags, annotations and metadata are not
+ * provided. The callback is only called if the message could be
+ * normalized, and only after the matching rule has been found.
+ *
+ * This function is only supported for v2 rulebases.
+ *
+ * @param[in] ctx The library context to use.
+ * @param[in] str The message string (see note at ln_normalize()).
+ * @param[in] strLen The length of the message in bytes.
+ * @param[in] cb callback to be called for each field
+ * @param[in] cookie opaque pointer passed to the callback
+ * @param[out] rule_id if non-NULL, receives a human-readable identifier
+ *                     of the matching rule. It is owned by the library
+ *                     and valid as long as the rulebase is loaded.
+ *
+ * @return Returns zero on success, LN_WRONGPARSER if the message could
+ *         not be normalized, the callback's return value if it
+ *         aborted the operation and something else on other errors.
+ */
+int ln_normalizeToSpans(ln_ctx ctx, const char *str, const size_t strLen,
+	ln_span_cb cb, void *cookie, const char **rule_id);
+
+/**
+ * Obtain the runtime profile.
+ *
+ * If LN_CTXOPT_PROFILE is set, the v2 engine counts how often and for
+ * how long each parser type and each parse dag node is used, as well as
+ * histograms of the number of nodes entered and the number of backtracks
+ * per message. This is cheap enough to be enabled on live traffic and
+ * works together with LN_CTXOPT_THREADSAFE. It can be used to find out
+ * which rules cost the most CPU time.
+ *
+ * The profile is returned as json object with the following members:
+ * - "messages", "parsed": number of messages normalized and parsed
+ * - "budget_exceeded": number of messages that exceeded the work budget
+ *   (see ln_setNormalizeBudget(), counted even if profiling is off)
+ * - "parsers": array of { "name", "calls", "success", "ns" } for each
+ *   parser type that was called
+ * - "nodes": array of { "id", "calls", "backtracks", "ns" } for each
+ *   node that was entered, most expensive first. "id" is the rulebase
+ *   identifier of the node; terminal nodes also have "file" and "line"
+ *   of the rule. Nodes where the work budget ran out also have
+ *   "budget_exceeded".
+ * - "pathlen", "backtracks": the histograms; entry i is the number of
+ *   messages with i nodes entered (backtracks, respectively). The last
+ *   entry also counts all larger values.
+ * Times of repeat and user-defined types include their nested parsers.
+ * Parse dags inside repeat are not included in "nodes".
+ *
+ * @param[in] ctx The library context to use.
+ * @param[out] json_p The profile. <b>Must be destructed if no longer
+ *                    needed.</b>
+ *
+ * @return Returns zero on success, LN_BADCONFIG if profiling is not
+ *         enabled and something else on other errors.
+ */
+int ln_getProfile(ln_ctx ctx, struct json_object **json_p);
+
+/**
+ * Reset all counters of the runtime profile.
+ *
+ * Like ln_setCtxOpts(), this must not be called while other threads
+ * are normalizing with this context.
+ *
+ * @param[in] ctx The library context to use.
+ */
+void ln_resetProfile(ln_ctx ctx);
+
+/**
+ * Obtain the memory used by the rulebase.
+ *
+ * The result is a json object with the number of bytes used, by
+ * category:
+ * - "nodes": parse dag nodes
+ * - "parser_tables": the parser tables of the nodes
+ * - "parser_data": configuration data of the individual parsers
+ * - "indexes": first-byte dispatch indexes and the literal prefilter
+ * - "strings": field names, parser configs, type names, rule file
+ *   names and node identifiers
+ * - "annotations": the annotation set and the precompiled annotations
+ * - "total": the sum of all of the above
+ * Parse dags of user-defined types and inside repeat are included.
+ * Overhead of the memory allocator and of the json objects kept with
+ * the rulebase (tags, rule mockups) is not. So the real footprint is
+ * somewhat larger, but the numbers are suitable to compare rulebases.
+ *
+ * This is only supported for v2 rulebases. It may be called while
+ * other threads normalize or replace the rulebase via ln_ctxReload().
+ *
+ * @param[in] ctx The library context to use.
+ * @param[out] json_p The memory usage. <b>Must be destructed if no
+ *                    longer needed.</b>
+ *
+ * @return Returns zero on success, LN_BADCONFIG if the rulebase is
+ *         not a v2 one and something else on other errors.
+ */
+int ln_getMemoryStats(ln_ctx ctx, struct json_object **json_p);
+
+/**
+ * Obtain the statistics of the shape cache (see ln_setShapeCache()).
+ *
+ * The result is a json object with these members:
+ * - "entries": size of the cache
+ * - "used": number of entries that hold a path
+ * - "hits": messages parsed via the cache
+ * - "misses": messages for which no path was cached
+ * - "mismatches": messages for which the cached path did not verify
+ *   or a parser that is tried first also matched
+ * - "bytes": memory used by the cache
+ * Hits, misses and mismatches are counted since the cache was enabled.
+ * They are also shown by ln_fullPdagStats().
+ *
+ * @param[in] ctx The library context to use.
+ * @param[out] json_p The statistics. <b>Must be destructed if no
+ *                    longer needed.</b>
+ *
+ * @return Returns zero on success, LN_BADCONFIG if the cache is not
+ *         enabled and something else on other errors.
+ */
+int ln_getShapeCacheStats(ln_ctx ctx, struct json_object **json_p);
+
+/**
+ * Thread safety.
+ *
+ * If LN_CTXOPT_THREADSAFE is set, ln_normalize() may be called
+ * concurrently by multiple threads on the same context. In that mode,
+ * the library does not write to the shared rulebase during
+ * normalization. Consequently, per-node runtime statistics (those
+ * shown by extended pdag statistics) are not collected, but the runtime
+ * profile (LN_CTXOPT_PROFILE) is. Also, each event receives its own copy
+ * of "event.tags", so that events can safely be modified and destructed
+ * by different threads.
+ *
+ * Once ln_loadSamples() has returned, the context and its rulebase
+ * are read-only for ln_normalize(). The caller must make sure that
+ * none of the following happens while normalization is in progress
+ * on any thread:
+ * - loading additional rulebases via ln_loadSamples()
+ *   (but the rulebase can be replaced via ln_ctxReload())
+ * - setting options via ln_setCtxOpts()
+ * - replacing callbacks via ln_setDebugCB() / ln_setErrMsgCB(),
+ *   or toggling debug mode via ln_enableDebug()
+ * - calling ln_exitCtx()
+ * Note that the debug callback, if set, may be called concurrently
+ * by multiple threads and must be prepared for that.
+ *
+ * This mode is only supported for v2 rulebases. Also, it is not
+ * available if the library was built with advanced statistics, as
+ * these are kept in global counters (see ln_hasAdvancedStats()).
+ * ln_setCtxOpts() then refuses to set LN_CTXOPT_THREADSAFE.
+ */
+
 /* here we add some stuff from the compatibility layer. A separate include
  * would be cleaner, but would potentially require changes all over the
  * place. So doing it here is better. The respective replacement
@@ -43,6 +43,12 @@ struct ln_type_pdag {
 	ln_pdag *pdag;
 };
 
+/* Note: after the rulebase has been loaded, no member of the ctx (and
+ * nothing reachable from it) must be written to during normalization
+ * when LN_CTXOPT_THREADSAFE is set. See liblognorm.h for the details.
+ * The only exception are the profile counters (LN_CTXOPT_PROFILE),
+ * which are always updated atomically.
+ */
 struct ln_ctx_s {
 	unsigned objID;	/**< a magic number to prevent some memory addressing errors */
 	void (*dbgCB)(void *cookie, const char *msg, size_t lenMsg);
@@ -64,6 +70,42 @@ struct ln_ctx_s {
 	struct ln_type_pdag *type_pdags; /**< array of our type pdags */
 	int nTypes;		 /**< number of type pdags */
 	int version;		/**< 1 or 2, depending on rulebase/algo version */
+	void *pdagArena;	/**< frozen pdag nodes and parser tables (see ln_pdagOptimize) */
+	size_t nArenaNodes;	/**< number of nodes at start of pdagArena */
+	struct ln_pdag_profile *prof; /**< runtime profile, NULL if not enabled */
+	struct ln_pdag_nodeprof *nodeProf; /**< per-node profile counters of our rulebase, NULL if none */
+	struct {
+		unsigned maxCalls;	/**< max parser calls per message, 0 = unlimited */
+		unsigned maxDepth;	/**< max recursion depth, 0 = unlimited */
+		uint64_t maxNs;		/**< max time per message, 0 = unlimited */
+	} budget;		/**< work budget, see ln_setNormalizeBudget() */
+	uint64_t budgetExceeded; /**< number of messages that ran out of budget (atomic) */
+	unsigned reoptInterval;	/**< re-optimize every n messages, 0 = never */
+	unsigned reoptCount;	/**< messages since last re-optimization */
+	struct json_tokener *tokener; /**< for the JSON parsers if not threadSafe, see ln_npbTokener() */
+	struct npb_frame *frames; /**< normalizer stack if not threadSafe, see npbConstruct() */
+	size_t maxframes;	/**< size of frames */
+	struct ln_prefilter *prefilter; /**< literal prefilter, NULL if not used (see prefilter.c) */
+	struct ln_strtab *strtab; /**< names and configs used by the rulebase (see strtab.c) */
+	struct ln_shapecache *shapeCache; /**< shape cache for this rulebase, NULL if none (see shapecache.c) */
+	unsigned shapeCacheSize; /**< entries of the shape cache, 0 = disabled, see ln_setShapeCache() */
+	struct {
+		uint64_t hits;		/**< cached path verified */
+		uint64_t misses;	/**< no cached path */
+		uint64_t mismatches;	/**< cached path did not verify */
+	} shapeCacheStats;
+
+	/* rulebase publication, see ln_ctxReload(). Normalization uses the
+	 * rulebase (pdag, types, annotations) of the context rb points to.
+	 * Initially, this is the context itself. After a reload, it is an
+	 * internal context that only holds the new rulebase. Readers are
+	 * tracked by two counters, so the writer can wait until all
+	 * normalizations that may still use the old rulebase are done.
+	 */
+	ln_ctx rb;		/**< context owning the rulebase in use */
+	unsigned rbRefcnt;	/**< LN_RB_REF per user of our rulebase + 1 while not exited */
+	unsigned rcuEpoch;	/**< low bit selects the reader counter */
+	uint64_t rcuReaders[2];	/**< normalizations in progress, per epoch */
 
 	/* here follows stuff for the v1 subsystem -- do NOT make any changes
 	 * down here. This is strictly read-only. May also be removed some time in
@@ -75,8 +117,47 @@ struct ln_ctx_s {
 	int include_level;		/**< 1 for main rulebase file, higher for include levels */
 	const char *conf_file;		/**< currently open config file or NULL, if none */
 	unsigned int conf_ln_nbr;	/**< current config file line number */
+	int v1compile;			/**< state of v1 rulebase compilation, LN_V1C_* (see samp.c) */
+	unsigned v1unsupported;		/**< number of v1 constructs that cannot be compiled */
 };
 
+#define LN_RB_REF 2
+
+/* v1 rulebase compilation (LN_CTXOPT_COMPILE_V1) is done in two passes */
+#define LN_V1C_OFF	0	/**< not loading a v1 rulebase */
+#define LN_V1C_CHECK	1	/**< checking if all constructs can be translated */
+#define LN_V1C_LOAD	2	/**< adding the translated rules to the pdag */
+
+/* is the rulebase owned by rb used by more than one context? */
+#define ln_rbIsShared(rb) \
+	(__atomic_load_n(&(rb)->rbRefcnt, __ATOMIC_ACQUIRE) / LN_RB_REF > 1)
+
+/* can rules be added to the rulebase of ctx? Not if it has been
+ * replaced or is shared with other contexts.
+ */
+#define ln_rbIsPrivate(ctx) ((ctx)->rb == (ctx) && !ln_rbIsShared(ctx))
+
+/* begin using the rulebase of ctx; must be paired with ln_rbRelease() */
+static inline ln_ctx
+ln_rbAcquire(ln_ctx ctx, unsigned *const idx)
+{
+	*idx = __atomic_load_n(&ctx->rcuEpoch, __ATOMIC_SEQ_CST) & 1;
+	__atomic_fetch_add(&ctx->rcuReaders[*idx], 1, __ATOMIC_SEQ_CST);
+	return __atomic_load_n(&ctx->rb, __ATOMIC_SEQ_CST);
+}
+
+static inline void
+ln_rbRelease(ln_ctx ctx, const unsigned idx)
+{
+	__atomic_fetch_sub(&ctx->rcuReaders[idx], 1, __ATOMIC_RELEASE);
+}
+
+/* string table, see strtab.c */
+struct ln_strtab;
+const char *ln_strtabAdd(ln_ctx ctx, const char *const str, const size_t len);
+size_t ln_strtabMemSize(const struct ln_strtab *const tab);
+void ln_strtabDelete(struct ln_strtab *const tab);
+
 void ln_dbgprintf(ln_ctx ctx, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
 void ln_errprintf(ln_ctx ctx, const int eno, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
 
@@ -34,8 +34,16 @@
  */
 #include "config.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <libestr.h>
 
 #include "liblognorm.h"
@@ -58,11 +66,20 @@ static int outputSummaryLine = 0;
 static int outputNbrUnparsed = 0;
 static int addErrLineNbr = 0;	/**< add line number info to unparsed events */
 static int flatTags = 0;	/**< print event.tags in JSON? */
+static int batchSize = 1;	/**< number of messages to normalize in one batch */
+static int nThreads = 1;	/**< number of normalization worker threads */
+static int unorderedOutput = 0;	/**< threaded mode: output in completion order? */
+static enum { im_auto, im_mmap, im_block, im_stream } inputMode = im_auto;
+#define CHUNK_LINES 256	/**< max lines per batch or thread chunk */
+#define OUTBUF_FLUSH_SIZE (64 * 1024)
 static FILE *fpDOT;
 static es_str_t *encFmt = NULL; /**< a format string for encoder use */
 static es_str_t *mandatoryTag = NULL; /**< tag which must be given so that mesg will
 					   be output. NULL=all */
-static enum { f_syslog, f_json, f_xml, f_csv, f_raw } outfmt = f_json;
+static enum { f_syslog, f_json, f_xml, f_csv, f_raw, f_spans, f_spanjson } outfmt = f_json;
+static const char *rulebaseFile;	/**< rulebase to reload on SIGHUP */
+static int rulebaseCompiled;		/**< is it a compiled rulebase? */
+static volatile sig_atomic_t reloadRequested = 0;
 
 static void
 errCallBack(void __attribute__((unused)) *cookie, const char *msg,
@@ -84,55 +101,79 @@ complain(const char *errmsg)
 	fprintf(stderr, "%s\n", errmsg);
 }
 
+static void
+hupHandler(int __attribute__((unused)) sig)
+{
+	reloadRequested = 1;
+}
 
-/* rawmsg is, as the name says, the raw message, in case we have
- * "raw" formatter requested.
+/* reload the rulebase if requested via SIGHUP. In threaded mode, this
+ * is done by the reader while the workers keep normalizing.
  */
 static void
-outputEvent(struct json_object *json, const char *const rawmsg)
+checkReload(void)
 {
-	char *cstr = NULL;
-	es_str_t *str = NULL;
-
-	if(outfmt == f_raw) {
-		printf("%s\n", rawmsg);
+	if(!reloadRequested)
 		return;
-	}
+	reloadRequested = 0;
+	const int r = rulebaseCompiled ? ln_ctxReloadCompiled(ctx, rulebaseFile)
+				       : ln_ctxReload(ctx, rulebaseFile);
+	if(r != 0)
+		fprintf(stderr, "rulebase reload failed, continuing with previous rulebase\n");
+	else if(verbose > 0)
+		fprintf(stderr, "rulebase reloaded\n");
+}
+
 
+/* encode an event in the requested output format and append it,
+ * including the line terminator, to *out.
+ * rawmsg is, as the name says, the raw message, in case we have
+ * "raw" formatter requested.
+ */
+static void
+encodeEvent(struct json_object *json, const char *const rawmsg, es_str_t **out)
+{
+	const es_size_t start = es_strlen(*out);
+
+	/* events are encoded directly into the output buffer */
 	switch(outfmt) {
+	case f_raw:
+		es_addBuf(out, rawmsg, strlen(rawmsg));
+		break;
 	case f_json:
 		if(!flatTags) {
 			json_object_object_del(json, "event.tags");
 		}
-		cstr = (char*)json_object_to_json_string(json);
+		ln_fmtEventToJSONBuf(json, out);
 		break;
 	case f_syslog:
-		ln_fmtEventToRFC5424(json, &str);
+		ln_fmtEventToRFC5424Buf(json, out);
 		break;
 	case f_xml:
-		ln_fmtEventToXML(json, &str);
+		ln_fmtEventToXMLBuf(json, out);
 		break;
 	case f_csv:
-		ln_fmtEventToCSV(json, &str, encFmt);
-		break;
-	case f_raw:
-		fprintf(stderr, "program error: f_raw should not occur "
-			"here (file %s, line %d)\n", __FILE__, __LINE__);
-		abort();
+		ln_fmtEventToCSVBuf(json, out, encFmt);
 		break;
+	case f_spans:
+	case f_spanjson:
 	default:
 		fprintf(stderr, "program error: default case should not occur "
 			"here (file %s, line %d)\n", __FILE__, __LINE__);
 		abort();
 		break;
 	}
-	if (str != NULL)
-		cstr = es_str2cstr(str, NULL);
-	if(verbose > 0) fprintf(stderr, "normalized: '%s'\n", cstr);
-	printf("%s\n", cstr);
-	if (str != NULL)
-		free(cstr);
-	es_deleteStr(str);
+	if(verbose > 0 && outfmt != f_raw) fprintf(stderr, "normalized: '%.*s'\n",
+		(int) (es_strlen(*out) - start), (char*) es_getBufAddr(*out) + start);
+	es_addChar(out, '\n');
+}
+
+/* write encoded events and reset buffer for reuse */
+static void
+writeOutput(es_str_t *const out)
+{
+	fwrite(es_getBufAddr(out), 1, es_strlen(out), stdout);
+	es_emptyStr(out);
 }
 
 /* test if the tag exists */
@@ -171,95 +212,685 @@ amendLineNbr(json_object *const json, const int line_nbr)
 	}
 }
 
-#define DEFAULT_LINE_SIZE (10 * 1024)
+/* Input is read via a line reader. Regular files are memory-mapped,
+ * everything else is read in large blocks. In both cases, lines are
+ * split in place, so no per-line copy is needed. A line obtained from
+ * the reader is only valid until the next one is requested.
+ */
+#define READ_BLOCK_SIZE (1024 * 1024)
+struct lineReader {
+	int fd;
+	char *buf;		/**< mapping or read buffer */
+	size_t bufSize;		/**< size of buf */
+	size_t dataLen;		/**< valid data inside buf */
+	size_t pos;		/**< start of next line inside buf */
+	int mapped;		/**< buf is a file mapping */
+	int eof;		/**< no more data to read */
+	char *lastLine;		/**< mmap: copy of unterminated last line */
+};
 
-static char *
-read_line(FILE *fp)
+static int
+lineReaderInit(struct lineReader *const rd, const int fd)
 {
-	size_t line_capacity = DEFAULT_LINE_SIZE;
-	char *line = NULL;
-	size_t line_len = 0;
-	char ch = 0;
-	do {
-		ch = fgetc(fp);
-		if (ch == EOF) break;
-		if (line == NULL) {
-			line = malloc(line_capacity);
-		} else if (line_len == line_capacity) {
-			line_capacity *= 2;
-			line = realloc(line, line_capacity);
+	struct stat st;
+
+	memset(rd, 0, sizeof(*rd));
+	rd->fd = fd;
+	if(   (inputMode == im_auto || inputMode == im_mmap)
+	   && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		/* we need write access to split lines in place, but a
+		 * private mapping never modifies the file.
+		 */
+		void *const map = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE, fd, 0);
+		if(map != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+			madvise(map, (size_t) st.st_size, MADV_SEQUENTIAL);
+#endif
+			rd->buf = map;
+			rd->bufSize = rd->dataLen = (size_t) st.st_size;
+			rd->mapped = 1;
+			rd->eof = 1;
+			return 0;
 		}
-		if (line == NULL) {
+	}
+	if(inputMode == im_mmap) {
+		fprintf(stderr, "input cannot be memory-mapped, using block reads\n");
+	}
+	rd->bufSize = READ_BLOCK_SIZE;
+	if((rd->buf = malloc(rd->bufSize)) == NULL) {
+		fprintf(stderr, "Couldn't allocate input buffer\n");
+		return -1;
+	}
+	return 0;
+}
+
+static void
+lineReaderExit(struct lineReader *const rd)
+{
+	if(rd->mapped)
+		munmap(rd->buf, rd->bufSize);
+	else
+		free(rd->buf);
+	free(rd->lastLine);
+}
+
+/* read next block of data, keeping the yet unprocessed part */
+static int
+lineReaderFill(struct lineReader *const rd)
+{
+	if(rd->pos > 0) {
+		memmove(rd->buf, rd->buf + rd->pos, rd->dataLen - rd->pos);
+		rd->dataLen -= rd->pos;
+		rd->pos = 0;
+	}
+	if(rd->dataLen + 1 >= rd->bufSize) { /* need room for terminating NUL */
+		char *const newbuf = realloc(rd->buf, 2 * rd->bufSize);
+		if(newbuf == NULL) {
 			fprintf(stderr, "Couldn't allocate working-buffer for log-line\n");
-			return NULL;
+			return -1;
 		}
-		line[line_len++] = ch;
-	} while(ch != '\n');
+		rd->buf = newbuf;
+		rd->bufSize *= 2;
+	}
+	ssize_t nRead;
+	do {
+		nRead = read(rd->fd, rd->buf + rd->dataLen, rd->bufSize - rd->dataLen - 1);
+	} while(nRead == -1 && errno == EINTR);
+	if(nRead <= 0) {
+		if(nRead == -1)
+			perror("error reading input");
+		rd->eof = 1;
+	} else {
+		rd->dataLen += (size_t) nRead;
+	}
+	return 0;
+}
+
+/* obtain next line (without line terminator) or NULL on end of input */
+static char *
+read_line(struct lineReader *const rd, size_t *const lenLine)
+{
+	char *line;
+	char *lf;
+	size_t len;
 
-	if (line != NULL) {
-		line[--line_len] = '\0';
-		if(line_len > 0 && line[line_len - 1] == '\r')
-			line[--line_len] = '\0';
+	while((lf = memchr(rd->buf + rd->pos, '\n', rd->dataLen - rd->pos)) == NULL) {
+		if(rd->eof) {
+			if(rd->pos == rd->dataLen)
+				return NULL;
+			/* last line without LF */
+			len = rd->dataLen - rd->pos;
+			if(rd->mapped) { /* no room for NUL inside mapping */
+				free(rd->lastLine);
+				if((rd->lastLine = malloc(len + 1)) == NULL)
+					return NULL;
+				memcpy(rd->lastLine, rd->buf + rd->pos, len);
+				line = rd->lastLine;
+			} else {
+				line = rd->buf + rd->pos;
+			}
+			rd->pos = rd->dataLen;
+			goto finalize;
+		}
+		if(lineReaderFill(rd) != 0)
+			return NULL;
 	}
+	line = rd->buf + rd->pos;
+	len = lf - line;
+	rd->pos += len + 1;
+
+finalize:
+	line[len] = '\0';
+	if(len > 0 && line[len - 1] == '\r')
+		line[--len] = '\0';
+	*lenLine = len;
 	return line;
 }
 
+/* copies of lines which must survive reading of further input */
+struct lineStore {
+	char *text;		/**< all lines, one after another */
+	size_t used;
+	size_t size;
+	size_t n;		/**< number of lines stored */
+	size_t max;		/**< max number of lines */
+	size_t *offs;
+	size_t *lens;
+	char **lines;		/**< only valid after lineStoreFinalize() */
+};
+
+static int
+lineStoreInit(struct lineStore *const ls, const size_t max)
+{
+	memset(ls, 0, sizeof(*ls));
+	ls->max = max;
+	ls->offs = malloc(max * sizeof(size_t));
+	ls->lens = malloc(max * sizeof(size_t));
+	ls->lines = malloc(max * sizeof(char*));
+	if(ls->offs == NULL || ls->lens == NULL || ls->lines == NULL) {
+		fprintf(stderr, "Couldn't allocate line buffer\n");
+		return -1;
+	}
+	return 0;
+}
+
+static void
+lineStoreExit(struct lineStore *const ls)
+{
+	free(ls->text);
+	free(ls->offs);
+	free(ls->lens);
+	free(ls->lines);
+}
+
+static void
+lineStoreReset(struct lineStore *const ls)
+{
+	ls->n = 0;
+	ls->used = 0;
+}
+
+/* add a copy of line, the store must not be full */
+static int
+lineStoreAdd(struct lineStore *const ls, const char *const line, const size_t len)
+{
+	if(ls->used + len + 1 > ls->size) {
+		size_t newsize = (ls->size == 0) ? 64 * 1024 : ls->size;
+		while(ls->used + len + 1 > newsize)
+			newsize *= 2;
+		char *const newtext = realloc(ls->text, newsize);
+		if(newtext == NULL) {
+			fprintf(stderr, "Couldn't allocate line buffer\n");
+			return -1;
+		}
+		ls->text = newtext;
+		ls->size = newsize;
+	}
+	memcpy(ls->text + ls->used, line, len + 1);
+	ls->offs[ls->n] = ls->used;
+	ls->lens[ls->n] = len;
+	ls->used += len + 1;
+	ls->n++;
+	return 0;
+}
+
+/* make line pointers valid, must be called after the last add */
+static void
+lineStoreFinalize(struct lineStore *const ls)
+{
+	for(size_t i = 0 ; i < ls->n ; ++i)
+		ls->lines[i] = ls->text + ls->offs[i];
+}
+
+/* counters for the summary */
+struct evtCounters {
+	long long unsigned parsed;
+	long long unsigned unparsed;
+	long long unsigned wrongTag;
+};
+static struct evtCounters counters;
+static es_str_t *outbuf = NULL;	/**< output buffer for single-threaded mode */
+
+/* check an event that was just normalized, update counters and, if
+ * it is to be output, append its encoded form to *out. The event is
+ * destructed when done.
+ */
+static void
+checkEvent(struct json_object *json, const char *const line, const int line_nbr,
+	const char *const mandatoryTagCstr, struct evtCounters *const cnt,
+	es_str_t **out)
+{
+	if(json == NULL)
+		return;
+	if(eventHasTag(json, mandatoryTagCstr)) {
+		struct json_object *dummy;
+		const int parsed = !json_object_object_get_ex(json,
+			"unparsed-data", &dummy);
+		if(parsed) {
+			cnt->parsed++;
+			if(recOutput & OUTPUT_PARSED_RECS) {
+				encodeEvent(json, line, out);
+			}
+		} else {
+			cnt->unparsed++;
+			amendLineNbr(json, line_nbr);
+			if(recOutput & OUTPUT_UNPARSED_RECS) {
+				encodeEvent(json, line, out);
+			}
+		}
+	} else {
+		cnt->wrongTag++;
+	}
+	json_object_put(json);
+}
+
+/* check and output an event in single-threaded mode. Output is
+ * buffered, except in stream mode.
+ */
+static void
+handleEvent(struct json_object *json, const char *const line, const int line_nbr,
+	const char *const mandatoryTagCstr)
+{
+	checkEvent(json, line, line_nbr, mandatoryTagCstr, &counters, &outbuf);
+	if(inputMode == im_stream) {
+		writeOutput(outbuf);
+		fflush(stdout);
+	} else if(es_strlen(outbuf) >= OUTBUF_FLUSH_SIZE) {
+		writeOutput(outbuf);
+	}
+}
+
+/* span output: one line per field, directly from the message buffer */
+static int
+outputSpan(void *const cookie, const struct ln_field_span *const span)
+{
+	const char *const line = (const char *) cookie;
+	if(span->value == NULL) {
+		printf("field %s %s %zu %zu '%.*s'\n", span->name, span->parser,
+			span->offs, span->len, (int) span->len, line + span->offs);
+	} else {
+		printf("field %s %s %zu %zu %s\n", span->name, span->parser,
+			span->offs, span->len, json_object_to_json_string(span->value));
+	}
+	return 0;
+}
+
+/* normalize a line via the span API (no json event is built) */
+static void
+normalizeToSpans(const char *const line, const size_t len)
+{
+	const char *rule_id;
+	printf("message '%s'\n", line);
+	const int r = ln_normalizeToSpans(ctx, line, len, outputSpan,
+		(void*) line, &rule_id);
+	if(r == 0) {
+		counters.parsed++;
+		printf("rule '%s'\n", rule_id);
+	} else {
+		counters.unparsed++;
+		printf("unparsed\n");
+	}
+}
+
+/* span JSON output: the event is encoded directly from the spans */
+struct spanJSON {
+	const char *line;
+	int nfields;
+};
+
+static int
+outputSpanJSON(void *const cookie, const struct ln_field_span *const span)
+{
+	struct spanJSON *const sj = (struct spanJSON *) cookie;
+	return ln_fmtSpanToJSONBuf(sj->line, span, &sj->nfields, &outbuf);
+}
+
+/* normalize a line via the span API and output it as JSON. What is
+ * written is undone if the event is not to be output.
+ */
+static void
+normalizeToSpanJSON(const char *const line, const size_t len)
+{
+	struct spanJSON sj = { line, 0 };
+	const es_size_t start = es_strlen(outbuf);
+	const int r = ln_normalizeToSpans(ctx, line, len, outputSpanJSON,
+		(void*) &sj, NULL);
+	if(r == 0) {
+		counters.parsed++;
+		if(recOutput & OUTPUT_PARSED_RECS) {
+			ln_fmtSpansEndJSONBuf(sj.nfields, &outbuf);
+			es_addChar(&outbuf, '\n');
+		} else {
+			outbuf->lenStr = start;
+		}
+	} else {
+		counters.unparsed++;
+		outbuf->lenStr = start;
+		if(recOutput & OUTPUT_UNPARSED_RECS) {
+			/* the span API does not tell how far parsing got */
+			struct json_object *const json = json_object_new_object();
+			json_object_object_add(json, "originalmsg",
+				json_object_new_string_len(line, len));
+			ln_fmtEventToJSONBuf(json, &outbuf);
+			es_addChar(&outbuf, '\n');
+			json_object_put(json);
+		}
+	}
+	if(inputMode == im_stream) {
+		writeOutput(outbuf);
+		fflush(stdout);
+	} else if(es_strlen(outbuf) >= OUTBUF_FLUSH_SIZE) {
+		writeOutput(outbuf);
+	}
+}
+
+/* normalize input data in batches of batchSize lines */
+static void
+normalizeBatched(struct lineReader *const rd, int *const line_nbr,
+	const char *const mandatoryTagCstr)
+{
+	struct lineStore ls;
+	struct json_object **events;
+	int eof = 0;
+
+	events = calloc(batchSize, sizeof(struct json_object*));
+	if(lineStoreInit(&ls, batchSize) != 0 || events == NULL) {
+		fprintf(stderr, "Couldn't allocate batch buffers\n");
+		goto done;
+	}
+
+	while(!eof) {
+		lineStoreReset(&ls);
+		while(ls.n < ls.max) {
+			size_t len;
+			const char *const line = read_line(rd, &len);
+			if(line == NULL) {
+				eof = 1;
+				break;
+			}
+			if(verbose > 0) fprintf(stderr, "To normalize: '%s'\n", line);
+			if(lineStoreAdd(&ls, line, len) != 0)
+				goto done;
+			events[ls.n - 1] = NULL;
+		}
+		lineStoreFinalize(&ls);
+		checkReload();
+		ln_normalizeBatch(ctx, (const char **) ls.lines, ls.lens, ls.n, events);
+		for(size_t i = 0 ; i < ls.n ; ++i) {
+			++(*line_nbr);
+			handleEvent(events[i], ls.lines[i], *line_nbr, mandatoryTagCstr);
+		}
+	}
+done:
+	lineStoreExit(&ls);
+	free(events);
+}
+
+/* Multi-threaded normalization.
+ * The input is read by the main thread and cut into chunks of lines.
+ * A pool of workers normalizes and encodes chunks, each into its
+ * own output buffer. A writer thread emits the chunks, either in input
+ * order or in completion order (if unorderedOutput is set). The
+ * number of chunks in flight is limited, so memory use stays bounded.
+ */
+#define CHUNKS_PER_THREAD 4
+struct chunk {
+	unsigned long long seq;		/**< sequence number in input */
+	int first_line_nbr;		/**< line number of first line - 1 */
+	struct lineStore ls;		/**< lines to normalize */
+	es_str_t *out;			/**< encoded events */
+	struct evtCounters cnt;
+	struct chunk *next;
+};
+static struct {
+	pthread_mutex_t mut;
+	pthread_cond_t workAvail;	/**< signaled when work queue changes */
+	pthread_cond_t doneAvail;	/**< signaled when done list changes */
+	pthread_cond_t spaceAvail;	/**< signaled when chunks are written */
+	struct chunk *workRoot;		/**< chunks to normalize, FIFO */
+	struct chunk *workLast;
+	struct chunk *doneRoot;		/**< normalized chunks, unsorted */
+	unsigned inFlight;		/**< chunks read but not yet written */
+	unsigned long long nRead;	/**< chunks read so far */
+	int eof;			/**< reader is finished */
+	const char *mandatoryTagCstr;
+} tpool;
+
+static void
+processChunk(struct chunk *const c)
+{
+	struct json_object *events[CHUNK_LINES];
+
+	memset(events, 0, sizeof(events));
+	if(batchSize > 1) {
+		ln_normalizeBatch(ctx, (const char **) c->ls.lines, c->ls.lens, c->ls.n, events);
+	} else {
+		for(size_t i = 0 ; i < c->ls.n ; ++i)
+			ln_normalize(ctx, c->ls.lines[i], c->ls.lens[i], &events[i]);
+	}
+	for(size_t i = 0 ; i < c->ls.n ; ++i) {
+		checkEvent(events[i], c->ls.lines[i], c->first_line_nbr + (int) i + 1,
+			tpool.mandatoryTagCstr, &c->cnt, &c->out);
+	}
+	lineStoreExit(&c->ls);
+}
+
+static void *
+normalizeWorker(void __attribute__((unused)) *arg)
+{
+	struct chunk *c;
+
+	pthread_mutex_lock(&tpool.mut);
+	while(1) {
+		while(tpool.workRoot == NULL && !tpool.eof)
+			pthread_cond_wait(&tpool.workAvail, &tpool.mut);
+		if(tpool.workRoot == NULL)
+			break;
+		c = tpool.workRoot;
+		tpool.workRoot = c->next;
+		pthread_mutex_unlock(&tpool.mut);
+
+		processChunk(c);
+
+		pthread_mutex_lock(&tpool.mut);
+		c->next = tpool.doneRoot;
+		tpool.doneRoot = c;
+		pthread_cond_signal(&tpool.doneAvail);
+	}
+	pthread_mutex_unlock(&tpool.mut);
+	return NULL;
+}
+
+/* obtain next chunk to write from done list or NULL, if there is
+ * none yet. Must be called with mutex locked.
+ */
+static struct chunk *
+takeDoneChunk(const unsigned long long seq)
+{
+	struct chunk **pc;
+	for(pc = &tpool.doneRoot ; *pc != NULL ; pc = &(*pc)->next) {
+		if(unorderedOutput || (*pc)->seq == seq) {
+			struct chunk *const c = *pc;
+			*pc = c->next;
+			return c;
+		}
+	}
+	return NULL;
+}
+
+static void *
+outputWriter(void __attribute__((unused)) *arg)
+{
+	unsigned long long nWritten = 0;
+	struct chunk *c;
+
+	pthread_mutex_lock(&tpool.mut);
+	while(1) {
+		while((c = takeDoneChunk(nWritten)) == NULL
+		      && !(tpool.eof && nWritten == tpool.nRead))
+			pthread_cond_wait(&tpool.doneAvail, &tpool.mut);
+		if(c == NULL)
+			break;
+		pthread_mutex_unlock(&tpool.mut);
+
+		writeOutput(c->out);
+		counters.parsed += c->cnt.parsed;
+		counters.unparsed += c->cnt.unparsed;
+		counters.wrongTag += c->cnt.wrongTag;
+		es_deleteStr(c->out);
+		free(c);
+		++nWritten;
+
+		pthread_mutex_lock(&tpool.mut);
+		tpool.inFlight--;
+		pthread_cond_signal(&tpool.spaceAvail);
+	}
+	pthread_mutex_unlock(&tpool.mut);
+	return NULL;
+}
+
+static void
+normalizeThreaded(struct lineReader *const rd, const char *const mandatoryTagCstr)
+{
+	pthread_t *workers;
+	pthread_t writer;
+	int nWorkers = 0;
+	int line_nbr = 0;
+	int eof = 0;
+	const unsigned maxInFlight = CHUNKS_PER_THREAD * nThreads;
+
+	memset(&tpool, 0, sizeof(tpool));
+	pthread_mutex_init(&tpool.mut, NULL);
+	pthread_cond_init(&tpool.workAvail, NULL);
+	pthread_cond_init(&tpool.doneAvail, NULL);
+	pthread_cond_init(&tpool.spaceAvail, NULL);
+	tpool.mandatoryTagCstr = mandatoryTagCstr;
+
+	if((workers = calloc(nThreads, sizeof(pthread_t))) == NULL) {
+		fprintf(stderr, "Couldn't allocate thread table\n");
+		goto done;
+	}
+	if(pthread_create(&writer, NULL, outputWriter, NULL) != 0) {
+		fprintf(stderr, "Couldn't create writer thread\n");
+		goto done;
+	}
+	for( ; nWorkers < nThreads ; ++nWorkers) {
+		if(pthread_create(&workers[nWorkers], NULL, normalizeWorker, NULL) != 0) {
+			fprintf(stderr, "Couldn't create worker thread\n");
+			break;
+		}
+	}
+
+	while(!eof && nWorkers > 0) {
+		struct chunk *const c = calloc(1, sizeof(struct chunk));
+		if(   c == NULL || (c->out = es_newStr(CHUNK_LINES * 128)) == NULL
+		   || lineStoreInit(&c->ls, CHUNK_LINES) != 0) {
+			fprintf(stderr, "Couldn't allocate chunk\n");
+			if(c != NULL) {
+				lineStoreExit(&c->ls);
+				if(c->out != NULL)
+					es_deleteStr(c->out);
+			}
+			free(c);
+			break;
+		}
+		c->first_line_nbr = line_nbr;
+		while(c->ls.n < CHUNK_LINES) {
+			size_t len;
+			const char *const line = read_line(rd, &len);
+			if(line == NULL) {
+				eof = 1;
+				break;
+			}
+			if(verbose > 0) fprintf(stderr, "To normalize: '%s'\n", line);
+			if(lineStoreAdd(&c->ls, line, len) != 0) {
+				eof = 1;
+				break;
+			}
+		}
+		lineStoreFinalize(&c->ls);
+		checkReload();
+		line_nbr += (int) c->ls.n;
+		if(c->ls.n == 0) {
+			lineStoreExit(&c->ls);
+			es_deleteStr(c->out);
+			free(c);
+			break;
+		}
+
+		pthread_mutex_lock(&tpool.mut);
+		while(tpool.inFlight >= maxInFlight)
+			pthread_cond_wait(&tpool.spaceAvail, &tpool.mut);
+		c->seq = tpool.nRead++;
+		tpool.inFlight++;
+		if(tpool.workRoot == NULL)
+			tpool.workRoot = c;
+		else
+			tpool.workLast->next = c;
+		tpool.workLast = c;
+		pthread_cond_signal(&tpool.workAvail);
+		pthread_mutex_unlock(&tpool.mut);
+	}
+
+	pthread_mutex_lock(&tpool.mut);
+	tpool.eof = 1;
+	pthread_cond_broadcast(&tpool.workAvail);
+	pthread_cond_signal(&tpool.doneAvail);
+	pthread_mutex_unlock(&tpool.mut);
+	for(int i = 0 ; i < nWorkers ; ++i)
+		pthread_join(workers[i], NULL);
+	pthread_join(writer, NULL);
+
+done:
+	free(workers);
+	pthread_mutex_destroy(&tpool.mut);
+	pthread_cond_destroy(&tpool.workAvail);
+	pthread_cond_destroy(&tpool.doneAvail);
+	pthread_cond_destroy(&tpool.spaceAvail);
+}
+
 /* normalize input data
  */
 static void
 normalize(void)
 {
-	FILE *fp = stdin;
-	char *line = NULL;
+	struct lineReader rd;
+	const char *line;
+	size_t len;
 	struct json_object *json = NULL;
-	long long unsigned numParsed = 0;
-	long long unsigned numUnparsed = 0;
-	long long unsigned numWrongTag = 0;
 	char *mandatoryTagCstr = NULL;
 	int line_nbr = 0;	/* must be int to keep compatible with older json-c */
 	
 	if (mandatoryTag != NULL) {
 		mandatoryTagCstr = es_str2cstr(mandatoryTag, NULL);
 	}
+	if((outbuf = es_newStr(OUTBUF_FLUSH_SIZE + 1024)) == NULL) {
+		fprintf(stderr, "Couldn't allocate output buffer\n");
+		exit(1);
+	}
+	if(lineReaderInit(&rd, fileno(stdin)) != 0)
+		exit(1);
 
-	while((line = read_line(fp)) != NULL) {
-		++line_nbr;
-		if(verbose > 0) fprintf(stderr, "To normalize: '%s'\n", line);
-		ln_normalize(ctx, line, strlen(line), &json);
-		if(json != NULL) {
-			if(eventHasTag(json, mandatoryTagCstr)) {
-				struct json_object *dummy;
-				const int parsed = !json_object_object_get_ex(json,
-					"unparsed-data", &dummy);
-				if(parsed) {
-					numParsed++;
-					if(recOutput & OUTPUT_PARSED_RECS) {
-						outputEvent(json, line);
-					}
-				} else {
-					numUnparsed++;
-					amendLineNbr(json, line_nbr);
-					if(recOutput & OUTPUT_UNPARSED_RECS) {
-						outputEvent(json, line);
-					}
-				}
-			} else {
-				numWrongTag++;
-			}
-			json_object_put(json);
+	if(outfmt == f_spans) {
+		while((line = read_line(&rd, &len)) != NULL) {
+			checkReload();
+			normalizeToSpans(line, len);
+			if(inputMode == im_stream)
+				fflush(stdout);
+		}
+	} else if(outfmt == f_spanjson) {
+		while((line = read_line(&rd, &len)) != NULL) {
+			checkReload();
+			normalizeToSpanJSON(line, len);
+		}
+	} else if(nThreads > 1) {
+		normalizeThreaded(&rd, mandatoryTagCstr);
+	} else if(batchSize > 1) {
+		normalizeBatched(&rd, &line_nbr, mandatoryTagCstr);
+	} else {
+		while((line = read_line(&rd, &len)) != NULL) {
+			checkReload();
+			++line_nbr;
+			if(verbose > 0) fprintf(stderr, "To normalize: '%s'\n", line);
+			ln_normalize(ctx, line, len, &json);
+			handleEvent(json, line, line_nbr, mandatoryTagCstr);
 			json = NULL;
 		}
-        free(line);
 	}
-	if(outputNbrUnparsed && numUnparsed > 0)
-		fprintf(stderr, "%llu unparsable entries\n", numUnparsed);
-	if(numWrongTag > 0)
-		fprintf(stderr, "%llu entries with wrong tag dropped\n", numWrongTag);
+	writeOutput(outbuf);
+	fflush(stdout);
+	lineReaderExit(&rd);
+	if(outputNbrUnparsed && counters.unparsed > 0)
+		fprintf(stderr, "%llu unparsable entries\n", counters.unparsed);
+	if(counters.wrongTag > 0)
+		fprintf(stderr, "%llu entries with wrong tag dropped\n", counters.wrongTag);
 	if(outputSummaryLine) {
 		fprintf(stderr, "%llu records processed, %llu parsed, %llu unparsed\n",
-			numParsed+numUnparsed, numParsed, numUnparsed);
+			counters.parsed+counters.unparsed, counters.parsed, counters.unparsed);
 	}
 	free(mandatoryTagCstr);
+	es_deleteStr(outbuf);
 }
 
 
@@ -297,6 +928,19 @@ handle_generic_option(const char* opt) {
 		ln_setCtxOpts(ctx, LN_CTXOPT_ADD_RULE);
 	} else if (strcmp("addRuleLocation", opt) == 0) {
 		ln_setCtxOpts(ctx, LN_CTXOPT_ADD_RULE_LOCATION);
+	} else if (strcmp("threadSafe", opt) == 0) {
+		if(ln_setCtxOpts(ctx, LN_CTXOPT_THREADSAFE) != 0) {
+			fprintf(stderr, "-othreadSafe is not supported with advanced stats\n");
+			exit(1);
+		}
+	} else if (strcmp("profile", opt) == 0) {
+		ln_setCtxOpts(ctx, LN_CTXOPT_PROFILE);
+	} else if (strcmp("memoizeTypes", opt) == 0) {
+		ln_setCtxOpts(ctx, LN_CTXOPT_MEMOIZE_TYPES);
+	} else if (strcmp("prefilter", opt) == 0) {
+		ln_setCtxOpts(ctx, LN_CTXOPT_PREFILTER);
+	} else if (strcmp("compileV1", opt) == 0) {
+		ln_setCtxOpts(ctx, LN_CTXOPT_COMPILE_V1);
 	} else {
 		fprintf(stderr, "invalid -o option '%s'\n", opt);
 		exit(1);
@@ -307,20 +951,42 @@ static void usage(void)
 {
 fprintf(stderr,
 	"Options:\n"
-	"    -r<rulebase> Rulebase to use. This is required option\n"
+	"    -r<rulebase> Rulebase to use. This is required option (or -R)\n"
+	"    -R<compiled> Compiled rulebase to use instead of -r\n"
+	"    -c<compiled> Save compiled rulebase to file and exit\n"
 	"    -H           print summary line (nbr of msgs Handled)\n"
 	"    -U           print number of unparsed messages (only if non-zero)\n"
-	"    -e<json|xml|csv|cee-syslog|raw>\n"
+	"    -e<json|xml|csv|cee-syslog|raw|spans|span-json>\n"
 	"                 Change output format. By default, json is used\n"
 	"                 Raw is exactly like the input. It is useful in combination\n"
 	"                 with -p/-P options to extract known good/bad messages\n"
+	"                 Spans lists the fields found without building json\n"
+	"                 Span-json outputs these fields as json (faster, but\n"
+	"                 without tags, annotations and metadata)\n"
 	"    -E<format>   Encoder-specific format (used for CSV, read docs)\n"
 	"    -T           Include 'event.tags' in JSON format\n"
+	"    -b<n>        Normalize in batches of n messages\n"
+	"    -j<n>        Normalize with n worker threads (implies -othreadSafe)\n"
+	"    --input-mode=<auto|mmap|block|stream>\n"
+	"                 How to read input. auto (default) maps regular files\n"
+	"                 and uses block reads for everything else; stream\n"
+	"                 additionally outputs each record immediately\n"
+	"    -u           With -j, output records in completion order, not input order\n"
+	"    --budget=<calls>[,<depth>[,<usecs>]]\n"
+	"                 Limit work per message (parser calls, parse depth, time);\n"
+	"                 0 means unlimited. Messages exceeding it are unparsed\n"
+	"    --reoptimize=<n> Reorder parsers by observed matches every n messages\n"
+	"    --shape-cache=<n> Remember the parse path of up to n message shapes\n"
 	"    -oallowRegex Allow regexp matching (read docs about performance penalty)\n"
 	"    -oaddRule    Add a mockup of the matching rule.\n"
 	"    -oaddRuleLocation Add location of matching rule to metadata\n"
 	"    -oaddExecPath Add exec_path attribute to output\n"
 	"    -oaddOriginalMsg Always add original message to output, not just in error case\n"
+	"    -othreadSafe Use thread-safe normalization mode (no runtime node stats)\n"
+	"    -oprofile    Collect runtime profile (included in -s output)\n"
+	"    -omemoizeTypes Memoize user-defined type matches while backtracking\n"
+	"    -oprefilter  Skip rules whose literals are not in the message\n"
+	"    -ocompileV1  Process v1 rulebases with the v2 engine if possible\n"
 	"    -p           Print back only if the message has been parsed succesfully\n"
 	"    -P           Print back only if the message has NOT been parsed succesfully\n"
 	"    -L           Add source file line number information to unparsed line output\n"
@@ -340,6 +1006,8 @@ int main(int argc, char *argv[])
 {
 	int opt;
 	char *repository = NULL;
+	char *compiledRB = NULL;
+	char *compiledOut = NULL;
 	int ret = 0;
 	FILE *fpStats = NULL;
 	FILE *fpStatsDOT = NULL;
@@ -351,8 +1019,71 @@ int main(int argc, char *argv[])
 		goto exit;
 	}
 	
-	while((opt = getopt(argc, argv, "d:s:S:e:r:E:vVpPt:To:hHULx:")) != -1) {
+	static const struct option longopts[] = {
+		{ "input-mode", required_argument, NULL, 'I' },
+		{ "budget", required_argument, NULL, 'B' },
+		{ "reoptimize", required_argument, NULL, 'O' },
+		{ "shape-cache", required_argument, NULL, 'C' },
+		{ NULL, 0, NULL, 0 }
+	};
+	while((opt = getopt_long(argc, argv, "d:s:S:e:r:R:c:E:vVpPt:To:hHULx:b:j:u",
+			longopts, NULL)) != -1) {
 		switch (opt) {
+		case 'I':
+			if(!strcmp(optarg, "auto")) {
+				inputMode = im_auto;
+			} else if(!strcmp(optarg, "mmap")) {
+				inputMode = im_mmap;
+			} else if(!strcmp(optarg, "block")) {
+				inputMode = im_block;
+			} else if(!strcmp(optarg, "stream")) {
+				inputMode = im_stream;
+			} else {
+				complain("invalid --input-mode");
+				ret = 1;
+				goto exit;
+			}
+			break;
+		case 'B': {
+			unsigned budget[3] = { 0, 0, 0 };
+			char *p = optarg;
+			for(int i = 0 ; i < 3 && *p != '\0' ; ++i) {
+				budget[i] = strtoul(p, &p, 10);
+				if(*p == ',')
+					++p;
+				else if(*p != '\0')
+					break;
+			}
+			if(*p != '\0') {
+				complain("invalid --budget, must be <calls>[,<depth>[,<usecs>]]");
+				ret = 1;
+				goto exit;
+			}
+			ln_setNormalizeBudget(ctx, budget[0], budget[1], budget[2]);
+			break;
+			}
+		case 'O': {
+			char *p;
+			const unsigned long n = strtoul(optarg, &p, 10);
+			if(*optarg == '\0' || *p != '\0') {
+				complain("invalid --reoptimize, must be a number of messages");
+				ret = 1;
+				goto exit;
+			}
+			ln_setReoptimizeInterval(ctx, (unsigned) n);
+			break;
+			}
+		case 'C': {
+			char *p;
+			const unsigned long n = strtoul(optarg, &p, 10);
+			if(*optarg == '\0' || *p != '\0') {
+				complain("invalid --shape-cache, must be a number of entries");
+				ret = 1;
+				goto exit;
+			}
+			ln_setShapeCache(ctx, (unsigned) n);
+			break;
+			}
 		case 'V':
 			printVersion();
 			exit(1);
@@ -420,6 +1151,25 @@ int main(int argc, char *argv[])
 		case 'T':
 			flatTags = 1;
 			break;
+		case 'b':
+			batchSize = atoi(optarg);
+			if(batchSize < 1) {
+				complain("batch size must be 1 or larger");
+				ret = 1;
+				goto exit;
+			}
+			break;
+		case 'j':
+			nThreads = atoi(optarg);
+			if(nThreads < 1) {
+				complain("number of threads must be 1 or larger");
+				ret = 1;
+				goto exit;
+			}
+			break;
+		case 'u':
+			unorderedOutput = 1;
+			break;
 		case 'e': /* encoder to use */
 			if(!strcmp(optarg, "json")) {
 				outfmt = f_json;
@@ -431,11 +1181,21 @@ int main(int argc, char *argv[])
 				outfmt = f_csv;
 			} else if(!strcmp(optarg, "raw")) {
 				outfmt = f_raw;
+			} else if(!strcmp(optarg, "spans")) {
+				outfmt = f_spans;
+			} else if(!strcmp(optarg, "span-json")) {
+				outfmt = f_spanjson;
 			}
 			break;
 		case 'r': /* rule base to use */
 			repository = optarg;
 			break;
+		case 'R': /* compiled rule base to use */
+			compiledRB = optarg;
+			break;
+		case 'c': /* compile rule base */
+			compiledOut = optarg;
+			break;
 		case 't': /* if given, only messages tagged with the argument
 			     are output */
 			mandatoryTag = es_newStrFromCStr(optarg, strlen(optarg));
@@ -452,23 +1212,50 @@ int main(int argc, char *argv[])
 		}
 	}
 	
-	if(repository == NULL) {
-		complain("Samples repository must be given (-r)");
+	if((repository == NULL) == (compiledRB == NULL)) {
+		complain("Samples repository must be given (either -r or -R)");
 		ret = 1;
 		goto exit;
 	}
 
+	if(nThreads > 1) {
+		if(outfmt == f_spans || outfmt == f_spanjson) {
+			complain("-j can not be used with span output");
+			ret = 1;
+			goto exit;
+		}
+		if(ln_hasAdvancedStats()) {
+			complain("-j is not supported with advanced stats");
+			ret = 1;
+			goto exit;
+		}
+		ln_setCtxOpts(ctx, LN_CTXOPT_THREADSAFE);
+	}
+
 	ln_setErrMsgCB(ctx, errCallBack, NULL);
 	if(verbose) {
 		ln_setDebugCB(ctx, dbgCallBack, NULL);
 		ln_enableDebug(ctx, 1);
 	}
 
-	if(ln_loadSamples(ctx, repository)) {
+	if(compiledRB != NULL) {
+		if(ln_loadCompiledRulebase(ctx, compiledRB)) {
+			fprintf(stderr, "fatal error: cannot load compiled rulebase\n");
+			exit(1);
+		}
+	} else if(ln_loadSamples(ctx, repository)) {
 		fprintf(stderr, "fatal error: cannot load rulebase\n");
 		exit(1);
 	}
 
+	if(compiledOut != NULL) {
+		if(ln_saveCompiledRulebase(ctx, compiledOut)) {
+			fprintf(stderr, "fatal error: cannot save compiled rulebase\n");
+			ret = 1;
+		}
+		goto exit;
+	}
+
 	if(verbose > 0)
 		fprintf(stderr, "number of tree nodes: %d\n", ctx->nNodes);
 
@@ -480,6 +1267,14 @@ int main(int argc, char *argv[])
 
 	if(verbose > 2) ln_displayPDAG(ctx);
 
+	rulebaseFile = (compiledRB != NULL) ? compiledRB : repository;
+	rulebaseCompiled = (compiledRB != NULL);
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = hupHandler;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGHUP, &sa, NULL);
+
 	normalize();
 
 	if(fpStats != NULL) {
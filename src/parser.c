@@ -45,6 +45,13 @@
 #include <pcre.h>
 #include <errno.h>			
 #endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SSSE3_CHARSET_SCAN 1
+#include <tmmintrin.h>
+#endif
 
 
 /* some helpers */
@@ -66,6 +73,80 @@ hParseInt(const unsigned char **buf, size_t *lenBuf)
 	return i;
 }
 
+/* scan str from offset i for the first occurrence of character c.
+ * Returns the position found or len, if c does not occur. This maps
+ * to memchr(), which usually is vectorized by the C library.
+ */
+static inline size_t
+scanToChar(const char *const str, const size_t i, const size_t len, const char c)
+{
+	if(i >= len)
+		return len;
+	const char *const p = memchr(str + i, c, len - i);
+	return (p == NULL) ? len : (size_t) (p - str);
+}
+
+/* obtain the length of the common prefix of a and b, which are both
+ * at least n bytes long. On little-endian machines, this works a word
+ * at a time.
+ */
+static inline size_t
+commonPrefixLen(const char *const a, const char *const b, const size_t n)
+{
+	size_t j = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	for( ; j + 8 <= n ; j += 8) {
+		uint64_t wa, wb;
+		memcpy(&wa, a + j, 8);
+		memcpy(&wb, b + j, 8);
+		if(wa != wb)
+			return j + __builtin_ctzll(wa ^ wb) / 8;
+	}
+#endif
+	while(j < n && a[j] == b[j])
+		++j;
+	return j;
+}
+
+/* max number of terminators handled by the vectorized scanner */
+#define SCAN_SIMD_MAXCHARS 4
+/* scan str from offset i for the first occurrence of any of the
+ * nset characters in set. Returns the position found or len, if no
+ * such character occurs. For small sets, we process 16 bytes at a
+ * time if the platform supports it (SSE2 is always present on x86-64).
+ */
+static inline size_t
+scanToAnyOf(const char *const str, size_t i, const size_t len,
+	const char *const set, const size_t nset)
+{
+	if(nset == 1)
+		return scanToChar(str, i, len, set[0]);
+#ifdef __SSE2__
+	if(nset > 1 && nset <= SCAN_SIMD_MAXCHARS) {
+		__m128i term[SCAN_SIMD_MAXCHARS];
+		for(size_t k = 0 ; k < nset ; ++k)
+			term[k] = _mm_set1_epi8(set[k]);
+		while(i + 16 <= len) {
+			const __m128i blk = _mm_loadu_si128((const __m128i*) (str + i));
+			__m128i hit = _mm_cmpeq_epi8(blk, term[0]);
+			for(size_t k = 1 ; k < nset ; ++k)
+				hit = _mm_or_si128(hit, _mm_cmpeq_epi8(blk, term[k]));
+			const int mask = _mm_movemask_epi8(hit);
+			if(mask != 0)
+				return i + __builtin_ctz(mask);
+			i += 16;
+		}
+	}
+#endif
+	for( ; i < len ; ++i) {
+		for(size_t k = 0 ; k < nset ; ++k) {
+			if(str[i] == set[k])
+				return i;
+		}
+	}
+	return len;
+}
+
 /* parser _parse interface
  *
  * All parsers receive 
@@ -118,14 +199,6 @@ done:
 const char * ln_DataForDisplay##ParserName(__attribute__((unused)) ln_ctx ctx, void *const pdata)
 
 
-/* Return JSON parser config. This is primarily for comparison
- * of parser equalness.
- * @param[data] data parser data block
- * @return pointer to c string, NOT to be freed
- */
-#define PARSER_JsonConf(ParserName) \
-const char * ln_JsonConf##ParserName(__attribute__((unused)) ln_ctx ctx, void *const pdata)
-
 
 /* parser constructor
  * @param[in] json config json items
@@ -145,72 +218,213 @@ int ln_construct##ParserName( \
 #define PARSER_Destruct(ParserName) \
 void ln_destruct##ParserName(__attribute__((unused)) ln_ctx ctx, void *const pdata)
 
+/* memory used by the parser data block, including everything it owns
+ * except parse dags (see ln_getMemoryStats())
+ * @param[data] data parser data block
+ */
+#define PARSER_DataSize(ParserName) \
+size_t ln_dataSize##ParserName(__attribute__((unused)) void *const pdata)
+
+
+
+/* Fixed-layout matching for the date and time parsers. A layout
+ * describes 8 bytes: 'd' is a digit, '?' is any character and
+ * everything else must match exactly. LAYOUT8() turns a layout string
+ * into constant masks, so that the check is done with a single 64 bit
+ * load and a few mask operations. On success, *digits holds the digit
+ * values (see digitsAt()). The caller must ensure 8 bytes are available.
+ */
+struct layout8 {
+	uint64_t lit;		/**< characters that must match exactly */
+	uint64_t litMask;	/**< bytes of lit that must match */
+	uint64_t digMask;	/**< bytes that must be digits */
+};
+#define LAYOUT_ISLIT(l, k) ((l)[k] != 'd' && (l)[k] != '?')
+#define LAYOUT_LIT(l, k) ((uint64_t) (LAYOUT_ISLIT(l, k) ? (unsigned char) (l)[k] : 0) << (8 * (k)))
+#define LAYOUT_LITMASK(l, k) ((uint64_t) (LAYOUT_ISLIT(l, k) ? 0xff : 0) << (8 * (k)))
+#define LAYOUT_DIGMASK(l, k) ((uint64_t) ((l)[k] == 'd' ? 0xff : 0) << (8 * (k)))
+#define LAYOUT_ALL(m, l) (m(l, 0) | m(l, 1) | m(l, 2) | m(l, 3) \
+			| m(l, 4) | m(l, 5) | m(l, 6) | m(l, 7))
+#define LAYOUT8(l) ((const struct layout8) { LAYOUT_ALL(LAYOUT_LIT, l), \
+	LAYOUT_ALL(LAYOUT_LITMASK, l), LAYOUT_ALL(LAYOUT_DIGMASK, l) })
+
+static inline uint64_t
+load8(const char *const p)
+{
+	uint64_t v;
+	memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+static inline int
+matchLayout8(const char *const p, const struct layout8 layout, uint64_t *const digits)
+{
+	const uint64_t x = load8(p);
+	const uint64_t t = (x ^ 0x3030303030303030ull) & layout.digMask;
+	/* bit 7 of a byte is set if it does not hold a value 0..9 */
+	const uint64_t bad = ((t & 0x7f7f7f7f7f7f7f7full) + 0x7676767676767676ull) | t;
+	if(((x ^ layout.lit) & layout.litMask) != 0
+	   || (bad & layout.digMask & 0x8080808080808080ull) != 0)
+		return 0;
+	*digits = t;
+	return 1;
+}
+
+/* value of the two-digit number at byte k of a matchLayout8() result */
+static inline int
+digitsAt(const uint64_t digits, const int k)
+{
+	return ((digits >> (8 * k)) & 0xff) * 10 + ((digits >> (8 * (k + 1))) & 0xff);
+}
+
+/* check a "hh:mm:ss" matchLayout8() result */
+static inline int
+validHMS(const uint64_t digits, const int maxHour)
+{
+	return digitsAt(digits, 0) <= maxHour && digitsAt(digits, 3) <= 59 && digitsAt(digits, 6) <= 59;
+}
+
+#define MONTHKEY(a, b, c) (((uint32_t) (a) << 16) | ((uint32_t) (b) << 8) | (uint32_t) (c))
+/* number (1..12) of the three-letter month name at p, which is
+ * matched case-insensitively. 0 if there is no month name. p must
+ * have at least 3 bytes.
+ */
+static inline int
+monthFromName(const unsigned char *const p)
+{
+	static const uint32_t names[12] = {
+		MONTHKEY('j', 'a', 'n'), MONTHKEY('f', 'e', 'b'), MONTHKEY('m', 'a', 'r'),
+		MONTHKEY('a', 'p', 'r'), MONTHKEY('m', 'a', 'y'), MONTHKEY('j', 'u', 'n'),
+		MONTHKEY('j', 'u', 'l'), MONTHKEY('a', 'u', 'g'), MONTHKEY('s', 'e', 'p'),
+		MONTHKEY('o', 'c', 't'), MONTHKEY('n', 'o', 'v'), MONTHKEY('d', 'e', 'c') };
+	/* setting bit 5 lowercases letters and never makes a letter of
+	 * anything else.
+	 */
+	const uint32_t key = MONTHKEY(p[0] | 0x20, p[1] | 0x20, p[2] | 0x20);
+	for(int m = 0 ; m < 12 ; ++m) {
+		if(names[m] == key)
+			return m + 1;
+	}
+	return 0;
+}
+
+/* days since 1970-01-01 of a date in the proleptic Gregorian calendar */
+static int64_t
+daysFromCivil(int64_t year, const int month, const int day)
+{
+	year -= month <= 2;
+	const int64_t era = (year >= 0 ? year : year - 399) / 400;
+	const int64_t yoe = year - era * 400;
+	const int64_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
 
+/* value formats of the rfc5424 date parser. Parser data is only
+ * allocated for the non-string ones.
+ */
+enum dateFormat {
+	FMT_UNIX = 1,	/**< seconds since the epoch */
+	FMT_UNIX_NS	/**< nanoseconds since the epoch */
+};
+struct data_RFC5424Date {
+	enum dateFormat fmt;
+};
 
 /**
  * Parse a TIMESTAMP as specified in RFC5424 (subset of RFC3339).
  */
 PARSER_Parse(RFC5424Date)
+	const struct data_RFC5424Date *const data = (const struct data_RFC5424Date*) pdata;
 	const unsigned char *pszTS;
 	/* variables to temporarily hold time information while we parse */
-	__attribute__((unused)) int year;
+	int year;
 	int month;
 	int day;
 	int hour; /* 24 hour clock */
 	int minute;
 	int second;
-	__attribute__((unused)) int secfrac;	/* fractional seconds (must be 32 bit!) */
-	__attribute__((unused)) int secfracPrecision;
-	char OffsetHour;	/* UTC offset in hours */
-	int OffsetMinute;	/* UTC offset in minutes */
+	int64_t secfracNs = 0;	/* fractional seconds in nanoseconds */
+	int secfracPrecision = 0;
+	int OffsetHour = 0;	/* UTC offset in hours */
+	int OffsetMinute = 0;	/* UTC offset in minutes */
+	int OffsetSign = 0;
 	size_t len;
 	size_t orglen;
+	uint64_t d1, d2, d3;
 	/* end variables to temporarily hold time information while we parse */
 
 	pszTS = (unsigned char*) npb->str + *offs;
 	len = orglen = npb->strLen - *offs;
 
-	year = hParseInt(&pszTS, &len);
+	/* fast path for the usual layout "YYYY-MM-DDThh:mm:ss". Note that
+	 * the seconds must not be followed by another digit, else the
+	 * general path below yields a different result.
+	 */
+	if(   len >= 19
+	   && matchLayout8((const char*) pszTS, LAYOUT8("dddd-dd-"), &d1)
+	   && matchLayout8((const char*) pszTS + 8, LAYOUT8("ddTdd:dd"), &d2)
+	   && matchLayout8((const char*) pszTS + 11, LAYOUT8("dd:dd:dd"), &d3)
+	   && (len == 19 || !myisdigit(pszTS[19]))) {
+		year = digitsAt(d1, 0) * 100 + digitsAt(d1, 2);
+		month = digitsAt(d1, 5);
+		day = digitsAt(d2, 0);
+		hour = digitsAt(d3, 0);
+		minute = digitsAt(d3, 3);
+		second = digitsAt(d3, 6);
+		if(month < 1 || month > 12 || day < 1 || day > 31
+		   || hour > 23 || minute > 59 || second > 60)
+			goto done;
+		pszTS += 19;
+		len -= 19;
+	} else {
+		year = hParseInt(&pszTS, &len);
 
-	/* We take the liberty to accept slightly malformed timestamps e.g. in 
-	 * the format of 2003-9-1T1:0:0.  */
-	if(len == 0 || *pszTS++ != '-') goto done;
-	--len;
-	month = hParseInt(&pszTS, &len);
-	if(month < 1 || month > 12) goto done;
+		/* We take the liberty to accept slightly malformed timestamps e.g. in 
+		 * the format of 2003-9-1T1:0:0.  */
+		if(len == 0 || *pszTS++ != '-') goto done;
+		--len;
+		month = hParseInt(&pszTS, &len);
+		if(month < 1 || month > 12) goto done;
 
-	if(len == 0 || *pszTS++ != '-')
-		goto done;
-	--len;
-	day = hParseInt(&pszTS, &len);
-	if(day < 1 || day > 31) goto done;
+		if(len == 0 || *pszTS++ != '-')
+			goto done;
+		--len;
+		day = hParseInt(&pszTS, &len);
+		if(day < 1 || day > 31) goto done;
 
-	if(len == 0 || *pszTS++ != 'T') goto done;
-	--len;
+		if(len == 0 || *pszTS++ != 'T') goto done;
+		--len;
 
-	hour = hParseInt(&pszTS, &len);
-	if(hour < 0 || hour > 23) goto done;
+		hour = hParseInt(&pszTS, &len);
+		if(hour < 0 || hour > 23) goto done;
 
-	if(len == 0 || *pszTS++ != ':')
-		goto done;
-	--len;
-	minute = hParseInt(&pszTS, &len);
-	if(minute < 0 || minute > 59) goto done;
+		if(len == 0 || *pszTS++ != ':')
+			goto done;
+		--len;
+		minute = hParseInt(&pszTS, &len);
+		if(minute < 0 || minute > 59) goto done;
 
-	if(len == 0 || *pszTS++ != ':') goto done;
-	--len;
-	second = hParseInt(&pszTS, &len);
-	if(second < 0 || second > 60) goto done;
+		if(len == 0 || *pszTS++ != ':') goto done;
+		--len;
+		second = hParseInt(&pszTS, &len);
+		if(second < 0 || second > 60) goto done;
+	}
 
 	/* Now let's see if we have secfrac */
 	if(len > 0 && *pszTS == '.') {
 		--len;
-		const unsigned char *pszStart = ++pszTS;
-		secfrac = hParseInt(&pszTS, &len);
-		secfracPrecision = (int) (pszTS - pszStart);
-	} else {
-		secfracPrecision = 0;
-		secfrac = 0;
+		++pszTS;
+		for( ; len > 0 && myisdigit(*pszTS) ; --len, ++pszTS) {
+			if(secfracPrecision++ < 9)
+				secfracNs = secfracNs * 10 + *pszTS - '0';
+		}
+		for(int j = secfracPrecision ; j < 9 ; ++j)
+			secfracNs *= 10;
 	}
 
 	/* check the timezone */
@@ -220,10 +434,11 @@ PARSER_Parse(RFC5424Date)
 		--len;
 		pszTS++; /* eat Z */
 	} else if((*pszTS == '+') || (*pszTS == '-')) {
+		OffsetSign = (*pszTS == '+') ? 1 : -1;
 		--len;
 		pszTS++;
 
-		OffsetHour = hParseInt(&pszTS, &len);
+		OffsetHour = (char) hParseInt(&pszTS, &len);
 		if(OffsetHour < 0 || OffsetHour > 23)
 			goto done;
 
@@ -243,17 +458,81 @@ PARSER_Parse(RFC5424Date)
 			goto done;
 	}
 
+	int64_t secs = 0;
+	if(data != NULL) {
+		secs = daysFromCivil(year, month, day) * 86400
+			+ hour * 3600 + minute * 60 + second
+			- OffsetSign * (OffsetHour * 3600 + OffsetMinute * 60);
+		/* nanoseconds cover the years 1678 to 2262 only */
+		if(data->fmt == FMT_UNIX_NS && (secs < -INT64_MAX / 1000000000 + 1
+						|| secs > INT64_MAX / 1000000000 - 1))
+			goto done;
+	}
+
 	/* we had success, so update parse pointer */
 	*parsed = orglen - len;
 
 	if(value != NULL) {
-		*value = json_object_new_string_len(npb->str+(*offs), *parsed);
+		if(data != NULL) {
+			*value = json_object_new_int64((data->fmt == FMT_UNIX) ? secs
+				: secs * 1000000000 + secfracNs);
+		} else {
+			*value = json_object_new_string_len(npb->str+(*offs), *parsed);
+		}
 	}
 
 	r = 0; /* success */
 done:
 	return r;
 }
+PARSER_Construct(RFC5424Date)
+{
+	int r = 0;
+	enum dateFormat fmt = 0;
+
+	*pdata = NULL;
+	if(json == NULL)
+		goto done;
+
+	struct json_object_iterator it = json_object_iter_begin(json);
+	struct json_object_iterator itEnd = json_object_iter_end(json);
+	while (!json_object_iter_equal(&it, &itEnd)) {
+		const char *key = json_object_iter_peek_name(&it);
+		struct json_object *const val = json_object_iter_peek_value(&it);
+		if(!strcmp(key, "format")) {
+			const char *const str = json_object_get_string(val);
+			if(str != NULL && !strcmp(str, "timestamp-unix")) {
+				fmt = FMT_UNIX;
+			} else if(str != NULL && !strcmp(str, "timestamp-unix-ns")) {
+				fmt = FMT_UNIX_NS;
+			} else if(str == NULL || strcmp(str, "string")) {
+				ln_errprintf(ctx, 0, "invalid format for date-rfc5424: %s",
+					 json_object_to_json_string(val));
+			}
+		} else {
+			ln_errprintf(ctx, 0, "invalid param for date-rfc5424: %s",
+				 json_object_to_json_string(val));
+		}
+		json_object_iter_next(&it);
+	}
+
+	if(fmt != 0) {
+		struct data_RFC5424Date *const data = calloc(1, sizeof(struct data_RFC5424Date));
+		CHKN(data);
+		data->fmt = fmt;
+		*pdata = data;
+	}
+done:
+	return r;
+}
+PARSER_Destruct(RFC5424Date)
+{
+	free(pdata);
+}
+PARSER_DataSize(RFC5424Date)
+{
+	return sizeof(struct data_RFC5424Date);
+}
 
 
 /**
@@ -271,147 +550,33 @@ PARSER_Parse(RFC3164Date)
 	int hour; /* 24 hour clock */
 	int minute;
 	int second;
+	uint64_t d;
 
 	p = (unsigned char*) npb->str + *offs;
 	orglen = len = npb->strLen - *offs;
-	/* If we look at the month (Jan, Feb, Mar, Apr, May, Jun, Jul, Aug, Sep, Oct, Nov, Dec),
-	 * we may see the following character sequences occur:
-	 *
-	 * J(an/u(n/l)), Feb, Ma(r/y), A(pr/ug), Sep, Oct, Nov, Dec
-	 *
-	 * We will use this for parsing, as it probably is the
-	 * fastest way to parse it.
-	 */
-	if(len < 3)
-		goto done;
-
-	switch(*p++)
-	{
-	case 'j':
-	case 'J':
-		if(*p == 'a' || *p == 'A') {
-			++p;
-			if(*p == 'n' || *p == 'N') {
-				++p;
-				month = 1;
-			} else
-				goto done;
-		} else if(*p == 'u' || *p == 'U') {
-			++p;
-			if(*p == 'n' || *p == 'N') {
-				++p;
-				month = 6;
-			} else if(*p == 'l' || *p == 'L') {
-				++p;
-				month = 7;
-			} else
-				goto done;
-		} else
-			goto done;
-		break;
-	case 'f':
-	case 'F':
-		if(*p == 'e' || *p == 'E') {
-			++p;
-			if(*p == 'b' || *p == 'B') {
-				++p;
-				month = 2;
-			} else
-				goto done;
-		} else
-			goto done;
-		break;
-	case 'm':
-	case 'M':
-		if(*p == 'a' || *p == 'A') {
-			++p;
-			if(*p == 'r' || *p == 'R') {
-				++p;
-				month = 3;
-			} else if(*p == 'y' || *p == 'Y') {
-				++p;
-				month = 5;
-			} else
-				goto done;
-		} else
-			goto done;
-		break;
-	case 'a':
-	case 'A':
-		if(*p == 'p' || *p == 'P') {
-			++p;
-			if(*p == 'r' || *p == 'R') {
-				++p;
-				month = 4;
-			} else
-				goto done;
-		} else if(*p == 'u' || *p == 'U') {
-			++p;
-			if(*p == 'g' || *p == 'G') {
-				++p;
-				month = 8;
-			} else
-				goto done;
-		} else
-			goto done;
-		break;
-	case 's':
-	case 'S':
-		if(*p == 'e' || *p == 'E') {
-			++p;
-			if(*p == 'p' || *p == 'P') {
-				++p;
-				month = 9;
-			} else
-				goto done;
-		} else
-			goto done;
-		break;
-	case 'o':
-	case 'O':
-		if(*p == 'c' || *p == 'C') {
-			++p;
-			if(*p == 't' || *p == 'T') {
-				++p;
-				month = 10;
-			} else
-				goto done;
-		} else
-			goto done;
-		break;
-	case 'n':
-	case 'N':
-		if(*p == 'o' || *p == 'O') {
-
-			++p;
-			if(*p == 'v' || *p == 'V') {
-				++p;
-				month = 11;
-			} else
-				goto done;
-		} else
-			goto done;
-		break;
-	case 'd':
-	case 'D':
-		if(*p == 'e' || *p == 'E') {
-			++p;
-			if(*p == 'c' || *p == 'C') {
-				++p;
-				month = 12;
-			} else
-				goto done;
-		} else
-			goto done;
-		break;
-	default:
+	if(len < 3 || (month = monthFromName(p)) == 0)
 		goto done;
-	}
-
+	p += 3;
 	len -= 3;
 	
 	/* done month */
 
+	/* fast path for the usual layout " dd hh:mm:ss" (the day may also
+	 * be " d"). Again, the seconds must not be followed by a digit.
+	 */
+	if(   len >= 12
+	   && p[0] == ' ' && (p[1] == ' ' || myisdigit(p[1])) && myisdigit(p[2]) && p[3] == ' '
+	   && matchLayout8((const char*) p + 4, LAYOUT8("dd:dd:dd"), &d)
+	   && (len == 12 || !myisdigit(p[12]))) {
+		day = (p[1] == ' ') ? p[2] - '0' : (p[1] - '0') * 10 + p[2] - '0';
+		if(day < 1 || day > 31 || digitsAt(d, 0) > 23 || digitsAt(d, 3) > 59
+		   || digitsAt(d, 6) > 60)
+			goto done;
+		p += 12;
+		len -= 12;
+		goto time_done;
+	}
+
 	if(len == 0 || *p++ != ' ')
 		goto done;
 	--len;
@@ -463,6 +628,7 @@ PARSER_Parse(RFC3164Date)
 	if(second < 0 || second > 60)
 		goto done;
 
+time_done:
 	/* we provide support for an extra ":" after the date. While this is an
 	 * invalid format, it occurs frequently enough (e.g. with Cisco devices)
 	 * to permit it as a valid case. -- rgerhards, 2008-09-12
@@ -636,6 +802,10 @@ PARSER_Destruct(HexNumber)
 {
 	free(pdata);
 }
+PARSER_DataSize(HexNumber)
+{
+	return sizeof(struct data_HexNumber);
+}
 
 
 /**
@@ -651,6 +821,7 @@ PARSER_Destruct(HexNumber)
 PARSER_Parse(KernelTimestamp)
 	const char *c;
 	size_t i;
+	uint64_t d;
 
 	assert(npb->str != NULL);
 	assert(offs != NULL);
@@ -659,33 +830,15 @@ PARSER_Parse(KernelTimestamp)
 
 	i = *offs;
 	if(c[i] != '[' || i+LEN_KERNEL_TIMESTAMP > npb->strLen
-	   || !myisdigit(c[i+1])
-	   || !myisdigit(c[i+2])
-	   || !myisdigit(c[i+3])
-	   || !myisdigit(c[i+4])
-	   || !myisdigit(c[i+5])
-	   )
+	   || !matchLayout8(c + i, LAYOUT8("[ddddd??"), &d))
 		goto done;
 	i += 6;
 	for(int j = 0 ; j < 7 && i < npb->strLen && myisdigit(c[i]) ; )
 		++i, ++j;	/* just scan */
 
-	if(i >= npb->strLen || c[i] != '.')
-		goto done;
-
-	++i; /* skip over '.' */
-
-	if( i+7 > npb->strLen
-	   || !myisdigit(c[i+0])
-	   || !myisdigit(c[i+1])
-	   || !myisdigit(c[i+2])
-	   || !myisdigit(c[i+3])
-	   || !myisdigit(c[i+4])
-	   || !myisdigit(c[i+5])
-	   || c[i+6] != ']'
-	   )
+	if(i + 8 > npb->strLen || !matchLayout8(c + i, LAYOUT8(".dddddd]"), &d))
 		goto done;
-	i += 7;
+	i += 8;
 
 	/* success, persist */
 	*parsed = i - *offs;
@@ -747,8 +900,7 @@ PARSER_Parse(Word)
 	i = *offs;
 
 	/* search end of word */
-	while(i < npb->strLen && c[i] != ' ') 
-		i++;
+	i = scanToChar(c, i, npb->strLen, ' ');
 
 	if(i == *offs)
 		goto done;
@@ -774,8 +926,7 @@ struct data_StringTo {
  */
 PARSER_Parse(StringTo)
 	const char *c;
-	size_t i, j, m;
-	int chkstr;
+	size_t i;
 	struct data_StringTo *const data = (struct data_StringTo*) pdata;
 	const char *const toFind = data->toFind;
 	assert(npb->str != NULL);
@@ -783,28 +934,18 @@ PARSER_Parse(StringTo)
 	assert(parsed != NULL);
 	c = npb->str;
 	i = *offs;
-	chkstr = 0;
-
-	/* Total hunt for letter */
-	while(chkstr == 0 && i < npb->strLen ) {
-	    i++;
-	    if(c[i] == toFind[0]) {
-		/* Found the first letter, now find the rest of the string */
-		j = 1;
-		m = i+1;
-		while(m < npb->strLen && j < data->len ) {
-			if(c[m] != toFind[j])
-				break;
-			if(j == data->len - 1) { /* full match? */
-				chkstr = 1;
-				break;
-			}
-			j++;
-			m++;
-		}
-	    }
+
+	if(data->len == 0)
+		goto done;
+	/* Total hunt for letter, the field must not be empty */
+	for(i = scanToChar(c, i + 1, npb->strLen, toFind[0])
+	    ; i + data->len <= npb->strLen
+	    ; i = scanToChar(c, i + 1, npb->strLen, toFind[0])) {
+		/* Found the first letter, now check the rest of the string */
+		if(!memcmp(c + i + 1, toFind + 1, data->len - 1))
+			break;
 	}
-	if(i == *offs || i == npb->strLen || chkstr != 1)
+	if(i + data->len > npb->strLen)
 		goto done;
 
 	/* success, persist */
@@ -843,6 +984,11 @@ PARSER_Destruct(StringTo)
 	free((void*)data->toFind);
 	free(pdata);
 }
+PARSER_DataSize(StringTo)
+{
+	struct data_StringTo *data = (struct data_StringTo*) pdata;
+	return sizeof(struct data_StringTo) + data->len + 1;
+}
 
 /**
  * Parse a alphabetic word.
@@ -902,19 +1048,9 @@ PARSER_Parse(CharTo)
 	i = *offs;
 
 	/* search end of word */
-	int found = 0;
-	while(i < npb->strLen && !found) {
-		for(size_t j = 0 ; j < data->n_term_chars ; ++j) {
-			if(npb->str[i] == data->term_chars[j]) {
-				found = 1;
-				break;
-			}
-		}
-		if(!found)
-			++i;
-	}
+	i = scanToAnyOf(npb->str, i, npb->strLen, data->term_chars, data->n_term_chars);
 
-	if(i == *offs || i == npb->strLen || !found)
+	if(i == *offs || i == npb->strLen)
 		goto done;
 
 	/* success, persist */
@@ -968,30 +1104,30 @@ PARSER_Destruct(CharTo)
 	free(data->term_chars);
 	free(pdata);
 }
+PARSER_DataSize(CharTo)
+{
+	struct data_CharTo *const data = (struct data_CharTo*) pdata;
+	size_t size = sizeof(struct data_CharTo) + data->n_term_chars + 1;
+	if(data->data_for_display != NULL)
+		size += 8 + data->n_term_chars + 2;
+	return size;
+}
 
 
 
-struct data_Literal {
-	const char *lit;
-	const char *json_conf;
-};
 /**
  * Parse a specific literal.
+ * Note: single-character literals are usually handled inline by the
+ * normalizer and do not reach this function.
  */
 PARSER_Parse(Literal)
 	struct data_Literal *const data = (struct data_Literal*) pdata;
-	const char *const lit = data->lit;
-	size_t i = *offs;
-	size_t j;
-
-	for(j = 0 ; i < npb->strLen ; ++j) {
-		if(lit[j] != npb->str[i])
-			break;
-		++i;
-	}
+	const size_t avail = npb->strLen - *offs;
+	const size_t j = commonPrefixLen(data->lit, npb->str + *offs,
+		(data->len < avail) ? data->len : avail);
 
 	*parsed = j; /* we must always return how far we parsed! */
-	if(lit[j] == '\0') {
+	if(j == data->len) {
 		if(value != NULL) {
 			*value = json_object_new_string_len(npb->str+(*offs), *parsed);
 		}
@@ -1004,11 +1140,6 @@ PARSER_DataForDisplay(Literal)
 	struct data_Literal *data = (struct data_Literal*) pdata;
 	return data->lit;
 }
-PARSER_JsonConf(Literal)
-{
-	struct data_Literal *data = (struct data_Literal*) pdata;
-	return data->json_conf;
-}
 PARSER_Construct(Literal)
 {
 	int r = 0;
@@ -1021,7 +1152,7 @@ PARSER_Construct(Literal)
 		goto done;
 	}
 	data->lit = strdup(json_object_get_string(text));
-	data->json_conf = strdup(json_object_to_json_string(json));
+	data->len = strlen(data->lit);
 
 	*pdata = data;
 done:
@@ -1033,9 +1164,13 @@ PARSER_Destruct(Literal)
 {
 	struct data_Literal *data = (struct data_Literal*) pdata;
 	free((void*)data->lit);
-	free((void*)data->json_conf);
 	free(pdata);
 }
+PARSER_DataSize(Literal)
+{
+	struct data_Literal *data = (struct data_Literal*) pdata;
+	return sizeof(struct data_Literal) + data->len + 1;
+}
 /* for path compaction, we need a special handler to combine two
  * literal data elements.
  */
@@ -1045,12 +1180,11 @@ ln_combineData_Literal(void *const porg, void *const padd)
 	struct data_Literal *const __restrict__ org = porg;
 	struct data_Literal *const __restrict__ add = padd;
 	int r = 0;
-	const size_t len = strlen(org->lit);
-	const size_t add_len = strlen(add->lit);
-	char *const newlit = (char*)realloc((void*)org->lit, len+add_len+1);
+	char *const newlit = (char*)realloc((void*)org->lit, org->len+add->len+1);
 	CHKN(newlit);
 	org->lit = newlit;
-	memcpy((char*)org->lit+len, add->lit, add_len+1);
+	memcpy((char*)org->lit+org->len, add->lit, add->len+1);
+	org->len += add->len;
 done:	return r;
 }
 
@@ -1076,17 +1210,7 @@ PARSER_Parse(CharSeparated)
 	i = *offs;
 
 	/* search end of word */
-	int found = 0;
-	while(i < npb->strLen && !found) {
-		for(size_t j = 0 ; j < data->n_term_chars ; ++j) {
-			if(npb->str[i] == data->term_chars[j]) {
-				found = 1;
-				break;
-			}
-		}
-		if(!found)
-			++i;
-	}
+	i = scanToAnyOf(npb->str, i, npb->strLen, data->term_chars, data->n_term_chars);
 
 	/* success, persist */
 	*parsed = i - *offs;
@@ -1122,6 +1246,11 @@ PARSER_Destruct(CharSeparated)
 	free(data->term_chars);
 	free(pdata);
 }
+PARSER_DataSize(CharSeparated)
+{
+	struct data_CharSeparated *const data = (struct data_CharSeparated*) pdata;
+	return sizeof(struct data_CharSeparated) + data->n_term_chars + 1;
+}
 
 
 /**
@@ -1162,8 +1291,7 @@ PARSER_Parse(OpQuotedString)
 	i = *offs;
 
 	if(c[i] != '"') {
-		while(i < npb->strLen && c[i] != ' ') 
-			i++;
+		i = scanToChar(c, i, npb->strLen, ' ');
 
 		if(i == *offs)
 			goto done;
@@ -1176,8 +1304,7 @@ PARSER_Parse(OpQuotedString)
 	    ++i;
 
 	    /* search end of string */
-	    while(i < npb->strLen && c[i] != '"') 
-		    i++;
+	    i = scanToChar(c, i, npb->strLen, '"');
 
 	    if(i == npb->strLen || c[i] != '"')
 		    goto done;
@@ -1219,8 +1346,7 @@ PARSER_Parse(QuotedString)
 	++i;
 
 	/* search end of string */
-	while(i < npb->strLen && c[i] != '"') 
-		i++;
+	i = scanToChar(c, i, npb->strLen, '"');
 
 	if(i == npb->strLen || c[i] != '"')
 		goto done;
@@ -1244,42 +1370,22 @@ done:
  */
 PARSER_Parse(ISODate)
 	const char *c;
-	size_t i;
+	uint64_t d;
 
 	assert(npb->str != NULL);
 	assert(offs != NULL);
 	assert(parsed != NULL);
-	c = npb->str;
-	i = *offs;
+	c = npb->str + *offs;
 
 	if(*offs+10 > npb->strLen)
 		goto done;	/* if it is not 10 chars, it can't be an ISO date */
 
-	/* year */
-	if(!myisdigit(c[i])) goto done;
-	if(!myisdigit(c[i+1])) goto done;
-	if(!myisdigit(c[i+2])) goto done;
-	if(!myisdigit(c[i+3])) goto done;
-	if(c[i+4] != '-') goto done;
-	/* month */
-	if(c[i+5] == '0') {
-		if(c[i+6] < '1' || c[i+6] > '9') goto done;
-	} else if(c[i+5] == '1') {
-		if(c[i+6] < '0' || c[i+6] > '2') goto done;
-	} else {
+	if(!matchLayout8(c, LAYOUT8("dddd-dd-"), &d) || !myisdigit(c[8]) || !myisdigit(c[9]))
 		goto done;
-	}
-	if(c[i+7] != '-') goto done;
-	/* day */
-	if(c[i+8] == '0') {
-		if(c[i+9] < '1' || c[i+9] > '9') goto done;
-	} else if(c[i+8] == '1' || c[i+8] == '2') {
-		if(!myisdigit(c[i+9])) goto done;
-	} else if(c[i+8] == '3') {
-		if(c[i+9] != '0' && c[i+9] != '1') goto done;
-	} else {
+	const int month = digitsAt(d, 5);
+	const int day = (c[8] - '0') * 10 + c[9] - '0';
+	if(month < 1 || month > 12 || day < 1 || day > 31)
 		goto done;
-	}
 
 	/* success, persist */
 	*parsed = 10;
@@ -1485,37 +1591,18 @@ done:
 
 /**
  * Parse a timestamp in 24hr format (exactly HH:MM:SS).
- * Note: we do manual loop unrolling -- this is fast AND efficient.
- * rgerhards, 2011-01-14
  */
 PARSER_Parse(Time24hr)
-	const char *c;
-	size_t i;
+	uint64_t d;
 
 	assert(npb->str != NULL);
 	assert(offs != NULL);
 	assert(parsed != NULL);
-	c = npb->str;
-	i = *offs;
 
 	if(*offs+8 > npb->strLen)
 		goto done;	/* if it is not 8 chars, it can't be us */
-
-	/* hour */
-	if(c[i] == '0' || c[i] == '1') {
-		if(!myisdigit(c[i+1])) goto done;
-	} else if(c[i] == '2') {
-		if(c[i+1] < '0' || c[i+1] > '3') goto done;
-	} else {
+	if(!matchLayout8(npb->str + *offs, LAYOUT8("dd:dd:dd"), &d) || !validHMS(d, 23))
 		goto done;
-	}
-	/* TODO: the code below is a duplicate of 24hr parser - create common function */
-	if(c[i+2] != ':') goto done;
-	if(c[i+3] < '0' || c[i+3] > '5') goto done;
-	if(!myisdigit(c[i+4])) goto done;
-	if(c[i+5] != ':') goto done;
-	if(c[i+6] < '0' || c[i+6] > '5') goto done;
-	if(!myisdigit(c[i+7])) goto done;
 
 	/* success, persist */
 	*parsed = 8;
@@ -1529,37 +1616,18 @@ done:
 
 /**
  * Parse a timestamp in 12hr format (exactly HH:MM:SS).
- * Note: we do manual loop unrolling -- this is fast AND efficient.
- * TODO: the code below is a duplicate of 24hr parser - create common function?
- * rgerhards, 2011-01-14
  */
 PARSER_Parse(Time12hr)
-	const char *c;
-	size_t i;
+	uint64_t d;
 
 	assert(npb->str != NULL);
 	assert(offs != NULL);
 	assert(parsed != NULL);
-	c = npb->str;
-	i = *offs;
 
 	if(*offs+8 > npb->strLen)
 		goto done;	/* if it is not 8 chars, it can't be us */
-
-	/* hour */
-	if(c[i] == '0') {
-		if(!myisdigit(c[i+1])) goto done;
-	} else if(c[i] == '1') {
-		if(c[i+1] < '0' || c[i+1] > '2') goto done;
-	} else {
+	if(!matchLayout8(npb->str + *offs, LAYOUT8("dd:dd:dd"), &d) || !validHMS(d, 12))
 		goto done;
-	}
-	if(c[i+2] != ':') goto done;
-	if(c[i+3] < '0' || c[i+3] > '5') goto done;
-	if(!myisdigit(c[i+4])) goto done;
-	if(c[i+5] != ':') goto done;
-	if(c[i+6] < '0' || c[i+6] > '5') goto done;
-	if(!myisdigit(c[i+7])) goto done;
 
 	/* success, persist */
 	*parsed = 8;
@@ -1572,99 +1640,223 @@ done:
 }
 
 
-/* helper to IPv4 address parser, checks the next set of numbers.
- * Syntax 1 to 3 digits, value together not larger than 255.
- * @param[in] npb->str parse buffer
- * @param[in/out] offs offset into buffer, updated if successful
- * @return 0 if OK, 1 otherwise
+/* character class bit masks for a window of up to 64 bytes of the
+ * message. Bit n describes byte n of the window. Bytes beyond the end
+ * of the window are in no class.
  */
-static int
-chkIPv4AddrByte(npb_t *const npb, size_t *offs)
-{
-	int val = 0;
-	int r = 1;	/* default: done -- simplifies things */
-	const char *c;
-	size_t i = *offs;
+struct charmask {
+	uint64_t digit;
+	uint64_t hex;
+	uint64_t dot;
+	uint64_t colon;
+	uint64_t dash;
+	uint64_t space;
+};
 
-	c = npb->str;
-	if(i == npb->strLen || !myisdigit(c[i]))
-		goto done;
-	val = c[i++] - '0';
-	if(i < npb->strLen && myisdigit(c[i])) {
-		val = val * 10 + c[i++] - '0';
-		if(i < npb->strLen && myisdigit(c[i]))
-			val = val * 10 + c[i++] - '0';
-	}
-	if(val > 255)	/* cannot be a valid IP address byte! */
-		goto done;
+#ifdef __SSE2__
+/* mask of bytes b with lo <= b <= lo + n */
+static inline uint64_t
+inRange16(const __m128i blk, const char lo, const char n)
+{
+	const __m128i d = _mm_sub_epi8(blk, _mm_set1_epi8(lo));
+	return (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(n)), d));
+}
 
-	*offs = i;
-	r = 0;
-done:
-	return r;
+static inline uint64_t
+isChar16(const __m128i blk, const char c)
+{
+	return (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(blk, _mm_set1_epi8(c)));
 }
+#endif
 
-/**
- * Parser for IPv4 addresses.
+/* classify the len (max 64) bytes at str. If the platform supports it,
+ * this is done 16 bytes at a time, so the address parsers can check
+ * their motif with a few mask operations instead of char by char.
  */
-PARSER_Parse(IPv4)
-	const char *c;
-	size_t i;
-
+static inline void
+classifyWindow(const char *const str, const size_t len, struct charmask *const m)
+{
+	memset(m, 0, sizeof(*m));
+#ifdef __SSE2__
+	for(size_t j = 0 ; j < len ; j += 16) {
+		__m128i blk;
+		if(j + 16 <= len) {
+			blk = _mm_loadu_si128((const __m128i*) (str + j));
+		} else {
+			char tail[16] = { 0 };
+			memcpy(tail, str + j, len - j);
+			blk = _mm_loadu_si128((const __m128i*) tail);
+		}
+		const uint64_t digit = inRange16(blk, '0', 9);
+		m->digit |= digit << j;
+		m->hex |= (digit | inRange16(_mm_or_si128(blk, _mm_set1_epi8(0x20)), 'a', 5)) << j;
+		m->dot |= isChar16(blk, '.') << j;
+		m->colon |= isChar16(blk, ':') << j;
+		m->dash |= isChar16(blk, '-') << j;
+		m->space |= (isChar16(blk, ' ') | inRange16(blk, '\t', '\r' - '\t')) << j;
+	}
+#else
+	for(size_t j = 0 ; j < len ; ++j) {
+		const uint64_t bit = (uint64_t) 1 << j;
+		const unsigned char c = str[j];
+		if(myisdigit(c))
+			m->digit |= bit;
+		if(isxdigit(c))
+			m->hex |= bit;
+		if(c == '.')
+			m->dot |= bit;
+		else if(c == ':')
+			m->colon |= bit;
+		else if(c == '-')
+			m->dash |= bit;
+		else if(isspace(c))
+			m->space |= bit;
+	}
+#endif
+}
+
+/* length of the run of bytes in class mask starting at pos */
+static inline size_t
+runLen(const uint64_t mask, const size_t pos)
+{
+	return __builtin_ctzll(~(mask >> pos));
+}
+
+static inline unsigned
+hexval(const char c)
+{
+	return (c <= '9') ? (unsigned) (c - '0') : (unsigned) ((c | 0x20) - 'a' + 10);
+}
+
+
+/* The address parsers can return the address as a number instead of
+ * its textual form ("format":"number"). Parser data is only allocated
+ * in that case, so NULL means the value is the matched text.
+ */
+struct data_Address {
+	int fmtNumber;
+};
+static int
+constructAddress(ln_ctx ctx, json_object *const json, void **pdata, const char *const type)
+{
+	int r = 0;
+	int fmtNumber = 0;
+
+	*pdata = NULL;
+	if(json == NULL)
+		goto done;
+
+	struct json_object_iterator it = json_object_iter_begin(json);
+	struct json_object_iterator itEnd = json_object_iter_end(json);
+	while (!json_object_iter_equal(&it, &itEnd)) {
+		const char *key = json_object_iter_peek_name(&it);
+		struct json_object *const val = json_object_iter_peek_value(&it);
+		if(!strcmp(key, "format")) {
+			const char *const fmt = json_object_get_string(val);
+			if(fmt != NULL && !strcmp(fmt, "number")) {
+				fmtNumber = 1;
+			} else if(fmt == NULL || strcmp(fmt, "string")) {
+				ln_errprintf(ctx, 0, "invalid format for %s: %s", type,
+					 json_object_to_json_string(val));
+			}
+		} else {
+			ln_errprintf(ctx, 0, "invalid param for %s: %s", type,
+				 json_object_to_json_string(val));
+		}
+		json_object_iter_next(&it);
+	}
+
+	if(fmtNumber) {
+		struct data_Address *const data = calloc(1, sizeof(struct data_Address));
+		CHKN(data);
+		data->fmtNumber = 1;
+		*pdata = data;
+	}
+done:
+	return r;
+}
+
+/**
+ * Parser for IPv4 addresses.
+ * Each of the four bytes is 1 to 3 digits, with a value not larger
+ * than 255. The window holding the longest possible address is
+ * classified at once, so most non-addresses are rejected without
+ * looking at the individual characters.
+ */
+PARSER_Parse(IPv4)
+	const struct data_Address *const data = (const struct data_Address*) pdata;
+	struct charmask m;
+	uint32_t addr = 0;
+	size_t pos = 0;
+
 	assert(npb->str != NULL);
 	assert(offs != NULL);
 	assert(parsed != NULL);
-	i = *offs;
-	if(i + 7 > npb->strLen) {
+	if(*offs + 7 > npb->strLen) {
 		/* IPv4 addr requires at least 7 characters */
 		goto done;
 	}
-	c = npb->str;
+	const char *const c = npb->str + *offs;
+	const size_t rem = npb->strLen - *offs;
+	classifyWindow(c, (rem < 16) ? rem : 16, &m);
+	if(!(m.digit & 1) || __builtin_popcountll(m.dot) < 3)
+		goto done;
 
-	/* byte 1*/
-	if(chkIPv4AddrByte(npb, &i) != 0) goto done;
-	if(i == npb->strLen || c[i++] != '.') goto done;
-	/* byte 2*/
-	if(chkIPv4AddrByte(npb, &i) != 0) goto done;
-	if(i == npb->strLen || c[i++] != '.') goto done;
-	/* byte 3*/
-	if(chkIPv4AddrByte(npb, &i) != 0) goto done;
-	if(i == npb->strLen || c[i++] != '.') goto done;
-	/* byte 4 - we do NOT need any char behind it! */
-	if(chkIPv4AddrByte(npb, &i) != 0) goto done;
+	for(int b = 0 ; b < 4 ; ++b) {
+		size_t len = runLen(m.digit, pos);
+		if(len == 0)
+			goto done;
+		if(len > 3) {
+			if(b < 3)
+				goto done;
+			len = 3; /* byte 4 - we do NOT need any char behind it! */
+		}
+		unsigned val = 0;
+		for(size_t j = 0 ; j < len ; ++j)
+			val = val * 10 + c[pos + j] - '0';
+		if(val > 255)	/* cannot be a valid IP address byte! */
+			goto done;
+		addr = (addr << 8) | val;
+		pos += len;
+		if(b < 3) {
+			if(!((m.dot >> pos) & 1))
+				goto done;
+			++pos;
+		}
+	}
 
 	/* if we reach this point, we found a valid IP address */
-	*parsed = i - *offs;
+	*parsed = pos;
 	if(value != NULL) {
-		*value = json_object_new_string_len(npb->str+(*offs), *parsed);
+		if(data != NULL) {
+			*value = json_object_new_int64(addr);
+		} else {
+			*value = json_object_new_string_len(c, *parsed);
+		}
 	}
 	r = 0; /* success */
 done:
 	return r;
 }
-
-
-/* skip past the IPv6 address block, parse pointer is set to 
- * first char after the block. Returns an error if already at end
- * of string.
- * @param[in] npb->str parse buffer
- * @param[in/out] offs offset into buffer, updated if successful
- * @return 0 if OK, 1 otherwise
- */
-static int
-skipIPv6AddrBlock(npb_t *const npb,
-	size_t *const __restrict__ offs)
+PARSER_Construct(IPv4)
 {
-	int j;
-	if(*offs == npb->strLen)
-		return 1;
+	return constructAddress(ctx, json, pdata, "ipv4");
+}
+PARSER_Destruct(IPv4)
+{
+	free(pdata);
+}
+PARSER_DataSize(IPv4)
+{
+	return sizeof(struct data_Address);
+}
 
-	for(j = 0 ; j < 4  && *offs+j < npb->strLen && isxdigit(npb->str[*offs+j]) ; ++j)
-		/*just skip*/ ;
 
-	*offs += j;
-	return 0;
-}
+/* an IPv6 address (including an embedded IPv4 address) is at most
+ * 45 characters. The parser looks at no more than 47 of them, so we
+ * get all of them classified with three SIMD blocks.
+ */
+#define IPV6_WINDOW 48
 
 /**
  * Parser for IPv6 addresses.
@@ -1673,9 +1865,9 @@ skipIPv6AddrBlock(npb_t *const npb,
  * a valid address. This prevents false positives.
  */
 PARSER_Parse(IPv6)
-	const char *c;
-	size_t i;
-	size_t beginBlock; /* last block begin in case we need IPv4 parsing */
+	struct charmask m;
+	size_t pos = 0;
+	size_t beginBlock = 0; /* last block begin in case we need IPv4 parsing */
 	int hasIPv4 = 0;
 	int nBlocks = 0; /* how many blocks did we already have? */
 	int bHad0Abbrev = 0; /* :: already used? */
@@ -1683,136 +1875,479 @@ PARSER_Parse(IPv6)
 	assert(npb->str != NULL);
 	assert(offs != NULL);
 	assert(parsed != NULL);
-	i = *offs;
-	if(i + 2 > npb->strLen) {
+	if(*offs + 2 > npb->strLen) {
 		/* IPv6 addr requires at least 2 characters ("::") */
 		goto done;
 	}
-	c = npb->str;
+	const char *const c = npb->str + *offs;
+	const size_t rem = npb->strLen - *offs;
+	classifyWindow(c, (rem < IPV6_WINDOW) ? rem : IPV6_WINDOW, &m);
 
 	/* check that first block is non-empty */
-	if(! ( isxdigit(c[i]) || (c[i] == ':' && c[i+1] == ':') ) )
+	if(!(m.hex & 1) && (m.colon & 3) != 3)
+		goto done;
+
+	/* Without an embedded IPv4 address, we can only stop at whitespace
+	 * or end-of-string. So if the run of address characters ends in
+	 * anything else (or is longer than any address), this is no
+	 * address and we do not need to look at the blocks.
+	 */
+	const size_t eoa = runLen(m.hex | m.colon | m.dot, 0);
+	if(   (m.dot & (((uint64_t) 1 << eoa) - 1)) == 0
+	   && (eoa == IPV6_WINDOW || (eoa < rem && !((m.space >> eoa) & 1))))
 		goto done;
 
 	/* try for all potential blocks plus one more (so we see errors!) */
 	for(int j = 0 ; j < 9 ; ++j) {
-		beginBlock = i;
-		if(skipIPv6AddrBlock(npb, &i) != 0) goto done;
+		beginBlock = pos;
+		if(pos == rem) goto done;
+		const size_t len = runLen(m.hex, pos);
+		pos += (len > 4) ? 4 : len;
 		nBlocks++;
-		if(i == npb->strLen) goto chk_ok;
-		if(isspace(c[i])) goto chk_ok;
-		if(c[i] == '.'){ /* IPv4 processing! */
+		if(pos == rem) goto chk_ok;
+		if((m.space >> pos) & 1) goto chk_ok;
+		if((m.dot >> pos) & 1) { /* IPv4 processing! */
 			hasIPv4 = 1;
 			break;
 		}
-		if(c[i] != ':') goto done;
-		i++; /* "eat" ':' */
-		if(i == npb->strLen) goto chk_ok;
+		if(!((m.colon >> pos) & 1)) goto done;
+		pos++; /* "eat" ':' */
+		if(pos == rem) goto chk_ok;
 		/* check for :: */
-		if(bHad0Abbrev) {
-			if(c[i] == ':') goto done;
-		} else {
-			if(c[i] == ':') {
-				bHad0Abbrev = 1;
-				++i;
-				if(i == npb->strLen) goto chk_ok;
-			}
+		if((m.colon >> pos) & 1) {
+			if(bHad0Abbrev) goto done;
+			bHad0Abbrev = 1;
+			++pos;
+			if(pos == rem) goto chk_ok;
 		}
 	}
 
 	if(hasIPv4) {
+		size_t i;
 		size_t ipv4_parsed;
 		--nBlocks;
 		/* prevent pure IPv4 address to be recognized */
-		if(beginBlock == *offs) goto done;
-		i = beginBlock;
+		if(beginBlock == 0) goto done;
+		i = *offs + beginBlock;
 		if(ln_v2_parseIPv4(npb, &i, NULL, &ipv4_parsed, NULL) != 0)
 			goto done;
-		i += ipv4_parsed;
+		pos = beginBlock + ipv4_parsed;
 	}
 
 chk_ok:	/* we are finished parsing, check if things are ok */
 	if(nBlocks > 8) goto done;
 	if(bHad0Abbrev && nBlocks >= 8) goto done;
-	/* now check if trailing block is missing. Note that i is already
+	/* now check if trailing block is missing. Note that pos is already
 	 * on next character, so we need to go two back. Two are always
 	 * present, else we would not reach this code here.
 	 */
-	if(c[i-1] == ':' && c[i-2] != ':') goto done;
+	if(c[pos-1] == ':' && c[pos-2] != ':') goto done;
 
 	/* if we reach this point, we found a valid IP address */
-	*parsed = i - *offs;
+	*parsed = pos;
 	if(value != NULL) {
-		*value = json_object_new_string_len(npb->str+(*offs), *parsed);
+		*value = json_object_new_string_len(c, *parsed);
 	}
 	r = 0; /* success */
 done:
 	return r;
 }
 
-/* check if a char is valid inside a name of the iptables motif.
- * We try to keep the set as slim as possible, because the iptables
- * parser may otherwise create a very broad match (especially the
- * inclusion of simple words like "DF" cause grief here).
- * Note: we have taken the permitted set from iptables log samples.
- * Report bugs if we missed some additional rules.
+/* Shared tokenizer for the name=value style parsers (NameValue,
+ * v2-iptables, CEF extensions and Checkpoint LEA). The dialects only
+ * differ in which characters are valid inside a name, what separates
+ * name and value and how the end of a value is found, so they are
+ * described by a struct kvdialect. The tokenizer does a single pass
+ * over the message and records the name and value of each pair as
+ * offsets into the message. Only if the caller needs the value, these
+ * spans are turned into JSON at the end, so mismatches are cheap.
+ * Runs of name and value characters are scanned 16 bytes at a time
+ * if the platform supports it.
  */
+
+/* set of characters permitted inside a name */
+enum kvNameChars {
+	KV_NAME_ANY,	/* anything up to the assign char */
+	KV_NAME_NV,	/* alnum, '.', '_', '-' */
+	KV_NAME_CEF,	/* alnum, '.', '_' */
+	KV_NAME_IPT	/* upper case letters */
+};
+
+/* how the end of a value is detected */
+enum kvValueEnd {
+	KV_VAL_WORD,	/* value ends at whitespace */
+	KV_VAL_TERM,	/* value ends at (and includes) valueTerm */
+	KV_VAL_CEF	/* value ends in front of the next name */
+};
+
+#define KV_SKIPSP	0x01	/* skip SP in front of names */
+#define KV_TRAILSP	0x02	/* SP after the last pair is permitted */
+#define KV_SKIPSPVAL	0x04	/* skip SP in front of values */
+#define KV_FLAGS	0x08	/* names without a value (followed by SP) are permitted */
+#define KV_EMPTYNAME	0x10	/* empty names are permitted, but assign must not be last char */
+#define KV_ONESP	0x20	/* pairs are separated by a single SP */
+#define KV_WSSEP	0x40	/* pairs are separated by any amount of whitespace */
+#define KV_CSTRVAL	0x80	/* values end at a NUL byte */
+
+struct kvdialect {
+	enum kvNameChars nameChars;
+	char assign;
+	enum kvValueEnd valueEnd;
+	char valueTerm;
+	unsigned options;
+	int minPairs;
+};
+
+/* name must be alphanumeric characters, value must be non-whitespace
+ * characters. "name=" is valid and means a field with empty value.
+ */
+static const struct kvdialect kvNameValue =
+	{ KV_NAME_NV, '=', KV_VAL_WORD, 0, KV_WSSEP, 0 };
+/* Note that the iptables motif must have at least two fields, otherwise
+ * it could detect things that are not iptables to be it.
+ */
+static const struct kvdialect kvIPTables =
+	{ KV_NAME_IPT, '=', KV_VAL_WORD, 0, KV_FLAGS | KV_ONESP, 2 };
+static const struct kvdialect kvCEF =
+	{ KV_NAME_CEF, '=', KV_VAL_CEF, 0, KV_SKIPSP | KV_EMPTYNAME | KV_CSTRVAL, 0 };
+static const struct kvdialect kvCheckpointLEA =
+	{ KV_NAME_ANY, ':', KV_VAL_TERM, ';',
+	  KV_SKIPSP | KV_TRAILSP | KV_SKIPSPVAL | KV_EMPTYNAME | KV_CSTRVAL, 0 };
+
+#define KVP_NOVAL	0x01	/* pair has no value (iptables flag) */
+#define KVP_ESC		0x02	/* value contains escape sequences */
+
+struct kvpair {
+	size_t iName;
+	size_t lenName;
+	size_t iVal;
+	size_t lenVal;
+	int flags;
+};
+
+/* list of pairs found. The first few are kept inside the struct, so
+ * usual messages do not need any allocation.
+ */
+#define KV_NFIXED 32
+struct kvlist {
+	size_t n;
+	size_t max;
+	struct kvpair *pairs;
+	struct kvpair fixed[KV_NFIXED];
+};
+
+static inline void
+kvInit(struct kvlist *const kv)
+{
+	kv->n = 0;
+	kv->max = KV_NFIXED;
+	kv->pairs = kv->fixed;
+}
+
+static inline void
+kvFree(struct kvlist *const kv)
+{
+	if(kv->pairs != kv->fixed)
+		free(kv->pairs);
+}
+
+static int
+kvAdd(struct kvlist *const kv, const struct kvpair *const p)
+{
+	int r = 0;
+	if(kv->n == kv->max) {
+		struct kvpair *const old = (kv->pairs == kv->fixed) ? NULL : kv->pairs;
+		struct kvpair *pairs;
+		CHKN(pairs = realloc(old, 2 * kv->max * sizeof(struct kvpair)));
+		if(old == NULL)
+			memcpy(pairs, kv->fixed, sizeof(kv->fixed));
+		kv->pairs = pairs;
+		kv->max *= 2;
+	}
+	kv->pairs[kv->n++] = *p;
+done:
+	return r;
+}
+
 static inline int
-isValidIPTablesNameChar(const char c)
+isKVNameChar(const enum kvNameChars nc, const unsigned char c)
 {
-	/* right now, upper case only is valid */
-	return ('A' <= c && c <= 'Z') ? 1 : 0;
+	switch(nc) {
+	case KV_NAME_NV:
+		return isalnum(c) || c == '.' || c == '_' || c == '-';
+	case KV_NAME_CEF:
+		return isalnum(c) || c == '.' || c == '_';
+	case KV_NAME_IPT:
+		/* right now, upper case only is valid. We try to keep the
+		 * set as slim as possible, because the iptables parser may
+		 * otherwise create a very broad match (especially the
+		 * inclusion of simple words like "DF" cause grief here).
+		 * The permitted set is taken from iptables log samples.
+		 */
+		return 'A' <= c && c <= 'Z';
+	case KV_NAME_ANY:
+	default:
+		return 1;
+	}
+}
+
+/* returns the end of the run of name chars starting at i */
+static inline size_t
+scanKVName(const char *const str, size_t i, const size_t len,
+	const enum kvNameChars nc)
+{
+#ifdef __SSE2__
+	while(i + 16 <= len) {
+		const __m128i blk = _mm_loadu_si128((const __m128i*) (str + i));
+		uint64_t ok;
+		if(nc == KV_NAME_IPT) {
+			ok = inRange16(blk, 'A', 'Z' - 'A');
+		} else {
+			ok = inRange16(blk, '0', 9)
+			   | inRange16(_mm_or_si128(blk, _mm_set1_epi8(0x20)), 'a', 'z' - 'a')
+			   | isChar16(blk, '.') | isChar16(blk, '_');
+			if(nc == KV_NAME_NV)
+				ok |= isChar16(blk, '-');
+		}
+		if(ok != 0xffff)
+			return i + __builtin_ctz(~ok);
+		i += 16;
+	}
+#endif
+	while(i < len && isKVNameChar(nc, str[i]))
+		++i;
+	return i;
+}
+
+/* returns position of the first whitespace char at or after i, or len */
+static inline size_t
+scanToSpace(const char *const str, size_t i, const size_t len)
+{
+#ifdef __SSE2__
+	while(i + 16 <= len) {
+		const __m128i blk = _mm_loadu_si128((const __m128i*) (str + i));
+		const uint64_t sp = isChar16(blk, ' ') | inRange16(blk, '\t', '\r' - '\t');
+		if(sp != 0)
+			return i + __builtin_ctz(sp);
+		i += 16;
+	}
+#endif
+	while(i < len && !isspace(str[i]))
+		++i;
+	return i;
 }
 
-/* helper to iptables parser, parses out a a single name=value pair 
+static inline size_t
+skipSP(const char *const str, size_t i, const size_t len)
+{
+	while(i < len && str[i] == ' ')
+		++i;
+	return i;
+}
+
+/* Find the end of a CEF extension value. Values may contain spaces
+ * but need NOT to be quoted, so the value ends in front of the last
+ * word before the next unescaped equal sign, which is the name of the
+ * next pair. Valid escapes are "\=", "\\", "\r" and "\n". On entry,
+ * *pi is the first char of the value, on exit it is the end of it.
  */
 static int
-parseIPTablesNameValue(npb_t *const npb,
-	size_t *const __restrict__ offs,
-	struct json_object *const __restrict__ valroot)
+cefValueEnd(const char *const str, size_t *const pi, const size_t len, int *const flags)
 {
-	int r = LN_WRONGPARSER;
-	size_t i = *offs;
+	int r = 0;
+	size_t i = *pi;
+	size_t iLastWordBegin = 0;
+	int hadSP = 0;
 
-	const size_t iName = i;
-	while(i < npb->strLen && isValidIPTablesNameChar(npb->str[i]))
-		++i;
-	if(i == iName || (i < npb->strLen && npb->str[i] != '=' && npb->str[i] != ' '))
-		goto done; /* no name at all! */
-
-	const ssize_t lenName = i - iName;
-
-	ssize_t iVal = -1;
-	size_t lenVal = i - iVal;
-	if(i < npb->strLen && npb->str[i] != ' ') {
-		/* we have a real value (not just a flag name like "DF") */
-		++i; /* skip '=' */
-		iVal = i;
-		while(i < npb->strLen && !isspace(npb->str[i]))
+	while(1) {
+		const size_t iSpecial = scanToAnyOf(str, i, len, "= \\", 3);
+		if(hadSP && iSpecial > i) {
+			iLastWordBegin = i;
+			hadSP = 0;
+		}
+		i = iSpecial;
+		if(i == len || str[i] == '=')
+			break;
+		if(str[i] == ' ') {
+			hadSP = 1;
 			++i;
-		lenVal = i - iVal;
+		} else {
+			*flags |= KVP_ESC;
+			if(i + 1 == len) {
+				i = len;
+				break;
+			}
+			const char c = str[i + 1];
+			if(c != '=' && c != '\\' && c != 'r' && c != 'n')
+				FAIL(LN_WRONGPARSER);
+			i += 2;
+		}
 	}
 
-	/* parsing OK */
-	*offs = i;
-	r = 0;
+	/* Note: iLastWordBegin can never be at offset zero, because
+	 * the CEF header starts there!
+	 */
+	if(i < len && iLastWordBegin != 0)
+		i = iLastWordBegin - 1;
+	*pi = i;
+done:
+	return r;
+}
 
-	if(valroot == NULL)
-		goto done;
+/* tokenize the name/value pairs starting at *offs. If kv is non-NULL,
+ * the pairs are stored inside it. On success, *offs is updated to the
+ * end of the pairs found.
+ */
+static int
+kvTokenize(npb_t *const npb, const struct kvdialect *const d,
+	size_t *const offs, struct kvlist *const kv)
+{
+	int r = 0;
+	const char *const str = npb->str;
+	const size_t len = npb->strLen;
+	size_t i = *offs;
+	int npairs = 0;
+	struct kvpair p;
 
-	char *name;
-	CHKN(name = malloc(lenName+1));
-	memcpy(name, npb->str+iName, lenName);
-	name[lenName] = '\0';
-	json_object *json;
-	if(iVal == -1) {
-		json = NULL;
-	} else {
-		CHKN(json = json_object_new_string_len(npb->str+iVal, lenVal));
+	while(i < len) {
+		if(d->options & KV_SKIPSP) {
+			i = skipSP(str, i, len);
+			if(i == len && (d->options & KV_TRAILSP) && npairs > 0)
+				break;
+		}
+
+		p.iName = i;
+		if(d->nameChars == KV_NAME_ANY)
+			i = scanToChar(str, i, len, d->assign);
+		else
+			i = scanKVName(str, i, len, d->nameChars);
+		p.lenName = i - p.iName;
+		p.flags = 0;
+		if(d->options & KV_EMPTYNAME) {
+			if(i + 1 >= len || str[i] != d->assign)
+				FAIL(LN_WRONGPARSER);
+		} else if(p.lenName == 0) {
+			FAIL(LN_WRONGPARSER); /* no name at all! */
+		} else if(i == len || str[i] != d->assign) {
+			if(!(d->options & KV_FLAGS) || (i < len && str[i] != ' '))
+				FAIL(LN_WRONGPARSER);
+			p.flags = KVP_NOVAL; /* just a flag name like "DF" */
+		}
+
+		if(!(p.flags & KVP_NOVAL)) {
+			++i; /* skip assign */
+			if(d->options & KV_SKIPSPVAL)
+				i = skipSP(str, i, len);
+			p.iVal = i;
+			switch(d->valueEnd) {
+			case KV_VAL_WORD:
+				i = scanToSpace(str, i, len);
+				p.lenVal = i - p.iVal;
+				break;
+			case KV_VAL_TERM:
+				i = scanToChar(str, i, len, d->valueTerm);
+				if(i == len)
+					FAIL(LN_WRONGPARSER);
+				p.lenVal = i - p.iVal;
+				++i; /* skip terminator */
+				break;
+			case KV_VAL_CEF:
+			default:
+				if(cefValueEnd(str, &i, len, &p.flags) != 0)
+					FAIL(LN_WRONGPARSER);
+				p.lenVal = i - p.iVal;
+				++i; /* skip past value */
+				break;
+			}
+		}
+
+		if(kv != NULL)
+			CHKR(kvAdd(kv, &p));
+		++npairs;
+
+		if(d->options & KV_ONESP) {
+			if(i < len && str[i] == ' ')
+				++i;
+		} else if(d->options & KV_WSSEP) {
+			while(i < len && isspace(str[i]))
+				++i;
+		}
+	}
+
+	if(npairs < d->minPairs)
+		FAIL(LN_WRONGPARSER);
+
+	*offs = (i > len) ? len : i;
+done:
+	return r;
+}
+
+/* copy a CEF value, resolving escape sequences, to buf, which must
+ * be lenVal+1 bytes large.
+ */
+static void
+cefUnescape(npb_t *const npb, const struct kvpair *const p, char *const buf)
+{
+	size_t iDst = 0;
+	for(size_t iSrc = p->iVal ; iSrc < p->iVal + p->lenVal ; ++iSrc) {
+		if(npb->str[iSrc] == '\\') {
+			/* the escaped char may be the first one after the value,
+			 * if the last word of the value starts with an escape.
+			 */
+			if(++iSrc == npb->strLen)
+				break;
+			switch(npb->str[iSrc]) {
+			case 'n':	buf[iDst++] = '\n';
+					break;
+			case 'r':	buf[iDst++] = '\r';
+					break;
+			default:	buf[iDst++] = npb->str[iSrc];
+					break;
+			}
+		} else {
+			buf[iDst++] = npb->str[iSrc];
+		}
+	}
+	buf[iDst] = '\0';
+}
+
+/* add the pairs found by kvTokenize() to json */
+static int
+kvToJSON(npb_t *const npb, const struct kvdialect *const d,
+	const struct kvlist *const kv, struct json_object *const json)
+{
+	int r = 0;
+	char *buf = NULL;
+	size_t lenBuf = 0;
+
+	for(size_t k = 0 ; k < kv->n ; ++k) {
+		const struct kvpair *const p = kv->pairs + k;
+		const size_t need = p->lenName + 1 + ((p->flags & KVP_ESC) ? p->lenVal + 1 : 0);
+		if(need > lenBuf) {
+			char *newbuf;
+			CHKN(newbuf = realloc(buf, need));
+			buf = newbuf;
+			lenBuf = need;
+		}
+		memcpy(buf, npb->str + p->iName, p->lenName);
+		buf[p->lenName] = '\0';
+
+		struct json_object *val;
+		if(p->flags & KVP_NOVAL) {
+			val = NULL;
+		} else if(p->flags & KVP_ESC) {
+			char *const unesc = buf + p->lenName + 1;
+			cefUnescape(npb, p, unesc);
+			CHKN(val = json_object_new_string(unesc));
+		} else {
+			const char *const v = npb->str + p->iVal;
+			const size_t lenVal = (d->options & KV_CSTRVAL) ? strnlen(v, p->lenVal) : p->lenVal;
+			CHKN(val = json_object_new_string_len(v, lenVal));
+		}
+		json_object_object_add(json, buf, val);
 	}
-	json_object_object_add(valroot, name, json);
-	free(name);
 done:
+	free(buf);
 	return r;
 }
 
@@ -1821,48 +2356,29 @@ done:
  * This parser is named "v2-iptables" because of a traditional
  * parser named "iptables", which we do not want to replace, at
  * least right now (we may re-think this before the first release).
- * For performance reasons, this works in two stages. In the first
- * stage, we only detect if the motif is correct. The second stage is
- * only called when we know it is. In it, we go once again over the
- * message again and actually extract the data. This is done because
- * data extraction is relatively expensive and in most cases we will
- * have much more frequent mismatches than matches.
- * Note that this motif must have at least one field, otherwise it
+ * The message is tokenized only once, JSON is only created after
+ * we know the motif is correct (see kvTokenize()). This is done
+ * because data extraction is relatively expensive and in most cases
+ * we will have much more frequent mismatches than matches.
+ * Note that this motif must have at least two fields, otherwise it
  * could detect things that are not iptables to be it. Further limits
  * may be imposed in the future as we see additional need.
  * added 2015-04-30 rgerhards
  */
 PARSER_Parse(v2IPTables)
 	size_t i = *offs;
-	int nfields = 0;
+	struct kvlist kv;
 
-	/* stage one */
-	while(i < npb->strLen) {
-		CHKR(parseIPTablesNameValue(npb, &i, NULL));
-		++nfields;
-		/* exactly one SP is permitted between fields */
-		if(i < npb->strLen && npb->str[i] == ' ')
-			++i;
-	}
-
-	if(nfields < 2) {
-		FAIL(LN_WRONGPARSER);
-	}
+	kvInit(&kv);
+	CHKR(kvTokenize(npb, &kvIPTables, &i, (value == NULL) ? NULL : &kv));
 
 	/* success, persist */
 	*parsed = i - *offs;
 	r = 0;
 
-	/* stage two */
-	if(value == NULL)
-		goto done;
-
-	i = *offs;
-	CHKN(*value = json_object_new_object());
-	while(i < npb->strLen) {
-		CHKR(parseIPTablesNameValue(npb, &i, *value));
-		while(i < npb->strLen && isspace(npb->str[i]))
-			++i;
+	if(value != NULL) {
+		CHKN(*value = json_object_new_object());
+		CHKR(kvToJSON(npb, &kvIPTables, &kv, *value));
 	}
 
 done:
@@ -1870,9 +2386,113 @@ done:
 		json_object_put(*value);
 		*value = NULL;
 	}
+	kvFree(&kv);
 	return r;
 }
 
+/* results of jsonPrescan() */
+#define JSON_PRESCAN_BAD	0	/* cannot be valid JSON */
+#define JSON_PRESCAN_END	1	/* brackets balance, end found */
+#define JSON_PRESCAN_UNSURE	2	/* json-c needs to decide */
+/* nesting level up to which we check brackets. It must be below the
+ * json-c default depth, so that we never reject what json-c accepts.
+ */
+#define JSON_PRESCAN_MAXDEPTH	30
+
+static inline int
+isJSONSpecial(const char c, const int inString)
+{
+	if(c == '"' || c == '\\' || c == '\0')
+		return 1;
+	return !inString && ((c | 0x20) == '{' || (c | 0x20) == '}' || c == '\'' || c == '/');
+}
+
+/* find the next char at or after i that matters to jsonPrescan(). Inside
+ * strings, these are '"', '\' and NUL, outside also the brackets and
+ * the chars json-c non-standard syntax starts with ('\'', '/'). This is
+ * done 16 bytes at a time if the platform supports it.
+ */
+static inline size_t
+jsonScanSpecial(const char *const str, size_t i, const size_t len, const int inString)
+{
+#ifdef __SSE2__
+	while(i + 16 <= len) {
+		const __m128i blk = _mm_loadu_si128((const __m128i*) (str + i));
+		uint64_t m = isChar16(blk, '"') | isChar16(blk, '\\') | isChar16(blk, '\0');
+		if(!inString) {
+			/* '[' | 0x20 == '{' and ']' | 0x20 == '}' */
+			const __m128i lc = _mm_or_si128(blk, _mm_set1_epi8(0x20));
+			m |= isChar16(lc, '{') | isChar16(lc, '}')
+			   | isChar16(blk, '\'') | isChar16(blk, '/');
+		}
+		if(m != 0)
+			return i + __builtin_ctz(m);
+		i += 16;
+	}
+#endif
+	while(i < len && !isJSONSpecial(str[i], inString))
+		++i;
+	return i;
+}
+
+/* Check if the JSON starting with the '{' at str[i] can be valid before
+ * json-c builds any object. Only strings and brackets are looked at:
+ * if the brackets do not match or the message ends before they are
+ * closed, this is not JSON. Otherwise, *pEnd is set to the end of the
+ * JSON including trailing whitespace (see ln_v2_parseJSON()), so that
+ * json-c needs to look at that part only. For things json-c accepts
+ * beyond standard JSON (comments, single-quoted strings) and very deep
+ * nesting, we leave the decision to json-c.
+ */
+static int
+jsonPrescan(const char *const str, size_t i, const size_t len, size_t *const pEnd)
+{
+	uint32_t objects = 0; /* bit per open level: object or array? */
+	unsigned depth = 0;
+	int inString = 0;
+
+	while(1) {
+		i = jsonScanSpecial(str, i, len, inString);
+		if(i == len)
+			return JSON_PRESCAN_BAD; /* incomplete */
+		const char c = str[i];
+		if(inString) {
+			if(c == '\\') {
+				if(++i == len)
+					return JSON_PRESCAN_BAD;
+			} else if(c == '"') {
+				inString = 0;
+			} else {
+				return JSON_PRESCAN_UNSURE; /* NUL */
+			}
+		} else if(c == '"') {
+			inString = 1;
+		} else if(c == '{' || c == '[') {
+			if(depth == JSON_PRESCAN_MAXDEPTH)
+				return JSON_PRESCAN_UNSURE;
+			objects = (objects << 1) | (c == '{');
+			++depth;
+		} else if(c == '}' || c == ']') {
+			if((objects & 1) != (c == '}'))
+				return JSON_PRESCAN_BAD;
+			objects >>= 1;
+			if(--depth == 0)
+				break;
+		} else {
+			return JSON_PRESCAN_UNSURE;
+		}
+		++i;
+	}
+
+	for(++i ; i < len && isspace(str[i]) ; ++i)
+		/* just skip */;
+	/* json-c also permits comments after the JSON */
+	if(i < len && str[i] == '/')
+		return JSON_PRESCAN_UNSURE;
+	*pEnd = i;
+	return JSON_PRESCAN_END;
+}
+
 /**
  * Parse JSON. This parser tries to find JSON data inside a message.
  * If it finds valid JSON, it will extract it. Extra data after the
@@ -1883,11 +2503,14 @@ done:
  * neatly in sync. If json-c changes for some reason or we switch to
  * an alternate json lib, we probably need to be sure to keep that
  * behaviour, and probably emulate it.
+ * Most non-JSON is rejected by jsonPrescan() before json-c is called,
+ * and json-c only needs to look at the part found by it.
  * added 2015-04-28 by rgerhards, v1.1.2
  */
 PARSER_Parse(JSON)
 	const size_t i = *offs;
-	struct json_tokener *tokener = NULL;
+	size_t end = npb->strLen;
+	struct json_tokener *tokener;
 
 	if(npb->str[i] != '{' && npb->str[i] != ']') {
 		/* this can't be json, see RFC4627, Sect. 2
@@ -1900,11 +2523,15 @@ PARSER_Parse(JSON)
 		goto done;
 	}
 
-	if((tokener = json_tokener_new()) == NULL)
+	if(   npb->str[i] == '{'
+	   && jsonPrescan(npb->str, i, npb->strLen, &end) == JSON_PRESCAN_BAD)
+		goto done;
+
+	if((tokener = ln_npbTokener(npb)) == NULL)
 		goto done;
 
 	struct json_object *const json
-		= json_tokener_parse_ex(tokener, npb->str+i, (int) (npb->strLen - i));
+		= json_tokener_parse_ex(tokener, npb->str+i, (int) (end - i));
 
 	if(json == NULL)
 		goto done;
@@ -1920,77 +2547,10 @@ PARSER_Parse(JSON)
 	}
 
 done:
-	if(tokener != NULL)
-		json_tokener_free(tokener);
 	return r;
 }
 
 
-/* check if a char is valid inside a name of a NameValue list
- * The set of valid characters may be extended if there is good
- * need to do so. We have selected the current set carefully, but
- * may have overlooked some cases.
- */
-static inline int
-isValidNameChar(const char c)
-{
-	return (isalnum(c)
-		|| c == '.'
-		|| c == '_'
-		|| c == '-'
-		) ? 1 : 0;
-}
-/* helper to NameValue parser, parses out a a single name=value pair 
- *
- * name must be alphanumeric characters, value must be non-whitespace
- * characters, if quoted than with symmetric quotes. Supported formats
- * - name=value
- * - name="value"
- * - name='value'
- * Note "name=" is valid and means a field with empty value.
- * TODO: so far, quote characters are not permitted WITHIN quoted values.
- */
-static int
-parseNameValue(npb_t *const npb,
-	size_t *const __restrict__ offs,
-	struct json_object *const __restrict__ valroot)
-{
-	int r = LN_WRONGPARSER;
-	size_t i = *offs;
-
-	const size_t iName = i;
-	while(i < npb->strLen && isValidNameChar(npb->str[i]))
-		++i;
-	if(i == iName || npb->str[i] != '=')
-		goto done; /* no name at all! */
-
-	const size_t lenName = i - iName;
-	++i; /* skip '=' */
-
-	const size_t iVal = i;
-	while(i < npb->strLen && !isspace(npb->str[i]))
-		++i;
-	const size_t lenVal = i - iVal;
-
-	/* parsing OK */
-	*offs = i;
-	r = 0;
-
-	if(valroot == NULL)
-		goto done;
-
-	char *name;
-	CHKN(name = malloc(lenName+1));
-	memcpy(name, npb->str+iName, lenName);
-	name[lenName] = '\0';
-	json_object *json;
-	CHKN(json = json_object_new_string_len(npb->str+iVal, lenVal));
-	json_object_object_add(valroot, name, json);
-	free(name);
-done:
-	return r;
-}
-
 /**
  * Parse CEE syslog.
  * This essentially is a JSON parser, with additional restrictions:
@@ -2002,7 +2562,8 @@ done:
  */
 PARSER_Parse(CEESyslog)
 	size_t i = *offs;
-	struct json_tokener *tokener = NULL;
+	size_t end = npb->strLen;
+	struct json_tokener *tokener;
 	struct json_object *json = NULL;
 
 	if(npb->strLen < i + 7  || /* "@cee:{}" is minimum text */
@@ -2021,10 +2582,21 @@ PARSER_Parse(CEESyslog)
 		goto done;
 		/* note: we do not permit arrays in CEE mode */
 
-	if((tokener = json_tokener_new()) == NULL)
+	switch(jsonPrescan(npb->str, i, npb->strLen, &end)) {
+	case JSON_PRESCAN_BAD:
 		goto done;
+	case JSON_PRESCAN_END:
+		if(end != npb->strLen)
+			goto done; /* trailing data */
+		break;
+	default:
+		break;
+	}
 
-	json = json_tokener_parse_ex(tokener, npb->str+i, (int) (npb->strLen - i));
+	if((tokener = ln_npbTokener(npb)) == NULL)
+		goto done;
+
+	json = json_tokener_parse_ex(tokener, npb->str+i, (int) (end - i));
 
 	if(json == NULL)
 		goto done;
@@ -2042,8 +2614,6 @@ PARSER_Parse(CEESyslog)
 	}
 
 done:
-	if(tokener != NULL)
-		json_tokener_free(tokener);
 	if(json != NULL)
 		json_object_put(json);
 	return r;
@@ -2053,43 +2623,34 @@ done:
  * Parser for name/value pairs.
  * On entry must point to alnum char. All following chars must be
  * name/value pairs delimited by whitespace up until the end of string.
- * For performance reasons, this works in two stages. In the first
- * stage, we only detect if the motif is correct. The second stage is
- * only called when we know it is. In it, we go once again over the
- * message again and actually extract the data. This is done because
- * data extraction is relatively expensive and in most cases we will
- * have much more frequent mismatches than matches.
+ * The message is tokenized only once, JSON is only created after
+ * we know the motif is correct (see kvTokenize()). This is done
+ * because data extraction is relatively expensive and in most cases
+ * we will have much more frequent mismatches than matches.
  * added 2015-04-25 rgerhards
  */
 PARSER_Parse(NameValue)
 	size_t i = *offs;
+	struct kvlist kv;
 
-	/* stage one */
-	while(i < npb->strLen) {
-		CHKR(parseNameValue(npb, &i, NULL));
-		while(i < npb->strLen && isspace(npb->str[i]))
-			++i;
-	}
+	kvInit(&kv);
+	CHKR(kvTokenize(npb, &kvNameValue, &i, (value == NULL) ? NULL : &kv));
 
 	/* success, persist */
 	*parsed = i - *offs;
 	r = 0; /* success */
 
-	/* stage two */
-	if(value == NULL)
-		goto done;
-
-	i = *offs;
-	CHKN(*value = json_object_new_object());
-	while(i < npb->strLen) {
-		CHKR(parseNameValue(npb, &i, *value));
-		while(i < npb->strLen && isspace(npb->str[i]))
-			++i;
+	if(value != NULL) {
+		CHKN(*value = json_object_new_object());
+		CHKR(kvToJSON(npb, &kvNameValue, &kv, *value));
 	}
 
-	/* TODO: fix mem leak if alloc json fails */
-
 done:
+	if(r != 0 && value != NULL && *value != NULL) {
+		json_object_put(*value);
+		*value = NULL;
+	}
+	kvFree(&kv);
 	return r;
 }
 
@@ -2106,38 +2667,22 @@ done:
  * added 2015-05-04 by rgerhards, v1.1.2
  */
 PARSER_Parse(MAC48)
-	size_t i = *offs;
-	char delim;
+	const struct data_Address *const data = (const struct data_Address*) pdata;
+	const char *const c = npb->str + *offs;
+	struct charmask m;
 
-	if(npb->strLen < i + 17 || /* this motif has exactly 17 characters */
-	   !isxdigit(npb->str[i]) ||
-	   !isxdigit(npb->str[i+1])
+	if(npb->strLen < *offs + 17 || /* this motif has exactly 17 characters */
+	   !isxdigit(c[0]) ||
+	   !isxdigit(c[1])
 	   )
 		FAIL(LN_WRONGPARSER);
 
-	if(npb->str[i+2] == ':')
-		delim = ':';
-	else if(npb->str[i+2] == '-')
-		delim = '-';
-	else
-		FAIL(LN_WRONGPARSER);
-
-	/* first byte ok */
-	if(!isxdigit(npb->str[i+3])  ||
-	   !isxdigit(npb->str[i+4])  ||
-	   npb->str[i+5] != delim    || /* 2nd byte ok */
-	   !isxdigit(npb->str[i+6])  ||
-	   !isxdigit(npb->str[i+7])  ||
-	   npb->str[i+8] != delim    || /* 3rd byte ok */
-	   !isxdigit(npb->str[i+9])  ||
-	   !isxdigit(npb->str[i+10]) ||
-	   npb->str[i+11] != delim   || /* 4th byte ok */
-	   !isxdigit(npb->str[i+12]) ||
-	   !isxdigit(npb->str[i+13]) ||
-	   npb->str[i+14] != delim   || /* 5th byte ok */
-	   !isxdigit(npb->str[i+15]) ||
-	   !isxdigit(npb->str[i+16])    /* 6th byte ok */
-	   )
+	/* the motif is checked at once: hex digits at positions 0, 1, 3, 4,
+	 * ... 16 and the delimiter at positions 2, 5, ... 14.
+	 */
+	classifyWindow(c, 17, &m);
+	const uint64_t delim = (c[2] == ':') ? m.colon : m.dash;
+	if((m.hex & 0x1b6db) != 0x1b6db || (delim & 0x4924) != 0x4924)
 		FAIL(LN_WRONGPARSER);
 
 	/* success, persist */
@@ -2145,166 +2690,33 @@ PARSER_Parse(MAC48)
 	r = 0; /* success */
 
 	if(value != NULL) {
-		CHKN(*value = json_object_new_string_len(npb->str+i, 17));
-	}
-
-done:
-	return r;
-}
-
-
-/* This parses the extension value and updates the index
- * to point to the end of it.
- */
-static int
-cefParseExtensionValue(npb_t *const npb,
-	size_t *__restrict__ iEndVal)
-{
-	int r = 0;
-	size_t i = *iEndVal;
-	size_t iLastWordBegin;
-	/* first find next unquoted equal sign and record begin of
-	 * last word in front of it - this is the actual end of the
-	 * current name/value pair and the begin of the next one.
-	 */
-	int hadSP = 0;
-	int inEscape = 0;
-	for(iLastWordBegin = 0 ; i < npb->strLen ; ++i) {
-		if(inEscape) {
-			if(npb->str[i] != '=' &&
-			   npb->str[i] != '\\' &&
-			   npb->str[i] != 'r' &&
-			   npb->str[i] != 'n')
-			FAIL(LN_WRONGPARSER);
-			inEscape = 0;
+		if(data != NULL) {
+			int64_t addr = 0;
+			for(int j = 0 ; j < 17 ; j += 3)
+				addr = (addr << 8) | (hexval(c[j]) << 4) | hexval(c[j+1]);
+			CHKN(*value = json_object_new_int64(addr));
 		} else {
-			if(npb->str[i] == '=') {
-				break;
-			} else if(npb->str[i] == '\\') {
-				inEscape = 1;
-			} else if(npb->str[i] == ' ') {
-				hadSP = 1;
-			} else {
-				if(hadSP) {
-					iLastWordBegin = i;
-					hadSP = 0;
-				}
-			}
+			CHKN(*value = json_object_new_string_len(c, 17));
 		}
 	}
 
-	/* Note: iLastWordBegin can never be at offset zero, because
-	 * the CEF header starts there!
-	 */
-	if(i < npb->strLen) {
-		*iEndVal = (iLastWordBegin == 0) ? i : iLastWordBegin - 1;
-	} else {
-		*iEndVal = i;
-	}
 done:
 	return r;
 }
-
-/* must be positioned on first char of name, returns index
- * of end of name.
- * Note: ArcSight violates the CEF spec ifself: they generate
- * leading underscores in their extension names, which are
- * definetly not alphanumeric. We still accept them...
- * They also seem to use dots.
- */
-static int
-cefParseName(npb_t *const npb,
-	size_t *const __restrict__ i)
+PARSER_Construct(MAC48)
 {
-	int r = 0;
-	while(*i < npb->strLen && npb->str[*i] != '=') {
-		if(!(isalnum(npb->str[*i]) || npb->str[*i] == '_' || npb->str[*i] == '.'))
-			FAIL(LN_WRONGPARSER);
-		++(*i);
-	}
-done:
-	return r;
+	return constructAddress(ctx, json, pdata, "mac48");
 }
-
-/* parse CEF extensions. They are basically name=value
- * pairs with the ugly exception that values may contain
- * spaces but need NOT to be quoted. Thankfully, at least
- * names are specified as being alphanumeric without spaces
- * in them. So we must add a lookahead parser to check if
- * a word is a name (and thus the begin of a new pair) or
- * not. This is done by subroutines.
- */
-static int
-cefParseExtensions(npb_t *const npb,
-	size_t *const __restrict__ offs,
-	json_object *const __restrict__ jroot)
+PARSER_Destruct(MAC48)
 {
-	int r = 0;
-	size_t i = *offs;
-	size_t iName, lenName;
-	size_t iValue, lenValue;
-	char *name = NULL;
-	char *value = NULL;
-
-	while(i < npb->strLen) {
-		while(i < npb->strLen && npb->str[i] == ' ')
-			++i;
-		iName = i;
-		CHKR(cefParseName(npb, &i));
-		if(i+1 >= npb->strLen || npb->str[i] != '=')
-			FAIL(LN_WRONGPARSER);
-		lenName = i - iName;
-		++i; /* skip '=' */
-
-		iValue = i;
-		CHKR(cefParseExtensionValue(npb, &i));
-		lenValue = i - iValue;
-
-		++i; /* skip past value */
-
-		if(jroot != NULL) {
-			CHKN(name = malloc(sizeof(char) * (lenName + 1)));
-			memcpy(name, npb->str+iName, lenName);
-			name[lenName] = '\0';
-			CHKN(value = malloc(sizeof(char) * (lenValue + 1)));
-			/* copy value but escape it */
-			size_t iDst = 0;
-			for(size_t iSrc = 0 ; iSrc < lenValue ; ++iSrc) {
-				if(npb->str[iValue+iSrc] == '\\') {
-					++iSrc; /* we know the next char must exist! */
-					switch(npb->str[iValue+iSrc]) {
-					case '=':	value[iDst] = '=';
-							break;
-					case 'n':	value[iDst] = '\n';
-							break;
-					case 'r':	value[iDst] = '\r';
-							break;
-					case '\\':	value[iDst] = '\\';
-							break;
-					default:	break;
-					}
-				} else {
-					value[iDst] = npb->str[iValue+iSrc];
-				}
-				++iDst;
-			}
-			value[iDst] = '\0';
-			json_object *json;
-			CHKN(json = json_object_new_string(value));
-			json_object_object_add(jroot, name, json);
-			free(name); name = NULL;
-			free(value); value = NULL;
-		}
-	}
-
-	*offs = npb->strLen; /* this parser consume everything or fails */
-
-done:
-	free(name);
-	free(value);
-	return r;
+	free(pdata);
+}
+PARSER_DataSize(MAC48)
+{
+	return sizeof(struct data_Address);
 }
 
+
 /* gets a CEF header field. Must be positioned on the
  * first char after the '|' in front of field.
  * Note that '|' may be escaped as "\|", which also means
@@ -2369,6 +2781,9 @@ PARSER_Parse(CEF)
 	char *sigID = NULL;
 	char *name = NULL;
 	char *severity = NULL;
+	struct kvlist kv;
+
+	kvInit(&kv);
 
 	/* minumum header: "CEF:0|x|x|x|x|x|x|" -->  17 chars */
 	if(npb->strLen < i + 17 ||
@@ -2390,20 +2805,16 @@ PARSER_Parse(CEF)
 	CHKR(cefGetHdrField(npb, &i, (value == NULL) ? NULL : &severity));
 	++i; /* skip over terminal '|' */
 
-	/* OK, we now know we have a good header. Now, we need
-	 * to process extensions.
-	 * This time, we do NOT pre-process the extension, but rather
-	 * persist them directly to JSON. This is contrary to other
-	 * parsers, but as the CEF header is pretty unique, this time
-	 * it is exteremely unlike we will get a no-match during
-	 * extension processing. Even if so, nothing bad happens, as
-	 * the extracted data is discarded. But the regular case saves
-	 * us processing time and complexity. The only time when we
-	 * cannot directly process it is when the caller asks us not
-	 * to persist the data. So this must be handled differently.
+	/* OK, we now know we have a good header. Now, we need to
+	 * process extensions. They are basically name=value pairs with
+	 * the ugly exception that values may contain spaces but need NOT
+	 * to be quoted. Thankfully, at least names are specified as
+	 * being alphanumeric without spaces in them. Note: ArcSight
+	 * violates the CEF spec ifself: they generate leading underscores
+	 * in their extension names, which are definetly not alphanumeric.
+	 * We still accept them... They also seem to use dots.
 	 */
-	 size_t iBeginExtensions = i;
-	 CHKR(cefParseExtensions(npb, &i, NULL));
+	CHKR(kvTokenize(npb, &kvCEF, &i, (value == NULL) ? NULL : &kv));
 
 	/* success, persist */
 	*parsed = i - *offs;
@@ -2428,16 +2839,15 @@ PARSER_Parse(CEF)
 		json_object *jext;
 		CHKN(jext = json_object_new_object());
 		json_object_object_add(*value, "Extensions", jext);
-
-		i = iBeginExtensions;
-		cefParseExtensions(npb, &i, jext);
+		CHKR(kvToJSON(npb, &kvCEF, &kv, jext));
 	}
 
 done:
 	if(r != 0 && value != NULL && *value != NULL) {
 		json_object_put(*value);
-		value = NULL;
+		*value = NULL;
 	}
+	kvFree(&kv);
 	free(vendor);
 	free(product);
 	free(version);
@@ -2453,71 +2863,27 @@ done:
  */
 PARSER_Parse(CheckpointLEA)
 	size_t i = *offs;
-	size_t iName, lenName;
-	size_t iValue, lenValue;
-	int foundFields = 0;
-	char *name = NULL;
-	char *val = NULL;
+	struct kvlist kv;
 
-	while(i < npb->strLen) {
-		while(i < npb->strLen && npb->str[i] == ' ') /* skip leading SP */
-			++i;
-		if(i == npb->strLen) { /* OK if just trailing space */
-			if(foundFields == 0)
-				FAIL(LN_WRONGPARSER);
-			break; /* we are done with the loop, all processed */
-		} else {
-			++foundFields;
-		}
-		iName = i;
-		/* TODO: do a stricter check? ... but we don't have a spec */
-		while(i < npb->strLen && npb->str[i] != ':') {
-			++i;
-		}
-		if(i+1 >= npb->strLen || npb->str[i] != ':')
-			FAIL(LN_WRONGPARSER);
-		lenName = i - iName;
-		++i; /* skip ':' */
-
-		while(i < npb->strLen && npb->str[i] == ' ') /* skip leading SP */
-			++i;
-		iValue = i;
-		while(i < npb->strLen && npb->str[i] != ';') {
-			++i;
-		}
-		if(i+1 > npb->strLen || npb->str[i] != ';')
-			FAIL(LN_WRONGPARSER);
-		lenValue = i - iValue;
-		++i; /* skip ';' */
-
-		if(value != NULL) {
-			CHKN(name = malloc(sizeof(char) * (lenName + 1)));
-			memcpy(name, npb->str+iName, lenName);
-			name[lenName] = '\0';
-			CHKN(val = malloc(sizeof(char) * (lenValue + 1)));
-			memcpy(val, npb->str+iValue, lenValue);
-			val[lenValue] = '\0';
-			if(*value == NULL)
-				CHKN(*value = json_object_new_object());
-			json_object *json;
-			CHKN(json = json_object_new_string(val));
-			json_object_object_add(*value, name, json);
-			free(name); name = NULL;
-			free(val); val = NULL;
-		}
-	}
+	kvInit(&kv);
+	/* TODO: do a stricter check on names? ... but we don't have a spec */
+	CHKR(kvTokenize(npb, &kvCheckpointLEA, &i, (value == NULL) ? NULL : &kv));
 
 	/* success, persist */
 	*parsed =  i - *offs;
 	r = 0; /* success */
 
+	if(value != NULL && kv.n > 0) {
+		CHKN(*value = json_object_new_object());
+		CHKR(kvToJSON(npb, &kvCheckpointLEA, &kv, *value));
+	}
+
 done:
-	free(name);
-	free(val);
 	if(r != 0 && value != NULL && *value != NULL) {
 		json_object_put(*value);
-		value = NULL;
+		*value = NULL;
 	}
+	kvFree(&kv);
 	return r;
 }
 
@@ -2555,8 +2921,70 @@ chkNoDupeDotInParserDefs(ln_ctx ctx, struct json_object *parsers)
 	return r;
 }
 
+/* does the (not yet optimized) pdag have a field named "."? */
+static int
+pdagHasDotField(const struct ln_pdag *const dag)
+{
+	for(int i = 0 ; i < dag->nparsers ; ++i) {
+		const ln_parser_t *const prs = dag->parsers + i;
+		if(prs->name != NULL && prs->name[0] == '.' && prs->name[1] == '\0')
+			return 1;
+		if(prs->node != NULL && pdagHasDotField(prs->node))
+			return 1;
+	}
+	return 0;
+}
+
+/* create the array element for one repetition from the spans collected
+ * from index base on. A field named "." provides the element value
+ * directly. If there is a single such field, which is the usual case,
+ * no container object is needed at all.
+ */
+static int
+repeatElement(npb_t *const npb, struct data_Repeat *const data, const size_t base,
+	struct json_object **const elem)
+{
+	int r = 0;
+	struct json_object *container = NULL;
+	struct json_object *dotval;
+
+	*elem = NULL;
+	if(data->hasDotField && npb->nspans == base + 1) {
+		struct npb_span *const span = npb->spans + base;
+		const char *const name = span->prs->name;
+		if(   name[0] == '.' && name[1] == '\0'
+		   && (span->value == NULL || json_object_get_type(span->value) != json_type_object)) {
+			if(span->value == NULL) {
+				CHKN(*elem = json_object_new_string_len(npb->str + span->offs, span->len));
+			} else {
+				*elem = span->value;
+				span->value = NULL;
+			}
+			goto done;
+		}
+	}
+
+	CHKN(container = json_object_new_object());
+	CHKR(ln_npbSpansToJSON(npb, data->parser, base, container));
+	if(data->hasDotField && json_object_object_get_ex(container, ".", &dotval)) {
+		*elem = json_object_get(dotval);
+		json_object_put(container);
+	} else {
+		*elem = container;
+	}
+	container = NULL;
+done:
+	if(container != NULL)
+		json_object_put(container);
+	ln_npbDropSpans(npb, base);
+	return r;
+}
+
 /**
  * "repeat" special parser.
+ * The parser and while parts are normalized in span mode, so that the
+ * fields are only turned into json if they are actually needed, and
+ * then directly into their final place.
  */
 PARSER_Parse(Repeat)
 	struct data_Repeat *const data = (struct data_Repeat*) pdata;
@@ -2565,18 +2993,25 @@ PARSER_Parse(Repeat)
 	size_t lastKnownGood = strtoffs;
 	struct json_object *json_arr = NULL;
 	const size_t parsedTo_save = npb->parsedTo;
+	const int spanMode_save = npb->spanMode;
+	const size_t spanBase = npb->nspans;
 
+	npb->spanMode = 1;
 	do {
-		struct json_object *parsed_value = json_object_new_object();
-		r = ln_normalizeRec(npb, data->parser, strtoffs, 1,
-				    parsed_value, &endNode);
+		struct json_object *elem = NULL;
+		r = ln_normalizeRec(npb, data->parser, strtoffs, 1, NULL, &endNode);
 		strtoffs = npb->parsedTo;
-		LN_DBGPRINTF(npb->ctx, "repeat parser returns %d, parsed %zu, json: %s",
-			r, npb->parsedTo, json_object_to_json_string(parsed_value));
+		LN_DBGPRINTF(npb->ctx, "repeat parser returns %d, parsed %zu, fields %zu",
+			r, npb->parsedTo, npb->nspans - spanBase);
+		if(r == 0 && value != NULL) {
+			r = repeatElement(npb, data, spanBase, &elem);
+		} else {
+			ln_npbDropSpans(npb, spanBase);
+		}
 
 		if(r != 0) {
-			json_object_put(parsed_value);
-			if(data->permitMismatchInParser) {
+			/* running out of budget is not a mismatch */
+			if(data->permitMismatchInParser && r != LN_NOMEM && !npb->budgetExceeded) {
 				strtoffs = lastKnownGood; /* go back to final match */
 				LN_DBGPRINTF(npb->ctx, "mismatch in repeat, "
 					"parse ptr back to %zd", strtoffs);
@@ -2586,55 +3021,39 @@ PARSER_Parse(Repeat)
 			}
 		}
 
-		if(json_arr == NULL) {
-			json_arr = json_object_new_array();
-		}
-
-		/* check for name=".", which means we need to place the
-		 * value only into to array. As we do not have direct
-		 * access to the key, we loop over our result as a work-
-		 * around.
-		 */
-		struct json_object *toAdd = parsed_value;
-		struct json_object_iterator it = json_object_iter_begin(parsed_value);
-		struct json_object_iterator itEnd = json_object_iter_end(parsed_value);
-		while (!json_object_iter_equal(&it, &itEnd)) {
-			const char *key = json_object_iter_peek_name(&it);
-			struct json_object *const val = json_object_iter_peek_value(&it);
-			if(key[0] == '.' && key[1] == '\0') {
-				json_object_get(val); /* inc refcount! */
-				toAdd = val;
+		if(elem != NULL) {
+			if(json_arr == NULL) {
+				CHKN(json_arr = json_object_new_array());
 			}
-			json_object_iter_next(&it);
+			json_object_array_add(json_arr, elem);
 		}
 
-		json_object_array_add(json_arr, toAdd);
-		if(toAdd != parsed_value)
-			json_object_put(parsed_value);
-		LN_DBGPRINTF(npb->ctx, "arr: %s", json_object_to_json_string(json_arr));
-
 		/* now check if we shall continue */
 		npb->parsedTo = 0;
 		lastKnownGood = strtoffs; /* record pos in case of fail in while */
 		r = ln_normalizeRec(npb, data->while_cond, strtoffs, 1, NULL, &endNode);
+		ln_npbDropSpans(npb, spanBase);
 		LN_DBGPRINTF(npb->ctx, "repeat while returns %d, parsed %zu",
 			r, npb->parsedTo);
 		if(r == 0)
 			strtoffs = npb->parsedTo;
 	} while(r == 0);
+	if(npb->budgetExceeded) {
+		r = LN_BUDGET_EXCEEDED;
+		goto done;
+	}
 
 success:
 	/* success, persist */
 	*parsed = strtoffs - *offs;
-	if(value == NULL) {
-		json_object_put(json_arr);
-	} else {
+	if(value != NULL)
 		*value = json_arr;
-	}
-	npb->parsedTo = parsedTo_save;
+	json_arr = NULL;
 	r = 0; /* success */
 done:
-	if(r != 0 && json_arr != NULL) {
+	npb->spanMode = spanMode_save;
+	npb->parsedTo = parsedTo_save;
+	if(json_arr != NULL) {
 		json_object_put(json_arr);
 	}
 	return r;
@@ -2662,6 +3081,7 @@ PARSER_Construct(Repeat)
 			json_object_get(val); /* prevent free in pdagAddParser */
 			CHKR(ln_pdagAddParser(ctx, &endnode, val));
 			endnode->flags.isTerminal = 1;
+			data->hasDotField = pdagHasDotField(data->parser);
 		} else if(!strcmp(key, "while")) {
 			endnode = data->while_cond = ln_newPDAG(ctx); 
 			json_object_get(val); /* prevent free in pdagAddParser */
@@ -2695,6 +3115,10 @@ PARSER_Destruct(Repeat)
 		ln_pdagDelete(data->while_cond);
 	free(pdata);
 }
+PARSER_DataSize(Repeat)
+{
+	return sizeof(struct data_Repeat);
+}
 
 
 /* string escaping modes */
@@ -2702,6 +3126,9 @@ PARSER_Destruct(Repeat)
 #define ST_ESC_BACKSLASH 1
 #define ST_ESC_DOUBLE 2
 #define ST_ESC_BOTH 3
+struct str_charset {
+	uint8_t bits[32];
+};
 struct data_String {
 	enum { ST_QUOTE_AUTO = 0, ST_QUOTE_NONE = 1, ST_QUOTE_REQD = 2 }
 		quoteMode;
@@ -2711,23 +3138,104 @@ struct data_String {
 	} flags;
 	char qchar_begin;
 	char qchar_end;
-	char perm_chars[256]; // TODO: make this bit-wise, so we need  only 32 bytes
+	unsigned char vecscan;	/**< use vectorized run scanning? */
+	struct str_charset perm_chars;	/**< permitted chars */
+	struct str_charset run_chars[2]; /**< chars not needing special handling,
+					   * [0] outside, [1] inside quotes */
 };
+/* character set as bitmap. The layout is chosen so that it can directly
+ * be used as lookup table for nibble-based vectorized class matching:
+ * char c is member of the set if bit ((c >> 4) & 7) of
+ * bits[(c >> 7) * 16 + (c & 0x0f)] is set.
+ */
 static inline void
-stringSetPermittedChar(struct data_String *const data, char c, int val)
+charsetSet(struct str_charset *const cs, const unsigned char c, const int val)
+{
+	const unsigned idx = (c >> 7) * 16 + (c & 0x0f);
+	const uint8_t mask = 1 << ((c >> 4) & 7);
+	if(val)
+		cs->bits[idx] |= mask;
+	else
+		cs->bits[idx] &= ~mask;
+}
+static inline int
+charsetIsMember(const struct str_charset *const cs, const unsigned char c)
+{
+	return (cs->bits[(c >> 7) * 16 + (c & 0x0f)] >> ((c >> 4) & 7)) & 1;
+}
+#ifdef HAVE_SSSE3_CHARSET_SCAN
+/* skip all chars which are member of cs, 16 at a time. Returns the
+ * position of the first non-member or a position less than 16 bytes
+ * away from len, where the caller must continue with the scalar scan.
+ */
+__attribute__((target("ssse3")))
+static size_t
+charsetSkipSSSE3(const struct str_charset *const cs,
+	const char *const str, size_t i, const size_t len)
 {
-#if 0
-	const int i = (unsigned) c / 8;
-	const int shft = (unsigned) c % 8;
-	const unsigned mask = ~(1 << shft);
-	perm_arr[i] = (perm_arr[i] & (0xff 
+	const __m128i tbl_lo = _mm_loadu_si128((const __m128i*) cs->bits);
+	const __m128i tbl_hi = _mm_loadu_si128((const __m128i*) (cs->bits + 16));
+	const __m128i bittab = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+					     1, 2, 4, 8, 16, 32, 64, -128);
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	const __m128i bit8 = _mm_set1_epi8(0x08);
+	while(i + 16 <= len) {
+		const __m128i v = _mm_loadu_si128((const __m128i*) (str + i));
+		const __m128i lo = _mm_and_si128(v, nibble);
+		const __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+		const __m128i isHigh = _mm_cmpeq_epi8(_mm_and_si128(hi, bit8), bit8);
+		const __m128i row = _mm_or_si128(
+			_mm_and_si128(isHigh, _mm_shuffle_epi8(tbl_hi, lo)),
+			_mm_andnot_si128(isHigh, _mm_shuffle_epi8(tbl_lo, lo)));
+		const __m128i bit = _mm_shuffle_epi8(bittab, hi);
+		const int member = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(row, bit), bit));
+		if(member != 0xffff)
+			return i + __builtin_ctz(~member);
+		i += 16;
+	}
+	return i;
+}
 #endif
-	data->perm_chars[(unsigned)c] = val;
+/* skip all chars which are member of cs. Returns position of first
+ * non-member or len, if there is none.
+ */
+static inline size_t
+charsetSkip(const struct str_charset *const cs, const int vecscan,
+	const char *const str, size_t i, const size_t len)
+{
+#ifdef HAVE_SSSE3_CHARSET_SCAN
+	if(vecscan)
+		i = charsetSkipSSSE3(cs, str, i, len);
+#else
+	(void) vecscan;
+#endif
+	while(i < len && charsetIsMember(cs, (unsigned char) str[i]))
+		++i;
+	return i;
+}
+static inline void
+stringSetPermittedChar(struct data_String *const data, char c, int val)
+{
+	charsetSet(&data->perm_chars, (unsigned char) c, val);
 }
 static inline int
 stringIsPermittedChar(struct data_String *const data, char c)
 {
-	return data->perm_chars[(unsigned)c];
+	return charsetIsMember(&data->perm_chars, (unsigned char) c);
+}
+/* compute the sets of chars that can be consumed without any further
+ * checks. Must be called after all options are processed.
+ */
+static void
+stringBuildRunChars(struct data_String *const data)
+{
+	for(int q = 0 ; q < 2 ; ++q) {
+		data->run_chars[q] = data->perm_chars;
+		if(data->flags.esc_md == ST_ESC_BACKSLASH || data->flags.esc_md == ST_ESC_BOTH)
+			charsetSet(&data->run_chars[q], '\\', 0);
+	}
+	charsetSet(&data->run_chars[0], ' ', 0);
+	charsetSet(&data->run_chars[1], (unsigned char) data->qchar_end, 0);
 }
 static void
 stringAddPermittedCharArr(struct data_String *const data,
@@ -2823,6 +3331,11 @@ PARSER_Parse(String)
 
 	/* scan string */
 	while(i < npb->strLen) {
+		/* consume run of ordinary chars in one sweep */
+		i = charsetSkip(&data->run_chars[bHaveQuotes], data->vecscan,
+			npb->str, i, npb->strLen);
+		if(i == npb->strLen)
+			break;
 		if(bHaveQuotes) {
 			if(npb->str[i] == data->qchar_end) {
 				if(data->flags.esc_md == ST_ESC_DOUBLE
@@ -2921,7 +3434,10 @@ PARSER_Construct(String)
 	data->flags.esc_md = ST_ESC_BOTH;
 	data->qchar_begin = '"';
 	data->qchar_end = '"';
-	memset(data->perm_chars, 0xff, sizeof(data->perm_chars));
+	memset(&data->perm_chars, 0xff, sizeof(data->perm_chars));
+#ifdef HAVE_SSSE3_CHARSET_SCAN
+	data->vecscan = __builtin_cpu_supports("ssse3") ? 1 : 0;
+#endif
 	
 	struct json_object_iterator it = json_object_iter_begin(json);
 	struct json_object_iterator itEnd = json_object_iter_end(json);
@@ -2977,7 +3493,7 @@ PARSER_Construct(String)
 			}
 			data->qchar_end = *optval;
 		} else if(!strcasecmp(key, "matching.permitted")) {
-			memset(data->perm_chars, 0x00, sizeof(data->perm_chars));
+			memset(&data->perm_chars, 0x00, sizeof(data->perm_chars));
 			if(json_object_is_type(val, json_type_string)) {
 				stringAddPermittedChars(data, val);
 			} else if(json_object_is_type(val, json_type_array)) {
@@ -2996,6 +3512,7 @@ PARSER_Construct(String)
 
 	if(data->quoteMode == ST_QUOTE_NONE)
 		data->flags.esc_md = ST_ESC_NONE;
+	stringBuildRunChars(data);
 	*pdata = data;
 done:
 	return r;
@@ -3004,3 +3521,7 @@ PARSER_Destruct(String)
 {
 	free(pdata);
 }
+PARSER_DataSize(String)
+{
+	return sizeof(struct data_String);
+}
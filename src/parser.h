@@ -44,9 +44,10 @@
 #define PARSERDEF(parser) \
 	int ln_construct##parser(ln_ctx ctx, json_object *const json, void **pdata); \
 	int ln_v2_parse##parser(npb_t *npb, size_t *offs, void *const, size_t *parsed, struct json_object **value); \
-	void ln_destruct##parser(ln_ctx ctx, void *const pdata);
+	void ln_destruct##parser(ln_ctx ctx, void *const pdata); \
+	size_t ln_dataSize##parser(void *const pdata);
 
-PARSERDEF_NO_DATA(RFC5424Date);
+PARSERDEF(RFC5424Date);
 PARSERDEF_NO_DATA(RFC3164Date);
 PARSERDEF_NO_DATA(Number);
 PARSERDEF_NO_DATA(Float);
@@ -68,13 +69,13 @@ PARSERDEF_NO_DATA(ISODate);
 PARSERDEF_NO_DATA(Time12hr);
 PARSERDEF_NO_DATA(Time24hr);
 PARSERDEF_NO_DATA(Duration);
-PARSERDEF_NO_DATA(IPv4);
+PARSERDEF(IPv4);
 PARSERDEF_NO_DATA(IPv6);
 PARSERDEF_NO_DATA(JSON);
 PARSERDEF_NO_DATA(CEESyslog);
 PARSERDEF_NO_DATA(v2IPTables);
 PARSERDEF_NO_DATA(CiscoInterfaceSpec);
-PARSERDEF_NO_DATA(MAC48);
+PARSERDEF(MAC48);
 PARSERDEF_NO_DATA(CEF);
 PARSERDEF_NO_DATA(CheckpointLEA);
 PARSERDEF_NO_DATA(NameValue);
@@ -85,10 +86,15 @@ PARSERDEF_NO_DATA(NameValue);
 int ln_combineData_Literal(void *const org, void *const add);
 
 /* definitions for friends */
+struct data_Literal {
+	const char *lit;	/**< literal text */
+	size_t len;		/**< length of lit */
+};
 struct data_Repeat {
 	ln_pdag *parser;
 	ln_pdag *while_cond;
 	int permitMismatchInParser;
+	int hasDotField;	/**< is there a field named "." in parser? */
 };
 
 #endif /* #ifndef LIBLOGNORM_PARSER_H_INCLUDED */
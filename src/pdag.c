@@ -14,7 +14,12 @@
 #include <string.h>
 #include <assert.h>
 #include <ctype.h>
+#include <time.h>
+#include <inttypes.h>
 #include <libestr.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 #include "liblognorm.h"
 #include "v1_liblognorm.h"
@@ -26,6 +31,7 @@
 #include "internal.h"
 #include "parser.h"
 #include "helpers.h"
+#include "enc.h"
 
 void ln_displayPDAGComponentAlternative(struct ln_pdag *dag, int level);
 void ln_displayPDAGComponent(struct ln_pdag *dag, int level);
@@ -43,6 +49,39 @@ int advstats_max_lit_parser_calls = 0;
 int advstats_lit_parser_calls[ADVSTATS_MAX_ENTITIES];
 #endif
 
+/* runtime profile counters may be updated by multiple threads */
+#define PROF_ADD(var, n) __atomic_fetch_add(&(var), (n), __ATOMIC_RELAXED)
+#define PROF_GET(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+
+static inline uint64_t
+profNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* we use the TSC where available, as it is much cheaper to read than
+ * the clock. Ticks are converted to ns only when the profile is exported.
+ */
+static inline uint64_t
+profTicks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return profNs();
+#endif
+}
+
+/* the profile counters of a node, NULL if there are none */
+static inline struct ln_pdag_nodeprof *
+npbNodeProf(const npb_t *const npb, const struct ln_pdag *const dag)
+{
+	return (npb->nodeProf == NULL || !dag->flags.inArena) ? NULL
+		: npb->nodeProf + (dag - npb->profArena);
+}
+
 /* parser lookup table
  * This is a memory- and cache-optimized way of calling parsers.
  * VERY IMPORTANT: the initialization must be done EXACTLY in the
@@ -58,26 +97,28 @@ int advstats_lit_parser_calls[ADVSTATS_MAX_ENTITIES];
  */
 #ifdef ADVANCED_STATS
 #define PARSER_ENTRY_NO_DATA(identifier, parser, prio) \
-{ identifier, prio, NULL, ln_v2_parse##parser, NULL, 0, 0 }
+{ identifier, prio, NULL, ln_v2_parse##parser, NULL, NULL, 0, 0 }
 #define PARSER_ENTRY(identifier, parser, prio) \
-{ identifier, prio, ln_construct##parser, ln_v2_parse##parser, ln_destruct##parser, 0, 0 }
+{ identifier, prio, ln_construct##parser, ln_v2_parse##parser, ln_destruct##parser, \
+  ln_dataSize##parser, 0, 0 }
 #else
 #define PARSER_ENTRY_NO_DATA(identifier, parser, prio) \
-{ identifier, prio, NULL, ln_v2_parse##parser, NULL }
+{ identifier, prio, NULL, ln_v2_parse##parser, NULL, NULL }
 #define PARSER_ENTRY(identifier, parser, prio) \
-{ identifier, prio, ln_construct##parser, ln_v2_parse##parser, ln_destruct##parser }
+{ identifier, prio, ln_construct##parser, ln_v2_parse##parser, ln_destruct##parser, \
+  ln_dataSize##parser }
 #endif
 static struct ln_parser_info parser_lookup_table[] = {
 	PARSER_ENTRY("literal", Literal, 4),
 	PARSER_ENTRY("repeat", Repeat, 4),
 	PARSER_ENTRY_NO_DATA("date-rfc3164", RFC3164Date, 8),
-	PARSER_ENTRY_NO_DATA("date-rfc5424", RFC5424Date, 8),
+	PARSER_ENTRY("date-rfc5424", RFC5424Date, 8),
 	PARSER_ENTRY_NO_DATA("number", Number, 16),
 	PARSER_ENTRY_NO_DATA("float", Float, 16),
 	PARSER_ENTRY("hexnumber", HexNumber, 16),
 	PARSER_ENTRY_NO_DATA("kernel-timestamp", KernelTimestamp, 16),
 	PARSER_ENTRY_NO_DATA("whitespace", Whitespace, 4),
-	PARSER_ENTRY_NO_DATA("ipv4", IPv4, 4),
+	PARSER_ENTRY("ipv4", IPv4, 4),
 	PARSER_ENTRY_NO_DATA("ipv6", IPv6, 4),
 	PARSER_ENTRY_NO_DATA("word", Word, 32),
 	PARSER_ENTRY_NO_DATA("alpha", Alpha, 32),
@@ -92,7 +133,7 @@ static struct ln_parser_info parser_lookup_table[] = {
 	PARSER_ENTRY_NO_DATA("name-value-list", NameValue, 8),
 	PARSER_ENTRY_NO_DATA("json", JSON, 4),
 	PARSER_ENTRY_NO_DATA("cee-syslog", CEESyslog, 4),
-	PARSER_ENTRY_NO_DATA("mac48", MAC48, 16),
+	PARSER_ENTRY("mac48", MAC48, 16),
 	PARSER_ENTRY_NO_DATA("cef", CEF, 4),
 	PARSER_ENTRY_NO_DATA("checkpoint-lea", CheckpointLEA, 4),
 	PARSER_ENTRY_NO_DATA("v2-iptables", v2IPTables, 4),
@@ -103,6 +144,8 @@ static struct ln_parser_info parser_lookup_table[] = {
 };
 #define NPARSERS (sizeof(parser_lookup_table)/sizeof(struct ln_parser_info))
 #define DFLT_USR_PARSER_PRIO 30000 /**< default priority if user has not specified it */
+#define DISPATCH_MIN_PARSERS 3 /**< min number of parsers at a node to build a dispatch index */
+#define PRSIDX_MIN_PARSERS 8 /**< min number of parsers at a node to build a parser lookup index */
 static inline const char *
 parserName(const prsid_t id)
 {
@@ -114,6 +157,29 @@ parserName(const prsid_t id)
 	return name;
 }
 
+/* priority of a parser of a compiled v1 rulebase (LN_V1C_LOAD, see
+ * samp.c). The v1 engine tries the fields of a node in the order they
+ * were added, then the literal text and "rest" last. If there are
+ * multiple "rest" fields, the one added last wins. Literals with an
+ * explicit priority are part of a field and are ordered like one.
+ * This is done after merging, so identical fields are still shared.
+ * @param[in] pos position at which the parser is added to its node
+ */
+static int
+v1ParserPrio(const ln_parser_t *const prs, int pos)
+{
+	int prio;
+	if(pos > 0x7fff)
+		pos = 0x7fff;
+	if(prs->prsid == PRS_LITERAL && (prs->prio >> 8) == DFLT_USR_PARSER_PRIO)
+		prio = DFLT_USR_PARSER_PRIO + 0x8000;
+	else if(parser_lookup_table[prs->prsid].parser == ln_v2_parseRest)
+		prio = DFLT_USR_PARSER_PRIO + 0xffff - pos;
+	else
+		prio = DFLT_USR_PARSER_PRIO + pos;
+	return (prio << 8) | (prs->prio & 0xff);
+}
+
 prsid_t 
 ln_parserName2ID(const char *const __restrict__ name)
 {
@@ -164,7 +230,7 @@ ln_pdagFindType(ln_ctx ctx, const char *const __restrict__ name, const int bAdd)
 	ctx->type_pdags = newarr;
 	td = ctx->type_pdags + ctx->nTypes;
 	++ctx->nTypes;
-	td->name = strdup(name);
+	td->name = ln_strtabAdd(ctx, name, strlen(name));
 	td->pdag = ln_newPDAG(ctx);
 done:
 	return td;
@@ -190,6 +256,44 @@ ln_pdagClearVisited(ln_ctx ctx)
 	ln_pdagComponentClearVisited(ctx->pdag);
 }
 
+/* check if the value of a parser is always exactly the substring it
+ * matched. If so, there is no need to have the parser create it: we can
+ * do that ourselves, and only if the subtree also matches (so it
+ * it actually goes into the event). This saves lots of alloc/free
+ * calls if we backtrack.
+ */
+static int
+prsValueIsSubstring(const ln_parser_t *const prs)
+{
+	if(prs->prsid == PRS_CUSTOM_TYPE)
+		return 0;
+	int (*const parser)(npb_t *npb, size_t*, void *const, size_t*, struct json_object **)
+		= parser_lookup_table[prs->prsid].parser;
+	/* these only have data if they do not return the text */
+	if(parser == ln_v2_parseIPv4 || parser == ln_v2_parseMAC48
+	   || parser == ln_v2_parseRFC5424Date)
+		return prs->parser_data == NULL;
+	return    parser == ln_v2_parseLiteral
+	       || parser == ln_v2_parseRFC3164Date
+	       || parser == ln_v2_parseNumber
+	       || parser == ln_v2_parseFloat
+	       || parser == ln_v2_parseHexNumber
+	       || parser == ln_v2_parseKernelTimestamp
+	       || parser == ln_v2_parseWhitespace
+	       || parser == ln_v2_parseWord
+	       || parser == ln_v2_parseStringTo
+	       || parser == ln_v2_parseAlpha
+	       || parser == ln_v2_parseCharTo
+	       || parser == ln_v2_parseCharSeparated
+	       || parser == ln_v2_parseRest
+	       || parser == ln_v2_parseQuotedString
+	       || parser == ln_v2_parseISODate
+	       || parser == ln_v2_parseDuration
+	       || parser == ln_v2_parseTime24hr
+	       || parser == ln_v2_parseTime12hr
+	       || parser == ln_v2_parseIPv6;
+}
+
 /**
  * Process a parser defintion. Note that a single defintion can potentially
  * contain many parser instances.
@@ -205,9 +309,18 @@ ln_newParser(ln_ctx ctx,
 	prsid_t prsid;
 	struct ln_type_pdag *custType = NULL;
 	const char *name = NULL;
-	const char *textconf = json_object_to_json_string(prscnf);
+	es_str_t *conf = NULL;
 	int parserPrio;
 
+	/* configs are compared as strings to find identical parsers,
+	 * so member order must not matter
+	 */
+	if(   (conf = es_newStr(128)) == NULL
+	   || ln_fmtConfToJSONBuf(prscnf, &conf) != 0) {
+		LN_DBGPRINTF(ctx, "lnNewParser: alloc config string failed");
+		goto done;
+	}
+
 	json_object_object_get_ex(prscnf, "type", &json);
 	if(json == NULL) {
 		ln_errprintf(ctx, 0, "parser type missing in config: %s",
@@ -236,7 +349,9 @@ ln_newParser(ln_ctx ctx,
 	if(json == NULL || !strcmp(json_object_get_string(json), "-")) {
 		name = NULL;
 	} else {
-		name = strdup(json_object_get_string(json));
+		const char *const jname = json_object_get_string(json);
+		if((name = ln_strtabAdd(ctx, jname, strlen(jname))) == NULL)
+			goto done;
 	}
 
 	json_object_object_get_ex(prscnf, "priority", &json);
@@ -255,7 +370,6 @@ ln_newParser(ln_ctx ctx,
 	/* got all data items */
 	if((node = calloc(1, sizeof(ln_parser_t))) == NULL) {
 		LN_DBGPRINTF(ctx, "lnNewParser: alloc node failed");
-		free((void*)name);
 		goto done;
 	}
 
@@ -263,7 +377,12 @@ ln_newParser(ln_ctx ctx,
 	node->prio = ((assignedPrio << 8) & 0xffffff00) | (parserPrio & 0xff);
 	node->name = name;
 	node->prsid = prsid;
-	node->conf = strdup(textconf);
+	node->conf = ln_strtabAdd(ctx, (char*) es_getBufAddr(conf), es_strlen(conf));
+	if(node->conf == NULL) {
+		free(node);
+		node = NULL;
+		goto done;
+	}
 	if(prsid == PRS_CUSTOM_TYPE) {
 		node->custType = custType;
 	} else {
@@ -271,7 +390,10 @@ ln_newParser(ln_ctx ctx,
 			parser_lookup_table[prsid].construct(ctx, prscnf, &node->parser_data);
 		}
 	}
+	node->deferValue = prsValueIsSubstring(node);
 done:
+	if(conf != NULL)
+		es_deleteStr(conf);
 	return node;
 }
 
@@ -301,8 +423,6 @@ pdagDeletePrs(ln_ctx ctx, ln_parser_t *const __restrict__ prs)
 	// cannot simply delete the next node! (refcount? something else?)
 	if(prs->node != NULL)
 		ln_pdagDelete(prs->node);
-	free((void*)prs->name);
-	free((void*)prs->conf);
 	if(prs->parser_data != NULL)
 		parser_lookup_table[prs->prsid].destruct(ctx, prs->parser_data);
 }
@@ -320,14 +440,22 @@ ln_pdagDelete(struct ln_pdag *const __restrict__ pdag)
 
 	if(pdag->tags != NULL)
 		json_object_put(pdag->tags);
+	ln_annotFreeCompiled(pdag->annots, pdag->nannots);
+	if(pdag->mockup != NULL)
+		json_object_put(pdag->mockup);
+	if(pdag->location != NULL)
+		json_object_put(pdag->location);
 
 	for(int i = 0 ; i < pdag->nparsers ; ++i) {
 		pdagDeletePrs(pdag->ctx, pdag->parsers+i);
 	}
-	free(pdag->parsers);
+	if(!pdag->flags.prsInArena)
+		free(pdag->parsers);
+	free(pdag->dispatch);
+	free(pdag->prsIdx);
 	free((void*)pdag->rb_id);
-	free((void*)pdag->rb_file);
-	free(pdag);
+	if(!pdag->flags.inArena)
+		free(pdag);
 done:	return;
 }
 
@@ -378,17 +506,155 @@ qsort_parserCmp(const void *v1, const void *v2)
 	return p1->prio - p2->prio;
 }
 
+/* check if parsers are already in priority order. qsort() is not
+ * stable, so we must not re-sort an already sorted set (this happens
+ * when a compiled rulebase is loaded).
+ */
+static int
+parsersSorted(const struct ln_pdag *const dag)
+{
+	for(int i = 1 ; i < dag->nparsers ; ++i)
+		if(dag->parsers[i-1].prio > dag->parsers[i].prio)
+			return 0;
+	return 1;
+}
+
+/* obtain the set of bytes the parser can potentially start a match with.
+ * This is used for the first-byte dispatch index, so the set must
+ * NEVER miss a byte the parser could actually start with (including
+ * oddities like an RFC5424 date without year). When in doubt,
+ * a parser must be treated as unrestricted.
+ * @param[out] set must be 256 bytes, set[c] is nonzero if c can start a match
+ * @return 1 if the parser is restricted, 0 if it may start with any byte
+ */
+static int
+prsStartSet(ln_ctx ctx, const ln_parser_t *const prs, unsigned char *const set)
+{
+	memset(set, 0, 256);
+	if(prs->prsid == PRS_CUSTOM_TYPE)
+		return 0;
+
+	int (*const parser)(npb_t *npb, size_t*, void *const, size_t*, struct json_object **)
+		= parser_lookup_table[prs->prsid].parser;
+	if(prs->prsid == PRS_LITERAL) {
+		const char *const lit = ln_DataForDisplayLiteral(ctx, prs->parser_data);
+		if(lit[0] == '\0')
+			return 0; /* empty literal matches everywhere */
+		set[(unsigned char) lit[0]] = 1;
+	} else if(   parser == ln_v2_parseNumber
+		  || parser == ln_v2_parseIPv4
+		  || parser == ln_v2_parseISODate
+		  || parser == ln_v2_parseTime24hr
+		  || parser == ln_v2_parseTime12hr
+		  || parser == ln_v2_parseDuration) {
+		for(int c = '0' ; c <= '9' ; ++c)
+			set[c] = 1;
+	} else if(parser == ln_v2_parseFloat || parser == ln_v2_parseRFC5424Date) {
+		for(int c = '0' ; c <= '9' ; ++c)
+			set[c] = 1;
+		set['-'] = 1;
+		if(parser == ln_v2_parseFloat)
+			set['.'] = 1;
+	} else if(parser == ln_v2_parseHexNumber) {
+		set['0'] = 1;
+	} else if(parser == ln_v2_parseMAC48 || parser == ln_v2_parseIPv6) {
+		for(int c = 0 ; c < 256 ; ++c)
+			set[c] = isxdigit(c) ? 1 : 0;
+		if(parser == ln_v2_parseIPv6)
+			set[':'] = 1;
+	} else if(parser == ln_v2_parseWhitespace) {
+		for(int c = 0 ; c < 256 ; ++c)
+			set[c] = isspace(c) ? 1 : 0;
+	} else if(parser == ln_v2_parseRFC3164Date) {
+		for(const char *m = "JFMASONDjfmasond" ; *m ; ++m)
+			set[(unsigned char) *m] = 1;
+	} else if(parser == ln_v2_parseKernelTimestamp) {
+		set['['] = 1;
+	} else if(parser == ln_v2_parseQuotedString) {
+		set['"'] = 1;
+	} else if(parser == ln_v2_parseJSON) {
+		set['{'] = 1;
+		set[']'] = 1; /* same check as inside the parser */
+	} else if(parser == ln_v2_parseCEESyslog) {
+		set['@'] = 1;
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+/* build first-byte dispatch index for a node. Must be called after the
+ * parsers have been sorted, as the index lists preserve the order of
+ * the parser table. If the index is not worth it (too few parsers or
+ * none that can be excluded by looking at the first byte), no index
+ * is built and the node is processed by walking all of its parsers.
+ */
+static int
+pdagBuildDispatch(ln_ctx ctx, struct ln_pdag *const dag)
+{
+	int r = 0;
+	unsigned char *sets = NULL;
+	struct ln_pdag_dispatch *dispatch = NULL;
+	size_t nentries = 0;
+	int nrestricted = 0;
+
+	free(dag->dispatch); /* may be present if node is visited multiple times */
+	dag->dispatch = NULL;
+	if(dag->nparsers < DISPATCH_MIN_PARSERS)
+		goto done;
+
+	CHKN(sets = malloc(dag->nparsers * 256));
+	for(int i = 0 ; i < dag->nparsers ; ++i) {
+		unsigned char *const set = sets + i * 256;
+		if(prsStartSet(ctx, dag->parsers+i, set)) {
+			++nrestricted;
+		} else {
+			memset(set, 1, 256);
+		}
+		for(int c = 0 ; c < 256 ; ++c)
+			nentries += set[c];
+	}
+	if(nrestricted == 0)
+		goto done;
+
+	if(dag->nparsers > UINT16_MAX || nentries > UINT16_MAX)
+		goto done; /* does not fit into the index */
+
+	CHKN(dispatch = malloc(sizeof(struct ln_pdag_dispatch) + nentries * sizeof(uint16_t)));
+	size_t n = 0;
+	for(int c = 0 ; c < 256 ; ++c) {
+		dispatch->offs[c] = (uint16_t) n;
+		for(int i = 0 ; i < dag->nparsers ; ++i) {
+			if(sets[i * 256 + c])
+				dispatch->prs[n++] = (uint16_t) i;
+		}
+	}
+	dispatch->offs[256] = (uint16_t) n;
+	dag->dispatch = dispatch;
+	LN_DBGPRINTF(ctx, "dispatch index for %p: %d parsers, %d restricted, %zu entries",
+		dag, dag->nparsers, nrestricted, nentries);
+
+done:
+	free(sets);
+	return r;
+}
+
 static int
 ln_pdagComponentOptimize(ln_ctx ctx, struct ln_pdag *const dag)
 {
 	int r = 0;
 
+	/* the lookup index is only needed while building, and the parser
+	 * table is reordered now
+	 */
+	free(dag->prsIdx);
+	dag->prsIdx = NULL;
 for(int i = 0 ; i < dag->nparsers ; ++i) { /* TODO: remove when confident enough */
 	ln_parser_t *prs = dag->parsers+i;
 	LN_DBGPRINTF(ctx, "pre sort, parser %d:%s[%d]", i, prs->name, prs->prio);
 }
 	/* first sort parsers in priority order */
-	if(dag->nparsers > 1) {
+	if(dag->nparsers > 1 && !parsersSorted(dag)) {
 		qsort(dag->parsers, dag->nparsers, sizeof(ln_parser_t), qsort_parserCmp);
 	}
 for(int i = 0 ; i < dag->nparsers ; ++i) { /* TODO: remove when confident enough */
@@ -407,6 +673,10 @@ for(int i = 0 ; i < dag->nparsers ; ++i) { /* TODO: remove when confident enough
 
 		ln_pdagComponentOptimize(ctx, prs->node);
 	}
+
+	/* done after path compaction, so that literals are final */
+	CHKR(pdagBuildDispatch(ctx, dag));
+done:
 	return r;
 }
 
@@ -495,6 +765,257 @@ ln_pdagComponentSetIDs(ln_ctx ctx, struct ln_pdag *const dag, const char *prefix
 	}
 }
 
+/* work data for freezing the pdag */
+struct pdag_freeze {
+	struct ln_pdag **nodes;		/**< all nodes, in DFS order */
+	size_t nnodes;
+	size_t maxnodes;
+	size_t nparsers;		/**< total number of parser entries */
+};
+struct pdag_freeze_map {
+	const struct ln_pdag *old;
+	struct ln_pdag *new;
+};
+
+static int
+ln_pdagFreezeCollect(struct pdag_freeze *const fz, struct ln_pdag *const dag)
+{
+	int r = 0;
+	if(dag->flags.visited)
+		goto done;
+	dag->flags.visited = 1;
+	if(fz->nnodes == fz->maxnodes) {
+		const size_t newmax = (fz->maxnodes == 0) ? 256 : 2 * fz->maxnodes;
+		struct ln_pdag **const newnodes = realloc(fz->nodes, newmax * sizeof(struct ln_pdag*));
+		CHKN(newnodes);
+		fz->nodes = newnodes;
+		fz->maxnodes = newmax;
+	}
+	fz->nodes[fz->nnodes++] = dag;
+	fz->nparsers += dag->nparsers;
+	for(int i = 0 ; i < dag->nparsers ; ++i)
+		CHKR(ln_pdagFreezeCollect(fz, dag->parsers[i].node));
+done:	return r;
+}
+
+static int
+qsort_freezeMapCmp(const void *v1, const void *v2)
+{
+	const struct pdag_freeze_map *const m1 = (const struct pdag_freeze_map *) v1;
+	const struct pdag_freeze_map *const m2 = (const struct pdag_freeze_map *) v2;
+	return (m1->old < m2->old) ? -1 : (m1->old > m2->old);
+}
+
+static struct ln_pdag *
+ln_pdagFreezeLookup(const struct pdag_freeze_map *const map, const size_t n,
+	const struct ln_pdag *const old)
+{
+	const struct pdag_freeze_map key = { old, NULL };
+	const struct pdag_freeze_map *const m =
+		bsearch(&key, map, n, sizeof(struct pdag_freeze_map), qsort_freezeMapCmp);
+	return m->new;
+}
+
+/**
+ * pdag optimizer step: freeze the graph.
+ * Nodes are individually allocated while the pdag is built, and so
+ * are their parser tables. So a walk through the graph jumps all over
+ * the heap. This step copies all nodes of all components (in DFS
+ * order, which is the order in which normalization usually walks them)
+ * and their parser tables into a single arena. The arena is owned by
+ * the context. If the graph is frozen again (e.g. because another
+ * rulebase was loaded), a new arena replaces the old one. Nodes and
+ * tables are flagged, so that they are not individually free'd or
+ * realloc'ed.
+ */
+static int
+ln_pdagFreeze(ln_ctx ctx)
+{
+	int r = 0;
+	struct pdag_freeze fz;
+	struct pdag_freeze_map *map = NULL;
+	char *arena = NULL;
+	struct ln_pdag_nodeprof *nodeProf = NULL;
+
+	memset(&fz, 0, sizeof(fz));
+	ln_pdagClearVisited(ctx);
+	for(int i = 0 ; i < ctx->nTypes ; ++i)
+		CHKR(ln_pdagFreezeCollect(&fz, ctx->type_pdags[i].pdag));
+	CHKR(ln_pdagFreezeCollect(&fz, ctx->pdag));
+
+	CHKN(map = malloc(fz.nnodes * sizeof(struct pdag_freeze_map)));
+	CHKN(arena = malloc(fz.nnodes * sizeof(struct ln_pdag) + fz.nparsers * sizeof(ln_parser_t)));
+	if(ctx->nodeProf != NULL)
+		CHKN(nodeProf = calloc(fz.nnodes, sizeof(struct ln_pdag_nodeprof)));
+	struct ln_pdag *const newnodes = (struct ln_pdag *) arena;
+	ln_parser_t *prstab = (ln_parser_t *) (newnodes + fz.nnodes);
+	for(size_t k = 0 ; k < fz.nnodes ; ++k) {
+		map[k].old = fz.nodes[k];
+		map[k].new = newnodes + k;
+	}
+	qsort(map, fz.nnodes, sizeof(struct pdag_freeze_map), qsort_freezeMapCmp);
+
+	for(size_t k = 0 ; k < fz.nnodes ; ++k) {
+		const struct ln_pdag *const old = fz.nodes[k];
+		struct ln_pdag *const dag = newnodes + k;
+		memcpy(dag, old, sizeof(struct ln_pdag));
+		dag->flags.visited = 0;
+		dag->flags.inArena = 1;
+		dag->flags.prsInArena = 0;
+		if(dag->nparsers > 0) {
+			memcpy(prstab, old->parsers, dag->nparsers * sizeof(ln_parser_t));
+			dag->parsers = prstab;
+			dag->flags.prsInArena = 1;
+			prstab += dag->nparsers;
+		}
+		for(int i = 0 ; i < dag->nparsers ; ++i) {
+			dag->parsers[i].node = ln_pdagFreezeLookup(map, fz.nnodes, dag->parsers[i].node);
+		}
+	}
+
+	for(int i = 0 ; i < ctx->nTypes ; ++i)
+		ctx->type_pdags[i].pdag = ln_pdagFreezeLookup(map, fz.nnodes, ctx->type_pdags[i].pdag);
+	ctx->pdag = ln_pdagFreezeLookup(map, fz.nnodes, ctx->pdag);
+
+	/* per-node profile counters follow their nodes to the new order */
+	if(nodeProf != NULL) {
+		const struct ln_pdag *const oldnodes = (const struct ln_pdag *) ctx->pdagArena;
+		for(size_t k = 0 ; k < fz.nnodes ; ++k) {
+			if(fz.nodes[k]->flags.inArena)
+				nodeProf[k] = ctx->nodeProf[fz.nodes[k] - oldnodes];
+		}
+		free(ctx->nodeProf);
+		ctx->nodeProf = nodeProf;
+		nodeProf = NULL;
+	}
+
+	/* everything moved, so we can now release the old memory */
+	for(size_t k = 0 ; k < fz.nnodes ; ++k) {
+		struct ln_pdag *const old = fz.nodes[k];
+		if(!old->flags.prsInArena)
+			free(old->parsers);
+		if(!old->flags.inArena)
+			free(old);
+	}
+	free(ctx->pdagArena);
+	ctx->pdagArena = arena;
+	ctx->nArenaNodes = fz.nnodes;
+	LN_DBGPRINTF(ctx, "pdag frozen: %zu nodes, %zu parsers", fz.nnodes, fz.nparsers);
+
+done:
+	if(r != 0)
+		free(arena);
+	free(nodeProf);
+	free(map);
+	free(fz.nodes);
+	return r;
+}
+
+/**
+ * pdag optimizer step: precompile annotations.
+ * The tags of a terminal node are fixed, so the annotations to apply
+ * can be resolved once, instead of for each event. As more
+ * annotations may have been loaded since the last run, existing
+ * lists are rebuilt.
+ */
+static int
+ln_pdagComponentCompileAnnots(ln_ctx ctx, struct ln_pdag *const dag)
+{
+	int r = 0;
+	if(dag->flags.visited)
+		goto done;
+	dag->flags.visited = 1;
+	if(dag->tags != NULL) {
+		ln_annotFreeCompiled(dag->annots, dag->nannots);
+		dag->annots = NULL;
+		dag->nannots = 0;
+		CHKR(ln_annotCompile(ctx, dag->tags, &dag->annots, &dag->nannots));
+	}
+	for(int i = 0 ; i < dag->nparsers ; ++i)
+		CHKR(ln_pdagComponentCompileAnnots(ctx, dag->parsers[i].node));
+done:	return r;
+}
+
+/* build the location object for a rule's terminal node */
+static struct json_object *
+newRuleLocation(const struct ln_pdag *const endNode)
+{
+	struct json_object *location;
+	if((location = json_object_new_object()) == NULL)
+		goto done;
+	json_object_object_add(location, "file", json_object_new_string(endNode->rb_file));
+	json_object_object_add(location, "line", json_object_new_int((int)endNode->rb_lineno));
+done:	return location;
+}
+
+/* add a parser to the (not reversed) rule mockup, see add_rule_to_mockup() */
+static int
+mockupAddPrs(es_str_t **str, const ln_parser_t *const prs)
+{
+	int r;
+	if(prs->prsid == PRS_LITERAL) {
+		const struct data_Literal *const lit = prs->parser_data;
+		CHKR(es_addBuf(str, lit->lit, lit->len));
+	} else {
+		CHKR(es_addChar(str, '%'));
+		if(prs->name == NULL) {
+			CHKR(es_addChar(str, '-'));
+		} else {
+			CHKR(es_addBuf(str, prs->name, strlen(prs->name)));
+		}
+		CHKR(es_addChar(str, ':'));
+		CHKR(es_addBuf(str, parserName(prs->prsid), strlen(parserName(prs->prsid))));
+		CHKR(es_addChar(str, '%'));
+	}
+done:	return r;
+}
+
+/**
+ * pdag optimizer step: precompute rule metadata.
+ * If a terminal node can be reached by only one path, and that path
+ * does not contain user-defined types or repeats (which are expanded
+ * in the mockup), the rule mockup is the same for all events. So it
+ * is built here, instead of for each event while walking up the
+ * recursion. The rule location is fixed per terminal node in any
+ * case. This is only done if the respective option is set; if it is
+ * set later, metadata is built on the fly as before.
+ */
+static int
+ln_pdagComponentPrecomputeMeta(ln_ctx ctx, struct ln_pdag *const dag,
+	es_str_t **path, const int isStatic)
+{
+	int r = 0;
+	if(dag->flags.visited)
+		goto done;
+	dag->flags.visited = 1;
+	if(dag->mockup != NULL) {
+		json_object_put(dag->mockup);
+		dag->mockup = NULL;
+	}
+	if(dag->location != NULL) {
+		json_object_put(dag->location);
+		dag->location = NULL;
+	}
+	if(dag->flags.isTerminal) {
+		if((ctx->opts & LN_CTXOPT_ADD_RULE) && isStatic)
+			CHKN(dag->mockup = json_object_new_string_len((char*) es_getBufAddr(*path),
+				es_strlen(*path)));
+		if((ctx->opts & LN_CTXOPT_ADD_RULE_LOCATION) && dag->rb_file != NULL)
+			CHKN(dag->location = newRuleLocation(dag));
+	}
+	const es_size_t lenPath = es_strlen(*path);
+	for(int i = 0 ; i < dag->nparsers ; ++i) {
+		const ln_parser_t *const prs = dag->parsers+i;
+		const int prsStatic = isStatic && prs->node->refcnt == 1
+			&& prs->prsid != PRS_CUSTOM_TYPE && prs->prsid != PRS_REPEAT;
+		if(prsStatic)
+			CHKR(mockupAddPrs(path, prs));
+		CHKR(ln_pdagComponentPrecomputeMeta(ctx, prs->node, path, prsStatic));
+		(*path)->lenStr = lenPath;
+	}
+done:	return r;
+}
+
 /**
  * Optimize the pdag.
  * This includes all components.
@@ -503,6 +1024,7 @@ int
 ln_pdagOptimize(ln_ctx ctx)
 {
 	int r = 0;
+	es_str_t *path = NULL;
 
 	for(int i = 0 ; i < ctx->nTypes ; ++i) {
 		LN_DBGPRINTF(ctx, "optimizing component %s\n", ctx->type_pdags[i].name);
@@ -514,12 +1036,152 @@ ln_pdagOptimize(ln_ctx ctx)
 	ln_pdagComponentOptimize(ctx, ctx->pdag);
 	LN_DBGPRINTF(ctx, "finished optimizing main pdag component");
 	ln_pdagComponentSetIDs(ctx, ctx->pdag, "");
+	ln_pdagClearVisited(ctx);
+	CHKR(ln_pdagComponentCompileAnnots(ctx, ctx->pdag));
+	if(ctx->opts & (LN_CTXOPT_ADD_RULE | LN_CTXOPT_ADD_RULE_LOCATION)) {
+		CHKN(path = es_newStr(256));
+		ln_pdagClearVisited(ctx);
+		CHKR(ln_pdagComponentPrecomputeMeta(ctx, ctx->pdag, &path, 1));
+	}
+	CHKR(ln_pdagFreeze(ctx));
+	if(ctx->opts & LN_CTXOPT_PROFILE)
+		CHKR(ln_pdagNodeProfAlloc(ctx));
+	CHKR(ln_prefilterBuild(ctx));
+	ln_shapeCacheClear(ctx->shapeCache);
 LN_DBGPRINTF(ctx, "---AFTER OPTIMIZATION------------------");
 ln_displayPDAG(ctx);
 LN_DBGPRINTF(ctx, "=======================================");
+done:
+	if(path != NULL)
+		es_deleteStr(path);
 	return r;
 }
 
+/* check if the order of two (adjacent) parsers can be swapped without
+ * changing results. This is the case if at most one of them can match
+ * at any given position: two literals where none is a prefix of the
+ * other or two parsers that must start with different bytes.
+ */
+static int
+prsExclusive(ln_ctx ctx, const ln_parser_t *const p1, const ln_parser_t *const p2)
+{
+	unsigned char set1[256], set2[256];
+
+	if(p1->prsid == PRS_LITERAL && p2->prsid == PRS_LITERAL) {
+		const char *const lit1 = ln_DataForDisplayLiteral(ctx, p1->parser_data);
+		const char *const lit2 = ln_DataForDisplayLiteral(ctx, p2->parser_data);
+		const size_t len1 = strlen(lit1);
+		const size_t len2 = strlen(lit2);
+		return strncmp(lit1, lit2, (len1 < len2) ? len1 : len2) != 0;
+	}
+	if(!prsStartSet(ctx, p1, set1) || !prsStartSet(ctx, p2, set2))
+		return 0;
+	for(int c = 0 ; c < 256 ; ++c)
+		if(set1[c] && set2[c])
+			return 0;
+	return 1;
+}
+
+/* how often a parser matched: whenever it does, its successor node is
+ * entered. Either the node statistics or the profile counters are
+ * available, depending on the mode we run in.
+ */
+static uint64_t
+prsMatchCount(ln_ctx ctx, const ln_parser_t *const prs)
+{
+	const uint64_t called = prs->node->stats.called;
+	uint64_t profiled = 0;
+	if(ctx->nodeProf != NULL && prs->node->flags.inArena)
+		profiled = PROF_GET(ctx->nodeProf[prs->node
+			- (const struct ln_pdag *) ctx->pdagArena].calls);
+	return (called > profiled) ? called : profiled;
+}
+
+/* reorder the parsers of a single node by match count. This is an
+ * insertion sort which stops moving a parser as soon as it hits one
+ * that has a different priority or is not exclusive to it. So the
+ * relative order of parsers which could both match is never changed.
+ * @return number of parsers moved
+ */
+static int
+pdagReorderParsers(ln_ctx ctx, struct ln_pdag *const dag)
+{
+	int nmoved = 0;
+
+	for(int i = 1 ; i < dag->nparsers ; ++i) {
+		int j;
+		for(j = i ; j > 0 ; --j) {
+			ln_parser_t *const prev = dag->parsers + j - 1;
+			ln_parser_t *const curr = dag->parsers + j;
+			if(   prev->prio != curr->prio
+			   || prsMatchCount(ctx, curr) <= prsMatchCount(ctx, prev)
+			   || !prsExclusive(ctx, prev, curr))
+				break;
+			const ln_parser_t tmp = *prev;
+			*prev = *curr;
+			*curr = tmp;
+		}
+		if(j != i)
+			++nmoved;
+	}
+	return nmoved;
+}
+
+static int
+ln_pdagComponentReorder(ln_ctx ctx, struct ln_pdag *const dag)
+{
+	int nmoved = 0;
+	if(dag->flags.visited)
+		return 0;
+	dag->flags.visited = 1;
+	nmoved += pdagReorderParsers(ctx, dag);
+	for(int i = 0 ; i < dag->nparsers ; ++i)
+		nmoved += ln_pdagComponentReorder(ctx, dag->parsers[i].node);
+	return nmoved;
+}
+
+/**
+ * Re-optimize the pdag based on the usage statistics (or the runtime
+ * profile) gathered so far. Parsers of the same priority are reordered
+ * so that the ones which match most often are tried first, then the
+ * regular optimizer steps run again and the graph is re-frozen, so
+ * that the memory layout follows the new order.
+ */
+static int
+pdagReoptimize(ln_ctx ctx)
+{
+	int r = 0;
+	int nmoved = 0;
+
+	if(ctx->version == 1)
+		goto done;
+	ln_pdagClearVisited(ctx);
+	for(int i = 0 ; i < ctx->nTypes ; ++i)
+		nmoved += ln_pdagComponentReorder(ctx, ctx->type_pdags[i].pdag);
+	nmoved += ln_pdagComponentReorder(ctx, ctx->pdag);
+	LN_DBGPRINTF(ctx, "pdag reoptimize: %d parsers moved", nmoved);
+
+	for(int i = 0 ; i < ctx->nTypes ; ++i)
+		CHKR(ln_pdagComponentOptimize(ctx, ctx->type_pdags[i].pdag));
+	CHKR(ln_pdagComponentOptimize(ctx, ctx->pdag));
+	CHKR(ln_pdagFreeze(ctx));
+	CHKR(ln_prefilterBuild(ctx));
+	ln_shapeCacheClear(ctx->shapeCache);
+done:	return r;
+}
+
+int
+ln_pdagReoptimize(ln_ctx ctx)
+{
+	ln_ctx const rb = ctx->rb;
+	if(ln_rbIsShared(rb)) {
+		ln_errprintf(ctx, 0, "rulebase is shared by multiple contexts "
+			"and cannot be re-optimized");
+		return LN_BADCONFIG;
+	}
+	return pdagReoptimize(rb);
+}
+
 
 #define LN_INTERN_PDAG_STATS_NPARSERS 100
 /* data structure for pdag statistics */
@@ -628,6 +1290,8 @@ ln_pdagStats(ln_ctx ctx, struct ln_pdag *const dag, FILE *const fp, const int ex
 	if(extendedStats) {
 		fprintf(fp, "Usage Statistics:\n"
 			    "-----------------\n");
+		if(ctx->opts & LN_CTXOPT_THREADSAFE)
+			fprintf(fp, "note: not collected in thread-safe mode\n");
 		fprintf(fp, "called, backtracked, rule\n");
 		ln_pdagComponentClearVisited(dag);
 		ln_pdagStatsExtended(ctx, dag, fp, 0);
@@ -644,29 +1308,74 @@ ln_pdagStats(ln_ctx ctx, struct ln_pdag *const dag, FILE *const fp, const int ex
 void
 ln_fullPdagStats(ln_ctx ctx, FILE *const fp, const int extendedStats)
 {
-	if(ctx->ptree != NULL) {
+	ln_ctx const rb = ctx->rb;
+	if(rb->ptree != NULL) {
 		/* we need to handle the old cruft */
-		ln_fullPTreeStats(ctx, fp, extendedStats);
+		ln_fullPTreeStats(rb, fp, extendedStats);
 		return;
 	}
 
 	fprintf(fp, "User-Defined Types\n"
 	            "==================\n");
-	fprintf(fp, "number types: %d\n", ctx->nTypes);
-	for(int i = 0 ; i < ctx->nTypes ; ++i)
-		fprintf(fp, "type: %s\n", ctx->type_pdags[i].name);
+	fprintf(fp, "number types: %d\n", rb->nTypes);
+	for(int i = 0 ; i < rb->nTypes ; ++i)
+		fprintf(fp, "type: %s\n", rb->type_pdags[i].name);
 
-	for(int i = 0 ; i < ctx->nTypes ; ++i) {
+	for(int i = 0 ; i < rb->nTypes ; ++i) {
 		fprintf(fp, "\n"
 			    "type PDAG: %s\n"
-		            "----------\n", ctx->type_pdags[i].name);
-		ln_pdagStats(ctx, ctx->type_pdags[i].pdag, fp, extendedStats);
+		            "----------\n", rb->type_pdags[i].name);
+		ln_pdagStats(rb, rb->type_pdags[i].pdag, fp, extendedStats);
 	}
 
 	fprintf(fp, "\n"
 		    "Main PDAG\n"
 	            "=========\n");
-	ln_pdagStats(ctx, ctx->pdag, fp, extendedStats);
+	ln_pdagStats(rb, rb->pdag, fp, extendedStats);
+
+	struct json_object *mem;
+	if(ln_getMemoryStats(ctx, &mem) == 0) {
+		fprintf(fp, "\n"
+			    "Memory Usage\n"
+			    "============\n"
+			    "%s\n", json_object_to_json_string(mem));
+		json_object_put(mem);
+	}
+
+	struct json_object *sc;
+	if(ln_getShapeCacheStats(ctx, &sc) == 0) {
+		fprintf(fp, "\n"
+			    "Shape Cache\n"
+			    "===========\n"
+			    "%s\n", json_object_to_json_string(sc));
+		json_object_put(sc);
+	}
+
+	const uint64_t budgetHits = PROF_GET(ctx->budgetExceeded);
+	if(budgetHits > 0) {
+		const struct ln_pdag *const nodes = (const struct ln_pdag *) rb->pdagArena;
+		fprintf(fp, "\n"
+			    "Work Budget\n"
+			    "===========\n");
+		fprintf(fp, "messages exceeding budget: %" PRIu64 "\n", budgetHits);
+		fprintf(fp, "exceeded, rule\n");
+		for(size_t i = 0 ; i < rb->nArenaNodes ; ++i) {
+			const uint64_t hits = PROF_GET(nodes[i].budgetExceeded);
+			if(hits > 0)
+				fprintf(fp, "%" PRIu64 ", %s\n", hits, nodes[i].rb_id);
+		}
+	}
+
+	if(ctx->prof != NULL) {
+		struct json_object *prof;
+		if(ln_getProfile(ctx, &prof) == 0) {
+			fprintf(fp, "\n"
+				    "Runtime Profile\n"
+				    "===============\n"
+				    "%s\n", json_object_to_json_string(prof));
+			json_object_put(prof);
+		}
+	}
 
 #ifdef	ADVANCED_STATS
 	const uint64_t parsers_failed = advstats_parsers_called - advstats_parsers_success;
@@ -796,6 +1505,87 @@ isLeaf(struct ln_pdag *dag)
 }
 
 
+/**
+ * lookup index for the parsers of a node while the pdag is built.
+ * Rules are added one after another, and each of their parsers needs
+ * to be checked against the parsers that already exist at the node.
+ * Without an index, this is quadratic for nodes with many parsers.
+ * The index is created once a node has PRSIDX_MIN_PARSERS parsers and
+ * is dropped by the optimizer. While it exists, the parser table grows
+ * by doubling its size.
+ */
+struct ln_pdag_prsidx {
+	int maxparsers;		/**< allocated size of the parser table */
+	uint32_t size;		/**< number of slots, always a power of two */
+	struct {
+		uint32_t hash;
+		int prs;	/**< parser index + 1, 0 = free slot */
+	} slots[];
+};
+
+static uint32_t
+prsHash(const ln_parser_t *const prs)
+{
+	uint32_t h = 2166136261u ^ prs->prsid;
+	for(const char *p = prs->conf ; *p != '\0' ; ++p)
+		h = (h ^ (unsigned char) *p) * 16777619u;
+	return h;
+}
+
+static void
+prsIdxInsert(struct ln_pdag_prsidx *const idx, const uint32_t hash, const int iprs)
+{
+	uint32_t k = hash & (idx->size - 1);
+	while(idx->slots[k].prs != 0)
+		k = (k + 1) & (idx->size - 1);
+	idx->slots[k].hash = hash;
+	idx->slots[k].prs = iprs + 1;
+}
+
+/* (re)create the index of a node, with room to add as many parsers
+ * as it already has
+ */
+static int
+prsIdxBuild(struct ln_pdag *const dag)
+{
+	int r = 0;
+	struct ln_pdag_prsidx *idx;
+	uint32_t size = 16;
+	while(size < 4 * (uint32_t) dag->nparsers)
+		size *= 2;
+	CHKN(idx = calloc(1, sizeof(struct ln_pdag_prsidx) + size * sizeof(idx->slots[0])));
+	idx->size = size;
+	idx->maxparsers = (dag->prsIdx == NULL) ? dag->nparsers : dag->prsIdx->maxparsers;
+	for(int i = 0 ; i < dag->nparsers ; ++i)
+		prsIdxInsert(idx, prsHash(dag->parsers + i), i);
+	free(dag->prsIdx);
+	dag->prsIdx = idx;
+done:	return r;
+}
+
+/* find a parser identical to prs at the node, -1 if there is none */
+static int
+pdagFindParser(const struct ln_pdag *const dag, const ln_parser_t *const prs, const uint32_t hash)
+{
+	if(dag->prsIdx == NULL) {
+		for(int i = 0 ; i < dag->nparsers ; ++i) {
+			if(   dag->parsers[i].prsid == prs->prsid
+			   && !strcmp(dag->parsers[i].conf, prs->conf))
+				return i;
+		}
+		return -1;
+	}
+	const struct ln_pdag_prsidx *const idx = dag->prsIdx;
+	for(uint32_t k = hash & (idx->size - 1) ; idx->slots[k].prs != 0 ; k = (k + 1) & (idx->size - 1)) {
+		const ln_parser_t *const cand = dag->parsers + idx->slots[k].prs - 1;
+		if(   idx->slots[k].hash == hash
+		   && cand->prsid == prs->prsid
+		   && !strcmp(cand->conf, prs->conf))
+			return idx->slots[k].prs - 1;
+	}
+	return -1;
+}
+
 /**
  * Add a parser instance to the pdag at the current position.
  *
@@ -831,25 +1621,22 @@ ln_pdagAddParserInstance(ln_ctx ctx,
 	ln_parser_t *const parser = ln_newParser(ctx, prscnf);
 	CHKN(parser);
 	LN_DBGPRINTF(ctx, "pdag: %p, parser %p", pdag, parser);
-	/* check if we already have this parser, if so, merge
+	/* check if we already have this parser, if so, merge. Configs
+	 * are canonical (see ln_newParser()), so comparing them as
+	 * strings is fine.
 	 */
-	int i;
-	for(i = 0 ; i < pdag->nparsers ; ++i) {
-		LN_DBGPRINTF(ctx, "parser  comparison:\n%s\n%s",  pdag->parsers[i].conf, parser->conf);
-		if(   pdag->parsers[i].prsid == parser->prsid
-		   && !strcmp(pdag->parsers[i].conf, parser->conf)) {
-		   	// FIXME: the current ->conf object is depending on
-			//        the order of json elements. We should do a JSON
-			//        comparison (a bit more complex). For now, it
-			//        works like we do it now.
-			// FIXME: if nextnode is set, check we can actually combine, 
-			//        else err out
-			*nextnode = pdag->parsers[i].node;
-			r = 0;
-			LN_DBGPRINTF(ctx, "merging with pdag %p", pdag);
-			pdagDeletePrs(ctx, parser); /* no need for data items */
-			goto done;
-		}
+	const uint32_t hash = prsHash(parser);
+	if(pdag->prsIdx == NULL && pdag->nparsers >= PRSIDX_MIN_PARSERS)
+		CHKR(prsIdxBuild(pdag));
+	const int i = pdagFindParser(pdag, parser, hash);
+	if(i >= 0) {
+		// FIXME: if nextnode is set, check we can actually combine, 
+		//        else err out
+		*nextnode = pdag->parsers[i].node;
+		r = 0;
+		LN_DBGPRINTF(ctx, "merging with pdag %p", pdag);
+		pdagDeletePrs(ctx, parser); /* no need for data items */
+		goto done;
 	}
 	/* if we reach this point, we have a new parser type */
 	if(*nextnode == NULL) {
@@ -858,12 +1645,37 @@ ln_pdagAddParserInstance(ln_ctx ctx,
 		(*nextnode)->refcnt++;
 	}
 	parser->node = *nextnode;
-	ln_parser_t *const newtab
-		= realloc(pdag->parsers, (pdag->nparsers+1) * sizeof(ln_parser_t));
-	CHKN(newtab);
-	pdag->parsers = newtab;
+	if(ctx->v1compile == LN_V1C_LOAD)
+		parser->prio = v1ParserPrio(parser, pdag->nparsers);
+	if(pdag->flags.prsInArena) {
+		/* frozen table must not be realloc'ed, so move it out */
+		ln_parser_t *const heaptab = malloc(pdag->nparsers * sizeof(ln_parser_t));
+		CHKN(heaptab);
+		memcpy(heaptab, pdag->parsers, pdag->nparsers * sizeof(ln_parser_t));
+		pdag->parsers = heaptab;
+		pdag->flags.prsInArena = 0;
+	}
+	if(pdag->prsIdx == NULL) {
+		ln_parser_t *const newtab
+			= realloc(pdag->parsers, (pdag->nparsers+1) * sizeof(ln_parser_t));
+		CHKN(newtab);
+		pdag->parsers = newtab;
+	} else if(pdag->nparsers == pdag->prsIdx->maxparsers) {
+		const int newmax = 2 * pdag->prsIdx->maxparsers;
+		ln_parser_t *const newtab = realloc(pdag->parsers, newmax * sizeof(ln_parser_t));
+		CHKN(newtab);
+		pdag->parsers = newtab;
+		pdag->prsIdx->maxparsers = newmax;
+	}
 	memcpy(pdag->parsers+pdag->nparsers, parser, sizeof(ln_parser_t));
 	pdag->nparsers++;
+	if(pdag->prsIdx != NULL) {
+		if(2 * (uint32_t) pdag->nparsers > pdag->prsIdx->size) {
+			CHKR(prsIdxBuild(pdag));
+		} else {
+			prsIdxInsert(pdag->prsIdx, hash, pdag->nparsers - 1);
+		}
+	}
 
 	r = 0;
 
@@ -1070,7 +1882,6 @@ static inline void dotAddPtr(es_str_t **str, void *p)
 	i = snprintf(buf, sizeof(buf), "l%p", p);
 	es_addBuf(str, buf, i);
 }
-struct data_Literal { const char *lit; }; // TODO remove when this hack is no longe needed
 /**
  * recursive handler for DOT graph generator.
  */
@@ -1179,16 +1990,353 @@ ln_genStatsDotPDAGGraph(struct ln_pdag *dag, FILE *const fp)
 void
 ln_fullPDagStatsDOT(ln_ctx ctx, FILE *const fp)
 {
-	ln_genStatsDotPDAGGraph(ctx->pdag, fp);
+	ln_genStatsDotPDAGGraph(ctx->rb->pdag, fp);
 }
 
 
-static inline int
-addOriginalMsg(const char *str, const size_t strLen, struct json_object *const json)
+struct ln_pdag_profile *
+ln_newProfile(void)
 {
-	int r = 1;
-	struct json_object *value;
-
+	struct ln_pdag_profile *const prof = calloc(1, sizeof(struct ln_pdag_profile));
+	if(prof != NULL) {
+		prof->startTicks = profTicks();
+		prof->startNs = profNs();
+	}
+	return prof;
+}
+
+/* set up the per-node profile counters of a rulebase, if it does not
+ * have them yet. This is done when a context that uses the rulebase
+ * enables profiling, or when the rulebase of such a context is
+ * (re)loaded. Normalizations that are already in progress do not see
+ * the new counters, so this may be done while other threads
+ * normalize. The counters are released together with the rulebase.
+ */
+int
+ln_pdagNodeProfAlloc(ln_ctx rb)
+{
+	int r = 0;
+	struct ln_pdag_nodeprof *nodeProf;
+	struct ln_pdag_nodeprof *expected = NULL;
+	if(__atomic_load_n(&rb->nodeProf, __ATOMIC_ACQUIRE) != NULL || rb->nArenaNodes == 0)
+		goto done;
+	CHKN(nodeProf = calloc(rb->nArenaNodes, sizeof(struct ln_pdag_nodeprof)));
+	/* another context that shares rb may have been faster */
+	if(!__atomic_compare_exchange_n(&rb->nodeProf, &expected, nodeProf,
+		0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		free(nodeProf);
+done:	return r;
+}
+
+void
+ln_resetProfile(ln_ctx ctx)
+{
+	if(ctx->prof == NULL)
+		return;
+	memset(ctx->prof, 0, sizeof(struct ln_pdag_profile));
+	ctx->prof->startTicks = profTicks();
+	ctx->prof->startNs = profNs();
+	if(ctx->rb->nodeProf != NULL)
+		memset(ctx->rb->nodeProf, 0,
+			ctx->rb->nArenaNodes * sizeof(struct ln_pdag_nodeprof));
+}
+
+/* a node of the profile export, with a snapshot of its counters */
+struct prof_node {
+	const struct ln_pdag *dag;
+	struct ln_pdag_nodeprof cnt;
+};
+
+static int
+qsort_profNodeCmp(const void *v1, const void *v2)
+{
+	const uint64_t t1 = ((const struct prof_node *) v1)->cnt.ticks;
+	const uint64_t t2 = ((const struct prof_node *) v2)->cnt.ticks;
+	return (t1 < t2) - (t1 > t2); /* descending */
+}
+
+/* add a histogram as array, trailing zero buckets are not included */
+static struct json_object *
+profHist2JSON(const uint64_t *const hist)
+{
+	struct json_object *const arr = json_object_new_array();
+	int last = LN_PROF_HIST_SIZE - 1;
+	if(arr == NULL)
+		goto done;
+	while(last >= 0 && PROF_GET(hist[last]) == 0)
+		--last;
+	for(int i = 0 ; i <= last ; ++i)
+		json_object_array_add(arr, json_object_new_int64(PROF_GET(hist[i])));
+done:	return arr;
+}
+
+/**
+ * Export the runtime profile. All nodes of all components are located
+ * in the pdag arena, so we do not need to walk the graph (which would
+ * need the visited flags and thus break concurrent normalization).
+ */
+int
+ln_getProfile(ln_ctx ctx, struct json_object **json_p)
+{
+	int r = 0;
+	struct json_object *json = NULL;
+	struct json_object *arr;
+	struct json_object *item;
+	struct prof_node *sorted = NULL;
+	struct ln_pdag *const nodes = (struct ln_pdag *) ctx->rb->pdagArena;
+	const size_t nnodes = ctx->rb->nArenaNodes;
+	const struct ln_pdag_nodeprof *const nodeProf = ctx->rb->nodeProf;
+	const struct ln_pdag_profile *const prof = ctx->prof;
+	size_t nsorted = 0;
+	double nsPerTick = 1.0;
+
+	*json_p = NULL;
+	if(prof == NULL) {
+		r = LN_BADCONFIG;
+		goto done;
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	const uint64_t elapsedTicks = profTicks() - prof->startTicks;
+	if(elapsedTicks > 0)
+		nsPerTick = (double) (profNs() - prof->startNs) / elapsedTicks;
+#endif
+
+	CHKN(json = json_object_new_object());
+	json_object_object_add(json, "messages", json_object_new_int64(PROF_GET(prof->msgs)));
+	json_object_object_add(json, "parsed", json_object_new_int64(PROF_GET(prof->parsed)));
+	json_object_object_add(json, "budget_exceeded",
+		json_object_new_int64(PROF_GET(ctx->budgetExceeded)));
+
+	CHKN(arr = json_object_new_array());
+	json_object_object_add(json, "parsers", arr);
+	for(int i = 0 ; i < PRS_INVALID ; ++i) {
+		if(PROF_GET(prof->prs[i].calls) == 0)
+			continue;
+		CHKN(item = json_object_new_object());
+		json_object_array_add(arr, item);
+		json_object_object_add(item, "name", json_object_new_string(parserName(i)));
+		json_object_object_add(item, "calls", json_object_new_int64(PROF_GET(prof->prs[i].calls)));
+		json_object_object_add(item, "success", json_object_new_int64(PROF_GET(prof->prs[i].success)));
+		json_object_object_add(item, "ns",
+			json_object_new_int64((int64_t) (PROF_GET(prof->prs[i].ticks) * nsPerTick)));
+	}
+
+	if(nnodes > 0)
+		CHKN(sorted = calloc(nnodes, sizeof(struct prof_node)));
+	for(size_t i = 0 ; i < nnodes ; ++i) {
+		struct prof_node *const pn = sorted + nsorted;
+		if(nodeProf != NULL) {
+			pn->cnt.calls = PROF_GET(nodeProf[i].calls);
+			pn->cnt.backtracks = PROF_GET(nodeProf[i].backtracks);
+			pn->cnt.ticks = PROF_GET(nodeProf[i].ticks);
+		}
+		if(pn->cnt.calls > 0 || PROF_GET(nodes[i].budgetExceeded) > 0) {
+			pn->dag = nodes + i;
+			++nsorted;
+		}
+	}
+	qsort(sorted, nsorted, sizeof(struct prof_node), qsort_profNodeCmp);
+	CHKN(arr = json_object_new_array());
+	json_object_object_add(json, "nodes", arr);
+	for(size_t i = 0 ; i < nsorted ; ++i) {
+		const struct ln_pdag *const dag = sorted[i].dag;
+		const struct ln_pdag_nodeprof *const cnt = &sorted[i].cnt;
+		CHKN(item = json_object_new_object());
+		json_object_array_add(arr, item);
+		json_object_object_add(item, "id", json_object_new_string(dag->rb_id == NULL ? "" : dag->rb_id));
+		if(dag->flags.isTerminal && dag->rb_file != NULL) {
+			json_object_object_add(item, "file", json_object_new_string(dag->rb_file));
+			json_object_object_add(item, "line", json_object_new_int(dag->rb_lineno));
+		}
+		json_object_object_add(item, "calls", json_object_new_int64(cnt->calls));
+		json_object_object_add(item, "backtracks", json_object_new_int64(cnt->backtracks));
+		json_object_object_add(item, "ns",
+			json_object_new_int64((int64_t) (cnt->ticks * nsPerTick)));
+		if(PROF_GET(dag->budgetExceeded) > 0)
+			json_object_object_add(item, "budget_exceeded",
+				json_object_new_int64(PROF_GET(dag->budgetExceeded)));
+	}
+
+	json_object_object_add(json, "pathlen", profHist2JSON(prof->pathlen));
+	json_object_object_add(json, "backtracks", profHist2JSON(prof->backtracks));
+	*json_p = json;
+	json = NULL;
+
+done:
+	free(sorted);
+	if(json != NULL)
+		json_object_put(json);
+	return r;
+}
+
+
+/* work data for ln_getMemoryStats(). Nodes may be shared, so we keep
+ * a set of the ones already counted. The visited flags cannot be used
+ * for this, as other threads may be normalizing.
+ */
+struct pdag_memstats {
+	size_t nodes;
+	size_t prsTables;
+	size_t prsData;
+	size_t indexes;
+	size_t strings;
+	size_t annots;
+	const struct ln_pdag **seen;	/**< hash set of counted nodes, NULL = free */
+	size_t size;			/**< number of slots, always a power of two */
+	size_t nseen;
+};
+
+/* add dag to the set of counted nodes
+ * @return 1 if it was already in the set, 0 if added, -1 if out of memory
+ */
+static int
+memstatsSeen(struct pdag_memstats *const ms, const struct ln_pdag *const dag)
+{
+	if(2 * (ms->nseen + 1) > ms->size) {
+		const size_t newSize = (ms->size == 0) ? 256 : 2 * ms->size;
+		const struct ln_pdag **const newSeen = calloc(newSize, sizeof(struct ln_pdag *));
+		if(newSeen == NULL)
+			return -1;
+		for(size_t i = 0 ; i < ms->size ; ++i) {
+			if(ms->seen[i] == NULL)
+				continue;
+			size_t k = (((uintptr_t) ms->seen[i]) >> 4) & (newSize - 1);
+			while(newSeen[k] != NULL)
+				k = (k + 1) & (newSize - 1);
+			newSeen[k] = ms->seen[i];
+		}
+		free(ms->seen);
+		ms->seen = newSeen;
+		ms->size = newSize;
+	}
+	size_t k = (((uintptr_t) dag) >> 4) & (ms->size - 1);
+	for( ; ms->seen[k] != NULL ; k = (k + 1) & (ms->size - 1)) {
+		if(ms->seen[k] == dag)
+			return 1;
+	}
+	ms->seen[k] = dag;
+	++ms->nseen;
+	return 0;
+}
+
+static int
+pdagMemStats(struct pdag_memstats *const ms, const struct ln_pdag *const dag)
+{
+	int r = 0;
+
+	if(dag == NULL)
+		goto done;
+	if((r = memstatsSeen(ms, dag)) != 0) {
+		r = (r == 1) ? 0 : LN_NOMEM;
+		goto done;
+	}
+
+	ms->nodes += sizeof(struct ln_pdag);
+	ms->prsTables += ((dag->prsIdx == NULL) ? dag->nparsers : dag->prsIdx->maxparsers)
+			 * sizeof(ln_parser_t);
+	if(dag->dispatch != NULL)
+		ms->indexes += sizeof(struct ln_pdag_dispatch)
+			       + dag->dispatch->offs[256] * sizeof(uint16_t);
+	if(dag->prsIdx != NULL)
+		ms->indexes += sizeof(struct ln_pdag_prsidx)
+			       + dag->prsIdx->size * sizeof(dag->prsIdx->slots[0]);
+	if(dag->rb_id != NULL)
+		ms->strings += strlen(dag->rb_id) + 1;
+	ms->annots += dag->nannots * sizeof(struct ln_annot_kv);
+	for(int i = 0 ; i < dag->nannots ; ++i)
+		ms->annots += json_object_get_string_len(dag->annots[i].value) + 1;
+
+	for(int i = 0 ; i < dag->nparsers ; ++i) {
+		const ln_parser_t *const prs = dag->parsers+i;
+		if(prs->parser_data != NULL)
+			ms->prsData += parser_lookup_table[prs->prsid].datasize(prs->parser_data);
+		if(prs->prsid == PRS_REPEAT) {
+			const struct data_Repeat *const data = (struct data_Repeat*) prs->parser_data;
+			CHKR(pdagMemStats(ms, data->parser));
+			CHKR(pdagMemStats(ms, data->while_cond));
+		}
+		CHKR(pdagMemStats(ms, prs->node));
+	}
+done:
+	return r;
+}
+
+int
+ln_getMemoryStats(ln_ctx ctx, struct json_object **json_p)
+{
+	int r = 0;
+	struct json_object *json = NULL;
+	struct pdag_memstats ms;
+	unsigned rcuIdx;
+	/* the rulebase may be replaced while we walk it */
+	const ln_ctx rb = ln_rbAcquire(ctx, &rcuIdx);
+
+	memset(&ms, 0, sizeof(ms));
+	*json_p = NULL;
+	if(rb->version != 2) {
+		r = LN_BADCONFIG;
+		goto done;
+	}
+
+	for(int i = 0 ; i < rb->nTypes ; ++i)
+		CHKR(pdagMemStats(&ms, rb->type_pdags[i].pdag));
+	CHKR(pdagMemStats(&ms, rb->pdag));
+	ms.nodes += rb->nTypes * sizeof(struct ln_type_pdag);
+	ms.indexes += ln_prefilterMemSize(rb->prefilter);
+	ms.strings += ln_strtabMemSize(rb->strtab);
+	ms.annots += ln_annotSetMemSize(rb->pas);
+
+	CHKN(json = json_object_new_object());
+	json_object_object_add(json, "nodes", json_object_new_int64(ms.nodes));
+	json_object_object_add(json, "parser_tables", json_object_new_int64(ms.prsTables));
+	json_object_object_add(json, "parser_data", json_object_new_int64(ms.prsData));
+	json_object_object_add(json, "indexes", json_object_new_int64(ms.indexes));
+	json_object_object_add(json, "strings", json_object_new_int64(ms.strings));
+	json_object_object_add(json, "annotations", json_object_new_int64(ms.annots));
+	json_object_object_add(json, "total", json_object_new_int64(ms.nodes + ms.prsTables
+		+ ms.prsData + ms.indexes + ms.strings + ms.annots));
+	*json_p = json;
+
+done:
+	ln_rbRelease(ctx, rcuIdx);
+	free(ms.seen);
+	return r;
+}
+
+int
+ln_getShapeCacheStats(ln_ctx ctx, struct json_object **json_p)
+{
+	int r = 0;
+	struct json_object *json;
+	const struct ln_shapecache *const sc = ctx->rb->shapeCache;
+
+	*json_p = NULL;
+	if(ctx->shapeCacheSize == 0) {
+		r = LN_BADCONFIG;
+		goto done;
+	}
+	CHKN(json = json_object_new_object());
+	json_object_object_add(json, "entries", json_object_new_int64(ctx->shapeCacheSize));
+	json_object_object_add(json, "used",
+		json_object_new_int64((sc == NULL) ? 0 : ln_shapeCacheUsed(sc)));
+	json_object_object_add(json, "hits", json_object_new_int64(ctx->shapeCacheStats.hits));
+	json_object_object_add(json, "misses", json_object_new_int64(ctx->shapeCacheStats.misses));
+	json_object_object_add(json, "mismatches",
+		json_object_new_int64(ctx->shapeCacheStats.mismatches));
+	json_object_object_add(json, "bytes", json_object_new_int64(ln_shapeCacheMemSize(sc)));
+	*json_p = json;
+
+done:
+	return r;
+}
+
+
+static inline int
+addOriginalMsg(const char *str, const size_t strLen, struct json_object *const json)
+{
+	int r = 1;
+	struct json_object *value;
+
 	value = json_object_new_string_len(str, strLen);
 	if (value == NULL) {
 		goto done;
@@ -1226,25 +2374,36 @@ addRuleMetadata(npb_t *const __restrict__ npb,
 	ln_ctx ctx = npb->ctx;
 	struct json_object *meta = NULL;
 	struct json_object *meta_rule = NULL;
-	struct json_object *value;
 
 	if(ctx->opts & LN_CTXOPT_ADD_RULE) { /* matching rule mockup */
 		if(meta_rule == NULL)
 			meta_rule = json_object_new_object();
-		char *cstr = strrev(es_str2cstr(npb->rule, NULL));
-		json_object_object_add(meta_rule, RULE_MOCKUP_KEY,
-			json_object_new_string(cstr));
-		free(cstr);
+		if(endNode->mockup == NULL) {
+			char *cstr = strrev(es_str2cstr(npb->rule, NULL));
+			json_object_object_add(meta_rule, RULE_MOCKUP_KEY,
+				json_object_new_string(cstr));
+			free(cstr);
+		} else if(ctx->opts & LN_CTXOPT_THREADSAFE) {
+			json_object_object_add_ex(meta_rule, RULE_MOCKUP_KEY,
+				json_object_new_string_len(json_object_get_string(endNode->mockup),
+					json_object_get_string_len(endNode->mockup)),
+				JSON_C_OBJECT_ADD_KEY_IS_NEW | JSON_C_OBJECT_KEY_IS_CONSTANT);
+		} else {
+			json_object_object_add_ex(meta_rule, RULE_MOCKUP_KEY,
+				json_object_get(endNode->mockup),
+				JSON_C_OBJECT_ADD_KEY_IS_NEW | JSON_C_OBJECT_KEY_IS_CONSTANT);
+		}
 	}
 
 	if(ctx->opts & LN_CTXOPT_ADD_RULE_LOCATION) {
 		if(meta_rule == NULL)
 			meta_rule = json_object_new_object();
-		struct json_object *const location = json_object_new_object();
-		value = json_object_new_string(endNode->rb_file);
-		json_object_object_add(location, "file", value);
-		value = json_object_new_int((int)endNode->rb_lineno);
-		json_object_object_add(location, "line", value);
+		/* the shared object's refcount must not be touched by
+		 * multiple threads, so we need a copy in thread-safe mode.
+		 */
+		struct json_object *const location =
+			(endNode->location == NULL || (ctx->opts & LN_CTXOPT_THREADSAFE))
+			? newRuleLocation(endNode) : json_object_get(endNode->location);
 		json_object_object_add(meta_rule, RULE_LOCATION_KEY, location);
 	}
 
@@ -1266,7 +2425,7 @@ addRuleMetadata(npb_t *const __restrict__ npb,
 			     npb->astats.lit_parser_calls);
 		es_addBuf(&npb->astats.exec_path, hdr, lenhdr);
 		char * cstr = es_str2cstr(npb->astats.exec_path, NULL);
-		value = json_object_new_string(cstr);
+		struct json_object *const value = json_object_new_string(cstr);
 		if (value != NULL) {
 			json_object_object_add(meta, EXEC_PATH_KEY, value);
 		}
@@ -1302,9 +2461,13 @@ done:
 }
 
 
-/* Do some fixup to the json that we cannot do on a lower layer */
+/* Do some fixup to the json that we cannot do on a lower layer.
+ * keyFlags tells if the field name may be referenced by the event
+ * instead of being copied (see npbConstruct()).
+ */
 static int
 fixJSON(struct ln_pdag *dag,
+	const unsigned keyFlags,
 	struct json_object **value,
 	struct json_object *json,
 	const ln_parser_t *const prs)
@@ -1331,8 +2494,7 @@ fixJSON(struct ln_pdag *dag,
 		} else {
 			LN_DBGPRINTF(dag->ctx, "field name is '.', but json type is %s",
 				json_type_to_name(json_object_get_type(*value)));
-			json_object_object_add_ex(json, prs->name, *value,
-				JSON_C_OBJECT_ADD_KEY_IS_NEW|JSON_C_OBJECT_KEY_IS_CONSTANT);
+			json_object_object_add_ex(json, prs->name, *value, keyFlags);
 		}
 	} else {
 		int isDotDot = 0;
@@ -1363,31 +2525,215 @@ fixJSON(struct ln_pdag *dag,
 			LN_DBGPRINTF(dag->ctx, "subordinate field name is '..', combining");
 			json_object_get(valDotDot);
 			json_object_put(*value);
-			json_object_object_add_ex(json, prs->name, valDotDot,
-				JSON_C_OBJECT_ADD_KEY_IS_NEW|JSON_C_OBJECT_KEY_IS_CONSTANT);
+			json_object_object_add_ex(json, prs->name, valDotDot, keyFlags);
 		} else {
-			json_object_object_add_ex(json, prs->name, *value,
-				JSON_C_OBJECT_ADD_KEY_IS_NEW|JSON_C_OBJECT_KEY_IS_CONSTANT);
+			json_object_object_add_ex(json, prs->name, *value, keyFlags);
 		}
 	}
 	r = 0;
 	return r;
 }
 
-// TODO: streamline prototype when done with changes
+static inline uint32_t
+memoHashKey(const struct ln_type_pdag *const type, const size_t offs)
+{
+	return (uint32_t) ((uintptr_t) type >> 4) * 31 + (uint32_t) offs * 0x9e3779b1u;
+}
 
 static int
-tryParser(npb_t *const __restrict__ npb,
+memoGrow(npb_t *const __restrict__ npb)
+{
+	int r = 0;
+	const size_t newmax = (npb->maxmemo == 0) ? 16 : 2 * npb->maxmemo;
+	const size_t newHashSize = 2 * newmax;
+	struct npb_memo *newmemo;
+	uint32_t *newhash;
+
+	CHKN(newmemo = realloc(npb->memo, newmax * sizeof(struct npb_memo)));
+	npb->memo = newmemo;
+	CHKN(newhash = calloc(newHashSize, sizeof(uint32_t)));
+	for(size_t i = 0 ; i < npb->nmemo ; ++i) {
+		size_t h = memoHashKey(npb->memo[i].type, npb->memo[i].offs) & (newHashSize - 1);
+		while(newhash[h] != 0)
+			h = (h + 1) & (newHashSize - 1);
+		newhash[h] = i + 1;
+	}
+	free(npb->memoHash);
+	npb->memoHash = newhash;
+	npb->memoHashSize = newHashSize;
+	npb->maxmemo = newmax;
+done:	return r;
+}
+
+/* find the memo entry for a custom type at the given offset. If there
+ * is none yet, a new entry is created and *isNew set. It is filled in
+ * when the type has been matched; until then, it says "no match", so
+ * that a type which (indirectly) refers to itself at the same offset
+ * does not recurse endlessly nor read an unset result.
+ * Returns the entry index or -1 if out of memory. Note that we return
+ * an index, because nested types may grow the memo array.
+ */
+static ssize_t
+memoLookup(npb_t *const __restrict__ npb, const struct ln_type_pdag *const type,
+	const size_t offs, int *const isNew)
+{
+	size_t h;
+
+	*isNew = 0;
+	if(npb->memoHashSize > 0) {
+		h = memoHashKey(type, offs) & (npb->memoHashSize - 1);
+		while(npb->memoHash[h] != 0) {
+			const struct npb_memo *const m = npb->memo + npb->memoHash[h] - 1;
+			if(m->type == type && m->offs == offs)
+				return npb->memoHash[h] - 1;
+			h = (h + 1) & (npb->memoHashSize - 1);
+		}
+	}
+	if(npb->nmemo == npb->maxmemo) {
+		if(memoGrow(npb) != 0)
+			return -1;
+	}
+	h = memoHashKey(type, offs) & (npb->memoHashSize - 1);
+	while(npb->memoHash[h] != 0)
+		h = (h + 1) & (npb->memoHashSize - 1);
+	const size_t idx = npb->nmemo++;
+	npb->memoHash[h] = idx + 1;
+	npb->memo[idx].type = type;
+	npb->memo[idx].offs = offs;
+	npb->memo[idx].r = LN_WRONGPARSER;
+	npb->memo[idx].parsed = 0;
+	npb->memo[idx].value = NULL;
+	*isNew = 1;
+	return idx;
+}
+
+/* forget all memoized results, must be done for each new message */
+static void
+memoReset(npb_t *const __restrict__ npb)
+{
+	if(npb->nmemo == 0)
+		return;
+	for(size_t i = 0 ; i < npb->nmemo ; ++i) {
+		if(npb->memo[i].value != NULL)
+			json_object_put(npb->memo[i].value);
+	}
+	memset(npb->memoHash, 0, npb->memoHashSize * sizeof(uint32_t));
+	npb->nmemo = 0;
+}
+
+/* match a user-defined type. The result only depends on type and
+ * offset, so it can be memoized: we start with parsedTo at the
+ * offset, as otherwise the consumed length would depend on how far
+ * earlier parsers got.
+ */
+static int
+normalizeCustomType(npb_t *const __restrict__ npb,
+	const ln_parser_t *const prs,
+	const size_t offs,
+	size_t *const __restrict__ pParsed,
+	struct json_object **value)
+{
+	int r;
+	struct ln_pdag *endNode = NULL;
+	ssize_t memoIdx = -1;
+	int isNew;
+
+	if(npb->memoize) {
+		if((memoIdx = memoLookup(npb, prs->custType, offs, &isNew)) == -1) {
+			r = LN_NOMEM;
+			goto done;
+		}
+		if(!isNew) {
+			const struct npb_memo *const m = npb->memo + memoIdx;
+			LN_DBGPRINTF(npb->ctx, "custom type '%s' at %zu: memoized result %d",
+				prs->custType->name, offs, m->r);
+			r = m->r;
+			*pParsed = m->parsed;
+			if(r == 0)
+				*value = json_object_get(m->value);
+			goto done;
+		}
+	}
+
+	CHKN(*value = json_object_new_object());
+	LN_DBGPRINTF(npb->ctx, "calling custom parser '%s'", prs->custType->name);
+	npb->parsedTo = offs;
+	r = ln_normalizeRec(npb, prs->custType->pdag, offs, 1, *value, &endNode);
+	*pParsed = npb->parsedTo - offs;
+	if(r != 0) {
+		json_object_put(*value);
+		*value = NULL;
+	}
+
+	if(memoIdx != -1) {
+		struct npb_memo *const m = npb->memo + memoIdx;
+		m->r = r;
+		m->parsed = *pParsed;
+		m->value = (r == 0) ? json_object_get(*value) : NULL;
+	}
+done:	return r;
+}
+
+/* the work budget ran out at the given node: stop normalization of
+ * this message and record where it happened.
+ */
+static void
+budgetExceeded(npb_t *const __restrict__ npb, struct ln_pdag *const dag)
+{
+	LN_DBGPRINTF(npb->ctx, "work budget exceeded at node %p (%s), %u parser calls, depth %u",
+		dag, dag->rb_id, npb->budgetCalls, npb->depth);
+	npb->budgetExceeded = 1;
+	PROF_ADD(dag->budgetExceeded, 1);
+	PROF_ADD(npb->ctx->budgetExceeded, 1);
+}
+
+/* charge one parser call to the budget. Reading the clock is not
+ * exactly cheap, so we check the time only every few calls.
+ * Returns non-zero if the budget is exceeded.
+ */
+#define BUDGET_TIME_CHECK_INTERVAL 64
+static inline int
+budgetCharge(npb_t *const __restrict__ npb, struct ln_pdag *const dag)
+{
+	const ln_ctx ctx = npb->ctx;
+	++npb->budgetCalls;
+	if(   (ctx->budget.maxCalls != 0 && npb->budgetCalls > ctx->budget.maxCalls)
+	   || (npb->deadline != 0 && npb->budgetCalls % BUDGET_TIME_CHECK_INTERVAL == 0
+	       && profNs() > npb->deadline))
+		budgetExceeded(npb, dag);
+	return npb->budgetExceeded;
+}
+
+/* reset the budget for a new message */
+static inline void
+budgetStart(npb_t *const __restrict__ npb)
+{
+	npb->budgetExceeded = 0;
+	npb->budgetCalls = 0;
+	npb->depth = 0;
+	npb->deadline = (npb->ctx->budget.maxNs == 0) ? 0 : profNs() + npb->ctx->budget.maxNs;
+}
+
+/* debug output, unless we are in one of the plain variants of the
+ * normalizer (see ln_normalizeRec()). plain must be a constant.
+ */
+#define PLAIN_DBGPRINTF(plain, ctx, ...) if(!(plain)) { LN_DBGPRINTF(ctx, __VA_ARGS__) }
+
+// TODO: streamline prototype when done with changes
+
+static inline __attribute__((always_inline)) int
+tryParserVariant(npb_t *const __restrict__ npb,
 	struct ln_pdag *dag,
 	size_t *offs,
 	size_t *const __restrict__ pParsed,
 	struct json_object **value,
-	const ln_parser_t *const prs
+	const ln_parser_t *const prs,
+	const int plain
 	)
 {
 	int r;
-	struct ln_pdag *endNode = NULL;
 	size_t parsedTo = npb->parsedTo;
+	const uint64_t profStart = (npb->prof == NULL) ? 0 : profTicks();
 #	ifdef	ADVANCED_STATS
 	char hdr[16];
 	const size_t lenhdr 
@@ -1418,24 +2764,54 @@ tryParser(npb_t *const __restrict__ npb,
 	es_addChar(&npb->astats.exec_path, ',');
 #	endif
 
+	/* nested normalization (custom types, repeat, ...) always builds json
+	 * and is not part of the path for the shape cache
+	 */
+	const int spanMode = npb->spanMode;
+	const int scRecord = npb->scRecord;
+	npb->spanMode = 0;
+	npb->scRecord = 0;
 	if(prs->prsid == PRS_CUSTOM_TYPE) {
-		if(*value == NULL)
-			*value = json_object_new_object();
-		LN_DBGPRINTF(dag->ctx, "calling custom parser '%s'", prs->custType->name);
-		r = ln_normalizeRec(npb, prs->custType->pdag, *offs, 1, *value, &endNode);
-		LN_DBGPRINTF(dag->ctx, "called CUSTOM PARSER '%s', result %d, "
+		r = normalizeCustomType(npb, prs, *offs, pParsed, value);
+		PLAIN_DBGPRINTF(plain, dag->ctx, "called CUSTOM PARSER '%s', result %d, "
 			"offs %zd, *pParsed %zd", prs->custType->name, r, *offs, *pParsed);
-		*pParsed = npb->parsedTo - *offs;
 		#ifdef	ADVANCED_STATS
 		es_addBuf(&npb->astats.exec_path, hdr, lenhdr);
 		es_addBuf(&npb->astats.exec_path, "[R:USR],", 8); 
 		#endif
+	} else if(prs->prsid == PRS_LITERAL
+		  && ((const struct data_Literal*) prs->parser_data)->len == 1) {
+		/* single-char literals are very frequent (the rulebase loader
+		 * creates them, and not all can be compacted), so we avoid the
+		 * call. Literal values are always deferred, so no value needed.
+		 */
+		if(   *offs < npb->strLen
+		   && npb->str[*offs] == ((const struct data_Literal*) prs->parser_data)->lit[0]) {
+			*pParsed = 1;
+			r = 0;
+		} else {
+			*pParsed = 0;
+			r = LN_WRONGPARSER;
+		}
 	} else {
-		r = parser_lookup_table[prs->prsid].parser(npb,
-			offs, prs->parser_data, pParsed, (prs->name == NULL) ? NULL : value);
+		r = parser_lookup_table[prs->prsid].parser(npb, offs, prs->parser_data, pParsed,
+			(prs->name == NULL || prs->deferValue) ? NULL : value);
 	}
-	LN_DBGPRINTF(npb->ctx, "parser lookup returns %d, pParsed %zu", r, *pParsed);
+	PLAIN_DBGPRINTF(plain, npb->ctx, "parser lookup returns %d, pParsed %zu", r, *pParsed);
 	npb->parsedTo = parsedTo;
+	npb->spanMode = spanMode;
+	npb->scRecord = scRecord;
+
+	if(npb->prof != NULL) {
+		const uint64_t ticks = profTicks() - profStart;
+		PROF_ADD(npb->prof->prs[prs->prsid].calls, 1);
+		if(r == 0)
+			PROF_ADD(npb->prof->prs[prs->prsid].success, 1);
+		PROF_ADD(npb->prof->prs[prs->prsid].ticks, ticks);
+		struct ln_pdag_nodeprof *const np = npbNodeProf(npb, dag);
+		if(np != NULL)
+			PROF_ADD(np->ticks, ticks);
+	}
 
 #ifdef	ADVANCED_STATS
 	++advstats_parsers_called;
@@ -1453,6 +2829,30 @@ tryParser(npb_t *const __restrict__ npb,
 	return r;
 }
 
+static int
+tryParser(npb_t *const __restrict__ npb,
+	struct ln_pdag *dag,
+	size_t *offs,
+	size_t *const __restrict__ pParsed,
+	struct json_object **value,
+	const ln_parser_t *const prs
+	)
+{
+	return tryParserVariant(npb, dag, offs, pParsed, value, prs, 0);
+}
+
+static int
+tryParserPlain(npb_t *const __restrict__ npb,
+	struct ln_pdag *dag,
+	size_t *offs,
+	size_t *const __restrict__ pParsed,
+	struct json_object **value,
+	const ln_parser_t *const prs
+	)
+{
+	return tryParserVariant(npb, dag, offs, pParsed, value, prs, 1);
+}
+
 
 static void
 add_str_reversed(npb_t *const __restrict__ npb,
@@ -1478,10 +2878,8 @@ add_rule_to_mockup(npb_t *const __restrict__ npb,
 	const ln_parser_t *const __restrict__ prs)
 {
 	if(prs->prsid == PRS_LITERAL) {
-		const char *const val = 
-			  ln_DataForDisplayLiteral(npb->ctx,
-				prs->parser_data);
-		add_str_reversed(npb, val, strlen(val));
+		const struct data_Literal *const lit = prs->parser_data;
+		add_str_reversed(npb, lit->lit, lit->len);
 	} else {
 		/* note: name/value order must also be reversed! */
 		es_addChar(&npb->rule, '%');
@@ -1498,148 +2896,732 @@ add_rule_to_mockup(npb_t *const __restrict__ npb,
 	}
 }
 
-/**
- * Recursive step of the normalizer. It walks the parse dag and calls itself
- * recursively when this is appropriate. It also implements backtracking in
- * those (hopefully rare) cases where it is required.
- *
- * @param[in] dag current tree to process
- * @param[in] string string to be matched against (the to-be-normalized data)
- * @param[in] strLen length of the to-be-matched string
- * @param[in] offs start position in input data
- * @param[out] pPrasedTo ptr to position up to which the the parsing succed in max
- * @param[in/out] json ... that is being created during normalization
- * @param[out] endNode if a match was found, this is the matching node (undefined otherwise)
- *
- * @return regular liblognorm error code (0->OK, something else->error)
- * TODO: can we use parameter block to prevent pushing params to the stack?
+/* record a field span (span mode only). We are called while walking
+ * upwards the tree, so spans are added last field first. Unnamed
+ * fields are not recorded. The span takes ownership of value.
+ */
+static int
+addSpan(npb_t *const __restrict__ npb,
+	const ln_parser_t *const __restrict__ prs,
+	const size_t offs,
+	const size_t len,
+	struct json_object *const value)
+{
+	int r = 0;
+	if(prs->name == NULL) {
+		if(value != NULL)
+			json_object_put(value);
+		goto done;
+	}
+	if(npb->nspans == npb->maxspans) {
+		const size_t newmax = (npb->maxspans == 0) ? 16 : npb->maxspans * 2;
+		struct npb_span *const newspans =
+			realloc(npb->spans, newmax * sizeof(struct npb_span));
+		if(newspans == NULL) {
+			if(value != NULL)
+				json_object_put(value);
+			r = LN_NOMEM;
+			goto done;
+		}
+		npb->spans = newspans;
+		npb->maxspans = newmax;
+	}
+	struct npb_span *const span = npb->spans + npb->nspans++;
+	span->prs = prs;
+	span->offs = offs;
+	span->len = len;
+	span->value = value;
+done:	return r;
+}
+
+/* get the tokener for the JSON parsers, ready for a new parse. It is
+ * created on first use and kept, so that backtracking does not cost an
+ * alloc/free pair per attempt. Without threadSafe, the context keeps
+ * it, otherwise it lives as long as the npb.
+ */
+struct json_tokener *
+ln_npbTokener(npb_t *const __restrict__ npb)
+{
+	struct json_tokener **const tokener = (npb->ctx->opts & LN_CTXOPT_THREADSAFE)
+		? &npb->tokener : &npb->ctx->tokener;
+	if(*tokener == NULL)
+		*tokener = json_tokener_new();
+	else
+		json_tokener_reset(*tokener);
+	return *tokener;
+}
+
+/* free the spans from index base on */
+void
+ln_npbDropSpans(npb_t *const __restrict__ npb, const size_t base)
+{
+	for(size_t i = base ; i < npb->nspans ; ++i) {
+		if(npb->spans[i].value != NULL)
+			json_object_put(npb->spans[i].value);
+	}
+	npb->nspans = base;
+}
+
+/* move the fields of the spans from index base on into json, the
+ * same way ln_normalizeRec() adds them in json mode. This is used
+ * by parsers that run a nested normalization in span mode, so that
+ * they can decide which values to keep.
  */
 int
-ln_normalizeRec(npb_t *const __restrict__ npb,
-	struct ln_pdag *dag,
+ln_npbSpansToJSON(npb_t *const __restrict__ npb,
+	struct ln_pdag *const dag,
+	const size_t base,
+	struct json_object *const json)
+{
+	int r = 0;
+	for(size_t i = base ; i < npb->nspans ; ++i) {
+		struct npb_span *const span = npb->spans + i;
+		struct json_object *value = span->value;
+		span->value = NULL;
+		if(value == NULL) {
+			CHKN(value = json_object_new_string_len(npb->str + span->offs, span->len));
+		}
+		CHKR(fixJSON(dag, npb->keyFlags, &value, json, span->prs));
+	}
+done:
+	ln_npbDropSpans(npb, base);
+	return r;
+}
+
+/* is a parser not to be tried, because its subtree needs a literal
+ * that the message does not contain (see prefilter.c)?
+ */
+static inline int
+prsFilteredOut(npb_t *const __restrict__ npb, const ln_parser_t *const prs)
+{
+	if(prs->reqLit == 0)
+		return 0;
+	if(!npb->litsScanned) {
+		ln_prefilterScan(npb->rb->prefilter, npb->str, npb->strLen, npb->litsFound);
+		npb->litsScanned = 1;
+	}
+	const uint32_t lit = prs->reqLit - 1;
+	return !(npb->litsFound[lit / 64] & ((uint64_t) 1 << (lit % 64)));
+}
+
+/* add the field of a parser whose subtree matched */
+static inline __attribute__((always_inline)) int
+acceptParser(npb_t *const __restrict__ npb,
+	struct ln_pdag *const dag,
+	const ln_parser_t *const prs,
 	const size_t offs,
+	const size_t parsed,
+	struct json_object *value,
+	struct json_object *const json,
+	struct ln_pdag **endNode,
+	const int plain)
+{
+	int r = 0;
+	PLAIN_DBGPRINTF(plain, dag->ctx, "parser matches at %zu", offs);
+	if(npb->spanMode) {
+		CHKR(addSpan(npb, prs, offs, parsed, value));
+	} else {
+		if(prs->deferValue && prs->name != NULL) {
+			/* now we know the value is needed */
+			CHKN(value = json_object_new_string_len(npb->str + offs, parsed));
+		}
+		CHKR(fixJSON(dag, npb->keyFlags, &value, json, prs));
+	}
+	if(!plain && (npb->ctx->opts & LN_CTXOPT_ADD_RULE) && (*endNode)->mockup == NULL) {
+		add_rule_to_mockup(npb, prs);
+	}
+	if(npb->scRecord) {
+		const size_t idx = prs - dag->parsers;
+		if(npb->scLen < LN_SC_MAXPATH && idx <= UINT16_MAX)
+			npb->scPath[npb->scLen++] = (uint16_t) idx;
+		else
+			npb->scLen = LN_SC_MAXPATH + 1;
+	}
+done:	return r;
+}
+
+/* the walk of ln_normalizeRec(), plain must be a constant */
+static inline __attribute__((always_inline)) int
+normalizeVariant(npb_t *const __restrict__ npb,
+	struct ln_pdag *dag,
+	size_t offs,
 	const int bPartialMatch,
 	struct json_object *json,
-	struct ln_pdag **endNode
+	struct ln_pdag **endNode,
+	const int plain
 	)
 {
-	int r = LN_WRONGPARSER;
-	int localR;
-	size_t i;
+	const size_t base = npb->nframes;
+	int r;
 	size_t iprs;
-	size_t parsedTo = npb->parsedTo;
-	size_t parsed = 0;
+	size_t nprs;
+	const uint16_t *prsidx;
+	size_t parsedTo;
+	const ln_parser_t *prs;
+	size_t i;
+	size_t parsed;
 	struct json_object *value;
-	
-LN_DBGPRINTF(dag->ctx, "%zu: enter parser, dag node %p, json %p", offs, dag, json);
 
-	++dag->stats.called;
+enter:
+	PLAIN_DBGPRINTF(plain, dag->ctx, "%zu: enter parser, dag node %p, json %p", offs, dag, json);
+	if(npb->hasBudget) {
+		if(npb->budgetExceeded) {
+			r = LN_BUDGET_EXCEEDED;
+			goto up;
+		}
+		if(npb->ctx->budget.maxDepth != 0 && npb->depth >= npb->ctx->budget.maxDepth) {
+			budgetExceeded(npb, dag);
+			r = LN_BUDGET_EXCEEDED;
+			goto up;
+		}
+		++npb->depth;
+	}
+	if(!(npb->ctx->opts & LN_CTXOPT_THREADSAFE))
+		++dag->stats.called;
+	if(npb->prof != NULL) {
+		struct ln_pdag_nodeprof *const np = npbNodeProf(npb, dag);
+		if(np != NULL)
+			PROF_ADD(np->calls, 1);
+		++npb->profPathlen;
+	}
 #ifdef	ADVANCED_STATS
 	++npb->astats.pathlen;
 	++npb->astats.recursion_level;
 #endif
+	parsedTo = npb->parsedTo;
+	iprs = 0;
+	nprs = dag->nparsers;
+	prsidx = NULL;
+
+	/* if we have a dispatch index, only those parsers are tried that
+	 * can potentially start with the current byte. At end of string,
+	 * we do not know, so all parsers are tried.
+	 */
+	if(dag->dispatch != NULL && offs < npb->strLen) {
+		const unsigned char c = (unsigned char) npb->str[offs];
+		prsidx = dag->dispatch->prs + dag->dispatch->offs[c];
+		nprs = dag->dispatch->offs[c+1] - dag->dispatch->offs[c];
+	}
 
+next:
 	/* now try the parsers */
-	for(iprs = 0 ; iprs < dag->nparsers && r != 0 ; ++iprs) {
-		const ln_parser_t *const prs = dag->parsers + iprs;
-		if(dag->ctx->debug) {
-			LN_DBGPRINTF(dag->ctx, "%zu/%d:trying '%s' parser for field '%s', "
+	while(iprs < nprs && !npb->budgetExceeded) {
+		prs = dag->parsers + ((prsidx == NULL) ? iprs : prsidx[iprs]);
+		++iprs;
+		if(!plain && dag->ctx->debug) {
+			PLAIN_DBGPRINTF(plain, dag->ctx, "%zu/%d:trying '%s' parser for field '%s', "
 				     "data '%s'",
 					offs, bPartialMatch, parserName(prs->prsid), prs->name,
 					(prs->prsid == PRS_LITERAL)
 					 ? ln_DataForDisplayLiteral(dag->ctx, prs->parser_data)
 				 	 : "UNKNOWN");
 		}
+		if(prsFilteredOut(npb, prs))
+			continue;
+		if(npb->hasBudget && budgetCharge(npb, dag))
+			break;
 		i = offs;
 		value = NULL;
-		localR = tryParser(npb, dag, &i, &parsed, &value, prs);
-		if(localR == 0) {
+		if((plain ? tryParserPlain(npb, dag, &i, &parsed, &value, prs)
+			  : tryParser(npb, dag, &i, &parsed, &value, prs)) == 0) {
 			parsedTo = i + parsed;
-			/* potential hit, need to verify */
-			LN_DBGPRINTF(dag->ctx, "%zu: potential hit, trying subtree %p",
+			/* potential hit, need to verify: push our choice point
+			 * and descend into the subtree
+			 */
+			PLAIN_DBGPRINTF(plain, dag->ctx, "%zu: potential hit, trying subtree %p",
 				offs, prs->node);
-			r = ln_normalizeRec(npb, prs->node, parsedTo,
-					    bPartialMatch, json, endNode);
-			LN_DBGPRINTF(dag->ctx, "%zu: subtree returns %d, parsedTo %zu", offs, r, parsedTo);
-			if(r == 0) {
-				LN_DBGPRINTF(dag->ctx, "%zu: parser matches at %zu", offs, i);
-				CHKR(fixJSON(dag, &value, json, prs));
-				if(npb->ctx->opts & LN_CTXOPT_ADD_RULE) {
-					add_rule_to_mockup(npb, prs);
-				}
-			} else {
-				++dag->stats.backtracked;
-				#ifdef	ADVANCED_STATS
-					++npb->astats.backtracked;
-					es_addBuf(&npb->astats.exec_path, "[B]", 3);
-				#endif
-				LN_DBGPRINTF(dag->ctx, "%zu nonmatch, backtracking required, parsed to=%zu",
-						offs, parsedTo);
-				if (value != NULL) { /* Free the value if it was created */
-					json_object_put(value);
+			if(npb->nframes == npb->maxframes) {
+				const size_t newmax = (npb->maxframes == 0) ? 32 : npb->maxframes * 2;
+				struct npb_frame *const newframes =
+					realloc(npb->frames, newmax * sizeof(struct npb_frame));
+				if(newframes == NULL) {
+					if(value != NULL)
+						json_object_put(value);
+					r = LN_NOMEM;
+					goto fail;
 				}
+				npb->frames = newframes;
+				npb->maxframes = newmax;
 			}
+			struct npb_frame *const fr = npb->frames + npb->nframes++;
+			fr->dag = dag;
+			fr->offs = offs;
+			fr->parsedTo = parsedTo;
+			fr->prsidx = prsidx;
+			fr->nprs = nprs;
+			fr->iprs = iprs;
+			fr->prs = prs;
+			fr->valOffs = i;
+			fr->parsed = parsed;
+			fr->value = value;
+			dag = prs->node;
+			offs = parsedTo;
+			goto enter;
 		}
 		/* did we have a longer parser --> then update */
 		if(parsedTo > npb->parsedTo)
 			npb->parsedTo = parsedTo;
-		LN_DBGPRINTF(dag->ctx, "parsedTo %zu, *pParsedTo %zu", parsedTo, npb->parsedTo);
 	}
 
-LN_DBGPRINTF(dag->ctx, "offs %zu, strLen %zu, isTerm %d", offs, npb->strLen, dag->flags.isTerminal);
-	if(dag->flags.isTerminal && (offs == npb->strLen || bPartialMatch)) {
+	/* all parsers tried */
+	r = LN_WRONGPARSER;
+matched: /* r is 0 if a parser matched */
+	PLAIN_DBGPRINTF(plain, dag->ctx, "offs %zu, strLen %zu, isTerm %d", offs, npb->strLen, dag->flags.isTerminal);
+	if(npb->budgetExceeded) {
+		r = LN_BUDGET_EXCEEDED;
+	} else if(dag->flags.isTerminal && (offs == npb->strLen || bPartialMatch)) {
 		*endNode = dag;
 		r = 0;
-		goto done;
 	}
-
-done:
-	LN_DBGPRINTF(dag->ctx, "%zu returns %d, pParsedTo %zu, parsedTo %zu",
+leave: /* r is the result of the node */
+	if(npb->hasBudget)
+		--npb->depth;
+	PLAIN_DBGPRINTF(plain, dag->ctx, "%zu returns %d, pParsedTo %zu, parsedTo %zu",
 		offs, r, npb->parsedTo, parsedTo);
 #	ifdef	ADVANCED_STATS
 	--npb->astats.recursion_level;
 #	endif
+up: /* back to the parent node with the result r of the subtree */
+	if(npb->nframes == base)
+		goto done;
+	{
+		const struct npb_frame *const fr = npb->frames + --npb->nframes;
+		dag = fr->dag;
+		offs = fr->offs;
+		parsedTo = fr->parsedTo;
+		prsidx = fr->prsidx;
+		nprs = fr->nprs;
+		iprs = fr->iprs;
+		prs = fr->prs;
+		i = fr->valOffs;
+		parsed = fr->parsed;
+		value = fr->value;
+	}
+	PLAIN_DBGPRINTF(plain, dag->ctx, "%zu: subtree returns %d, parsedTo %zu", offs, r, parsedTo);
+	if(r != 0) {
+		if(!(npb->ctx->opts & LN_CTXOPT_THREADSAFE))
+			++dag->stats.backtracked;
+		if(npb->prof != NULL) {
+			struct ln_pdag_nodeprof *const np = npbNodeProf(npb, dag);
+			if(np != NULL)
+				PROF_ADD(np->backtracks, 1);
+			++npb->profBacktracks;
+		}
+		#ifdef	ADVANCED_STATS
+			++npb->astats.backtracked;
+			es_addBuf(&npb->astats.exec_path, "[B]", 3);
+		#endif
+		PLAIN_DBGPRINTF(plain, dag->ctx, "%zu nonmatch, backtracking required, parsed to=%zu",
+				offs, parsedTo);
+		if (value != NULL) { /* Free the value if it was created */
+			json_object_put(value);
+		}
+		if(parsedTo > npb->parsedTo)
+			npb->parsedTo = parsedTo;
+		goto next;
+	}
+	if((r = acceptParser(npb, dag, prs, i, parsed, value, json, endNode, plain)) != 0)
+		goto leave;
+	if(parsedTo > npb->parsedTo)
+		npb->parsedTo = parsedTo;
+	goto matched;
+
+fail:	/* hard error, drop all choice points of this call */
+	if(npb->hasBudget)
+		--npb->depth;
+	while(npb->nframes > base) {
+		const struct npb_frame *const fr = npb->frames + --npb->nframes;
+		if(fr->value != NULL)
+			json_object_put(fr->value);
+		if(npb->hasBudget)
+			--npb->depth;
+	}
+done:
 	return r;
 }
 
+/**
+ * The normalizer. It walks the parse dag depth-first, trying the
+ * parsers of each node in priority order, and backtracks if the
+ * subtree of a matching parser does not match. The first full match
+ * wins, so a terminal node only matches if none of its parsers do.
+ *
+ * This is done without recursion: the state of the current node is
+ * kept in local variables, and when we descend into the subtree of a
+ * matching parser, it is pushed as a choice point onto a stack inside
+ * the npb (reused between messages, see npbConstruct()). So the C
+ * stack does not grow with the path length. Only nested normalizations
+ * (custom types, repeat, ...) call us again; they use the same stack
+ * on top of ours.
+ *
+ * There are two variants of the walk, generated from the same code: the
+ * plain one is used if there is neither debug output nor a rule mockup
+ * to build, which is the normal case in production. It has no checks
+ * for these in its inner loop. The variant is selected once per npb
+ * (see npbConstruct()).
+ *
+ * @param[in] dag current tree to process
+ * @param[in] offs start position in input data
+ * @param[in] bPartialMatch does the match need not end at the end of the message?
+ * @param[in/out] json ... that is being created during normalization
+ * @param[out] endNode if a match was found, this is the matching node (undefined otherwise)
+ *
+ * npb->parsedTo is updated to the max position up to which parsing succeeded.
+ *
+ * @return regular liblognorm error code (0->OK, something else->error)
+ */
 int
-ln_normalize(ln_ctx ctx, const char *str, const size_t strLen, struct json_object **json_p)
+ln_normalizeRec(npb_t *const __restrict__ npb,
+	struct ln_pdag *dag,
+	const size_t offs,
+	const int bPartialMatch,
+	struct json_object *json,
+	struct ln_pdag **endNode
+	)
 {
-	int r;
-	/* old cruft */
-	if(ctx->version == 1) {
-		r = ln_v1_normalize(ctx, str, strLen, json_p);
+	if(npb->plain)
+		return normalizeVariant(npb, dag, offs, bPartialMatch, json, endNode, 1);
+	return normalizeVariant(npb, dag, offs, bPartialMatch, json, endNode, 0);
+}
+
+/* would the full search try a parser of dag that comes before parser
+ * number upto at offs, and does it match? Only the parsers themselves
+ * are called, not their subtrees. So this may say yes although the
+ * full search would drop that parser later on, but never the other
+ * way around.
+ */
+static int
+shapePathPreempted(npb_t *const __restrict__ npb,
+	struct ln_pdag *const dag,
+	const size_t offs,
+	const size_t upto)
+{
+	const uint16_t *prsidx = NULL;
+	size_t nprs = dag->nparsers;
+
+	/* same selection as in ln_normalizeRec() */
+	if(dag->dispatch != NULL && offs < npb->strLen) {
+		const unsigned char c = (unsigned char) npb->str[offs];
+		prsidx = dag->dispatch->prs + dag->dispatch->offs[c];
+		nprs = dag->dispatch->offs[c+1] - dag->dispatch->offs[c];
+	}
+	for(size_t n = 0 ; n < nprs ; ++n) {
+		const size_t idx = (prsidx == NULL) ? n : prsidx[n];
+		if(idx >= upto)
+			break;
+		const ln_parser_t *const prs = dag->parsers + idx;
+		if(prsFilteredOut(npb, prs))
+			continue;
+		size_t i = offs;
+		size_t parsed = 0;
+		struct json_object *value = NULL;
+		const int r = npb->plain ? tryParserPlain(npb, dag, &i, &parsed, &value, prs)
+					 : tryParser(npb, dag, &i, &parsed, &value, prs);
+		if(value != NULL)
+			json_object_put(value);
+		if(r == 0)
+			return 1;
+	}
+	return 0;
+}
+
+/* normalize along a path from the shape cache (see shapecache.c).
+ * Besides the parsers on the path, we call those that the full search
+ * by ln_normalizeRec() would try first at the same offsets, but not
+ * their subtrees. If any of them matches, the message may belong to
+ * another rule and the full search is needed. So results are the same
+ * as without the cache, at a fraction of the cost of the full search.
+ * @return 0 if the message matches along the path, LN_WRONGPARSER if
+ *         the full search is needed, something else on hard errors
+ */
+static int
+normalizeShapePath(npb_t *const __restrict__ npb,
+	const uint16_t *const path,
+	const unsigned len,
+	struct json_object *const json,
+	struct ln_pdag **endNode)
+{
+	int r = LN_WRONGPARSER;
+	struct {
+		struct ln_pdag *dag;
+		const ln_parser_t *prs;
+		size_t offs;
+		size_t parsed;
+		struct json_object *value;
+	} steps[LN_SC_MAXPATH];
+	unsigned nsteps = 0;
+	struct ln_pdag *dag = npb->rb->pdag;
+	size_t offs = 0;
+
+	for(unsigned k = 0 ; k < len ; ++k) {
+		size_t i = offs;
+		size_t parsed = 0;
+		struct json_object *value = NULL;
+
+		if(path[k] >= dag->nparsers || shapePathPreempted(npb, dag, offs, path[k]))
+			goto done;
+		const ln_parser_t *const prs = dag->parsers + path[k];
+		if((npb->plain ? tryParserPlain(npb, dag, &i, &parsed, &value, prs)
+			       : tryParser(npb, dag, &i, &parsed, &value, prs)) != 0) {
+			if(value != NULL)
+				json_object_put(value);
+			goto done;
+		}
+		steps[nsteps].dag = dag;
+		steps[nsteps].prs = prs;
+		steps[nsteps].offs = i;
+		steps[nsteps].parsed = parsed;
+		steps[nsteps].value = value;
+		++nsteps;
+		offs = i + parsed;
+		dag = prs->node;
+	}
+	/* a terminal node only matches if none of its parsers does */
+	if(   !dag->flags.isTerminal || offs != npb->strLen
+	   || shapePathPreempted(npb, dag, offs, dag->nparsers))
 		goto done;
+
+	/* success, now do what ln_normalizeRec() does on the way back */
+	*endNode = dag;
+	if(!(npb->ctx->opts & LN_CTXOPT_THREADSAFE))
+		++dag->stats.called;
+	r = 0;
+	while(nsteps > 0) {
+		--nsteps;
+		struct json_object *value = steps[nsteps].value;
+		const ln_parser_t *const prs = steps[nsteps].prs;
+		steps[nsteps].value = NULL;
+		if(!(npb->ctx->opts & LN_CTXOPT_THREADSAFE))
+			++steps[nsteps].dag->stats.called;
+		if(prs->deferValue && prs->name != NULL) {
+			CHKN(value = json_object_new_string_len(npb->str + steps[nsteps].offs,
+				steps[nsteps].parsed));
+		}
+		CHKR(fixJSON(steps[nsteps].dag, npb->keyFlags, &value, json, prs));
 	}
-	/* end old cruft */
 
-	struct ln_pdag *endNode = NULL;
-	npb_t npb;
-	memset(&npb, 0, sizeof(npb));
-	npb.ctx = ctx;
-	npb.str = str;
-	npb.strLen = strLen;
+done:
+	for(unsigned k = 0 ; k < nsteps ; ++k) {
+		if(steps[k].value != NULL)
+			json_object_put(steps[k].value);
+	}
+	return r;
+}
+
+/* the shape cache to use for the current message, NULL if none. It is
+ * not used in thread-safe mode (it is updated during normalization) and
+ * with rule mockups (which are built during the full search).
+ */
+static struct ln_shapecache *
+npbShapeCache(npb_t *const __restrict__ npb)
+{
+	const ln_ctx ctx = npb->ctx;
+	ln_ctx const rb = npb->rb;
+	if(   ctx->shapeCacheSize == 0
+	   || (ctx->opts & (LN_CTXOPT_THREADSAFE | LN_CTXOPT_ADD_RULE)))
+		return NULL;
+	if(rb->shapeCache != NULL && ln_shapeCacheSize(rb->shapeCache) != ctx->shapeCacheSize) {
+		ln_shapeCacheDelete(rb->shapeCache);
+		rb->shapeCache = NULL;
+	}
+	if(rb->shapeCache == NULL)
+		rb->shapeCache = ln_shapeCacheNew(ctx->shapeCacheSize);
+	return rb->shapeCache;
+}
+
+/* create a private copy of a tag bucket (a json array of strings) */
+static struct json_object *
+copyTags(struct json_object *const tags)
+{
+	struct json_object *const copy = json_object_new_array();
+	if(copy == NULL)
+		goto done;
+	const int ntags = json_object_array_length(tags);
+	for(int i = 0 ; i < ntags ; ++i) {
+		struct json_object *const tag = json_object_array_get_idx(tags, i);
+		json_object_array_add(copy, json_object_new_string_len(
+			json_object_get_string(tag), json_object_get_string_len(tag)));
+	}
+done:	return copy;
+}
+
+/* set up a npb for use by normalizeMsg(). The same npb can be used
+ * for multiple messages, so that setup cost needs to be paid only once.
+ */
+static int
+npbConstruct(ln_ctx ctx, npb_t *const __restrict__ npb)
+{
+	int r = 0;
+	memset(npb, 0, sizeof(*npb));
+	npb->ctx = ctx;
 	if(ctx->opts & LN_CTXOPT_ADD_RULE) {
-		npb.rule = es_newStr(1024);
+		CHKN(npb->rule = es_newStr(1024));
+	}
+#	ifdef ADVANCED_STATS
+	CHKN(npb->astats.exec_path = es_newStr(1024));
+#	endif
+	npb->rb = ln_rbAcquire(ctx, &npb->rcuIdx);
+	/* events must not outlive the context, so they can reference the
+	 * field names of its own rulebase. A reloaded or shared rulebase
+	 * may be deleted earlier, so events need copies of its names.
+	 */
+	npb->keyFlags = JSON_C_OBJECT_ADD_KEY_IS_NEW;
+	if(npb->rb == ctx)
+		npb->keyFlags |= JSON_C_OBJECT_KEY_IS_CONSTANT;
+	if(ctx->opts & LN_CTXOPT_PROFILE) {
+		npb->prof = ctx->prof;
+		npb->nodeProf = __atomic_load_n(&npb->rb->nodeProf, __ATOMIC_ACQUIRE);
+		npb->profArena = npb->rb->pdagArena;
+	}
+	npb->hasBudget = ctx->budget.maxCalls != 0 || ctx->budget.maxDepth != 0
+		|| ctx->budget.maxNs != 0;
+	/* the rule mockup of a type is only created while it is matched */
+	npb->memoize = (ctx->opts & LN_CTXOPT_MEMOIZE_TYPES) && npb->rb->nTypes > 0
+		&& !(ctx->opts & LN_CTXOPT_ADD_RULE);
+	/* without debug output and rule mockups, the plain walk is used */
+	npb->plain = !(ctx->opts & LN_CTXOPT_ADD_RULE)
+		&& ctx->dbgCB == NULL && npb->rb->dbgCB == NULL;
+	/* the normalizer stack is reused, like the tokener (see ln_npbTokener()) */
+	if(!(ctx->opts & LN_CTXOPT_THREADSAFE)) {
+		npb->frames = ctx->frames;
+		npb->maxframes = ctx->maxframes;
+	}
+done:	return r;
+}
+
+static void
+npbDestruct(npb_t *const __restrict__ npb)
+{
+	ln_rbRelease(npb->ctx, npb->rcuIdx);
+	for(size_t i = 0 ; i < npb->nspans ; ++i) {
+		if(npb->spans[i].value != NULL)
+			json_object_put(npb->spans[i].value);
+	}
+	free(npb->spans);
+	if(npb->ctx->opts & LN_CTXOPT_THREADSAFE) {
+		free(npb->frames);
+	} else {
+		npb->ctx->frames = npb->frames;
+		npb->ctx->maxframes = npb->maxframes;
+	}
+	memoReset(npb);
+	free(npb->memo);
+	free(npb->memoHash);
+	if(npb->tokener != NULL)
+		json_tokener_free(npb->tokener);
+	free(npb->litsFound);
+	if(npb->rule != NULL)
+		es_deleteStr(npb->rule);
+#	ifdef ADVANCED_STATS
+	if(npb->astats.exec_path != NULL)
+		es_deleteStr(npb->astats.exec_path);
+#	endif
+}
+
+/* prepare the prefilter result for a new message. The message is only
+ * scanned when the first parser with a prefilter literal is reached.
+ */
+static int
+npbPrefilterStart(npb_t *const __restrict__ npb)
+{
+	int r = 0;
+	npb->litsScanned = 0;
+	if(npb->rb->prefilter == NULL)
+		goto done;
+	const size_t nwords = ln_prefilterWords(npb->rb->prefilter);
+	if(nwords > npb->maxLitsWords) {
+		uint64_t *const newlits = realloc(npb->litsFound, nwords * sizeof(uint64_t));
+		CHKN(newlits);
+		npb->litsFound = newlits;
+		npb->maxLitsWords = nwords;
 	}
+done:	return r;
+}
+
+/* normalize a single message with an already constructed npb.
+ * Only things that change from message to message are reset here.
+ */
+static int
+normalizeMsg(npb_t *const __restrict__ npb,
+	const char *str,
+	const size_t strLen,
+	struct json_object **json_p)
+{
+	int r;
+	ln_ctx ctx = npb->ctx;
+	struct ln_pdag *endNode = NULL;
+
+	/* like ln_pdagReoptimize(), we must not touch a shared rulebase */
+	if(   ctx->reoptInterval != 0
+	   && !(ctx->opts & LN_CTXOPT_THREADSAFE)
+	   && !ln_rbIsShared(npb->rb)
+	   && ++ctx->reoptCount >= ctx->reoptInterval) {
+		ctx->reoptCount = 0;
+		CHKR(pdagReoptimize(npb->rb));
+		/* the nodes have moved, and their profile counters with them */
+		if(npb->prof != NULL) {
+			npb->nodeProf = npb->rb->nodeProf;
+			npb->profArena = npb->rb->pdagArena;
+		}
+	}
+	npb->str = str;
+	npb->strLen = strLen;
+	npb->parsedTo = 0;
+	npb->profPathlen = 0;
+	npb->profBacktracks = 0;
+	memoReset(npb);
+	CHKR(npbPrefilterStart(npb));
+	if(npb->hasBudget)
+		budgetStart(npb);
+	if(npb->rule != NULL)
+		es_emptyStr(npb->rule);
 #	ifdef ADVANCED_STATS
-	npb.astats.exec_path = es_newStr(1024);
+	es_str_t *const exec_path = npb->astats.exec_path;
+	memset(&npb->astats, 0, sizeof(npb->astats));
+	es_emptyStr(exec_path);
+	npb->astats.exec_path = exec_path;
 #	endif
 
 	if(*json_p == NULL) {
 		CHKN(*json_p = json_object_new_object());
 	}
 
-	r = ln_normalizeRec(&npb, ctx->pdag, 0, 0, *json_p, &endNode);
+	struct ln_shapecache *const sc = npbShapeCache(npb);
+	uint64_t scKey = 0;
+	r = LN_WRONGPARSER;
+	if(sc != NULL) {
+		unsigned len;
+		scKey = ln_shapeCacheKey(str, strLen);
+		const uint16_t *const path = ln_shapeCacheLookup(sc, scKey, &len);
+		if(path == NULL) {
+			++ctx->shapeCacheStats.misses;
+		} else {
+			r = normalizeShapePath(npb, path, len, *json_p, &endNode);
+			if(r == 0)
+				++ctx->shapeCacheStats.hits;
+			else if(r == LN_WRONGPARSER)
+				++ctx->shapeCacheStats.mismatches;
+			else
+				goto done;
+		}
+	}
+	if(r != 0) {
+		npb->scRecord = (sc != NULL);
+		npb->scLen = 0;
+		r = ln_normalizeRec(npb, npb->rb->pdag, 0, 0, *json_p, &endNode);
+		npb->scRecord = 0;
+		if(sc != NULL && r == 0 && endNode->flags.isTerminal)
+			ln_shapeCacheStore(sc, scKey, npb->scPath, npb->scLen);
+	}
 
 	if(ctx->debug) {
 		if(r == 0) {
 			LN_DBGPRINTF(ctx, "final result for normalizer: parsedTo %zu, endNode %p, "
 				     "isTerminal %d, tagbucket %p",
-				     npb.parsedTo, endNode, endNode->flags.isTerminal, endNode->tags);
+				     npb->parsedTo, endNode, endNode->flags.isTerminal, endNode->tags);
 		} else {
 			LN_DBGPRINTF(ctx, "final result for normalizer: parsedTo %zu, endNode %p",
-				     npb.parsedTo, endNode);
+				     npb->parsedTo, endNode);
 		}
 	}
 	LN_DBGPRINTF(ctx, "DONE, final return is %d", r);
@@ -1647,9 +3629,18 @@ ln_normalize(ln_ctx ctx, const char *str, const size_t strLen, struct json_objec
 		/* success, finalize event */
 		if(endNode->tags != NULL) {
 			/* add tags to an event */
-			json_object_get(endNode->tags);
-			json_object_object_add(*json_p, "event.tags", endNode->tags);
-			CHKR(ln_annotate(ctx, *json_p, endNode->tags));
+			if(ctx->opts & LN_CTXOPT_THREADSAFE) {
+				/* the refcount of the shared tag bucket must not
+				 * be touched by multiple threads, so we need a copy.
+				 */
+				json_object_object_add(*json_p, "event.tags",
+					copyTags(endNode->tags));
+			} else {
+				json_object_get(endNode->tags);
+				json_object_object_add(*json_p, "event.tags", endNode->tags);
+			}
+			CHKR(ln_annotateCompiled(endNode->annots, endNode->nannots, *json_p,
+				ctx->opts & LN_CTXOPT_THREADSAFE));
 		}
 		if(ctx->opts & LN_CTXOPT_ADD_ORIGINALMSG) {
 			/* originalmsg must be kept outside of metadata for 
@@ -1658,45 +3649,155 @@ ln_normalize(ln_ctx ctx, const char *str, const size_t strLen, struct json_objec
 			json_object_object_add(*json_p, ORIGINAL_MSG_KEY,
 				json_object_new_string_len(str, strLen));
 		}
-		addRuleMetadata(&npb, *json_p, endNode);
+		addRuleMetadata(npb, *json_p, endNode);
 		r = 0;
 	} else {
-		addUnparsedField(str, strLen, npb.parsedTo, *json_p);
+		addUnparsedField(str, strLen, npb->parsedTo, *json_p);
 	}
 
-	if(ctx->opts & LN_CTXOPT_ADD_RULE) {
-		es_deleteStr(npb.rule);
+	if(npb->prof != NULL) {
+		struct ln_pdag_profile *const prof = npb->prof;
+		PROF_ADD(prof->msgs, 1);
+		if(r == 0)
+			PROF_ADD(prof->parsed, 1);
+		PROF_ADD(prof->pathlen[npb->profPathlen < LN_PROF_HIST_SIZE
+			? npb->profPathlen : LN_PROF_HIST_SIZE - 1], 1);
+		PROF_ADD(prof->backtracks[npb->profBacktracks < LN_PROF_HIST_SIZE
+			? npb->profBacktracks : LN_PROF_HIST_SIZE - 1], 1);
 	}
 
 #ifdef	ADVANCED_STATS
 	if(r != 0)
-		es_addBuf(&npb.astats.exec_path, "[FAILED]", 8);
+		es_addBuf(&npb->astats.exec_path, "[FAILED]", 8);
 	else if(!endNode->flags.isTerminal)
-		es_addBuf(&npb.astats.exec_path, "[FAILED:NON-TERMINAL]", 21);
-	if(npb.astats.pathlen < ADVSTATS_MAX_ENTITIES)
-		advstats_pathlens[npb.astats.pathlen]++;
-	if(npb.astats.pathlen > advstats_max_pathlen) {
-		advstats_max_pathlen = npb.astats.pathlen;
+		es_addBuf(&npb->astats.exec_path, "[FAILED:NON-TERMINAL]", 21);
+	if(npb->astats.pathlen < ADVSTATS_MAX_ENTITIES)
+		advstats_pathlens[npb->astats.pathlen]++;
+	if(npb->astats.pathlen > advstats_max_pathlen) {
+		advstats_max_pathlen = npb->astats.pathlen;
 	}
-	if(npb.astats.backtracked < ADVSTATS_MAX_ENTITIES)
-		advstats_backtracks[npb.astats.backtracked]++;
-	if(npb.astats.backtracked > advstats_max_backtracked) {
-		advstats_max_backtracked = npb.astats.backtracked;
+	if(npb->astats.backtracked < ADVSTATS_MAX_ENTITIES)
+		advstats_backtracks[npb->astats.backtracked]++;
+	if(npb->astats.backtracked > advstats_max_backtracked) {
+		advstats_max_backtracked = npb->astats.backtracked;
 	}
 
 	/* parser calls */
-	if(npb.astats.parser_calls < ADVSTATS_MAX_ENTITIES)
-		advstats_parser_calls[npb.astats.parser_calls]++;
-	if(npb.astats.parser_calls > advstats_max_parser_calls) {
-		advstats_max_parser_calls = npb.astats.parser_calls;
+	if(npb->astats.parser_calls < ADVSTATS_MAX_ENTITIES)
+		advstats_parser_calls[npb->astats.parser_calls]++;
+	if(npb->astats.parser_calls > advstats_max_parser_calls) {
+		advstats_max_parser_calls = npb->astats.parser_calls;
 	}
-	if(npb.astats.lit_parser_calls < ADVSTATS_MAX_ENTITIES)
-		advstats_lit_parser_calls[npb.astats.lit_parser_calls]++;
-	if(npb.astats.lit_parser_calls > advstats_max_lit_parser_calls) {
-		advstats_max_lit_parser_calls = npb.astats.lit_parser_calls;
+	if(npb->astats.lit_parser_calls < ADVSTATS_MAX_ENTITIES)
+		advstats_lit_parser_calls[npb->astats.lit_parser_calls]++;
+	if(npb->astats.lit_parser_calls > advstats_max_lit_parser_calls) {
+		advstats_max_lit_parser_calls = npb->astats.lit_parser_calls;
 	}
-
-	es_deleteStr(npb.astats.exec_path);
 #endif
 done:	return r;
 }
+
+int
+ln_normalize(ln_ctx ctx, const char *str, const size_t strLen, struct json_object **json_p)
+{
+	int r;
+	npb_t npb;
+
+	CHKR(npbConstruct(ctx, &npb));
+	/* old cruft */
+	if(npb.rb->version == 1)
+		r = ln_v1_normalize(npb.rb, str, strLen, json_p);
+	else
+	/* end old cruft */
+		r = normalizeMsg(&npb, str, strLen, json_p);
+	npbDestruct(&npb);
+done:	return r;
+}
+
+int
+ln_normalizeBatch(ln_ctx ctx, const char **msgs, const size_t *lens, const size_t n,
+	struct json_object **out)
+{
+	int r = 0;
+	int localR;
+	npb_t npb;
+
+	CHKR(npbConstruct(ctx, &npb));
+	/* old cruft */
+	if(npb.rb->version == 1) {
+		for(size_t i = 0 ; i < n ; ++i) {
+			localR = ln_v1_normalize(npb.rb, msgs[i], lens[i], out+i);
+			if(localR != 0)
+				r = localR;
+		}
+		npbDestruct(&npb);
+		goto done;
+	}
+	/* end old cruft */
+
+	if(n > 0) {
+		__builtin_prefetch(npb.rb->pdag->parsers);
+		__builtin_prefetch(msgs[0]);
+	}
+	for(size_t i = 0 ; i < n ; ++i) {
+		if(i + 1 < n)
+			__builtin_prefetch(msgs[i+1]);
+		localR = normalizeMsg(&npb, msgs[i], lens[i], out+i);
+		if(localR == LN_WRONGPARSER || localR == LN_BUDGET_EXCEEDED) {
+			r = localR;
+		} else if(localR != 0) {
+			r = localR;
+			break; /* hard error, we cannot continue */
+		}
+	}
+	npbDestruct(&npb);
+done:	return r;
+}
+
+int
+ln_normalizeToSpans(ln_ctx ctx, const char *str, const size_t strLen,
+	ln_span_cb cb, void *const cookie, const char **rule_id)
+{
+	int r;
+	npb_t npb;
+	struct ln_pdag *endNode = NULL;
+
+	CHKR(npbConstruct(ctx, &npb));
+	if(npb.rb->version == 1) {
+		ln_errprintf(ctx, 0, "span API is not supported for v1 rulebases");
+		npbDestruct(&npb);
+		r = LN_BADCONFIG;
+		goto done;
+	}
+	npb.str = str;
+	npb.strLen = strLen;
+	npb.spanMode = 1;
+	if((r = npbPrefilterStart(&npb)) != 0) {
+		npbDestruct(&npb);
+		goto done;
+	}
+	if(npb.hasBudget)
+		budgetStart(&npb);
+	r = ln_normalizeRec(&npb, npb.rb->pdag, 0, 0, NULL, &endNode);
+	LN_DBGPRINTF(ctx, "span normalizer returns %d, parsedTo %zu, nspans %zu",
+		r, npb.parsedTo, npb.nspans);
+	if(r == 0 && endNode->flags.isTerminal) {
+		if(rule_id != NULL)
+			*rule_id = endNode->rb_id;
+		/* spans were collected last field first */
+		for(size_t i = npb.nspans ; i > 0 && r == 0 ; --i) {
+			const struct npb_span *const span = npb.spans + (i - 1);
+			struct ln_field_span fspan;
+			fspan.name = span->prs->name;
+			fspan.offs = span->offs;
+			fspan.len = span->len;
+			fspan.parser = parserName(span->prs->prsid);
+			fspan.value = span->value;
+			r = cb(cookie, &fspan);
+		}
+	} else if(r == 0) {
+		r = LN_WRONGPARSER;
+	}
+	npbDestruct(&npb);
+done:	return r;
+}
@@ -27,6 +27,7 @@ typedef struct npb npb_t;
 typedef uint8_t prsid_t;
 
 struct ln_type_pdag;
+struct ln_annot_kv;
 
 /** 
  * parser IDs.
@@ -80,6 +81,8 @@ struct ln_type_pdag;
  */
 struct ln_parser_s {
 	prsid_t prsid;		/**< parser ID (for lookup table) */
+	unsigned char deferValue; /**< value is only created after the subtree matched */
+	uint32_t reqLit;	/**< prefilter literal id + 1 the subtree needs, 0 if none (see prefilter.c) */
 	ln_pdag *node;		/**< node to branch to if parser succeeded */
 	void *parser_data;	/**< opaque data that the field-parser understands */
 	struct ln_type_pdag *custType;	/**< points to custom type, if such is used */
@@ -95,6 +98,7 @@ struct ln_parser_info {
 	int (*parser)(npb_t *npb, size_t*, void *const,
 				  size_t*, struct json_object **); /**< parser to use */
 	void (*destruct)(ln_ctx, void *const); /* note: destructor is only needed if parser data exists */
+	size_t (*datasize)(void *const); /**< memory used by parser data */
 #ifdef ADVANCED_STATS
 	uint64_t called;
 	uint64_t success;
@@ -102,23 +106,46 @@ struct ln_parser_info {
 };
 
 
+/**
+ * first-byte dispatch index of a pdag node.
+ * For each possible value of the next input byte, this holds the list
+ * of parsers (as index into the node's parser table) which can
+ * potentially match at that byte. The lists are kept in parser
+ * priority order. The index is built by the optimizer, so it is only
+ * present on optimized nodes (and not even on all of them).
+ */
+struct ln_pdag_dispatch {
+	uint16_t offs[257];		/**< start of list for each byte value inside prs, offs[256] is end */
+	uint16_t prs[];			/**< parser indexes, all lists one after another */
+};
+
 /* parse DAG object
  */
 struct ln_pdag {
 	ln_ctx ctx;			/**< our context */ // TODO: why do we need it?
 	ln_parser_t *parsers;		/* array of parsers to try */
-	prsid_t nparsers;		/**< current table size (prsid_t slighly abused) */
+	int nparsers;			/**< current table size */
+	struct ln_pdag_dispatch *dispatch; /**< first-byte dispatch index, NULL if not used */
+	struct ln_pdag_prsidx *prsIdx;	/**< parser lookup while the pdag is built, NULL if not used */
 	struct {
 		unsigned isTerminal:1;	/**< designates this node a terminal sequence */
 		unsigned visited:1;	/**< work var for recursive procedures */
+		unsigned inArena:1;	/**< node itself lives in the ctx pdag arena */
+		unsigned prsInArena:1;	/**< parser table lives in the ctx pdag arena */
+		unsigned prefilter:1;	/**< some parsers have a prefilter literal */
 	} flags;
 	struct json_object *tags;	/**< tags to assign to events of this type */
+	struct ln_annot_kv *annots;	/**< precompiled annotations for tags, built by optimizer */
+	int nannots;			/**< number of entries in annots */
+	struct json_object *mockup;	/**< precomputed rule mockup, NULL if path-dependent */
+	struct json_object *location;	/**< precomputed rule location */
 	int refcnt;			/**< reference count for deleting tracking */
 	struct {
 		unsigned called;
 		unsigned backtracked;	/**< incremented when backtracking was initiated */
 		unsigned terminated;
 	} stats;	/**< usage statistics */
+	uint64_t budgetExceeded;	/**< times the work budget ran out here (atomic) */
 	const char *rb_id;		/**< human-readable rulebase identifier, for stats etc */
 	
 	// experimental, move outside later
@@ -142,6 +169,76 @@ extern int advstats_max_backtracked;
 extern int advstats_backtracks[ADVSTATS_MAX_ENTITIES];
 #endif
 
+/* runtime profile, only collected if LN_CTXOPT_PROFILE is set. There is
+ * one of these per context. All counters are updated with relaxed atomic
+ * operations, so this also works in thread-safe mode. Times are kept in
+ * ticks (TSC cycles where available, else ns) and are converted to ns
+ * only when the profile is exported.
+ */
+#define LN_PROF_HIST_SIZE 64	/**< histogram size, last bucket counts all larger values */
+
+/* per-node counters of the runtime profile. They are kept outside of
+ * the nodes, so that nodes do not grow if nobody profiles. A rulebase
+ * has one entry per node of its pdag arena, in arena order, once a
+ * context that uses it enables LN_CTXOPT_PROFILE (see
+ * ln_pdagNodeProfAlloc()).
+ */
+struct ln_pdag_nodeprof {
+	uint64_t calls;		/**< number of times the node was entered */
+	uint64_t backtracks;	/**< number of failed subtrees */
+	uint64_t ticks;		/**< time spent in parsers of this node */
+};
+struct ln_pdag_profile {
+	uint64_t msgs;			/**< messages normalized */
+	uint64_t parsed;		/**< ...of which could be parsed */
+	struct {
+		uint64_t calls;
+		uint64_t success;
+		uint64_t ticks;
+	} prs[PRS_INVALID];		/**< per parser type, indexed by prsid */
+	uint64_t pathlen[LN_PROF_HIST_SIZE];	/**< histogram: nodes entered per message */
+	uint64_t backtracks[LN_PROF_HIST_SIZE];	/**< histogram: backtracks per message */
+	uint64_t startTicks;		/**< ticks when profile was (re)started... */
+	uint64_t startNs;		/**< ...and the same in ns, for tick conversion */
+};
+
+/** a field span. In span mode, these are collected instead of
+ * adding the field values to a json object.
+ */
+struct npb_span {
+	const ln_parser_t *prs;		/**< parser that matched the field */
+	size_t offs;			/**< start of field in message */
+	size_t len;			/**< length of field */
+	struct json_object *value;	/**< value, only if not just the substring */
+};
+
+/** a memoized custom type result (see LN_CTXOPT_MEMOIZE_TYPES). */
+struct npb_memo {
+	const struct ln_type_pdag *type; /**< custom type that was tried... */
+	size_t offs;			/**< ...at this offset */
+	int r;				/**< result of the match */
+	size_t parsed;			/**< number of bytes consumed */
+	struct json_object *value;	/**< value on success, we hold a reference */
+};
+
+/** a choice point of the normalizer, kept for each pdag node on the
+ * current path but the last one (see ln_normalizeRec()).
+ */
+struct npb_frame {
+	struct ln_pdag *dag;		/**< the node */
+	size_t offs;			/**< where the node starts in the message */
+	size_t parsedTo;		/**< end of the last parser match at this node */
+	const uint16_t *prsidx;		/**< dispatch list, NULL if all parsers are tried */
+	size_t nprs;			/**< number of parsers to try */
+	size_t iprs;			/**< next parser to try */
+	const ln_parser_t *prs;		/**< parser whose subtree is being tried... */
+	size_t valOffs;			/**< ...its match starts here... */
+	size_t parsed;			/**< ...and is this long */
+	struct json_object *value;	/**< its value, NULL if not (yet) created */
+};
+
+#define LN_SC_MAXPATH 48	/**< max steps of a path in the shape cache */
+
 /** the "normalization paramater block" (npb)
  * This structure is passed to all normalization routines including
  * parsers. It contains data that commonly needs to be passed,
@@ -156,11 +253,45 @@ extern int advstats_backtracks[ADVSTATS_MAX_ENTITIES];
  */
 struct npb {
 	ln_ctx ctx;
+	ln_ctx rb;			/**< context owning the rulebase in use (see ln_ctxReload) */
+	unsigned rcuIdx;		/**< reader counter taken for rb */
 	const char *str;		/**< to-be-normalized message */
 	size_t strLen;			/**< length of it */
 	size_t parsedTo;		/**< up to which byte could this be parsed? */
 	es_str_t *rule;			/**< a mock-up of the rule used to parse */
 	es_str_t *exec_path;
+	int spanMode;			/**< collect field spans instead of building json? */
+	struct npb_span *spans;		/**< spans collected so far, last field first */
+	size_t nspans;			/**< number of spans collected */
+	size_t maxspans;		/**< size of spans array */
+	struct ln_pdag_profile *prof;	/**< profile to update, NULL if not profiling */
+	struct ln_pdag_nodeprof *nodeProf; /**< per-node counters of rb, NULL if none */
+	const struct ln_pdag *profArena; /**< first node of the arena nodeProf belongs to */
+	unsigned profPathlen;		/**< nodes entered for current message */
+	unsigned profBacktracks;	/**< backtracks for current message */
+	int hasBudget;			/**< is a work budget set? */
+	int budgetExceeded;		/**< did the current message run out of budget? */
+	unsigned budgetCalls;		/**< parser calls for current message */
+	unsigned depth;			/**< number of nodes on the current path */
+	uint64_t deadline;		/**< time budget end (ns), 0 if none */
+	int memoize;			/**< memoize custom type results? */
+	unsigned keyFlags;		/**< flags for adding fields named by the rulebase */
+	struct npb_memo *memo;		/**< memoized results for current message */
+	size_t nmemo;			/**< number of memo entries in use */
+	size_t maxmemo;			/**< size of memo array */
+	uint32_t *memoHash;		/**< hash index into memo (entry index + 1, 0 = free) */
+	size_t memoHashSize;		/**< size of hash index, always a power of two */
+	struct json_tokener *tokener;	/**< JSON parser state, see ln_npbTokener() */
+	uint64_t *litsFound;		/**< prefilter literals in the message, bit per literal id */
+	size_t maxLitsWords;		/**< size of litsFound */
+	int litsScanned;		/**< is litsFound valid for the current message? */
+	int plain;			/**< use the plain walk of ln_normalizeRec()? */
+	struct npb_frame *frames;	/**< choice points of ln_normalizeRec(), see struct npb_frame */
+	size_t nframes;			/**< number of frames in use */
+	size_t maxframes;		/**< size of frames array */
+	int scRecord;			/**< record the winning path for the shape cache? */
+	unsigned scLen;			/**< steps in scPath, > LN_SC_MAXPATH if too long */
+	uint16_t scPath[LN_SC_MAXPATH];	/**< winning path, deepest step first */
 #ifdef ADVANCED_STATS
 	int pathlen;
 	int backtracked;
@@ -254,6 +385,8 @@ ln_parser_t * ln_newLiteralParser(ln_ctx ctx, char lit);
 ln_parser_t* ln_newParser(ln_ctx ctx, json_object *const prscnf);
 struct ln_type_pdag * ln_pdagFindType(ln_ctx ctx, const char *const __restrict__ name, const int bAdd);
 void ln_fullPDagStatsDOT(ln_ctx ctx, FILE *const fp);
+struct ln_pdag_profile * ln_newProfile(void);
+int ln_pdagNodeProfAlloc(ln_ctx rb);
 
 /* friends */
 int
@@ -264,5 +397,32 @@ ln_normalizeRec(npb_t *const __restrict__ npb,
 	struct json_object *json,
 	struct ln_pdag **endNode
 );
+void ln_npbDropSpans(npb_t *const __restrict__ npb, const size_t base);
+struct json_tokener *ln_npbTokener(npb_t *const __restrict__ npb);
+
+/* prefilter, see prefilter.c */
+struct ln_prefilter;
+int ln_prefilterBuild(ln_ctx ctx);
+void ln_prefilterDelete(struct ln_prefilter *const pf);
+size_t ln_prefilterMemSize(const struct ln_prefilter *const pf);
+size_t ln_prefilterWords(const struct ln_prefilter *const pf);
+void ln_prefilterScan(const struct ln_prefilter *const pf, const char *const str,
+	const size_t len, uint64_t *const found);
+int ln_npbSpansToJSON(npb_t *const __restrict__ npb, struct ln_pdag *const dag,
+	const size_t base, struct json_object *const json);
+
+/* shape cache, see shapecache.c */
+struct ln_shapecache;
+struct ln_shapecache *ln_shapeCacheNew(const unsigned size);
+void ln_shapeCacheDelete(struct ln_shapecache *const sc);
+void ln_shapeCacheClear(struct ln_shapecache *const sc);
+unsigned ln_shapeCacheSize(const struct ln_shapecache *const sc);
+unsigned ln_shapeCacheUsed(const struct ln_shapecache *const sc);
+size_t ln_shapeCacheMemSize(const struct ln_shapecache *const sc);
+uint64_t ln_shapeCacheKey(const char *const str, const size_t len);
+const uint16_t *ln_shapeCacheLookup(const struct ln_shapecache *const sc, const uint64_t key,
+	unsigned *const len);
+void ln_shapeCacheStore(struct ln_shapecache *const sc, const uint64_t key,
+	const uint16_t *const revpath, const unsigned len);
 
 #endif /* #ifndef LOGNORM_PDAG_H_INCLUDED */
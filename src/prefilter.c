@@ -0,0 +1,499 @@
+/**
+ * @file prefilter.c
+ * @brief Literal prefilter for the parse dag.
+ *
+ * Large rulebases often consist of rules that differ by a keyword
+ * somewhere in the message, after some fields. Prefix sharing in the
+ * pdag cannot help there, so many alternatives are tried in turn. The
+ * prefilter finds, for each parser at a branch point, a literal that
+ * every rule below that parser contains. The message is scanned for
+ * all these literals once, and parsers whose literal is not in the
+ * message are not tried (see ln_normalizeRec()). Parsers without
+ * such a literal are always tried, so normalization results do not
+ * change.
+ *
+ * Literals are searched by one of their 4-byte substrings ("grams").
+ * For each literal, the gram that is rarest among all literals is
+ * used, so that few literals need to be verified for a hit. A bitmap
+ * indexed by gram hash rejects most positions of the message with a
+ * single lookup.
+ *//*
+ * Copyright 2026 by Rainer Gerhards and Adiscon GmbH.
+ *
+ * Released under ASL 2.0.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <libestr.h>
+
+#include "liblognorm.h"
+#include "lognorm.h"
+#include "pdag.h"
+#include "internal.h"
+#include "parser.h"
+
+#define PF_GRAMLEN 4	/**< length of grams, literals must be at least as long */
+#define PF_SETMAX 8	/**< max literals remembered as required per node */
+#define PF_BLOOMBITS 16	/**< log2 of number of bits in gram bitmap */
+#define PREFILTER_MIN_PARSERS 2 /**< min number of parsers at a node to use the prefilter */
+
+struct pf_lit {
+	const char *str;
+	size_t len;
+};
+
+/* a literal inside the gram index: lit contains gram at offset offs */
+struct pf_entry {
+	uint32_t gram;
+	uint32_t lit;
+	uint32_t offs;
+};
+
+/* hash slot: entries [first, first+n) have the gram, n == 0 means free */
+struct pf_slot {
+	uint32_t gram;
+	uint32_t first;
+	uint32_t n;
+};
+
+struct ln_prefilter {
+	size_t nlits;
+	struct pf_lit *lits;		/**< literals, index is id */
+	struct pf_entry *entries;	/**< literals, sorted by gram */
+	struct pf_slot *slots;		/**< gram hash table */
+	unsigned slotBits;		/**< log2 of number of slots */
+	uint64_t bloom[(1 << PF_BLOOMBITS) / 64]; /**< bit per gram hash value */
+};
+
+static inline uint32_t
+pfHash(const uint32_t gram)
+{
+	return gram * 0x9e3779b1u;
+}
+
+static inline uint32_t
+pfGram(const char *const p)
+{
+	uint32_t gram;
+	memcpy(&gram, p, PF_GRAMLEN);
+	return gram;
+}
+
+size_t
+ln_prefilterWords(const struct ln_prefilter *const pf)
+{
+	return (pf->nlits + 63) / 64;
+}
+
+void
+ln_prefilterScan(const struct ln_prefilter *const pf, const char *const str,
+	const size_t len, uint64_t *const found)
+{
+	memset(found, 0, ln_prefilterWords(pf) * sizeof(uint64_t));
+	for(size_t i = 0 ; i + PF_GRAMLEN <= len ; ++i) {
+		const uint32_t gram = pfGram(str + i);
+		const uint32_t h = pfHash(gram);
+		const uint32_t bit = h >> (32 - PF_BLOOMBITS);
+		if(!(pf->bloom[bit / 64] & ((uint64_t) 1 << (bit % 64))))
+			continue;
+		const uint32_t mask = (1u << pf->slotBits) - 1;
+		for(uint32_t k = h >> (32 - pf->slotBits) ; pf->slots[k].n != 0 ; k = (k + 1) & mask) {
+			const struct pf_slot *const slot = pf->slots + k;
+			if(slot->gram != gram)
+				continue;
+			for(uint32_t e = slot->first ; e < slot->first + slot->n ; ++e) {
+				const struct pf_entry *const ent = pf->entries + e;
+				const struct pf_lit *const lit = pf->lits + ent->lit;
+				if(   i >= ent->offs
+				   && i - ent->offs + lit->len <= len
+				   && !memcmp(str + i - ent->offs, lit->str, lit->len))
+					found[ent->lit / 64] |= (uint64_t) 1 << (ent->lit % 64);
+			}
+			break;
+		}
+	}
+}
+
+void
+ln_prefilterDelete(struct ln_prefilter *const pf)
+{
+	if(pf == NULL)
+		return;
+	free(pf->lits);
+	free(pf->entries);
+	free(pf->slots);
+	free(pf);
+}
+
+size_t
+ln_prefilterMemSize(const struct ln_prefilter *const pf)
+{
+	if(pf == NULL)
+		return 0;
+	return sizeof(struct ln_prefilter)
+		+ pf->nlits * (sizeof(struct pf_lit) + sizeof(struct pf_entry))
+		+ ((size_t) 1 << pf->slotBits) * sizeof(struct pf_slot);
+}
+
+
+/* work data for building the prefilter */
+
+/* set of literals required by all successful paths from a node. If
+ * "top" is set, no path is successful at all (any literal is required).
+ */
+struct pf_set {
+	unsigned char done;
+	unsigned char top;
+	unsigned char n;
+	uint32_t lit[PF_SETMAX];
+};
+
+/* a distinct literal of the rulebase */
+struct pf_blit {
+	const char *str;
+	size_t len;
+	uint32_t hash;
+	uint32_t id;		/**< final id + 1, 0 if not used by the prefilter */
+};
+
+struct pf_build {
+	ln_ctx ctx;
+	struct ln_pdag *nodes;		/**< arena nodes */
+	size_t nnodes;
+	struct pf_set *sets;		/**< per arena node */
+	struct pf_blit *lits;
+	size_t nlits;
+	size_t maxlits;
+	uint32_t *litHash;		/**< index + 1 into lits, 0 = free */
+	size_t litHashSize;		/**< always a power of two */
+	size_t nused;			/**< literals used by the prefilter */
+};
+
+static uint32_t
+pfStrHash(const char *const str, const size_t len)
+{
+	uint32_t h = 2166136261u;
+	for(size_t i = 0 ; i < len ; ++i)
+		h = (h ^ (unsigned char) str[i]) * 16777619u;
+	return h;
+}
+
+static int
+pfRehash(struct pf_build *const b)
+{
+	int r = 0;
+	const size_t newSize = (b->litHashSize == 0) ? 1024 : 2 * b->litHashSize;
+	uint32_t *newHash;
+	CHKN(newHash = calloc(newSize, sizeof(uint32_t)));
+	for(size_t i = 0 ; i < b->nlits ; ++i) {
+		size_t k = b->lits[i].hash & (newSize - 1);
+		while(newHash[k] != 0)
+			k = (k + 1) & (newSize - 1);
+		newHash[k] = i + 1;
+	}
+	free(b->litHash);
+	b->litHash = newHash;
+	b->litHashSize = newSize;
+done:	return r;
+}
+
+/* get the index of a literal, adding it if it is new */
+static int
+pfIntern(struct pf_build *const b, const struct data_Literal *const lit, uint32_t *const idx)
+{
+	int r = 0;
+	const uint32_t h = pfStrHash(lit->lit, lit->len);
+	if(2 * (b->nlits + 1) > b->litHashSize)
+		CHKR(pfRehash(b));
+	size_t k = h & (b->litHashSize - 1);
+	for( ; b->litHash[k] != 0 ; k = (k + 1) & (b->litHashSize - 1)) {
+		const struct pf_blit *const l = b->lits + b->litHash[k] - 1;
+		if(l->hash == h && l->len == lit->len && !memcmp(l->str, lit->lit, lit->len)) {
+			*idx = b->litHash[k] - 1;
+			goto done;
+		}
+	}
+	if(b->nlits == b->maxlits) {
+		const size_t newmax = (b->maxlits == 0) ? 256 : 2 * b->maxlits;
+		struct pf_blit *newlits;
+		CHKN(newlits = realloc(b->lits, newmax * sizeof(struct pf_blit)));
+		b->lits = newlits;
+		b->maxlits = newmax;
+	}
+	b->lits[b->nlits].str = lit->lit;
+	b->lits[b->nlits].len = lit->len;
+	b->lits[b->nlits].hash = h;
+	b->lits[b->nlits].id = 0;
+	b->litHash[k] = b->nlits + 1;
+	*idx = b->nlits++;
+done:	return r;
+}
+
+/* add a literal to a set. If the set is full, the shortest literal is
+ * dropped: a subset of the required literals is still required.
+ */
+static void
+pfSetAdd(const struct pf_build *const b, struct pf_set *const s, const uint32_t lit)
+{
+	if(s->top)
+		return;
+	for(int i = 0 ; i < s->n ; ++i)
+		if(s->lit[i] == lit)
+			return;
+	if(s->n < PF_SETMAX) {
+		s->lit[s->n++] = lit;
+		return;
+	}
+	int shortest = 0;
+	for(int i = 1 ; i < s->n ; ++i)
+		if(b->lits[s->lit[i]].len < b->lits[s->lit[shortest]].len)
+			shortest = i;
+	if(b->lits[lit].len > b->lits[s->lit[shortest]].len)
+		s->lit[shortest] = lit;
+}
+
+static void
+pfSetIntersect(struct pf_set *const s, const struct pf_set *const other)
+{
+	if(other->top)
+		return;
+	if(s->top) {
+		*s = *other;
+		return;
+	}
+	int n = 0;
+	for(int i = 0 ; i < s->n ; ++i) {
+		for(int j = 0 ; j < other->n ; ++j) {
+			if(s->lit[i] == other->lit[j]) {
+				s->lit[n++] = s->lit[i];
+				break;
+			}
+		}
+	}
+	s->n = n;
+}
+
+static inline struct pf_set *
+pfNodeSet(struct pf_build *const b, const struct ln_pdag *const dag)
+{
+	return b->sets + (dag - b->nodes);
+}
+
+/* compute the literals every successful path starting at dag contains */
+static int
+pfRequired(struct pf_build *const b, struct ln_pdag *const dag)
+{
+	int r = 0;
+	struct pf_set *const set = pfNodeSet(b, dag);
+	if(set->done)
+		goto done;
+
+	struct pf_set acc;
+	memset(&acc, 0, sizeof(acc));
+	/* a terminal node does not need anything more, a node without
+	 * parsers can never be successful
+	 */
+	acc.top = !dag->flags.isTerminal;
+	for(int i = 0 ; i < dag->nparsers && !dag->flags.isTerminal ; ++i) {
+		const ln_parser_t *const prs = dag->parsers + i;
+		CHKR(pfRequired(b, prs->node));
+		struct pf_set edge = *pfNodeSet(b, prs->node);
+		if(prs->prsid == PRS_LITERAL) {
+			const struct data_Literal *const lit = prs->parser_data;
+			if(lit->len >= PF_GRAMLEN) {
+				uint32_t idx;
+				CHKR(pfIntern(b, lit, &idx));
+				pfSetAdd(b, &edge, idx);
+			}
+		}
+		pfSetIntersect(&acc, &edge);
+	}
+	acc.done = 1;
+	*set = acc;
+done:	return r;
+}
+
+/* select the literal to check for each parser of a branch point. We
+ * use the longest literal required below the parser itself, as a
+ * literal parser checks its own literal anyhow.
+ */
+static void
+pfSelect(struct pf_build *const b, struct ln_pdag *const dag)
+{
+	if(dag->nparsers < PREFILTER_MIN_PARSERS)
+		return;
+	for(int i = 0 ; i < dag->nparsers ; ++i) {
+		ln_parser_t *const prs = dag->parsers + i;
+		const struct pf_set *const s = pfNodeSet(b, prs->node);
+		if(s->top || s->n == 0)
+			continue;
+		uint32_t best = s->lit[0];
+		for(int j = 1 ; j < s->n ; ++j)
+			if(b->lits[s->lit[j]].len > b->lits[best].len)
+				best = s->lit[j];
+		if(b->lits[best].id == 0)
+			b->lits[best].id = ++b->nused;
+		prs->reqLit = b->lits[best].id;
+		dag->flags.prefilter = 1;
+	}
+}
+
+static int
+qsort_entryCmp(const void *v1, const void *v2)
+{
+	const struct pf_entry *const e1 = (const struct pf_entry *) v1;
+	const struct pf_entry *const e2 = (const struct pf_entry *) v2;
+	if(e1->gram != e2->gram)
+		return (e1->gram < e2->gram) ? -1 : 1;
+	return (e1->lit < e2->lit) ? -1 : (e1->lit > e2->lit);
+}
+
+/* number of literals that contain gram, counted in a hash table
+ * of used literals' grams
+ */
+struct pf_gramcnt {
+	uint32_t gram;
+	uint32_t cnt;
+};
+
+static struct pf_gramcnt *
+pfGramLookup(struct pf_gramcnt *const tab, const size_t size, const uint32_t gram)
+{
+	size_t k = pfHash(gram) & (size - 1);
+	while(tab[k].cnt != 0 && tab[k].gram != gram)
+		k = (k + 1) & (size - 1);
+	return tab + k;
+}
+
+/* build the search structures for the used literals */
+static int
+pfBuildIndex(struct pf_build *const b, struct ln_prefilter *const pf)
+{
+	int r = 0;
+	struct pf_gramcnt *cnt = NULL;
+	size_t ngrams = 0;
+
+	pf->nlits = b->nused;
+	CHKN(pf->lits = malloc(pf->nlits * sizeof(struct pf_lit)));
+	CHKN(pf->entries = malloc(pf->nlits * sizeof(struct pf_entry)));
+	for(size_t i = 0 ; i < b->nlits ; ++i) {
+		if(b->lits[i].id == 0)
+			continue;
+		pf->lits[b->lits[i].id - 1].str = b->lits[i].str;
+		pf->lits[b->lits[i].id - 1].len = b->lits[i].len;
+		ngrams += b->lits[i].len - PF_GRAMLEN + 1;
+	}
+
+	size_t cntSize = 64;
+	while(cntSize < 2 * ngrams)
+		cntSize *= 2;
+	CHKN(cnt = calloc(cntSize, sizeof(struct pf_gramcnt)));
+	for(size_t i = 0 ; i < pf->nlits ; ++i) {
+		const struct pf_lit *const lit = pf->lits + i;
+		for(size_t j = 0 ; j + PF_GRAMLEN <= lit->len ; ++j) {
+			struct pf_gramcnt *const c = pfGramLookup(cnt, cntSize, pfGram(lit->str + j));
+			c->gram = pfGram(lit->str + j);
+			++c->cnt;
+		}
+	}
+
+	/* the rarest gram of each literal; on ties, the later one, as
+	 * literals more often share their beginning
+	 */
+	for(size_t i = 0 ; i < pf->nlits ; ++i) {
+		const struct pf_lit *const lit = pf->lits + i;
+		size_t best = 0;
+		uint32_t bestCnt = UINT32_MAX;
+		for(size_t j = 0 ; j + PF_GRAMLEN <= lit->len ; ++j) {
+			const uint32_t c = pfGramLookup(cnt, cntSize, pfGram(lit->str + j))->cnt;
+			if(c <= bestCnt) {
+				best = j;
+				bestCnt = c;
+			}
+		}
+		pf->entries[i].gram = pfGram(lit->str + best);
+		pf->entries[i].lit = i;
+		pf->entries[i].offs = best;
+	}
+	qsort(pf->entries, pf->nlits, sizeof(struct pf_entry), qsort_entryCmp);
+
+	pf->slotBits = 4;
+	while(((size_t) 1 << pf->slotBits) < 2 * pf->nlits)
+		++pf->slotBits;
+	CHKN(pf->slots = calloc((size_t) 1 << pf->slotBits, sizeof(struct pf_slot)));
+	const uint32_t mask = (1u << pf->slotBits) - 1;
+	for(size_t i = 0 ; i < pf->nlits ; ) {
+		const uint32_t gram = pf->entries[i].gram;
+		const uint32_t h = pfHash(gram);
+		size_t n = 1;
+		while(i + n < pf->nlits && pf->entries[i + n].gram == gram)
+			++n;
+		uint32_t k = h >> (32 - pf->slotBits);
+		while(pf->slots[k].n != 0)
+			k = (k + 1) & mask;
+		pf->slots[k].gram = gram;
+		pf->slots[k].first = i;
+		pf->slots[k].n = n;
+		const uint32_t bit = h >> (32 - PF_BLOOMBITS);
+		pf->bloom[bit / 64] |= (uint64_t) 1 << (bit % 64);
+		i += n;
+	}
+done:
+	free(cnt);
+	return r;
+}
+
+int
+ln_prefilterBuild(ln_ctx ctx)
+{
+	int r = 0;
+	struct pf_build b;
+	struct ln_prefilter *pf = NULL;
+
+	memset(&b, 0, sizeof(b));
+	ln_prefilterDelete(ctx->prefilter);
+	ctx->prefilter = NULL;
+
+	/* all nodes live in the arena after the pdag has been frozen */
+	b.ctx = ctx;
+	b.nodes = (struct ln_pdag *) ctx->pdagArena;
+	b.nnodes = ctx->nArenaNodes;
+	for(size_t k = 0 ; k < b.nnodes ; ++k) {
+		b.nodes[k].flags.prefilter = 0;
+		for(int i = 0 ; i < b.nodes[k].nparsers ; ++i)
+			b.nodes[k].parsers[i].reqLit = 0;
+	}
+	if(!(ctx->opts & LN_CTXOPT_PREFILTER) || b.nnodes == 0)
+		goto done;
+
+	CHKN(b.sets = calloc(b.nnodes, sizeof(struct pf_set)));
+	for(size_t k = 0 ; k < b.nnodes ; ++k)
+		CHKR(pfRequired(&b, b.nodes + k));
+	for(size_t k = 0 ; k < b.nnodes ; ++k)
+		pfSelect(&b, b.nodes + k);
+	if(b.nused == 0)
+		goto done;
+
+	CHKN(pf = calloc(1, sizeof(struct ln_prefilter)));
+	CHKR(pfBuildIndex(&b, pf));
+	ctx->prefilter = pf;
+	pf = NULL;
+	LN_DBGPRINTF(ctx, "prefilter: %zu literals, %zu used", b.nlits, b.nused);
+
+done:
+	if(r != 0) {
+		/* no partial prefilter, so no parser must refer to one */
+		for(size_t k = 0 ; k < b.nnodes ; ++k) {
+			b.nodes[k].flags.prefilter = 0;
+			for(int i = 0 ; i < b.nodes[k].nparsers ; ++i)
+				b.nodes[k].parsers[i].reqLit = 0;
+		}
+	}
+	ln_prefilterDelete(pf);
+	free(b.sets);
+	free(b.lits);
+	free(b.litHash);
+	return r;
+}
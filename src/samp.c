@@ -187,6 +187,257 @@ done:
 	return r;
 }
 
+/**
+ *  Construct a literal parser json definition.
+ */
+static inline struct json_object *
+newLiteralParserJSONConf(char lit)
+{
+	char buf[] = "x";
+	buf[0] = lit;
+	struct json_object *val;
+	struct json_object *prscnf = json_object_new_object();
+
+	val = json_object_new_string("literal");
+	json_object_object_add(prscnf, "type", val);
+
+	val = json_object_new_string(buf);
+	json_object_object_add(prscnf, "text", val);
+
+	return prscnf;
+}
+
+
+/* Compilation of v1 rulebases (LN_CTXOPT_COMPILE_V1).
+ * A v1 rulebase is read twice. In the first pass (LN_V1C_CHECK), the
+ * field descriptions are only checked if they can be translated, and
+ * nothing is added to the pdag. Only if all of them can, the second
+ * pass (LN_V1C_LOAD) builds the rulebase into the pdag.
+ *
+ * The v1 matching order is established by the parser priorities the
+ * pdag assigns in LN_V1C_LOAD mode.
+ */
+
+enum v1FieldHow {
+	V1F_SAME,	/**< same parser in v2 */
+	V1F_EXTRADATA,	/**< same parser in v2, extra data required */
+	V1F_QUOTED,	/**< char-sep between literal quotes */
+	V1F_REST,	/**< "rest", must be the last field */
+	V1F_UNSUPP	/**< no v2 equivalent */
+};
+static const struct {
+	const char *name;
+	enum v1FieldHow how;
+} v1FieldTypes[] = {
+	{ "date-rfc3164", V1F_SAME },
+	{ "date-rfc5424", V1F_SAME },
+	{ "number", V1F_SAME },
+	{ "float", V1F_SAME },
+	{ "hexnumber", V1F_SAME },
+	{ "kernel-timestamp", V1F_SAME },
+	{ "whitespace", V1F_SAME },
+	{ "ipv4", V1F_SAME },
+	{ "ipv6", V1F_SAME },
+	{ "word", V1F_SAME },
+	{ "alpha", V1F_SAME },
+	{ "rest", V1F_REST },
+	{ "op-quoted-string", V1F_SAME },
+	{ "quoted-string", V1F_QUOTED },
+	{ "date-iso", V1F_SAME },
+	{ "time-24hr", V1F_SAME },
+	{ "time-12hr", V1F_SAME },
+	{ "duration", V1F_SAME },
+	{ "cisco-interface-spec", V1F_UNSUPP },
+	{ "json", V1F_SAME },
+	{ "cee-syslog", V1F_SAME },
+	{ "mac48", V1F_SAME },
+	{ "name-value-list", V1F_SAME },
+	{ "cef", V1F_SAME },
+	{ "checkpoint-lea", V1F_SAME },
+	{ "v2-iptables", V1F_SAME },
+	{ "iptables", V1F_UNSUPP },
+	{ "string-to", V1F_EXTRADATA },
+	{ "char-to", V1F_EXTRADATA },
+	{ "char-sep", V1F_EXTRADATA },
+	{ "tokenized", V1F_UNSUPP },
+	{ "regex", V1F_UNSUPP },
+	{ "recursive", V1F_UNSUPP },
+	{ "descent", V1F_UNSUPP },
+	{ "interpret", V1F_UNSUPP },
+	{ "suffixed", V1F_UNSUPP },
+	{ "named_suffixed", V1F_UNSUPP }
+};
+
+/* report a v1 construct which cannot be compiled (only once, during
+ * the check pass)
+ */
+static void
+v1Unsupported(ln_ctx ctx, const char *const what, const char *const name)
+{
+	if(ctx->v1compile != LN_V1C_CHECK)
+		return;
+	ln_errprintf(ctx, 0, "v1 rulebase: %s (field '%s') cannot be "
+		"compiled for the v2 engine", what, name);
+	++ctx->v1unsupported;
+}
+
+/**
+ * Translate a v1 field description and add it to the pdag. This
+ * follows the syntax of ln_v1_parseFieldDescr().
+ * The parse buffer must be positioned on the leading '%'.
+ */
+static int
+v1AddFieldDescr(ln_ctx ctx, struct ln_pdag **pdag, es_str_t *rule,
+	        size_t *bufOffs, es_str_t **str)
+{
+	int r = 0;
+	const char *const buf = (const char*)es_getBufAddr(rule);
+	const size_t lenBuf = es_strlen(rule);
+	size_t i = *bufOffs;
+	char *name = NULL;
+	char *ftype = NULL;
+	char *ed = NULL;
+	es_str_t *edata = NULL;
+	struct json_object *prscnf = NULL;
+	struct json_object *val;
+
+	assert(buf[i] == '%');
+	++i;
+	while(i < lenBuf && isspace(buf[i]))
+		++i;
+	es_emptyStr(*str);
+	while(i < lenBuf && buf[i] != ':') {
+		CHKR(es_addChar(str, buf[i++]));
+	}
+	if(es_strlen(*str) == 0 || i == lenBuf) {
+		FAIL(LN_INVLDFDESCR);
+	}
+	CHKN(name = es_str2cstr(*str, NULL));
+	++i; /* skip ':' */
+
+	/* type, trailing whitespace trimmed */
+	es_emptyStr(*str);
+	size_t j = i;
+	while(j < lenBuf && buf[j] != ':' && buf[j] != '%')
+		++j;
+	const size_t next = j;
+	while(j > i && isspace(buf[j-1]))
+		--j;
+	CHKR(es_addBuf(str, (char*)buf+i, j-i));
+	i = next;
+	if(i == lenBuf) {
+		FAIL(LN_INVLDFDESCR);
+	}
+	CHKN(ftype = es_str2cstr(*str, NULL));
+
+	if(buf[i] == '%') {
+		i++;
+	} else {
+		CHKN(edata = es_newStr(8));
+		i++;
+		while(i < lenBuf) {
+			if(buf[i] == '%') {
+				++i;
+				break; /* end of field */
+			}
+			CHKR(es_addChar(&edata, buf[i++]));
+		}
+		es_unescapeStr(edata);
+		CHKN(ed = es_str2cstr(edata, NULL));
+	}
+	*bufOffs = i;
+
+	size_t t;
+	for(t = 0 ; t < sizeof(v1FieldTypes)/sizeof(v1FieldTypes[0]) ; ++t) {
+		if(!strcmp(v1FieldTypes[t].name, ftype))
+			break;
+	}
+	if(t == sizeof(v1FieldTypes)/sizeof(v1FieldTypes[0])) {
+		/* the v1 engine ignores such rules, and so do we */
+		if(ctx->v1compile == LN_V1C_LOAD)
+			ln_errprintf(ctx, 0, "invalid field type '%s'", ftype);
+		FAIL(LN_INVLDFDESCR);
+	}
+	const enum v1FieldHow how = v1FieldTypes[t].how;
+	if(how == V1F_UNSUPP) {
+		v1Unsupported(ctx, ftype, name);
+		goto done;
+	}
+	if(!strcmp(name, ".")) {
+		/* v2 merges the value into the event */
+		v1Unsupported(ctx, "name '.'", name);
+		goto done;
+	}
+	if(how == V1F_EXTRADATA && (ed == NULL || *ed == '\0')) {
+		v1Unsupported(ctx, "missing extra data", name);
+		goto done;
+	}
+	if(how == V1F_REST) {
+		/* only literal text may follow */
+		for(j = i ; j < lenBuf ; ++j) {
+			if(buf[j] == '%') {
+				if(j+1 < lenBuf && buf[j+1] != '%')
+					break;
+				++j;
+			}
+		}
+		if(j < lenBuf) {
+			v1Unsupported(ctx, "rest followed by another field", name);
+			goto done;
+		}
+	}
+	if(ctx->v1compile == LN_V1C_CHECK)
+		goto done;
+
+	CHKN(prscnf = json_object_new_object());
+	CHKN(val = json_object_new_string(name));
+	json_object_object_add(prscnf, "name", val);
+	if(how == V1F_QUOTED) {
+		/* the explicit priority makes the opening quote order like a
+		 * field and keeps it apart from literal text (see pdag.c)
+		 */
+		struct json_object *quote;
+		CHKN(quote = newLiteralParserJSONConf('"'));
+		if((val = json_object_new_int(0)) == NULL) {
+			json_object_put(quote);
+			FAIL(LN_NOMEM);
+		}
+		json_object_object_add(quote, "priority", val);
+		CHKR(ln_pdagAddParser(ctx, pdag, quote));
+		CHKN(val = json_object_new_string("char-sep"));
+		json_object_object_add(prscnf, "type", val);
+		CHKN(val = json_object_new_string("\""));
+		json_object_object_add(prscnf, "extradata", val);
+		r = ln_pdagAddParser(ctx, pdag, prscnf);
+		prscnf = NULL;
+		CHKR(r);
+		CHKN(quote = newLiteralParserJSONConf('"'));
+		CHKR(ln_pdagAddParser(ctx, pdag, quote));
+		goto done;
+	}
+	CHKN(val = json_object_new_string(ftype));
+	json_object_object_add(prscnf, "type", val);
+	if(how == V1F_EXTRADATA) {
+		/* v1 uses only the first character for char-to and char-sep */
+		if(strcmp(ftype, "string-to"))
+			ed[1] = '\0';
+		CHKN(val = json_object_new_string(ed));
+		json_object_object_add(prscnf, "extradata", val);
+	}
+	r = ln_pdagAddParser(ctx, pdag, prscnf);
+	prscnf = NULL;
+
+done:
+	if(prscnf != NULL)
+		json_object_put(prscnf);
+	if(edata != NULL)
+		es_deleteStr(edata);
+	free(ed);
+	free(ftype);
+	free(name);
+	return r;
+}
+
 /**
  * Extract a field description from a sample.
  * The field description is added to the tail of the current
@@ -213,6 +464,9 @@ addFieldDescr(ln_ctx ctx, struct ln_pdag **pdag, es_str_t *rule,
 	es_size_t lenBuf;
 	struct json_object *prs_config = NULL;
 
+	if(ctx->v1compile != LN_V1C_OFF)
+		return v1AddFieldDescr(ctx, pdag, rule, bufOffs, str);
+
 	buf = (const char*)es_getBufAddr(rule);
 	lenBuf = es_strlen(rule);
 	assert(buf[i] == '%');
@@ -246,26 +500,6 @@ done:
 }
 
 
-/**
- *  Construct a literal parser json definition.
- */
-static inline struct json_object *
-newLiteralParserJSONConf(char lit)
-{
-	char buf[] = "x";
-	buf[0] = lit;
-	struct json_object *val;
-	struct json_object *prscnf = json_object_new_object();
-
-	val = json_object_new_string("literal");
-	json_object_object_add(prscnf, "type", val);
-
-	val = json_object_new_string(buf);
-	json_object_object_add(prscnf, "text", val);
-
-	return prscnf;
-}
-
 /**
  * Parse a Literal string out of the template and add it to the tree.
  * This function is used to create the unoptimized tree. So we do
@@ -316,6 +550,8 @@ parseLiteral(ln_ctx ctx, struct ln_pdag **pdag, es_str_t *rule,
 	}
 
 	*bufOffs = i;
+	if(ctx->v1compile == LN_V1C_CHECK)
+		goto done;
 
 	/* we now add the string to the tree */
 	for(i = 0 ; cstr[i] != '\0' ; ++i) {
@@ -373,10 +609,12 @@ addSampToTree(ln_ctx ctx,
 	}
 
 	LN_DBGPRINTF(ctx, "end addSampToTree %zu of %d", i, es_strlen(rule));
+	if(ctx->v1compile == LN_V1C_CHECK)
+		goto done;
 	/* we are at the end of rule processing, so this node is a terminal */
 	dag->flags.isTerminal = 1;
 	dag->tags = tagBucket;
-	dag->rb_file = strdup(ctx->conf_file);
+	CHKN(dag->rb_file = ln_strtabAdd(ctx, ctx->conf_file, strlen(ctx->conf_file)));
 	dag->rb_lineno = ctx->conf_ln_nbr;
 
 done:
@@ -559,9 +797,14 @@ processRule(ln_ctx ctx, const char *buf, es_size_t lenBuf, es_size_t offs)
 
 	ln_dbgprintf(ctx, "rule line to add: '%s'", buf+offs);
 	CHKR(processTags(ctx, buf, lenBuf, &offs, &tagBucket));
+	if(ctx->v1compile == LN_V1C_CHECK && tagBucket != NULL) {
+		json_object_put(tagBucket);
+		tagBucket = NULL;
+	}
 
 	if(offs == lenBuf) {
-		ln_errprintf(ctx, 0, "error: actual message sample part is missing");
+		if(ctx->v1compile != LN_V1C_CHECK)
+			ln_errprintf(ctx, 0, "error: actual message sample part is missing");
 		goto done;
 	}
 	if(ctx->rulePrefix == NULL) {
@@ -875,10 +1118,18 @@ ln_processSamp(ln_ctx ctx, const char *buf, const size_t lenBuf)
 		if(extendPrefix(ctx, buf, lenBuf, offs) != 0) goto done;
 	} else if(!es_strconstcmp(typeStr, "rule")) {
 		if(processRule(ctx, buf, lenBuf, offs) != 0) goto done;
+	} else if(!es_strconstcmp(typeStr, "annotate")) {
+		if(ctx->v1compile != LN_V1C_CHECK
+		   && processAnnotate(ctx, buf, lenBuf, offs) != 0) goto done;
+	} else if(ctx->v1compile != LN_V1C_OFF) {
+		/* v1 ignores all other record types */
+		char *str;
+		str = es_str2cstr(typeStr, NULL);
+		ln_dbgprintf(ctx, "invalid record type detected: '%s'", str);
+		free(str);
+		goto done;
 	} else if(!es_strconstcmp(typeStr, "type")) {
 		if(processType(ctx, buf, lenBuf, offs) != 0) goto done;
-	} else if(!es_strconstcmp(typeStr, "annotate")) {
-		if(processAnnotate(ctx, buf, lenBuf, offs) != 0) goto done;
 	} else if(!es_strconstcmp(typeStr, "include")) {
 		CHKR(processInclude(ctx, buf, offs));
 	} else {
@@ -1059,6 +1310,61 @@ done:
 	return r;
 }
 
+/* compile a v1 rulebase into the pdag, see LN_CTXOPT_COMPILE_V1.
+ * If that is not possible, it is loaded into the v1 engine instead.
+ * @return 0 if all is ok, something else otherwise
+ */
+static int
+compileV1(ln_ctx ctx, FILE *const repo, const char *const file)
+{
+	int r = 0;
+	int isEof = 0;
+	es_str_t *prefix = NULL;
+
+	/* the check pass must not leave a prefix behind */
+	if(ctx->rulePrefix != NULL)
+		CHKN(prefix = es_strdup(ctx->rulePrefix));
+	ctx->v1compile = LN_V1C_CHECK;
+	ctx->v1unsupported = 0;
+	rewind(repo);
+	ctx->conf_ln_nbr = 0;
+	while(!isEof) {
+		CHKR(ln_sampRead(ctx, repo, &isEof));
+	}
+	if(ctx->rulePrefix != NULL)
+		es_deleteStr(ctx->rulePrefix);
+	ctx->rulePrefix = prefix;
+	prefix = NULL;
+
+	if(ctx->v1unsupported > 0) {
+		ln_errprintf(ctx, 0, "v1 rulebase '%s' has %u construct(s) that cannot "
+			"be compiled, using the v1 engine", file, ctx->v1unsupported);
+		if(ctx->version == 2) {
+			ln_errprintf(ctx, 0, "rulebase '%s' can not be processed, because "
+				"other rulebases are already processed by the v2 engine", file);
+			FAIL(1);
+		}
+		ctx->v1compile = LN_V1C_OFF;
+		ctx->version = 1;
+		return doOldCruft(ctx, file);
+	}
+
+	ctx->v1compile = LN_V1C_LOAD;
+	ctx->version = 2;
+	rewind(repo);
+	ctx->conf_ln_nbr = 0;
+	isEof = 0;
+	while(!isEof) {
+		CHKR(ln_sampRead(ctx, repo, &isEof));
+	}
+
+done:
+	ctx->v1compile = LN_V1C_OFF;
+	if(prefix != NULL)
+		es_deleteStr(prefix);
+	return r;
+}
+
 /* try to open a rulebase file. This also tries to see if we need to
  * load it from some pre-configured alternative location.
  * @returns open file pointer or NULL in case of error
@@ -1111,6 +1417,13 @@ ln_sampLoad(ln_ctx ctx, const char *file)
 		ln_errprintf(ctx, errno, "error determing version of %s", file);
 		goto done;
 	}
+	if(version == 1 && (ctx->opts & LN_CTXOPT_COMPILE_V1) && ctx->version != 1) {
+		r = compileV1(ctx, repo, file);
+		fclose(repo);
+		if(r == 0 && ctx->version == 2 && ctx->include_level == 1)
+			ln_pdagOptimize(ctx);
+		goto done;
+	}
 	if(ctx->version != 0 && version != ctx->version) {
 		ln_errprintf(ctx, errno, "rulebase '%s' must be version %d, but is version %d "
 			" - can not be processed", file, ctx->version, version);
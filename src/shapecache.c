@@ -0,0 +1,183 @@
+/**
+ * @file shapecache.c
+ * @brief Message shape cache for the parse dag.
+ *
+ * Much of the traffic often consists of messages that differ only in
+ * some values, like heartbeats or connection teardown messages from
+ * the same sources. For these, the same path through the pdag wins
+ * over and over again. The shape cache remembers the winning path by
+ * a fingerprint of the message, which is a hash of the message with
+ * all numbers replaced by a single '0'. Digits inside words (like
+ * "event42" or hex values) are kept, as they often select the rule.
+ * If a message with the same fingerprint comes in, only that path is
+ * verified, along with the parsers that take precedence over it (see
+ * normalizeShapePath() in pdag.c). If verification fails, the full
+ * search is done and its result replaces the cache entry.
+ *
+ * The cache is direct-mapped and remembers the parser index at each
+ * node along the path, starting at the root of the main pdag. So it
+ * belongs to the rulebase and must be cleared whenever the pdag is
+ * changed.
+ *//*
+ * Copyright 2026 by Rainer Gerhards and Adiscon GmbH.
+ *
+ * Released under ASL 2.0.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <libestr.h>
+
+#include "liblognorm.h"
+#include "lognorm.h"
+#include "pdag.h"
+#include "internal.h"
+
+#define SC_KEYLEN 256	/**< max number of message bytes that go into the fingerprint */
+
+struct sc_entry {
+	uint64_t key;			/**< fingerprint, 0 = free */
+	uint16_t len;			/**< number of steps in path */
+	uint16_t path[LN_SC_MAXPATH];	/**< parser index per node, root first */
+};
+
+struct ln_shapecache {
+	unsigned size;		/**< number of entries, always a power of two */
+	unsigned used;		/**< number of entries in use */
+	struct sc_entry *entries;
+};
+
+struct ln_shapecache *
+ln_shapeCacheNew(const unsigned size)
+{
+	struct ln_shapecache *sc = calloc(1, sizeof(struct ln_shapecache));
+	if(sc == NULL)
+		goto done;
+	sc->size = size;
+	if((sc->entries = calloc(size, sizeof(struct sc_entry))) == NULL) {
+		free(sc);
+		sc = NULL;
+	}
+done:	return sc;
+}
+
+void
+ln_shapeCacheDelete(struct ln_shapecache *const sc)
+{
+	if(sc == NULL)
+		return;
+	free(sc->entries);
+	free(sc);
+}
+
+void
+ln_shapeCacheClear(struct ln_shapecache *const sc)
+{
+	if(sc == NULL)
+		return;
+	memset(sc->entries, 0, sc->size * sizeof(struct sc_entry));
+	sc->used = 0;
+}
+
+unsigned
+ln_shapeCacheSize(const struct ln_shapecache *const sc)
+{
+	return sc->size;
+}
+
+unsigned
+ln_shapeCacheUsed(const struct ln_shapecache *const sc)
+{
+	return sc->used;
+}
+
+size_t
+ln_shapeCacheMemSize(const struct ln_shapecache *const sc)
+{
+	return (sc == NULL) ? 0 : sizeof(struct ln_shapecache) + sc->size * sizeof(struct sc_entry);
+}
+
+static inline int
+scIsDigit(const unsigned char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static inline int
+scIsAlnum(const unsigned char c)
+{
+	return scIsDigit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+/* FNV-1a over the message, with each number (a run of digits that is
+ * not part of a word) collapsed to '0', so that different numbers (of
+ * different lengths) give the same fingerprint.
+ */
+uint64_t
+ln_shapeCacheKey(const char *const str, const size_t len)
+{
+	uint64_t h = 14695981039346656037ull;
+	const unsigned char *const s = (const unsigned char *) str;
+	const size_t n = (len < SC_KEYLEN) ? len : SC_KEYLEN;
+	size_t i = 0;
+	while(i < n) {
+		if(!scIsAlnum(s[i])) {
+			h = (h ^ s[i++]) * 1099511628211ull;
+			continue;
+		}
+		size_t j = i;
+		int number = 1;
+		while(j < n && scIsAlnum(s[j])) {
+			if(!scIsDigit(s[j]))
+				number = 0;
+			++j;
+		}
+		if(number) {
+			h = (h ^ '0') * 1099511628211ull;
+		} else {
+			for( ; i < j ; ++i)
+				h = (h ^ s[i]) * 1099511628211ull;
+		}
+		i = j;
+	}
+	return (h == 0) ? 1 : h;
+}
+
+static inline struct sc_entry *
+scSlot(const struct ln_shapecache *const sc, const uint64_t key)
+{
+	return sc->entries + ((key ^ (key >> 32)) & (sc->size - 1));
+}
+
+/* find the path for key.
+ * @return path (root first) or NULL if there is none
+ */
+const uint16_t *
+ln_shapeCacheLookup(const struct ln_shapecache *const sc, const uint64_t key, unsigned *const len)
+{
+	const struct sc_entry *const ent = scSlot(sc, key);
+	if(ent->key != key)
+		return NULL;
+	*len = ent->len;
+	return ent->path;
+}
+
+/* remember a path, replacing whatever was in its slot before.
+ * @param[in] revpath steps in reverse order (deepest first), as they
+ *                    are collected by ln_normalizeRec()
+ */
+void
+ln_shapeCacheStore(struct ln_shapecache *const sc, const uint64_t key,
+	const uint16_t *const revpath, const unsigned len)
+{
+	struct sc_entry *const ent = scSlot(sc, key);
+	if(len > LN_SC_MAXPATH)
+		return;
+	if(ent->key == 0)
+		++sc->used;
+	ent->key = key;
+	ent->len = len;
+	for(unsigned i = 0 ; i < len ; ++i)
+		ent->path[i] = revpath[len - 1 - i];
+}
@@ -0,0 +1,171 @@
+/**
+ * @file strtab.c
+ * @brief String table for the rulebase.
+ *
+ * Field names, parser configs, type names and rule file names repeat
+ * a lot inside a rulebase: the same field name is often used by
+ * thousands of rules, and all rules of a file have the same file name.
+ * So they are stored only once per context. The strings are packed
+ * into larger blocks and live as long as the rulebase. They MUST NOT be
+ * free'd individually.
+ *//*
+ * Copyright 2026 by Rainer Gerhards and Adiscon GmbH.
+ *
+ * Released under ASL 2.0.
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "liblognorm.h"
+#include "lognorm.h"
+#include "internal.h"
+
+#define STRTAB_BLOCKSIZE 4096	/**< default size of a string block */
+
+struct strtab_block {
+	struct strtab_block *next;
+	size_t used;
+	size_t size;
+	char data[];
+};
+
+struct ln_strtab {
+	struct strtab_block *blocks;	/**< current block first */
+	const char **slots;		/**< hash table of strings, NULL = free */
+	uint32_t *hashes;		/**< hash of each slot's string */
+	size_t size;			/**< number of slots, always a power of two */
+	size_t nstrings;		/**< number of strings */
+	size_t bytes;			/**< memory allocated */
+};
+
+static uint32_t
+strtabHash(const char *const str, const size_t len)
+{
+	uint32_t h = 2166136261u;
+	for(size_t i = 0 ; i < len ; ++i)
+		h = (h ^ (unsigned char) str[i]) * 16777619u;
+	return h;
+}
+
+static int
+strtabRehash(struct ln_strtab *const tab)
+{
+	int r = 0;
+	const size_t newSize = (tab->size == 0) ? 256 : 2 * tab->size;
+	const char **newSlots = NULL;
+	uint32_t *newHashes = NULL;
+
+	CHKN(newSlots = calloc(newSize, sizeof(char*)));
+	CHKN(newHashes = malloc(newSize * sizeof(uint32_t)));
+	for(size_t i = 0 ; i < tab->size ; ++i) {
+		if(tab->slots[i] == NULL)
+			continue;
+		size_t k = tab->hashes[i] & (newSize - 1);
+		while(newSlots[k] != NULL)
+			k = (k + 1) & (newSize - 1);
+		newSlots[k] = tab->slots[i];
+		newHashes[k] = tab->hashes[i];
+	}
+	tab->bytes += (newSize - tab->size) * (sizeof(char*) + sizeof(uint32_t));
+	free(tab->slots);
+	free(tab->hashes);
+	tab->slots = newSlots;
+	tab->hashes = newHashes;
+	tab->size = newSize;
+	newSlots = NULL;
+	newHashes = NULL;
+done:
+	free(newSlots);
+	free(newHashes);
+	return r;
+}
+
+/* copy a string into the current block, starting a new one if needed */
+static char *
+strtabStore(struct ln_strtab *const tab, const char *const str, const size_t len)
+{
+	struct strtab_block *blk = tab->blocks;
+	if(blk == NULL || blk->size - blk->used < len + 1) {
+		const size_t size = (len + 1 > STRTAB_BLOCKSIZE) ? len + 1 : STRTAB_BLOCKSIZE;
+		if((blk = malloc(sizeof(struct strtab_block) + size)) == NULL)
+			return NULL;
+		blk->used = 0;
+		blk->size = size;
+		tab->bytes += sizeof(struct strtab_block) + size;
+		if(tab->blocks != NULL && size != STRTAB_BLOCKSIZE) {
+			/* keep using the partially filled block */
+			blk->next = tab->blocks->next;
+			tab->blocks->next = blk;
+		} else {
+			blk->next = tab->blocks;
+			tab->blocks = blk;
+		}
+	}
+	char *const copy = blk->data + blk->used;
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+	blk->used += len + 1;
+	return copy;
+}
+
+/**
+ * Get the string table copy of a string, which is added if it is not
+ * yet present. The string must not contain NUL bytes.
+ * @return the copy or NULL if out of memory
+ */
+const char *
+ln_strtabAdd(ln_ctx ctx, const char *const str, const size_t len)
+{
+	struct ln_strtab *tab = ctx->strtab;
+	const char *res = NULL;
+
+	if(tab == NULL) {
+		if((tab = calloc(1, sizeof(struct ln_strtab))) == NULL)
+			goto done;
+		tab->bytes = sizeof(struct ln_strtab);
+		ctx->strtab = tab;
+	}
+	if(2 * (tab->nstrings + 1) > tab->size && strtabRehash(tab) != 0)
+		goto done;
+
+	const uint32_t h = strtabHash(str, len);
+	size_t k = h & (tab->size - 1);
+	for( ; tab->slots[k] != NULL ; k = (k + 1) & (tab->size - 1)) {
+		if(   tab->hashes[k] == h
+		   && !strncmp(tab->slots[k], str, len)
+		   && tab->slots[k][len] == '\0') {
+			res = tab->slots[k];
+			goto done;
+		}
+	}
+	if((res = strtabStore(tab, str, len)) == NULL)
+		goto done;
+	tab->slots[k] = res;
+	tab->hashes[k] = h;
+	++tab->nstrings;
+done:
+	return res;
+}
+
+size_t
+ln_strtabMemSize(const struct ln_strtab *const tab)
+{
+	return (tab == NULL) ? 0 : tab->bytes;
+}
+
+void
+ln_strtabDelete(struct ln_strtab *const tab)
+{
+	if(tab == NULL)
+		return;
+	for(struct strtab_block *blk = tab->blocks ; blk != NULL ; ) {
+		struct strtab_block *const next = blk->next;
+		free(blk);
+		blk = next;
+	}
+	free(tab->slots);
+	free(tab->hashes);
+	free(tab);
+}
@@ -0,0 +1,33 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "precompiled annotations"
+add_rule 'version=2'
+add_rule 'annotate=tag1:+a1="one"'
+add_rule 'annotate=tag1:+a2="two"'
+add_rule 'annotate=tag2:+a1="other"'
+add_rule 'rule=tag1,tag2:a %n:number% b'
+add_rule 'rule=tag3:c %n:number% d'
+add_rule 'rule=tag4:e %n:number% f'
+# annotations given after the rule must work as well
+add_rule 'annotate=tag3:+n="overwritten"'
+add_rule 'annotate=tag3:+c3="three"'
+
+for ln_opts in "" $threadsafe_opt; do
+	execute 'a 4711 b'
+	assert_output_json_eq '{"n": "4711", "a1": "one", "a2": "two"}'
+	# again, to make sure the shared values were left intact
+	execute 'a 12 b'
+	assert_output_json_eq '{"n": "12", "a1": "one", "a2": "two"}'
+
+	execute 'c 4711 d'
+	assert_output_json_eq '{"n": "overwritten", "c3": "three"}'
+
+	# tag without annotation
+	execute 'e 4711 f'
+	assert_output_json_eq '{"n": "4711"}'
+done
+
+ln_opts=""
+cleanup_tmp_files
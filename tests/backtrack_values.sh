@@ -0,0 +1,25 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "field values of backtracked paths do not show up"
+add_rule 'version=2'
+add_rule 'rule=:%{"name":"a", "type":"word", "priority":10}% x %b:number% end'
+add_rule 'rule=:%{"name":"a2", "type":"word", "priority":20}% x %n:number% %c:word%'
+add_rule 'rule=:%{"name":"r", "type":"rest", "priority":30}%'
+
+execute 'foo x 12 end'
+assert_output_json_eq '{"a": "foo", "b": "12"}'
+
+execute 'foo x 12 bar'
+assert_output_json_eq '{"a2": "foo", "n": "12", "c": "bar"}'
+assert_output_contains '"a2"'
+if grep -q '"b"\|"a"' test.out; then
+	echo "FAIL: value from backtracked path in output"
+	exit 1
+fi
+
+execute 'foo x bar'
+assert_output_json_eq '{"r": "foo x bar"}'
+
+cleanup_tmp_files
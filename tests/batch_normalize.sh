@@ -0,0 +1,35 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "batch normalization"
+add_rule 'version=2'
+add_rule 'rule=:a %n:number% b'
+add_rule 'rule=:c %w:word%'
+
+ln_opts="-b3"
+execute 'a 4711 b'
+assert_output_json_eq '{"n": "4711"}'
+
+# more messages than fit into a single batch, some of them unparsable
+ln_opts="-b2 -L -oaddRule"
+execute 'a 1 b
+c word
+a x b
+a 2 b
+c more'
+assert_output_contains '"n": "1"'
+assert_output_contains '"w": "word"'
+assert_output_contains '"unparsed-data": "x b"'
+assert_output_contains '"lognormalizer.line_nbr": 3'
+assert_output_contains '"n": "2"'
+assert_output_contains '"w": "more"'
+# mockup must be built freshly for each message
+assert_output_contains '"mockup": "c %w:word%"'
+if [ $(grep -c 'mockup": "a %n:number% b"' test.out) != 2 ]; then
+	echo "FAIL: rule mockup not correct for each message"
+	exit 1
+fi
+
+ln_opts=""
+cleanup_tmp_files
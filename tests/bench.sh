@@ -0,0 +1,142 @@
+#!/bin/bash
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+#
+# Benchmark driver, run via "make bench". It builds corpora for the
+# sample rulebases (rulebases/*.rulebase) as well as a generated large
+# rulebase and runs them through ln_bench with both the v1 and the v2
+# engine. Afterwards, the per-parser microbenchmarks are run.
+#
+# The following environment variables control the run:
+#   BENCH_MSGS   number of messages per corpus (default 100000)
+#   BENCH_RULES  number of rules in the large rulebase (default 10000)
+#   BENCH_PASSES how often each corpus is normalized (default 1)
+#   BENCH_ITERS  iterations per parser microbenchmark (default 200000)
+#   BENCH_DIR    scratch directory (default ./bench.work)
+
+srcdir=${srcdir:-.}
+top_srcdir=${top_srcdir:-$srcdir/..}
+rulebases=$top_srcdir/rulebases
+bench=./ln_bench
+msgs=${BENCH_MSGS:-100000}
+nrules=${BENCH_RULES:-10000}
+passes=${BENCH_PASSES:-1}
+iters=${BENCH_ITERS:-200000}
+work=${BENCH_DIR:-./bench.work}
+
+rm -rf $work
+mkdir -p $work || exit 1
+
+# write a corpus of $msgs lines picked round-robin from the given
+# template lines. A "#" in a template is replaced by a varying number
+# to keep the data somewhat realistic.
+gen_corpus() {
+	awk -v n=$msgs 'BEGIN { srand(42) }
+		{ t[nt++] = $0 }
+		END {
+			for(i = 0 ; i < n ; ++i) {
+				s = t[i % nt]
+				while(sub(/#/, int(rand() * 65535), s))
+					;
+				print s
+			}
+		}' > $1
+}
+
+# the v2 engine does not support some v1-only parsers (and regex is
+# disabled by default), so these rules are not used for either engine.
+gen_rulebases() {
+	grep -v -e ':tokenized:' -e ':regex:' -e ':iptables%' $2 > $work/$1_v1.rb
+	(echo "version=2"; cat $work/$1_v1.rb) > $work/$1_v2.rb
+}
+
+gen_rulebases cisco $rulebases/cisco.rulebase
+gen_corpus $work/cisco.txt <<'EOF'
+Oct 29 09:47:08 router1 #: #: %SYS-5-CONFIG_I: Configured from console by vty0 (10.0.0.1)
+Oct 29 09:47:08 router1 #: #: %SEC-6-AUTH: Authentication failure for SNMP req from host 192.168.1.1
+Oct 29 09:47:08 router1 #: #: %LINK-3-UPDOWN: Interface FastEthernet0/1, changed state to down
+Oct 29 09:47:08 router1 #: #: %LINEPROTO-5-UPDOWN: Line protocol on Interface FastEthernet0/1, changed state to up
+Oct 29 09:47:08 router1 #: #: %SYS-3-CONNECT: Attempted to connect to telnet from 172.16.0.3
+Oct 29 09:47:08 router1 #: #: %SYS-3-UNKNOWN: this message is not covered by the rulebase
+EOF
+
+gen_rulebases messages $rulebases/messages.rulebase
+gen_corpus $work/messages.txt <<'EOF'
+Oct 29 09:47:08 server ftpd: restart.
+Oct 29 09:47:08 server inetd: Bad line received from identity server at 10.1.2.3: # 
+Oct 29 09:47:08 server ftpd: FTP session closed
+Oct 29 09:47:08 server ftpd: wu-ftpd - TLS settings: control allow, client_cert allow, data allow
+Oct 29 09:47:08 server ftpd: User user# timed out after # seconds at Mon Oct 29 09:47:08 2012
+Oct 29 09:47:08 server ftpd: getpeername (in.ftpd): Transport endpoint is not connected
+Oct 29 09:47:08 server kernel: this message is not covered by the rulebase
+EOF
+
+gen_rulebases sample $rulebases/sample.rulebase
+gen_corpus $work/sample.txt <<'EOF'
+myhostname: code=#
+myhostname: name=somename
+Quantity: #
+Weight: #kg
+%%
+literal
+first field,second field,third field,fourth field
+CSV: field1,,field3
+Snow White and the Seven Dwarfs
+2012-10-11 src=127.0.0.1 dst=88.111.222.19
+Oct 29 09:47:08 server rsyslogd: rsyslogd's groupid changed to #
+Oct 29 09:47:08
+1985-04-12T19:20:50.52-04:00
+1985-04-12T19:20:50.52-04:00 testing #
+quoted_string="Contents of a quoted string cannot include quote marks"
+host#
+this message is not covered by the rulebase
+EOF
+
+# the large rulebase uses a handful of rule shapes with distinct
+# literal prefixes, so the parse DAG gets both wide and deep.
+awk -v n=$nrules 'BEGIN {
+	for(i = 0 ; i < n ; ++i) {
+		s = i % 4
+		if(s == 0)
+			printf("rule=login:svc%d: login user %%user:word%% from %%ip:ipv4%%\n", i)
+		else if(s == 1)
+			printf("rule=conn:svc%d: conn %%src:ipv4%%:%%sport:number%% -> %%dst:ipv4%%:%%dport:number%%\n", i)
+		else if(s == 2)
+			printf("rule=kv:svc%d: kv %%kv:name-value-list%%\n", i)
+		else
+			printf("rule=time:svc%d: request took %%t:number%% ms, status %%st:word%%\n", i)
+	}
+}' > $work/large_v1.rb
+(echo "version=2"; cat $work/large_v1.rb) > $work/large_v2.rb
+awk -v n=$msgs -v nr=$nrules 'BEGIN {
+	srand(42)
+	for(i = 0 ; i < n ; ++i) {
+		r = int(rand() * nr)
+		s = r % 4
+		if(i % 50 == 49)
+			printf("svc%d: this message is not covered by the rulebase\n", r)
+		else if(s == 0)
+			printf("svc%d: login user user%d from 10.%d.%d.%d\n", r, i, i % 256, r % 256, (i + r) % 256)
+		else if(s == 1)
+			printf("svc%d: conn 10.0.%d.%d:%d -> 192.168.%d.1:443\n", r, i % 256, r % 256, 1024 + i % 60000, r % 256)
+		else if(s == 2)
+			printf("svc%d: kv user=u%d action=login result=ok count=%d\n", r, i, r)
+		else
+			printf("svc%d: request took %d ms, status ok\n", r, i % 5000)
+	}
+}' > $work/large.txt
+
+echo "corpus benchmarks: $msgs messages, $passes pass(es), large rulebase: $nrules rules"
+$bench -H || exit 1
+rc=0
+for corpus in cisco messages sample large; do
+	for engine in v1 v2; do
+		$bench -l ${corpus}-$engine -n $passes \
+			-r $work/${corpus}_$engine.rb -i $work/$corpus.txt || rc=1
+	done
+done
+
+echo
+echo "parser microbenchmarks (v2 engine): $iters iterations each"
+$bench -P -m $iters || rc=1
+exit $rc
@@ -0,0 +1,102 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "compiled (binary) rulebase"
+add_rule 'version=2'
+add_rule 'type=@tuple:%a:number%/%b:number%'
+add_rule 'type=@tuple:%a:word%'
+add_rule 'rule=tup:t %t:@tuple% end'
+add_rule 'rule=alt:alt %{"type":"alternative", "parser":[{"name":"num", "type":"number"}, {"name":"ip", "type":"ipv4"}]}% %w:word%'
+add_rule 'rule=rep:rep %{"name":"numbers", "type":"repeat", "parser":{"name":"n", "type":"number"}, "while":{"type":"literal", "text":","}}%'
+add_rule 'rule=lit:prefix fixed text %w:word%'
+add_rule 'rule=lit:prefix fixed other %w:word%'
+add_rule 'rule=prio:x %{"name":"x", "type":"word", "priority":10}% end'
+add_rule 'rule=prio:x %{"name":"y", "type":"word", "priority":20}% %z:word%'
+add_rule 'annotate=lit:+annot="yes"'
+add_rule 'annotate=lit:+second="also"'
+add_rule 'annotate=alt:+alt_annot="1"'
+
+msgs="t 1/2 end
+t abc end
+alt 42 word
+alt 10.0.0.1 word
+rep 1,2,3
+prefix fixed text here
+prefix fixed other there
+x one end
+x one two
+no match"
+
+echo "$msgs" | $cmd -T -r tmp.rulebase -e json > test.expected
+$cmd -r tmp.rulebase -c tmp.compiled
+echo "$msgs" | $cmd -T -R tmp.compiled -e json > test.out
+echo "Out:"
+cat test.out
+if ! cmp test.expected test.out; then
+	echo "FAIL: compiled rulebase output differs:"
+	diff test.expected test.out
+	exit 1
+fi
+assert_output_contains '"annot": "yes"'
+assert_output_contains '"alt_annot": "1"'
+
+# garbage must be rejected
+echo "this is not a compiled rulebase" > tmp.compiled
+if echo "x" | $cmd -R tmp.compiled > test.out 2>&1; then
+	echo "FAIL: invalid compiled rulebase accepted"
+	exit 1
+fi
+
+# ...and so must corrupted files. They are built from these pieces:
+# header with no types and no annotations, a node definition with one
+# word parser (followed by its child node) and a terminal node.
+crb_header() {
+	printf 'LNCRB\001\000\000\000\000\000\000\000\000\000\000\000'
+}
+crb_word_node() {
+	printf '\000\000\377\377\377\377\377\377\377\377\000\000\000\000\001\000\000\000'
+	printf '\032\000\000\000{"type":"word","name":"w"}\000\000\000\000'
+}
+crb_terminal_node() {
+	printf '\000\001\377\377\377\377\377\377\377\377\000\000\000\000\000\000\000\000'
+}
+crb_must_fail() {
+	if echo "x" | $cmd -R tmp.compiled > test.out 2>&1; then
+		echo "FAIL: corrupted compiled rulebase accepted ($1)"
+		exit 1
+	fi
+	if ! grep -q "invalid or corrupted" test.out; then
+		echo "FAIL: corrupted compiled rulebase not reported ($1)"
+		cat test.out
+		exit 1
+	fi
+}
+
+# the pieces are fine on their own
+(crb_header; crb_word_node; crb_terminal_node) > tmp.compiled
+echo "x" | $cmd -R tmp.compiled -e json > test.out
+assert_output_json_eq '{ "w": "x" }'
+
+# the child refers back to the root: a cycle
+(crb_header; crb_word_node; printf '\001\000\000\000\000') > tmp.compiled
+crb_must_fail "back reference"
+
+# truncated file
+$cmd -r tmp.rulebase -c tmp.compiled
+head -c 100 tmp.compiled > tmp.truncated
+mv tmp.truncated tmp.compiled
+crb_must_fail "truncated"
+
+# a chain of nodes that is nested too deeply
+crb_word_node > tmp.chain
+for i in $(seq 14); do
+	cat tmp.chain tmp.chain > tmp.chain2
+	mv tmp.chain2 tmp.chain
+done
+(crb_header; cat tmp.chain; crb_terminal_node) > tmp.compiled
+rm -f tmp.chain
+crb_must_fail "nested too deeply"
+
+rm -f tmp.compiled test.expected
+cleanup_tmp_files
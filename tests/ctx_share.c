@@ -0,0 +1,147 @@
+/* test driver for sharing a rulebase between contexts, see
+ * rulebase_share.sh.
+ *
+ * Usage: ctx_share <rulebase> <second rulebase> <message>
+ *
+ * This file is part of the liblognorm project, released under ASL 2.0
+ */
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <json.h>
+#include "liblognorm.h"
+
+#define NCHILDREN 4
+#define NITER 2000
+
+struct worker {
+	ln_ctx ctx;
+	const char *msg;
+	int nfailed;
+	pthread_t tid;
+};
+
+static void
+printResult(const char *const who, ln_ctx ctx, const char *const msg)
+{
+	struct json_object *json = NULL;
+	ln_normalize(ctx, msg, strlen(msg), &json);
+	printf("%s: %s\n", who, json_object_to_json_string(json));
+	json_object_put(json);
+}
+
+/* normalize, but keep the event for later printing */
+static struct json_object *
+keepResult(ln_ctx ctx, const char *const msg)
+{
+	struct json_object *json = NULL;
+	ln_normalize(ctx, msg, strlen(msg), &json);
+	return json;
+}
+
+/* gather memory statistics while the rulebase is replaced */
+static void *
+statsWorker(void *const arg)
+{
+	struct worker *const w = arg;
+	for(int i = 0 ; i < NITER / 10 ; ++i) {
+		struct json_object *json = NULL;
+		if(ln_getMemoryStats(w->ctx, &json) != 0)
+			++w->nfailed;
+		json_object_put(json);
+	}
+	return NULL;
+}
+
+static void *
+worker(void *const arg)
+{
+	struct worker *const w = arg;
+	for(int i = 0 ; i < NITER ; ++i) {
+		struct json_object *json = NULL;
+		if(ln_normalize(w->ctx, w->msg, strlen(w->msg), &json) != 0)
+			++w->nfailed;
+		json_object_put(json);
+	}
+	return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct worker workers[NCHILDREN];
+	struct worker stats;
+	struct json_object *kept;
+	char name[32];
+
+	if(argc != 4) {
+		fprintf(stderr, "usage: ctx_share <rulebase> <rulebase2> <message>\n");
+		return 1;
+	}
+	ln_ctx parent = ln_initCtx();
+	if(parent == NULL || ln_loadSamples(parent, argv[1]) != 0) {
+		fprintf(stderr, "cannot load rulebase\n");
+		return 1;
+	}
+
+	for(int i = 0 ; i < NCHILDREN ; ++i) {
+		workers[i].ctx = ln_inherittedCtx(parent);
+		workers[i].msg = argv[3];
+		workers[i].nfailed = 0;
+		if(workers[i].ctx == NULL || ln_ctxAttachRulebase(workers[i].ctx, parent) != 0) {
+			fprintf(stderr, "cannot attach context %d\n", i);
+			return 1;
+		}
+	}
+	/* options are per context */
+	ln_setCtxOpts(workers[1].ctx, LN_CTXOPT_ADD_ORIGINALMSG);
+	/* ...but the shared rulebase must not be re-optimized */
+	ln_setReoptimizeInterval(workers[2].ctx, 1);
+	if(ln_clearCtxOpts(workers[2].ctx, LN_CTXOPT_THREADSAFE) == 0)
+		printf("child2: thread-safe mode turned off although shared\n");
+
+	if(ln_loadSamples(parent, argv[2]) == 0)
+		printf("parent: rulebase modified although shared\n");
+	if(ln_pdagReoptimize(parent) == 0)
+		printf("parent: rulebase reoptimized although shared\n");
+
+	/* events must stay valid when the rulebase they came from is replaced */
+	kept = keepResult(parent, argv[3]);
+	for(int i = 0 ; i < NCHILDREN ; ++i)
+		pthread_create(&workers[i].tid, NULL, worker, workers + i);
+	stats.ctx = parent;
+	stats.nfailed = 0;
+	pthread_create(&stats.tid, NULL, statsWorker, &stats);
+	/* replace the parent's rulebase while the children normalize */
+	if(ln_ctxReload(parent, argv[2]) != 0)
+		printf("parent: reload failed\n");
+	pthread_join(stats.tid, NULL);
+	if(stats.nfailed != 0)
+		printf("parent: %d memory stats failed\n", stats.nfailed);
+	for(int i = 0 ; i < NCHILDREN ; ++i) {
+		pthread_join(workers[i].tid, NULL);
+		if(workers[i].nfailed != 0)
+			printf("child%d: %d failed\n", i, workers[i].nfailed);
+	}
+
+	printf("parent kept: %s\n", json_object_to_json_string(kept));
+	json_object_put(kept);
+	printResult("parent", parent, argv[3]);
+	/* the children keep the rulebase, even after the parent is gone */
+	ln_exitCtx(parent);
+	for(int i = 0 ; i < NCHILDREN ; ++i) {
+		snprintf(name, sizeof(name), "child%d", i);
+		printResult(name, workers[i].ctx, argv[3]);
+		if(i == NCHILDREN - 1) {
+			/* the last user, so this deletes the shared rulebase */
+			kept = keepResult(workers[i].ctx, argv[3]);
+			if(ln_ctxReload(workers[i].ctx, argv[2]) != 0)
+				printf("%s: reload failed\n", name);
+			printf("%s kept: %s\n", name, json_object_to_json_string(kept));
+			json_object_put(kept);
+		}
+		ln_exitCtx(workers[i].ctx);
+	}
+	return 0;
+}
@@ -12,6 +12,21 @@ cmd=../src/ln_test
 
 . ./options.sh
 
+# a library built with advanced statistics refuses thread-safe mode
+# (-othreadSafe, -j), so tests leave it out then.
+if $cmd -V 2>&1 | grep -q "advanced stats: available"; then
+    threadsafe_opt=""
+else
+    threadsafe_opt="-othreadSafe"
+fi
+
+skip_without_threadsafe() {
+    if [ "x$threadsafe_opt" == "x" ]; then
+	echo "SKIP: thread-safe mode not available (advanced stats)"
+	exit 77
+    fi
+}
+
 test_def() {
     test_file=$(basename $1)
     test_name=$(echo $test_file | sed -e 's/\..*//g')
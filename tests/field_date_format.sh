@@ -0,0 +1,37 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "date parsers and timestamp formats"
+
+reset_rules
+add_rule 'version=2'
+add_rule 'rule=:%d:date-rfc3164% %t:time-24hr% %r:rest%'
+
+execute 'Oct 29 09:47:08 23:59:59 x'
+assert_output_json_eq '{ "d": "Oct 29 09:47:08", "t": "23:59:59", "r": "x" }'
+
+execute 'jan  5 00:00:60: 00:00:00 x' # short day, leap second, extra colon
+assert_output_json_eq '{ "d": "jan  5 00:00:60:", "t": "00:00:00", "r": "x" }'
+
+execute 'Oct 29 2015 09:47:08 12:00:00 x' # year, found e.g. with Cisco
+assert_output_json_eq '{ "d": "Oct 29 2015 09:47:08", "t": "12:00:00", "r": "x" }'
+
+execute 'Oct 32 09:47:08 12:00:00 x'
+assert_output_json_eq '{ "originalmsg": "Oct 32 09:47:08 12:00:00 x", "unparsed-data": "Oct 32 09:47:08 12:00:00 x" }'
+
+execute 'Oct 29 09:47:08 24:00:00 x'
+assert_output_json_eq '{ "originalmsg": "Oct 29 09:47:08 24:00:00 x", "unparsed-data": "24:00:00 x" }'
+
+reset_rules
+add_rule 'version=2'
+add_rule 'rule=:%{"type":"date-rfc5424", "name":"s", "format":"timestamp-unix"}% %{"type":"date-rfc5424", "name":"ns", "format":"timestamp-unix-ns"}% %{"type":"date-rfc5424", "name":"str", "format":"string"}%'
+
+execute '1985-04-12T19:20:50.52-04:00 1985-04-12T23:20:50.52Z 1985-04-12T23:20:50.52Z'
+assert_output_json_eq '{ "s": 482196050, "ns": 482196050520000000, "str": "1985-04-12T23:20:50.52Z" }'
+
+execute '2003-9-1T1:0:0Z 1969-12-31T23:59:59.999999999Z 2003-9-1T1:0:0Z'
+assert_output_json_eq '{ "s": 1062378000, "ns": -1, "str": "2003-9-1T1:0:0Z" }'
+
+
+cleanup_tmp_files
@@ -0,0 +1,43 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "ipv4 syntax and address formats"
+
+reset_rules
+add_rule 'version=2'
+add_rule 'rule=:%ip:ipv4%%tail:rest%'
+
+execute '192.168.100.254'
+assert_output_json_eq '{ "ip": "192.168.100.254", "tail": "" }'
+
+execute '0.0.0.0 x'
+assert_output_json_eq '{ "ip": "0.0.0.0", "tail": " x" }'
+
+# things that need to NOT match
+
+execute '1.2.3.256'
+assert_output_json_eq '{ "originalmsg": "1.2.3.256", "unparsed-data": "1.2.3.256" }'
+
+execute '1.2.3'
+assert_output_json_eq '{ "originalmsg": "1.2.3", "unparsed-data": "1.2.3" }'
+
+execute '1234.1.1.1'
+assert_output_json_eq '{ "originalmsg": "1234.1.1.1", "unparsed-data": "1234.1.1.1" }'
+
+execute '1..2.3.4'
+assert_output_json_eq '{ "originalmsg": "1..2.3.4", "unparsed-data": "1..2.3.4" }'
+
+# the address parsers can return the address as a number
+reset_rules
+add_rule 'version=2'
+add_rule 'rule=:%{"type":"ipv4", "name":"ip", "format":"number"}% %{"type":"mac48", "name":"mac", "format":"number"}%'
+
+execute '10.0.0.1 00:00:00:00:01:ff'
+assert_output_json_eq '{ "ip": 167772161, "mac": 511 }'
+
+execute '255.255.255.255 ff-ff-ff-ff-ff-ff'
+assert_output_json_eq '{ "ip": 4294967295, "mac": 281474976710655 }'
+
+
+cleanup_tmp_files
@@ -0,0 +1,36 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "JSON field bracket pre-scan"
+add_rule 'version=2'
+add_rule 'rule=:%field:json%'
+add_rule 'rule=:j %field:json%%tail:rest%'
+add_rule 'rule=:%field:cee-syslog%'
+
+# brackets and escapes inside strings do not count
+execute 'j {"f1": "}]", "f2": ["a\"{", {"x": "\\"}]} tail'
+assert_output_json_eq '{ "tail": "tail", "field": { "f1": "}]", "f2": [ "a\"{", { "x": "\\" } ] } }'
+
+# a long object spanning several scan blocks
+execute '{"aaaaaaaaaaaaaaaa": {"bbbbbbbbbbbbbbbb": ["cccccccccccccccc", "dddddddddddddddd"]}}'
+assert_output_json_eq '{ "field": { "aaaaaaaaaaaaaaaa": { "bbbbbbbbbbbbbbbb": [ "cccccccccccccccc", "dddddddddddddddd" ] } } }'
+
+# mismatched and unclosed brackets
+execute 'j {"f1": [1, 2}] tail'
+assert_output_json_eq '{ "originalmsg": "j {\"f1\": [1, 2}] tail", "unparsed-data": "{\"f1\": [1, 2}] tail" }'
+
+execute 'j {"f1": [1, 2]'
+assert_output_json_eq '{ "originalmsg": "j {\"f1\": [1, 2]", "unparsed-data": "{\"f1\": [1, 2]" }'
+
+execute 'j {"f1": "1}'
+assert_output_json_eq '{ "originalmsg": "j {\"f1\": \"1}", "unparsed-data": "{\"f1\": \"1}" }'
+
+# CEE must not have trailing data
+execute '@cee: {"f1": "1"}  '
+assert_output_json_eq '{ "field": { "f1": "1" } }'
+
+execute '@cee: {"f1": "1"} x'
+assert_output_json_eq '{ "originalmsg": "@cee: {\"f1\": \"1\"} x", "unparsed-data": "@cee: {\"f1\": \"1\"} x" }'
+
+cleanup_tmp_files
@@ -0,0 +1,43 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "name=value style parsers with long and many fields"
+add_rule 'version=2'
+add_rule 'rule=:nv %f:name-value-list%'
+add_rule 'rule=:ipt %f:v2-iptables%'
+add_rule 'rule=:cef %f:cef%'
+add_rule 'rule=:lea %f:checkpoint-lea%'
+
+# names and values longer than a scan block
+execute 'nv a.very_long-name.of.a.field=0123456789abcdef0123456789abcdef second.long_name.field=x'
+assert_output_json_eq '{ "f": { "a.very_long-name.of.a.field": "0123456789abcdef0123456789abcdef", "second.long_name.field": "x" } }'
+
+execute 'nv a.very_long-name.of.a.field,x=value'
+assert_output_json_eq '{ "originalmsg": "nv a.very_long-name.of.a.field,x=value", "unparsed-data": "a.very_long-name.of.a.field,x=value" }'
+
+execute 'ipt ABCDEFGHIJKLMNOPQRSTUVWXYZ=0123456789abcdef0123456789 DF LEN=1'
+assert_output_json_eq '{ "f": { "ABCDEFGHIJKLMNOPQRSTUVWXYZ": "0123456789abcdef0123456789", "DF": null, "LEN": "1" } }'
+
+execute 'ipt ABCDEFGHIJKLMNOPQRSTUVWXYz=1 DF'
+assert_output_json_eq '{ "originalmsg": "ipt ABCDEFGHIJKLMNOPQRSTUVWXYz=1 DF", "unparsed-data": "ABCDEFGHIJKLMNOPQRSTUVWXYz=1 DF" }'
+
+# more fields than kept without allocation
+execute 'nv f1=1 f2=2 f3=3 f4=4 f5=5 f6=6 f7=7 f8=8 f9=9 f10=10 f11=11 f12=12 f13=13 f14=14 f15=15 f16=16 f17=17 f18=18 f19=19 f20=20 f21=21 f22=22 f23=23 f24=24 f25=25 f26=26 f27=27 f28=28 f29=29 f30=30 f31=31 f32=32 f33=33 f34=34'
+assert_output_json_eq '{ "f": { "f1": "1", "f2": "2", "f3": "3", "f4": "4", "f5": "5", "f6": "6", "f7": "7", "f8": "8", "f9": "9", "f10": "10", "f11": "11", "f12": "12", "f13": "13", "f14": "14", "f15": "15", "f16": "16", "f17": "17", "f18": "18", "f19": "19", "f20": "20", "f21": "21", "f22": "22", "f23": "23", "f24": "24", "f25": "25", "f26": "26", "f27": "27", "f28": "28", "f29": "29", "f30": "30", "f31": "31", "f32": "32", "f33": "33", "f34": "34" } }'
+
+# CEF values with spaces and escapes spanning several scan blocks
+execute 'cef CEF:0|V|P|1|2|n|5| msg=a message with spaces and an \= escape inside request=http://example.com/x\=y\\z cnt=1'
+assert_output_json_eq '{ "f": { "DeviceVendor": "V", "DeviceProduct": "P", "DeviceVersion": "1", "SignatureID": "2", "Name": "n", "Severity": "5", "Extensions": { "msg": "a message with spaces and an = escape inside", "request": "http://example.com/x=y\\z", "cnt": "1" } } }'
+
+# a backslash at the very end of the message escapes nothing
+execute 'cef CEF:0|V|P|1|2|n|5| msg=value\'
+assert_output_json_eq '{ "f": { "DeviceVendor": "V", "DeviceProduct": "P", "DeviceVersion": "1", "SignatureID": "2", "Name": "n", "Severity": "5", "Extensions": { "msg": "value" } } }'
+
+execute 'cef CEF:0|V|P|1|2|n|5| msg=a\tb'
+assert_output_json_eq '{ "originalmsg": "cef CEF:0|V|P|1|2|n|5| msg=a\\tb", "unparsed-data": "CEF:0|V|P|1|2|n|5| msg=a\\tb" }'
+
+execute 'lea product: VPN-1 & FireWall-1 with a long value; src: 10.0.0.1; '
+assert_output_json_eq '{ "f": { "product": "VPN-1 & FireWall-1 with a long value", "src": "10.0.0.1" } }'
+
+cleanup_tmp_files
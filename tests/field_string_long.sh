@@ -0,0 +1,39 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "string type with long values"
+
+reset_rules
+add_rule 'version=2'
+add_rule 'rule=:a %f:string% b'
+
+execute 'a 0123456789abcdef0123456789abcdef0123 b'
+assert_output_json_eq '{"f": "0123456789abcdef0123456789abcdef0123"}'
+
+execute 'a "0123456789abcdef 0123456789abcdef 012" b'
+assert_output_json_eq '{"f": "0123456789abcdef 0123456789abcdef 012"}'
+
+execute 'a "0123456789abcdef 0123456789\"abcdef ""012" b'
+assert_output_json_eq '{"f": "0123456789abcdef 0123456789\"abcdef \"012"}'
+
+execute 'a 0123456789abcdef0123456789abcdefïöü b'
+assert_output_json_eq '{"f": "0123456789abcdef0123456789abcdefïöü"}'
+
+reset_rules
+add_rule 'version=2'
+add_rule 'rule=:a %f:string{"matching.permitted":[
+			       {"class":"alnum"}
+                               ]}% b'
+
+execute 'a abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 b'
+assert_output_json_eq '{"f": "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"}'
+
+# not permitted chars at various positions
+execute 'a abcdefghijklmnopq_stuvwxyz b'
+assert_output_json_eq '{"originalmsg": "a abcdefghijklmnopq_stuvwxyz b", "unparsed-data": "abcdefghijklmnopq_stuvwxyz b" }'
+
+execute 'a abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ012345678ä b'
+assert_output_json_eq '{"originalmsg": "a abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ012345678ä b", "unparsed-data": "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ012345678ä b" }'
+
+cleanup_tmp_files
@@ -0,0 +1,58 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "lognormalizer input modes"
+add_rule 'version=2'
+add_rule 'rule=:a %n:number% %w:word%'
+
+# includes CRLF line ending, an empty line, a line larger than the
+# read block size and a last line without LF
+printf 'a 1 one\na 2 two\r\n\na 3 three\n' > test.input
+printf 'a 4 ' >> test.input
+head -c 1500000 /dev/zero | tr '\0' 'x' >> test.input
+printf '\na 5 five' >> test.input
+
+$cmd -r tmp.rulebase -e json < test.input > test.expected
+assert_output() {
+	if ! cmp test.expected test.out; then
+		echo "FAIL: output differs for $1"
+		exit 1
+	fi
+}
+grep -F '{ "w": "five", "n": "5" }' test.expected
+grep -F '{ "w": "two", "n": "2" }' test.expected
+if [ $(wc -l < test.expected) -ne 6 ]; then
+	echo "FAIL: wrong number of records"
+	exit 1
+fi
+
+cat test.input | $cmd -r tmp.rulebase -e json > test.out
+assert_output pipe
+$cmd -r tmp.rulebase -e json --input-mode=mmap < test.input > test.out
+assert_output mmap
+$cmd -r tmp.rulebase -e json --input-mode=block < test.input > test.out
+assert_output block
+cat test.input | $cmd -r tmp.rulebase -e json --input-mode=stream > test.out
+assert_output stream
+$cmd -r tmp.rulebase -e json -b3 < test.input > test.out
+assert_output batch
+if [ "x$threadsafe_opt" != "x" ]; then
+	$cmd -r tmp.rulebase -e json -j2 < test.input > test.out
+	assert_output threads
+fi
+
+# empty input
+$cmd -r tmp.rulebase -e json < /dev/null > test.out
+if [ -s test.out ]; then
+	echo "FAIL: output for empty input"
+	exit 1
+fi
+
+if $cmd -r tmp.rulebase --input-mode=invalid < /dev/null; then
+	echo "FAIL: invalid input mode accepted"
+	exit 1
+fi
+
+rm -f test.input test.expected
+cleanup_tmp_files
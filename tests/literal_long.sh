@@ -0,0 +1,29 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "long literals"
+add_rule 'version=2'
+add_rule 'rule=:this is a rather long literal text, longer than a word %w:word%'
+add_rule 'rule=:x%n:number%y'
+
+execute 'this is a rather long literal text, longer than a word here'
+assert_output_json_eq '{ "w": "here" }'
+
+execute 'this is a rather long literal text, longer than a wort here'
+assert_output_contains '"unparsed-data"'
+
+execute 'this is a rather long literal'
+assert_output_contains '"unparsed-data"'
+
+execute 'this is a rather Long literal text, longer than a word here'
+assert_output_contains '"unparsed-data"'
+
+# one-char literals
+execute 'x42y'
+assert_output_json_eq '{ "n": "42" }'
+
+execute 'x42z'
+assert_output_contains '"unparsed-data": "z"'
+
+cleanup_tmp_files
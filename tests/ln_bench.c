@@ -0,0 +1,548 @@
+/**
+ * @file ln_bench.c
+ * @brief Benchmark driver for liblognorm.
+ *
+ * This tool measures normalization speed. In corpus mode, it loads a
+ * rulebase, reads a corpus of log lines into memory and normalizes
+ * all of them (optionally several times). It then reports throughput,
+ * per-message latency percentiles, heap allocations per message, the
+ * time needed to load the rulebase and the peak resident memory.
+ * In parser mode (-P), it runs a microbenchmark for each v2 parser
+ * with a single-field rulebase and a matching sample message.
+ *
+ * This is used by "make bench", see bench.sh.
+ *
+ *//*
+ * liblognorm - a fast samples-based log normalization library
+ * Copyright 2026 by Rainer Gerhards and Adiscon GmbH.
+ *
+ * This file is part of liblognorm.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * A copy of the LGPL v2.1 can be found in the file "COPYING" in this distribution.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <json.h>
+
+#include "liblognorm.h"
+
+/* Count heap allocations by interposing the allocator. glibc explicitly
+ * supports replacing malloc & friends in the main program, and this also
+ * catches allocations done inside liblognorm, libestr and libfastjson.
+ * On other platforms, allocation counts are not available.
+ */
+#if defined(__GLIBC__) && !defined(LN_BENCH_NO_ALLOC_COUNT)
+#define HAVE_ALLOC_COUNT 1
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void __libc_free(void *);
+
+static uint64_t nAllocs = 0;
+
+void *
+malloc(size_t size)
+{
+	++nAllocs;
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+	++nAllocs;
+	return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	++nAllocs;
+	return __libc_realloc(ptr, size);
+}
+
+void
+free(void *ptr)
+{
+	__libc_free(ptr);
+}
+#else
+#define HAVE_ALLOC_COUNT 0
+static uint64_t nAllocs = 0;
+#endif
+
+static int passes = 1;		/**< how often the corpus is normalized */
+static int microIters = 200000;	/**< iterations per parser microbenchmark */
+
+static void
+errCallBack(void __attribute__((unused)) *cookie, const char *msg,
+	    size_t __attribute__((unused)) lenMsg)
+{
+	fprintf(stderr, "liblognorm error: %s\n", msg);
+}
+
+static inline uint64_t
+nsNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+cmpU64(const void *a, const void *b)
+{
+	const uint64_t x = *(const uint64_t*) a;
+	const uint64_t y = *(const uint64_t*) b;
+	return (x > y) - (x < y);
+}
+
+/* returns the value at the given percentile of a sorted sample */
+static uint64_t
+percentile(const uint64_t *sorted, const size_t n, const int pct)
+{
+	size_t idx;
+	if(n == 0)
+		return 0;
+	idx = (n * pct) / 100;
+	if(idx >= n)
+		idx = n - 1;
+	return sorted[idx];
+}
+
+static long
+peakRSS(void)
+{
+	struct rusage ru;
+	if(getrusage(RUSAGE_SELF, &ru) != 0)
+		return -1;
+	return ru.ru_maxrss; /* KiB on Linux */
+}
+
+/* a message counts as parsed if the event carries no unparsed-data,
+ * which works the same way for the v1 and v2 engines.
+ */
+static int
+isParsed(struct json_object *json)
+{
+	struct json_object *unparsed;
+	return json != NULL
+		&& !json_object_object_get_ex(json, "unparsed-data", &unparsed);
+}
+
+/* load a rulebase into a fresh context, returning the load time in ns
+ * via loadTime. Returns NULL on error.
+ */
+static ln_ctx
+loadRulebase(const char *file, uint64_t *loadTime)
+{
+	ln_ctx ctx;
+	uint64_t start;
+
+	if((ctx = ln_initCtx()) == NULL) {
+		fprintf(stderr, "ln_bench: could not initialize context\n");
+		goto done;
+	}
+	ln_setErrMsgCB(ctx, errCallBack, NULL);
+	start = nsNow();
+	if(ln_loadSamples(ctx, file) != 0) {
+		fprintf(stderr, "ln_bench: could not load rulebase %s\n", file);
+		ln_exitCtx(ctx);
+		ctx = NULL;
+		goto done;
+	}
+	*loadTime = nsNow() - start;
+done:
+	return ctx;
+}
+
+struct corpus {
+	char *buf;
+	char **lines;
+	size_t *lens;
+	size_t nLines;
+};
+
+static int
+readCorpus(const char *file, struct corpus *const corp)
+{
+	int r = -1;
+	FILE *fp;
+	long size;
+	size_t i, nAlloc = 1024;
+	char *p, *end;
+
+	memset(corp, 0, sizeof(*corp));
+	if((fp = fopen(file, "r")) == NULL) {
+		perror(file);
+		goto done;
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+	if((corp->buf = malloc(size + 1)) == NULL)
+		goto done;
+	if(fread(corp->buf, 1, size, fp) != (size_t) size) {
+		perror(file);
+		goto done;
+	}
+	corp->buf[size] = '\0';
+	if((corp->lines = malloc(nAlloc * sizeof(char*))) == NULL)
+		goto done;
+	if((corp->lens = malloc(nAlloc * sizeof(size_t))) == NULL)
+		goto done;
+	end = corp->buf + size;
+	for(p = corp->buf ; p < end ; ) {
+		char *eol = memchr(p, '\n', end - p);
+		if(eol == NULL)
+			eol = end;
+		if(corp->nLines == nAlloc) {
+			nAlloc *= 2;
+			corp->lines = realloc(corp->lines, nAlloc * sizeof(char*));
+			corp->lens = realloc(corp->lens, nAlloc * sizeof(size_t));
+			if(corp->lines == NULL || corp->lens == NULL)
+				goto done;
+		}
+		*eol = '\0';
+		i = corp->nLines++;
+		corp->lines[i] = p;
+		corp->lens[i] = eol - p;
+		p = eol + 1;
+	}
+	r = 0;
+done:
+	if(fp != NULL)
+		fclose(fp);
+	return r;
+}
+
+static void
+freeCorpus(struct corpus *const corp)
+{
+	free(corp->buf);
+	free(corp->lines);
+	free(corp->lens);
+}
+
+static void
+printAllocs(const uint64_t allocs, const uint64_t nMsgs)
+{
+	if(HAVE_ALLOC_COUNT)
+		printf(" %8.1f", nMsgs ? (double) allocs / nMsgs : 0.0);
+	else
+		printf(" %8s", "n/a");
+}
+
+static void
+printHeader(void)
+{
+	printf("%-22s %9s %7s %12s %8s %8s %8s %10s %9s\n",
+		"bench", "msgs", "parsed%", "msgs/s", "p50(ns)", "p99(ns)",
+		"allocs", "load(ms)", "rss(KiB)");
+}
+
+/* bench mode: normalize a complete corpus */
+static int
+benchCorpus(const char *label, const char *rbFile, const char *corpusFile)
+{
+	int r = 1;
+	ln_ctx ctx = NULL;
+	struct corpus corp;
+	uint64_t *times = NULL;
+	uint64_t loadTime = 0, total = 0, allocsStart, allocs;
+	uint64_t nMsgs, nParsed = 0;
+	size_t i, k;
+	int pass;
+
+	memset(&corp, 0, sizeof(corp));
+	if((ctx = loadRulebase(rbFile, &loadTime)) == NULL)
+		goto done;
+	if(readCorpus(corpusFile, &corp) != 0)
+		goto done;
+	nMsgs = (uint64_t) corp.nLines * passes;
+	if(nMsgs == 0) {
+		fprintf(stderr, "ln_bench: corpus %s is empty\n", corpusFile);
+		goto done;
+	}
+	if((times = malloc(nMsgs * sizeof(uint64_t))) == NULL)
+		goto done;
+
+	k = 0;
+	allocsStart = nAllocs;
+	for(pass = 0 ; pass < passes ; ++pass) {
+		for(i = 0 ; i < corp.nLines ; ++i) {
+			struct json_object *json = NULL;
+			const uint64_t start = nsNow();
+			ln_normalize(ctx, corp.lines[i], corp.lens[i], &json);
+			if(pass == 0 && isParsed(json))
+				++nParsed;
+			if(json != NULL)
+				json_object_put(json);
+			times[k] = nsNow() - start;
+			total += times[k++];
+		}
+	}
+	allocs = nAllocs - allocsStart;
+
+	qsort(times, nMsgs, sizeof(uint64_t), cmpU64);
+	printf("%-22s %9zu %6.1f%% %12.0f %8llu %8llu", label, corp.nLines,
+		100.0 * nParsed / corp.nLines,
+		total ? (double) nMsgs * 1e9 / total : 0.0,
+		(unsigned long long) percentile(times, nMsgs, 50),
+		(unsigned long long) percentile(times, nMsgs, 99));
+	printAllocs(allocs, nMsgs);
+	printf(" %10.2f %9ld\n", loadTime / 1e6, peakRSS());
+	r = 0;
+done:
+	free(times);
+	freeCorpus(&corp);
+	if(ctx != NULL)
+		ln_exitCtx(ctx);
+	return r;
+}
+
+/* microbenchmarks for the parsers in parser_lookup_table (pdag.c).
+ * Each rule consists of a single field of the respective type (plus
+ * whatever literal text is needed to delimit it) and is run against
+ * a matching sample message.
+ */
+static const struct {
+	const char *name;
+	const char *rule;
+	const char *sample;
+} microBenches[] = {
+	{ "literal", "the quick brown fox jumps over the lazy dog",
+	  "the quick brown fox jumps over the lazy dog" },
+	{ "repeat", "%{\"name\":\"f\", \"type\":\"repeat\", "
+		"\"parser\":{\"name\":\"n\", \"type\":\"number\"}, "
+		"\"while\":{\"type\":\"literal\", \"text\":\", \"}}%",
+	  "1, 22, 333, 4444, 55555" },
+	{ "date-rfc3164", "%f:date-rfc3164%", "Oct 29 09:47:08" },
+	{ "date-rfc5424", "%f:date-rfc5424%", "1985-04-12T19:20:50.52-04:00" },
+	{ "number", "%f:number%", "1234567890" },
+	{ "float", "%f:float%", "-12345.6789" },
+	{ "hexnumber", "%f:hexnumber% x", "0x1f2e3d4c x" },
+	{ "kernel-timestamp", "%f:kernel-timestamp%", "[12345.123456]" },
+	{ "whitespace", "a%f:whitespace%b", "a       b" },
+	{ "ipv4", "%f:ipv4%", "192.168.100.254" },
+	{ "ipv6", "%f:ipv6%", "2001:db8:85a3::8a2e:370:7334" },
+	{ "word", "%f:word%", "aReasonablyLongWordWithoutSpaces" },
+	{ "alpha", "%f:alpha%", "alphabeticcharactersonly" },
+	{ "rest", "%f:rest%", "the remainder of the message, up to its end" },
+	{ "op-quoted-string", "%f:op-quoted-string%",
+	  "\"an optionally quoted string\"" },
+	{ "quoted-string", "%f:quoted-string%", "\"a quoted string value\"" },
+	{ "date-iso", "%f:date-iso%", "2012-10-11" },
+	{ "time-24hr", "%f:time-24hr%", "23:59:59" },
+	{ "time-12hr", "%f:time-12hr%", "11:59:59" },
+	{ "duration", "%f:duration%", "1:23:45" },
+	{ "cisco-interface-spec", "%f:cisco-interface-spec%",
+	  "outside:192.168.1.13/50179 (192.168.1.13/50179)(LOCAL\\some.user)" },
+	{ "name-value-list", "%f:name-value-list%",
+	  "a=1 b=two cc=three ddd=4444 eeee=fifth" },
+	{ "json", "%f:json%", "{\"a\": 1, \"b\": [1, 2, 3], \"c\": \"str\"}" },
+	{ "cee-syslog", "%f:cee-syslog%", "@cee:{\"a\": 1, \"c\": \"str\"}" },
+	{ "mac48", "%f:mac48%", "f0:f6:1c:5f:cc:a2" },
+	{ "cef", "%f:cef%",
+	  "CEF:0|Vendor|Product|1.0|100|some name|5| src=10.0.0.1 dst=10.0.0.2 msg=a value" },
+	{ "checkpoint-lea", "%f:checkpoint-lea%",
+	  "tcp_flags: RST-ACK; src: 192.168.0.1; dst: 10.0.0.1;" },
+	{ "v2-iptables", "%f:v2-iptables%",
+	  "IN=eth0 OUT= SRC=10.0.0.1 DST=10.0.0.2 LEN=60 TOS=0x00 PROTO=TCP" },
+	{ "string-to", "%f:string-to:--%--end", "some text with - dashes--end" },
+	{ "char-to", "%f:char-to:,%,x", "some text up to the comma,x" },
+	{ "char-sep", "%f:char-sep:,%,x", "some text up to the comma,x" },
+	{ "string", "%f:string% x", "aPlainStringValueWithoutSpaces x" },
+	{ NULL, NULL, NULL }
+};
+
+static int
+runMicroBench(const int idx, const char *rbFile)
+{
+	int r = 1;
+	FILE *fp;
+	ln_ctx ctx = NULL;
+	uint64_t *times = NULL;
+	uint64_t loadTime, total = 0, allocsStart, allocs;
+	struct json_object *json = NULL;
+	const char *sample = microBenches[idx].sample;
+	const size_t lenSample = strlen(sample);
+	int i;
+
+	if((fp = fopen(rbFile, "w")) == NULL) {
+		perror(rbFile);
+		goto done;
+	}
+	fprintf(fp, "version=2\nrule=:%s\n", microBenches[idx].rule);
+	fclose(fp);
+	if((ctx = loadRulebase(rbFile, &loadTime)) == NULL)
+		goto done;
+
+	ln_normalize(ctx, sample, lenSample, &json);
+	if(!isParsed(json)) {
+		printf("%-22s sample does not parse: %s\n", microBenches[idx].name,
+			json == NULL ? "(no event)"
+				     : json_object_to_json_string(json));
+		goto done;
+	}
+	json_object_put(json);
+	json = NULL;
+
+	if((times = malloc(microIters * sizeof(uint64_t))) == NULL)
+		goto done;
+	allocsStart = nAllocs;
+	for(i = 0 ; i < microIters ; ++i) {
+		const uint64_t start = nsNow();
+		ln_normalize(ctx, sample, lenSample, &json);
+		json_object_put(json);
+		json = NULL;
+		times[i] = nsNow() - start;
+		total += times[i];
+	}
+	allocs = nAllocs - allocsStart;
+	qsort(times, microIters, sizeof(uint64_t), cmpU64);
+	printf("%-22s %9d %8.0f %8llu %8llu", microBenches[idx].name, microIters,
+		(double) total / microIters,
+		(unsigned long long) percentile(times, microIters, 50),
+		(unsigned long long) percentile(times, microIters, 99));
+	printAllocs(allocs, microIters);
+	printf("\n");
+	r = 0;
+done:
+	if(json != NULL)
+		json_object_put(json);
+	free(times);
+	if(ctx != NULL)
+		ln_exitCtx(ctx);
+	return r;
+}
+
+static int
+benchParsers(const char *filter)
+{
+	int i;
+	int r = 0;
+	char rbFile[] = "/tmp/ln_bench.XXXXXX";
+	int fd;
+
+	if((fd = mkstemp(rbFile)) == -1) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+	printf("%-22s %9s %8s %8s %8s %8s\n",
+		"parser", "iters", "mean(ns)", "p50(ns)", "p99(ns)", "allocs");
+	for(i = 0 ; microBenches[i].name != NULL ; ++i) {
+		if(filter != NULL && strcmp(filter, microBenches[i].name))
+			continue;
+		r |= runMicroBench(i, rbFile);
+	}
+	unlink(rbFile);
+	return r;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+	"usage: ln_bench [options] -r <rulebase> -i <corpus>\n"
+	"       ln_bench [options] -P [parser]\n"
+	"Options:\n"
+	"    -r<rulebase>  rulebase to use (v1 or v2, as given in the file)\n"
+	"    -i<corpus>    file with one message per line\n"
+	"    -l<label>     label to use in the report (default: rulebase name)\n"
+	"    -n<passes>    normalize the corpus that many times\n"
+	"    -P            run parser microbenchmarks (optionally only one)\n"
+	"    -m<iters>     iterations per parser microbenchmark\n"
+	"    -H            print the header line for corpus mode\n"
+	"    -h            this help\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	int opt;
+	int r = 1;
+	int parserMode = 0;
+	int printHdr = 0;
+	const char *rbFile = NULL;
+	const char *corpusFile = NULL;
+	const char *label = NULL;
+
+	while((opt = getopt(argc, argv, "r:i:l:n:Pm:Hh")) != -1) {
+		switch (opt) {
+		case 'r':
+			rbFile = optarg;
+			break;
+		case 'i':
+			corpusFile = optarg;
+			break;
+		case 'l':
+			label = optarg;
+			break;
+		case 'n':
+			passes = atoi(optarg);
+			break;
+		case 'P':
+			parserMode = 1;
+			break;
+		case 'm':
+			microIters = atoi(optarg);
+			break;
+		case 'H':
+			printHdr = 1;
+			break;
+		case 'h':
+		default:
+			usage();
+			goto exit;
+		}
+	}
+
+	if(passes < 1 || microIters < 1) {
+		fprintf(stderr, "ln_bench: iteration counts must be positive\n");
+		goto exit;
+	}
+
+	if(parserMode) {
+		r = benchParsers(optind < argc ? argv[optind] : NULL);
+	} else {
+		if(printHdr)
+			printHeader();
+		if(rbFile == NULL && corpusFile == NULL) {
+			r = printHdr ? 0 : 1;
+			if(!printHdr)
+				usage();
+			goto exit;
+		}
+		if(rbFile == NULL || corpusFile == NULL) {
+			usage();
+			goto exit;
+		}
+		r = benchCorpus(label == NULL ? rbFile : label, rbFile, corpusFile);
+	}
+
+exit:
+	return r;
+}
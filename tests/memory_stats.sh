@@ -0,0 +1,40 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "memory usage statistics of the rulebase"
+add_rule 'version=2'
+add_rule 'type=@port:%port:number%'
+add_rule 'rule=t1:connect from %ip:ipv4% port %p:@port% user %u:word%'
+add_rule 'rule=t2:connect from %ip:ipv4% port %p:@port% host %h:word%'
+add_rule 'rule=t3:list %{"name":"l", "type":"repeat", "parser":{"type":"number", "name":"n"}, "while":{"type":"literal", "text":","}}%'
+add_rule 'annotate=t1:+a="b"'
+
+ln_opts="-s -"
+execute 'connect from 1.2.3.4 port 5 user x'
+assert_output_contains 'Memory Usage'
+assert_output_contains '"parser_tables": '
+assert_output_contains '"parser_data": '
+assert_output_contains '"strings": '
+assert_output_contains '"total": '
+# no index is needed for this small rulebase
+assert_output_contains '"indexes": 0,'
+
+# ...but the prefilter is one
+ln_opts="-oprefilter -s -"
+execute 'connect from 1.2.3.4 port 5 user x'
+assert_output_contains '"total": '
+if assert_output_contains '"indexes": 0,' ; then
+	echo "FAIL: prefilter memory not accounted"
+	exit 1
+fi
+
+# names are interned, so the annotation must still be applied
+ln_opts=""
+execute 'connect from 1.2.3.4 port 5 user x'
+assert_output_json_eq '{ "u": "x", "p": { "port": "5" }, "ip": "1.2.3.4", "a": "b" }'
+
+execute 'list 1,2,3'
+assert_output_json_eq '{ "l": [ { "n": "1" }, { "n": "2" }, { "n": "3" } ] }'
+
+cleanup_tmp_files
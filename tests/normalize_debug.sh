@@ -0,0 +1,35 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "same results with and without debug output"
+add_rule 'version=2'
+add_rule 'type=@pair:%a:number%=%b:word%'
+add_rule 'rule=:x %p:@pair% y'
+add_rule 'rule=:x %n:number% z'
+add_rule 'rule=:r %{"name":"l", "type":"repeat", "parser":{"type":"number", "name":"."}, "while":{"type":"literal", "text":","}}%'
+
+for opts in "" "-v"; do
+	ln_opts="$opts"
+	execute 'x 1=a y'
+	assert_output_json_eq '{ "p": { "a": "1", "b": "a" } }'
+	execute 'x 1 z'
+	assert_output_json_eq '{ "n": "1" }'
+	execute 'r 1,2,3'
+	assert_output_json_eq '{ "l": [ "1", "2", "3" ] }'
+	execute 'x 1 q'
+	assert_output_json_eq '{ "originalmsg": "x 1 q", "unparsed-data": " q" }'
+done
+
+# the debug walk does emit its trace
+echo 'x 1 z' | $cmd -v -r tmp.rulebase -e json 2> test.err > /dev/null
+if ! grep -q "trying 'number' parser" test.err; then
+	echo "FAIL: no parser trace in debug output"
+	cat test.err
+	rm -f test.err
+	exit 1
+fi
+rm -f test.err
+
+ln_opts=""
+cleanup_tmp_files
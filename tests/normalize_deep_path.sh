@@ -0,0 +1,45 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "long paths through the parse dag"
+rule=""
+msg=""
+for i in $(seq 0 199); do
+	rule="$rule%f$i:number% "
+	msg="$msg$i "
+done
+add_rule 'version=2'
+add_rule "rule=deep:${rule}end"
+add_rule 'rule=any:%a:number% %r:rest%'
+
+execute "${msg}end"
+assert_output_contains '"f0": "0"'
+assert_output_contains '"f199": "199"'
+
+# the deep rule fails at its very end, so we backtrack all the way up
+execute "${msg}other"
+assert_output_contains '"a": "0"'
+assert_output_contains '"r": "1 2 3'
+
+# nested normalization on top of a long path
+reset_rules
+rule=""
+msg=""
+for i in $(seq 0 59); do
+	rule="$rule%t$i:number%,"
+	msg="$msg$i,"
+done
+add_rule 'version=2'
+add_rule "type=@tail:${rule}"
+add_rule 'rule=:T %a:number% %b:number% %c:number% %x:@tail% end'
+
+execute "T 1 2 3 ${msg} end"
+assert_output_contains '"c": "3"'
+assert_output_contains '"t59": "59"'
+
+# the type matches, but not what follows it
+execute "T 1 2 3 ${msg}x end"
+assert_output_json_eq "{ \"originalmsg\": \"T 1 2 3 ${msg}x end\", \"unparsed-data\": \"x end\" }"
+
+cleanup_tmp_files
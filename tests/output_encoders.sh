@@ -0,0 +1,50 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "direct-to-buffer output encoders"
+add_rule 'version=2'
+add_rule 'type=@tuple:%a:number%/%b:number%'
+add_rule 'type=@dd:%..:number%-x'
+add_rule 'rule=:a %n:number% b %-:word% %w:word%'
+add_rule 'rule=:t %t:@tuple% %j:json%'
+add_rule 'rule=:d %d:@dd% %.:json%'
+add_rule 'rule=:q %q:quoted-string% %r:rest%'
+
+execute_fmt() {
+	echo "$2" | $cmd -r tmp.rulebase -e $1 -E'n,w q r' > test.out
+	echo "Out:"
+	cat test.out
+}
+
+# json must be identical to what the json library creates, so we
+# check the exact text
+execute_fmt json 't 1/2 {"k": "v", "n": [1, 2.5, true, null, "x"], "e": {}}'
+assert_output_contains '{ "j": { "k": "v", "n": [ 1, 2.5, true, null, "x" ], "e": { } }, "t": { "b": "2", "a": "1" } }'
+execute_fmt json "$(printf 'q "a\\\\b" tab\there\001')"
+assert_output_contains '{ "r": "tab\there\u0001", "q": "\"a\\\\b\"" }'
+
+execute_fmt span-json 'a 4711 b skip word'
+assert_output_contains '{ "n": "4711", "w": "word" }'
+execute_fmt span-json 't 1/2 {"k": "v", "e": {}}'
+assert_output_contains '{ "t": { "b": "2", "a": "1" }, "j": { "k": "v", "e": { } } }'
+# "." and ".." are handled like by the regular normalizer
+execute_fmt span-json 'd 7-x {"top": 1, "o": {"x": "y"}}'
+assert_output_contains '{ "d": "7", "top": 1, "o": { "x": "y" } }'
+execute_fmt span-json "$(printf 'q "a\\\\b" tab\there\001')"
+assert_output_contains '{ "q": "\"a\\\\b\"", "r": "tab\there\u0001" }'
+execute_fmt span-json 'no match'
+assert_output_contains '{ "originalmsg": "no match" }'
+
+execute_fmt csv 'a 4711 b skip word'
+assert_output_contains '"4711","word",,'
+execute_fmt csv "$(printf 'q "a\\\\b" tab\there\001')"
+assert_output_contains ',,"\"a\\\\b\"","tab\there\u0001"'
+
+execute_fmt xml 'q "a<b" x&y'
+assert_output_contains '<event><field name="r"><value>x&amp;y</value></field><field name="q"><value>"a&lt;b"</value></field></event>'
+
+execute_fmt cee-syslog 'q "a]b" x,y'
+assert_output_contains '[cee@115 r="x\,y" q="\"a\]b\""]'
+
+cleanup_tmp_files
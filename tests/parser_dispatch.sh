@@ -0,0 +1,57 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "first-byte dispatch with many alternatives at one node"
+add_rule 'version=2'
+add_rule 'rule=:abc %n:number%'
+add_rule 'rule=:abd %w:word%'
+add_rule 'rule=:xyz %w:word%'
+add_rule 'rule=:%n:number% items'
+add_rule 'rule=:%ip:ipv4% up'
+add_rule 'rule=:[%w:char-to:]%]'
+add_rule 'rule=:%r:rest%'
+
+execute 'abc 4711'
+assert_output_json_eq '{"n": "4711"}'
+
+execute 'abd word'
+assert_output_json_eq '{"w": "word"}'
+
+execute 'xyz word'
+assert_output_json_eq '{"w": "word"}'
+
+execute '12 items'
+assert_output_json_eq '{"n": "12"}'
+
+execute '10.0.0.1 up'
+assert_output_json_eq '{"ip": "10.0.0.1"}'
+
+execute '[tag]'
+assert_output_json_eq '{"w": "tag"}'
+
+# nothing but rest can start with these
+execute 'abe 4711'
+assert_output_json_eq '{"r": "abe 4711"}'
+
+execute '10.0.0.1 down'
+assert_output_json_eq '{"r": "10.0.0.1 down"}'
+
+execute ''
+assert_output_json_eq '{"r": ""}'
+
+# priorities must still be honored, even if parsers are dispatched
+reset_rules
+add_rule 'version=2'
+add_rule 'rule=:abc %n:number%'
+add_rule 'rule=:abd %w:word%'
+add_rule 'rule=:%{"name":"n", "type":"number", "priority":10}%%{"name":"r", "type":"rest", "priority":20}%'
+add_rule 'rule=:%{"name":"r", "type":"rest", "priority":15}%'
+
+execute 'abc 4711'
+assert_output_json_eq '{"r": "abc 4711"}'
+
+execute '12 items'
+assert_output_json_eq '{"n": "12", "r": " items"}'
+
+cleanup_tmp_files
@@ -0,0 +1,53 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "delimiter scanning over long fields"
+add_rule 'version=2'
+add_rule 'rule=:w %w:word% end'
+add_rule 'rule=:c %{"name":"c", "type":"char-to", "extradata":";,"}%;tail'
+add_rule 'rule=:s %{"name":"s", "type":"char-sep", "extradata":"|#"}%'
+add_rule 'rule=:t %{"name":"t", "type":"string-to", "extradata":"XY"}%XY rest'
+add_rule 'rule=:o %{"name":"o", "type":"string-to", "extradata":"!"}%!'
+add_rule 'rule=:q %q:quoted-string% end'
+add_rule 'rule=:p %p:op-quoted-string% end'
+
+# terminators around the 16 byte block boundaries
+execute 'w 0123456789abcde end'
+assert_output_json_eq '{ "w": "0123456789abcde" }'
+execute 'w 0123456789abcdef0123456789abcdef0 end'
+assert_output_json_eq '{ "w": "0123456789abcdef0123456789abcdef0" }'
+
+execute 'c 0123456789abcdef;tail'
+assert_output_json_eq '{ "c": "0123456789abcdef" }'
+execute 'c 0123456789abcdef0123456789abcde;tail'
+assert_output_json_eq '{ "c": "0123456789abcdef0123456789abcde" }'
+execute 'c 0123456789abcdef0123456789abcdef0;tail'
+assert_output_json_eq '{ "c": "0123456789abcdef0123456789abcdef0" }'
+# first terminator must win: ',' does not match the literal
+execute 'c 0123456789abcdef0123,456789abcdef0;tail'
+assert_output_contains '"unparsed-data": ",456789abcdef0;tail"'
+
+execute 's 0123456789abcdef0123456789abcdef0'
+assert_output_json_eq '{ "s": "0123456789abcdef0123456789abcdef0" }'
+execute 's 0123456789abcdef0123456789abcdef|0'
+assert_output_contains '"unparsed-data": "|0"'
+
+execute 't 0123456789abcdefX0123456789abcdefXY rest'
+assert_output_json_eq '{ "t": "0123456789abcdefX0123456789abcdef" }'
+execute 't 0123456789abcdefX'
+assert_output_contains '"unparsed-data": "0123456789abcdefX"'
+execute 'o 0123456789abcdef0123456789abcdef!'
+assert_output_json_eq '{ "o": "0123456789abcdef0123456789abcdef" }'
+
+execute 'q "0123456789abcdef 0123456789abcdef" end'
+assert_output_json_eq '{ "q": "\"0123456789abcdef 0123456789abcdef\"" }'
+execute 'q "0123456789abcdef 0123456789abcdef end'
+assert_output_contains '"unparsed-data"'
+
+execute 'p "0123456789abcdef 0123456789abcdef" end'
+assert_output_json_eq '{ "p": "0123456789abcdef 0123456789abcdef" }'
+execute 'p 0123456789abcdef0123456789abcdef end'
+assert_output_json_eq '{ "p": "0123456789abcdef0123456789abcdef" }'
+
+cleanup_tmp_files
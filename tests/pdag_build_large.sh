@@ -0,0 +1,29 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "many different parsers at the same pdag node"
+add_rule 'version=2'
+for i in $(seq 0 299); do
+	add_rule "rule=:%n$i:word% x$i"
+done
+
+execute 'a x5'
+assert_output_json_eq '{"n5": "a"}'
+
+execute 'a x299'
+assert_output_json_eq '{"n299": "a"}'
+
+# member order of parser configs does not matter
+reset_rules
+add_rule 'version=2'
+add_rule 'rule=:%{"type":"word", "name":"w"}% %{"name":"n", "type":"number"}% one'
+add_rule 'rule=:%{"name":"w", "type":"word"}% %{"type":"number", "name":"n"}% two'
+
+execute 'a 1 one'
+assert_output_json_eq '{"w": "a", "n": "1"}'
+
+execute 'a 1 two'
+assert_output_json_eq '{"w": "a", "n": "1"}'
+
+cleanup_tmp_files
@@ -0,0 +1,54 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "profile-guided parser reordering"
+add_rule 'version=2'
+add_rule 'rule=one:x1 %n:number%'
+add_rule 'rule=two:x2 %n:number%'
+add_rule 'rule=word1:y %a:word% a'
+add_rule 'rule=word2:y %b:word% b'
+
+msgs='x2 1
+x2 2
+x2 3
+x2 4
+x2 5
+x2 6
+x2 7
+x2 8
+x2 9
+x1 10'
+
+# without reordering, each "x2" message tries the "1 " literal first
+ln_opts="-oprofile -s -"
+execute "$msgs"
+assert_output_contains '{ "name": "literal", "calls": 29, "success": 20'
+
+# after the 4th message, the "2 " literal goes first
+ln_opts="--reoptimize=4 -oprofile -s -"
+execute "$msgs"
+assert_output_contains '{ "n": "9" }'
+assert_output_contains '{ "n": "10" }'
+assert_output_contains '{ "name": "literal", "calls": 24, "success": 20'
+
+# in thread-safe mode, re-optimization is left to the application
+if [ "x$threadsafe_opt" != "x" ]; then
+	ln_opts="--reoptimize=4 -oprofile $threadsafe_opt -s -"
+	execute "$msgs"
+	assert_output_contains '{ "name": "literal", "calls": 29, "success": 20'
+fi
+
+# words can both match the same text, so they are never reordered
+ln_opts="--reoptimize=2 -oprofile -s -"
+execute 'y foo b
+y foo b
+y foo b
+y foo b
+y foo a'
+assert_output_contains '{ "b": "foo" }'
+assert_output_contains '{ "a": "foo" }'
+assert_output_contains '{ "name": "word", "calls": 9, "success": 9'
+
+ln_opts=""
+cleanup_tmp_files
@@ -0,0 +1,49 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "literal prefilter for rules that differ after some fields"
+ln_opts=-oprefilter
+add_rule 'version=2'
+add_rule 'type=@user:user %u:word%'
+add_rule 'rule=:%host:word% %n:number% login accepted for %u:word%'
+add_rule 'rule=:%host:word% %ip:ipv4% login rejected for %u:word%'
+add_rule 'rule=:%host:word% %w:word% connection closed'
+add_rule 'rule=:%host:word% %w:word% session %id:number% %x:@user%'
+add_rule 'rule=:%host:word% %w:word% %r:rest%'
+
+execute 'srv 42 login accepted for joe'
+assert_output_json_eq '{"host": "srv", "n": "42", "u": "joe"}'
+
+execute 'srv 10.0.0.1 login rejected for joe'
+assert_output_json_eq '{"host": "srv", "ip": "10.0.0.1", "u": "joe"}'
+
+execute 'srv eth0 connection closed'
+assert_output_json_eq '{"host": "srv", "w": "eth0"}'
+
+execute 'srv eth0 session 7 user joe'
+assert_output_json_eq '{"host": "srv", "w": "eth0", "id": "7", "x": {"u": "joe"}}'
+
+# the rest rule needs no literal, so it must still be tried
+execute 'srv eth0 connection lost'
+assert_output_json_eq '{"host": "srv", "w": "eth0", "r": "connection lost"}'
+
+execute 'srv 42 login accepted'
+assert_output_json_eq '{"host": "srv", "w": "42", "r": "login accepted"}'
+
+# a literal that is present, but not where the rule needs it
+reset_rules
+add_rule 'version=2'
+add_rule 'rule=:%a:word% %n:number% error here'
+add_rule 'rule=:%a:word% %ip:ipv4% warning here'
+
+execute 'x 12 error here'
+assert_output_json_eq '{"a": "x", "n": "12"}'
+
+execute 'x 10.0.0.1 warning here'
+assert_output_json_eq '{"a": "x", "ip": "10.0.0.1"}'
+
+execute 'x 10.0.0.1 error here warning here'
+assert_output_json_eq '{"originalmsg": "x 10.0.0.1 error here warning here", "unparsed-data": " error here warning here"}'
+
+cleanup_tmp_files
@@ -0,0 +1,80 @@
+/* test driver for turning profiling on and off, see runtime_profile.sh.
+ *
+ * Usage: profile_opts <rulebase> <message>
+ *
+ * This file is part of the liblognorm project, released under ASL 2.0
+ */
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <json.h>
+#include "liblognorm.h"
+
+static void
+normalize(ln_ctx ctx, const char *const msg)
+{
+	struct json_object *json = NULL;
+	ln_normalize(ctx, msg, strlen(msg), &json);
+	json_object_put(json);
+}
+
+static void
+printProfile(const char *const when, ln_ctx ctx)
+{
+	struct json_object *json = NULL;
+	struct json_object *val;
+	if(ln_getProfile(ctx, &json) != 0) {
+		printf("%s: no profile\n", when);
+		return;
+	}
+	json_object_object_get_ex(json, "messages", &val);
+	printf("%s: messages %d", when, json_object_get_int(val));
+	json_object_object_get_ex(json, "nodes", &val);
+	printf(", nodes %d", (int) json_object_array_length(val));
+	if(json_object_array_length(val) > 0) {
+		json_object_object_get_ex(json_object_array_get_idx(val, 0), "calls", &val);
+		printf(", calls %d", json_object_get_int(val));
+	}
+	printf("\n");
+	json_object_put(json);
+}
+
+int
+main(int argc, char *argv[])
+{
+	if(argc != 3) {
+		fprintf(stderr, "usage: profile_opts <rulebase> <message>\n");
+		return 1;
+	}
+	ln_ctx ctx = ln_initCtx();
+	if(ctx == NULL || ln_loadSamples(ctx, argv[1]) != 0) {
+		fprintf(stderr, "cannot load rulebase\n");
+		return 1;
+	}
+	normalize(ctx, argv[2]);
+	printProfile("off", ctx);
+
+	/* enabled after the rulebase was loaded */
+	ln_setCtxOpts(ctx, LN_CTXOPT_PROFILE);
+	normalize(ctx, argv[2]);
+	normalize(ctx, argv[2]);
+	printProfile("on", ctx);
+
+	ln_clearCtxOpts(ctx, LN_CTXOPT_PROFILE);
+	normalize(ctx, argv[2]);
+	printProfile("cleared", ctx);
+
+	/* starts from zero again */
+	ln_setCtxOpts(ctx, LN_CTXOPT_PROFILE);
+	normalize(ctx, argv[2]);
+	printProfile("on again", ctx);
+
+	/* the counters follow the rulebase when it is replaced */
+	if(ln_ctxReload(ctx, argv[1]) != 0)
+		printf("reload failed\n");
+	normalize(ctx, argv[2]);
+	printProfile("reloaded", ctx);
+
+	ln_exitCtx(ctx);
+	return 0;
+}
@@ -0,0 +1,29 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "repeat with fields named dot"
+add_rule 'version=2'
+add_rule 'type=@kv:%name:char-to{"extradata":"="}%=%value:number%'
+add_rule 'rule=:N %{"name":"nums", "type":"repeat", "parser":{"type":"number", "name":"."}, "while":{"type":"literal", "text":","} }%'
+add_rule 'rule=:C %{"name":"kv", "type":"repeat", "parser":{"type":"@kv", "name":"."}, "while":{"type":"literal", "text":" "} }%'
+add_rule 'rule=:F %{"name":"alt", "type":"repeat", "parser":{"type":"alternative", "parser":[{"type":"number", "name":"."}, {"type":"alpha", "name":"w"}]}, "while":{"type":"literal", "text":";"} }%'
+add_rule 'rule=:U %{"type":"repeat", "parser":{"type":"number", "name":"."}, "while":{"type":"literal", "text":","} }% %w:word%'
+
+execute 'N 1,22,333'
+assert_output_json_eq '{ "nums": [ "1", "22", "333" ] }'
+
+# an object named "." is merged into the array element
+execute 'C a=1 b=2'
+assert_output_json_eq '{ "kv": [ { "name": "a", "value": "1" }, { "name": "b", "value": "2" } ] }'
+
+# only some of the repetitions have a field named "."
+execute 'F 12;ab;7'
+assert_output_json_eq '{ "alt": [ "12", { "w": "ab" }, "7" ] }'
+
+# unnamed repeat, no value is needed
+execute 'U 1,2,3 end'
+assert_output_json_eq '{ "w": "end" }'
+
+
+cleanup_tmp_files
@@ -0,0 +1,31 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "precomputed rule mockup and location"
+add_rule 'version=2'
+add_rule 'type=@tuple:%a:number%/%b:number%'
+add_rule 'rule=:t %t:@tuple% end'
+add_rule 'rule=:alt %{"type":"alternative", "parser":[{"name":"num", "type":"number"}, {"name":"ip", "type":"ipv4"}]}% %w:word%'
+add_rule 'rule=:prefix fixed text %w:word%'
+add_rule 'rule=:prefix fixed other %w:word% %-:number%'
+
+for mode in "" $threadsafe_opt; do
+	ln_opts="-oaddRule -oaddRuleLocation $mode"
+	execute 'prefix fixed text here'
+	assert_output_json_eq '{"w": "here", "metadata": {"rule": {"mockup": "prefix fixed text %w:word%", "location": {"file": "tmp.rulebase", "line": 5}}}}'
+	# again, to make sure the shared objects were left intact
+	execute 'prefix fixed other there 5'
+	assert_output_json_eq '{"w": "there", "metadata": {"rule": {"mockup": "prefix fixed other %w:word% %-:number%", "location": {"file": "tmp.rulebase", "line": 6}}}}'
+	execute 'prefix fixed text here'
+	assert_output_json_eq '{"w": "here", "metadata": {"rule": {"mockup": "prefix fixed text %w:word%", "location": {"file": "tmp.rulebase", "line": 5}}}}'
+
+	# these depend on the path taken, so are still built on the fly
+	execute 'alt 10.0.0.1 word'
+	assert_output_json_eq '{"w": "word", "ip": "10.0.0.1", "metadata": {"rule": {"mockup": "alt %ip:ipv4% %w:word%", "location": {"file": "tmp.rulebase", "line": 4}}}}'
+	execute 't 1/2 end'
+	assert_output_json_eq '{"t": {"a": "1", "b": "2"}, "metadata": {"rule": {"mockup": "t %t:USER-DEFINED% end%a:number%/%b:number%", "location": {"file": "tmp.rulebase", "line": 3}}}}'
+done
+
+ln_opts=""
+cleanup_tmp_files
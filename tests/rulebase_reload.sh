@@ -0,0 +1,55 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "rulebase reload on SIGHUP"
+add_rule 'version=2'
+add_rule 'rule=:a %n:number%'
+
+rm -f test.fifo
+mkfifo test.fifo
+$cmd -r tmp.rulebase -e json --input-mode=stream < test.fifo > test.out &
+pid=$!
+exec 3> test.fifo
+
+# wait until the given number of records has been written
+wait_records() {
+	for i in $(seq 100) ; do
+		if [ $(wc -l < test.out) -ge $1 ]; then
+			return 0
+		fi
+		sleep 0.1
+	done
+	echo "FAIL: timeout waiting for record $1"
+	kill $pid
+	exit 1
+}
+
+echo 'a 1' >&3
+wait_records 1
+
+reset_rules
+add_rule 'version=2'
+add_rule 'rule=:b %w:word%'
+kill -HUP $pid
+echo 'b two' >&3
+wait_records 2
+
+# if the new rulebase cannot be loaded, the old one stays in use
+reset_rules
+kill -HUP $pid
+echo 'b three' >&3
+wait_records 3
+
+exec 3>&-
+wait $pid
+cat test.out
+if [ "$(sed -n 1p test.out)" != '{ "n": "1" }' ] ||
+   [ "$(sed -n 2p test.out)" != '{ "w": "two" }' ] ||
+   [ "$(sed -n 3p test.out)" != '{ "w": "three" }' ]; then
+	echo "FAIL: unexpected output"
+	exit 1
+fi
+
+rm -f test.fifo
+cleanup_tmp_files
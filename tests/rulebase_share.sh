@@ -0,0 +1,26 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "sharing a rulebase between contexts"
+skip_without_threadsafe
+add_rule 'version=2'
+add_rule 'rule=one:a %n:number%'
+add_rule 'version=2' second
+add_rule 'rule=two:a %w:word%' second
+
+./ctx_share tmp.rulebase second.rulebase 'a 42' > test.out
+cat test.out
+assert_output_contains 'parent: { "w": "42", "event.tags": [ "two" ] }'
+assert_output_contains 'child0: { "n": "42", "event.tags": [ "one" ] }'
+assert_output_contains 'child1: { "n": "42", "event.tags": [ "one" ], "originalmsg": "a 42" }'
+assert_output_contains 'child3: { "n": "42", "event.tags": [ "one" ] }'
+# events taken before a reload
+assert_output_contains 'parent kept: { "n": "42", "event.tags": [ "one" ] }'
+assert_output_contains 'child3 kept: { "n": "42", "event.tags": [ "one" ] }'
+if [ $(wc -l < test.out) -ne 7 ]; then
+	echo "FAIL: unexpected output"
+	exit 1
+fi
+
+cleanup_tmp_files
@@ -0,0 +1,42 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "runtime profile"
+add_rule 'version=2'
+add_rule 'rule=tag1:a %n:number% b'
+add_rule 'rule=tag2:a %w:word% c'
+
+ln_opts="-oprofile -s -"
+execute 'a 4711 b
+a 4711 c
+a x y'
+assert_output_contains 'Runtime Profile'
+assert_output_contains '"messages": 3, "parsed": 2'
+assert_output_contains '{ "name": "number", "calls": 3, "success": 2'
+assert_output_contains '{ "name": "word", "calls": 2, "success": 2'
+# "a 4711 c" matches the number first and needs to backtrack once,
+# "a x y" fails after word and so backtracks at both nodes above it
+assert_output_contains '"backtracks": [ 1, 1, 1 ]'
+assert_output_contains '"line": 2'
+
+# this also works in thread-safe mode
+if [ "x$threadsafe_opt" != "x" ]; then
+	ln_opts="-oprofile $threadsafe_opt -s -"
+	execute 'a 4711 b
+a 4711 c'
+	assert_output_contains '"messages": 2, "parsed": 2'
+	assert_output_contains '"backtracks": [ 1, 1 ]'
+fi
+
+# profiling can be turned on after loading and off again
+ln_opts=""
+./profile_opts tmp.rulebase 'a 4711 b' > test.out
+cat test.out
+assert_output_contains 'off: no profile'
+assert_output_contains 'on: messages 2, nodes 4, calls 2'
+assert_output_contains 'cleared: no profile'
+assert_output_contains 'on again: messages 1, nodes 4, calls 1'
+assert_output_contains 'reloaded: messages 2, nodes 4, calls 1'
+
+cleanup_tmp_files
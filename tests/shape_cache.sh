@@ -0,0 +1,50 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "message shape cache"
+add_rule 'version=2'
+add_rule 'rule=num:x %n:number% y'
+add_rule 'rule=ip:host %ip:ipv4% up'
+add_rule 'rule=any:host %w:word% up'
+
+# all "x" messages have the same shape; the last "host" message has
+# the shape of the previous one, but does not match its path
+msgs='x 1 y
+x 22 y
+x 333 y
+host 1.2.3.4 up
+host 1.2.3.400 up'
+
+ln_opts="--shape-cache=16 -s -"
+execute "$msgs"
+assert_output_contains '{ "n": "1" }'
+assert_output_contains '{ "n": "22" }'
+assert_output_contains '{ "n": "333" }'
+assert_output_contains '{ "ip": "1.2.3.4" }'
+assert_output_contains '{ "w": "1.2.3.400" }'
+assert_output_contains 'Shape Cache'
+assert_output_contains '"hits": 2, "misses": 2, "mismatches": 1'
+
+# the result must not depend on the order of messages: after the word
+# path was cached, an address still goes to the preferred ipv4 rule
+for order in "host 1.2.3.400 up
+host 1.2.3.4 up" "host 1.2.3.4 up
+host 1.2.3.400 up"; do
+	ln_opts="--shape-cache=16 -s -"
+	execute "$order"
+	assert_output_contains '{ "ip": "1.2.3.4" }'
+	assert_output_contains '{ "w": "1.2.3.400" }'
+	assert_output_contains '"hits": 0, "misses": 1, "mismatches": 1'
+done
+
+# in thread-safe mode, the cache is not used
+if [ "x$threadsafe_opt" != "x" ]; then
+	ln_opts="--shape-cache=16 $threadsafe_opt -s -"
+	execute "$msgs"
+	assert_output_contains '{ "n": "333" }'
+	assert_output_contains '"hits": 0, "misses": 0, "mismatches": 0'
+fi
+
+ln_opts=""
+cleanup_tmp_files
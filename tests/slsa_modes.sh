@@ -0,0 +1,49 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "slsa gives the same rules in all processing modes"
+slsa=../tools/slsa
+
+# each block of 7 lines holds all message types, so chunks of whole
+# blocks must give the same rules as the whole input
+block='Jan 1 10:00:01 host1 sshd[100]: Accepted password for alice from 10.0.0.1 port 2201
+Jan 1 10:00:02 host1 sshd[101]: Accepted password for bob from 10.0.0.2 port 2202
+Jan 1 10:00:03 host2 sshd[102]: Failed password for carol from 10.0.0.3 port 2203
+Jan 1 10:00:04 host2 kernel: eth0 link up
+Jan 1 10:00:05 host3 kernel: eth1 link up
+Jan 1 10:00:06 host1 sshd[103]: Failed password for dave from 10.0.0.4 port 2204
+Jan 1 10:00:07 host3 kernel: eth2 link down'
+rm -f slsa.in
+for i in 1 2 3 4; do
+	echo "$block" >> slsa.in
+done
+
+$slsa < slsa.in > slsa.whole
+cat slsa.whole
+if ! grep -q '8 times: .*Accepted password for' slsa.whole; then
+	echo "FAIL: rule not found"
+	exit 1
+fi
+for opts in "--threads=4" "--chunk-size=7" "--chunk-size=14 --threads=3"; do
+	$slsa $opts < slsa.in > test.out
+	if ! cmp -s slsa.whole test.out; then
+		echo "FAIL: slsa $opts gives different rules:"
+		diff slsa.whole test.out
+		exit 1
+	fi
+done
+
+# unparsed messages from lognormalizer output are mined the same way
+reset_rules
+add_rule 'version=2'
+add_rule 'rule=:%date:date-rfc3164% %host:word% kernel: %if:word% link %state:word%'
+$cmd -r tmp.rulebase -e json < slsa.in | $slsa --lognormalizer-input > test.out
+cat test.out
+if grep -q 'kernel' test.out || ! grep -q '8 times: .*Accepted password for' test.out; then
+	echo "FAIL: wrong messages mined from lognormalizer output"
+	exit 1
+fi
+
+rm -f slsa.in slsa.whole
+cleanup_tmp_files
@@ -0,0 +1,51 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "span (non-json) result API"
+add_rule 'version=2'
+add_rule 'type=@tuple:%a:number%/%b:number%'
+add_rule 'rule=:a %n:number% b %-:word% %w:word%'
+add_rule 'rule=:t %t:@tuple% %j:json%'
+add_rule 'rule=:x %{"name":"x", "type":"word", "priority":10}% end'
+add_rule 'rule=:x %{"name":"y", "type":"word", "priority":20}% %z:word%'
+
+execute_spans() {
+	echo "$1" | $cmd -r tmp.rulebase -e spans > test.out
+	echo "Out:"
+	cat test.out
+}
+
+execute_spans 'a 4711 b skip word'
+assert_output_contains "field n number 2 4 '4711'"
+assert_output_contains "field w word 14 4 'word'"
+assert_output_contains "rule 'a %n:number% b %-:word% %w:word%'"
+if grep -q "field -" test.out; then
+	echo "FAIL: unnamed field reported"
+	exit 1
+fi
+# fields must be reported in message order
+if [ "$(sed -n 2p test.out)" != "field n number 2 4 '4711'" ]; then
+	echo "FAIL: fields not in message order"
+	exit 1
+fi
+
+execute_spans 't 1/2 {"k": "v"}'
+assert_output_contains 'field t USER-DEFINED 2 3 {'
+assert_output_contains '"a": "1"'
+assert_output_contains '"b": "2"'
+assert_output_contains 'field j json 6 10 { "k": "v" }'
+
+# backtracked fields must not show up
+execute_spans 'x one two'
+assert_output_contains "field y word 2 3 'one'"
+assert_output_contains "field z word 6 3 'two'"
+if grep -q "field x" test.out; then
+	echo "FAIL: field of backtracked path reported"
+	exit 1
+fi
+
+execute_spans 'no match'
+assert_output_contains "unparsed"
+
+cleanup_tmp_files
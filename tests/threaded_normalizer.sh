@@ -0,0 +1,52 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "multi-threaded lognormalizer"
+skip_without_threadsafe
+add_rule 'version=2'
+add_rule 'rule=even:a %n:number% even'
+add_rule 'rule=odd:a %n:number% odd %w:word%'
+
+# several chunks worth of data, including unparsable lines
+seq 1 3000 | awk '{ if($1 % 7 == 0) print "bad " $1; else if($1 % 2 == 0) print "a " $1 " even"; else print "a " $1 " odd w" $1; }' > test.input
+
+$cmd -r tmp.rulebase -e json -H < test.input > test.expected 2> test.expected.summary
+$cmd -r tmp.rulebase -e json -H -j4 < test.input > test.out 2> test.summary
+if ! cmp test.expected test.out; then
+	echo "FAIL: threaded output differs from single-threaded output"
+	exit 1
+fi
+if ! cmp test.expected.summary test.summary; then
+	echo "FAIL: summary differs:"
+	cat test.expected.summary test.summary
+	exit 1
+fi
+
+# batched workers
+$cmd -r tmp.rulebase -e json -j3 -b16 < test.input > test.out
+cmp test.expected test.out
+
+# unordered output must contain the same records
+$cmd -r tmp.rulebase -e json -H -j4 -u < test.input > test.out 2> test.summary
+sort test.expected > test.expected.sorted
+sort test.out > test.out.sorted
+if ! cmp test.expected.sorted test.out.sorted; then
+	echo "FAIL: unordered output records differ"
+	exit 1
+fi
+cmp test.expected.summary test.summary
+
+# line numbers of unparsed records
+$cmd -r tmp.rulebase -e json -L -j2 < test.input > test.out
+grep -F '"lognormalizer.line_nbr": 2996' test.out
+
+# tag filtering
+$cmd -r tmp.rulebase -e json -t odd < test.input > test.expected 2> test.expected.summary
+$cmd -r tmp.rulebase -e json -t odd -j2 < test.input > test.out 2> test.summary
+cmp test.expected test.out
+cmp test.expected.summary test.summary
+grep -F 'entries with wrong tag dropped' test.summary
+
+rm -f test.input test.expected test.expected.summary test.summary test.expected.sorted test.out.sorted
+cleanup_tmp_files
@@ -0,0 +1,28 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "thread-safe normalization mode"
+skip_without_threadsafe
+add_rule 'version=2'
+add_rule 'rule=tag1,tag2:a %n:number% b'
+add_rule 'annotate=tag1:+annot="yes"'
+
+ln_opts="-T -othreadSafe"
+execute 'a 4711 b'
+assert_output_json_eq '{"n": "4711", "annot": "yes", "event.tags": [ "tag1", "tag2" ]}'
+
+# second run to make sure the shared tag bucket was left intact
+execute 'a 12 b'
+assert_output_json_eq '{"n": "12", "annot": "yes", "event.tags": [ "tag1", "tag2" ]}'
+
+execute 'a x b'
+assert_output_json_eq '{ "originalmsg": "a x b", "unparsed-data": "x b" }'
+
+# node statistics are not collected in this mode
+ln_opts="-othreadSafe -S -"
+execute 'a 4711 b'
+assert_output_contains 'note: not collected in thread-safe mode'
+
+ln_opts=""
+cleanup_tmp_files
@@ -0,0 +1,109 @@
+/* test driver for concurrent normalization with one context, see
+ * threadsafe_threads.sh.
+ *
+ * Usage: threadsafe_normalize <rulebase> <message>...
+ *
+ * The messages are normalized once up front. Then all threads
+ * normalize all of them over and over, modify the events like an
+ * application would do and compare them to the up-front results.
+ *
+ * This file is part of the liblognorm project, released under ASL 2.0
+ */
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <json.h>
+#include "liblognorm.h"
+
+#define NTHREADS 8
+#define NITER 2000
+
+static ln_ctx ctx;
+static int nmsgs;
+static char **msgs;
+static char **expected;
+
+struct worker {
+	int nfailed;
+	pthread_t tid;
+};
+
+static void *
+worker(void *const arg)
+{
+	struct worker *const w = arg;
+	for(int i = 0 ; i < NITER ; ++i) {
+		const int m = i % nmsgs;
+		struct json_object *json = NULL;
+		ln_normalize(ctx, msgs[m], strlen(msgs[m]), &json);
+		if(json == NULL || strcmp(json_object_to_json_string(json), expected[m])) {
+			++w->nfailed;
+		} else {
+			/* events must be independent of each other */
+			json_object_object_del(json, "event.tags");
+			json_object_object_add(json, "seen", json_object_new_int(i));
+		}
+		json_object_put(json);
+	}
+	return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct worker workers[NTHREADS];
+	int r = 1;
+
+	if(argc < 3) {
+		fprintf(stderr, "usage: threadsafe_normalize <rulebase> <message>...\n");
+		return 1;
+	}
+	if((ctx = ln_initCtx()) == NULL)
+		return 1;
+	if(ln_setCtxOpts(ctx, LN_CTXOPT_THREADSAFE) != 0) {
+		if(ln_hasAdvancedStats()) {
+			printf("thread-safe mode rejected (advanced stats)\n");
+			r = 0;
+		}
+		goto done;
+	}
+	if(ln_hasAdvancedStats()) {
+		fprintf(stderr, "thread-safe mode accepted with advanced stats\n");
+		goto done;
+	}
+	if(ln_loadSamples(ctx, argv[1]) != 0)
+		goto done;
+
+	nmsgs = argc - 2;
+	msgs = argv + 2;
+	if((expected = calloc(nmsgs, sizeof(char*))) == NULL)
+		goto done;
+	for(int i = 0 ; i < nmsgs ; ++i) {
+		struct json_object *json = NULL;
+		ln_normalize(ctx, msgs[i], strlen(msgs[i]), &json);
+		expected[i] = strdup(json_object_to_json_string(json));
+		printf("%s\n", expected[i]);
+		json_object_put(json);
+	}
+
+	for(int i = 0 ; i < NTHREADS ; ++i) {
+		workers[i].nfailed = 0;
+		pthread_create(&workers[i].tid, NULL, worker, &workers[i]);
+	}
+	int nfailed = 0;
+	for(int i = 0 ; i < NTHREADS ; ++i) {
+		pthread_join(workers[i].tid, NULL);
+		nfailed += workers[i].nfailed;
+	}
+	printf("threads: %d, mismatches: %d\n", NTHREADS, nfailed);
+	for(int i = 0 ; i < nmsgs ; ++i)
+		free(expected[i]);
+	free(expected);
+	r = (nfailed == 0) ? 0 : 1;
+
+done:
+	ln_exitCtx(ctx);
+	return r;
+}
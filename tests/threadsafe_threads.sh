@@ -0,0 +1,26 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "concurrent normalization in thread-safe mode"
+add_rule 'version=2'
+add_rule 'type=@port:port %p:number%'
+add_rule 'rule=tag1,tag2:a %n:number% b'
+add_rule 'rule=tag1:conn from %ip:ipv4% %.:@port%'
+add_rule 'annotate=tag1:+annot="yes"'
+
+./threadsafe_normalize tmp.rulebase 'a 4711 b' 'conn from 10.0.0.1 port 22' 'a x b' > test.out
+if [ $? -ne 0 ]; then
+	cat test.out
+	echo "FAIL: threadsafe_normalize failed"
+	exit 1
+fi
+cat test.out
+if ! grep -q 'rejected (advanced stats)' test.out; then
+	assert_output_contains '{ "n": "4711", "event.tags": [ "tag1", "tag2" ], "annot": "yes" }'
+	assert_output_contains '"ip": "10.0.0.1"'
+	assert_output_contains '"unparsed-data": "x b"'
+	assert_output_contains 'mismatches: 0'
+fi
+
+cleanup_tmp_files
@@ -0,0 +1,48 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "memoization of user-defined types"
+add_rule 'version=2'
+add_rule 'type=@num:%n:number%'
+add_rule 'type=@pair:%k:alpha%=%.:@num%'
+add_rule 'rule=:x %p1:@pair% a'
+add_rule 'rule=:x %p2:@pair% b'
+add_rule 'rule=:x %p3:@pair% c'
+
+for opts in "" "-omemoizeTypes"; do
+	ln_opts="$opts"
+	execute 'x k=1 c'
+	assert_output_json_eq '{ "p3": { "k": "k", "n": "1" } }'
+
+	execute 'x k=1 a'
+	assert_output_json_eq '{ "p1": { "k": "k", "n": "1" } }'
+
+	execute 'x k=z c'
+	assert_output_json_eq '{ "originalmsg": "x k=z c", "unparsed-data": "k=z c" }'
+done
+
+# with memoization, the type is only matched once per offset
+ln_opts="-oprofile -s -"
+execute 'x k=1 c'
+assert_output_contains '{ "name": "alpha", "calls": 3,'
+ln_opts="-omemoizeTypes -oprofile -s -"
+execute 'x k=1 c'
+assert_output_contains '{ "name": "alpha", "calls": 1,'
+assert_output_contains '{ "name": "USER-DEFINED", "calls": 4,'
+
+# a type that refers to itself at the same offset finds the result
+# still outstanding, which counts as no match
+reset_rules
+add_rule 'version=2'
+add_rule 'type=@e:%l:@e%+%r:number%'
+add_rule 'type=@e:%n:number%'
+add_rule 'rule=:x %v:@e% end'
+ln_opts="-omemoizeTypes"
+execute 'x 1 end'
+assert_output_json_eq '{ "v": { "n": "1" } }'
+execute 'x 1+2 end'
+assert_output_json_eq '{ "originalmsg": "x 1+2 end", "unparsed-data": "+2 end" }'
+
+ln_opts=""
+cleanup_tmp_files
@@ -0,0 +1,38 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "compilation of v1 rulebases for the v2 engine"
+# v1 tries fields before literal text, the v2 default is the opposite
+add_rule 'rule=:%b:word% x'
+add_rule 'rule=:foo %a:word%'
+add_rule 'rule=:"%q:quoted-string%" %c:char-to:,%,%r:rest%'
+add_rule 'rule=:%q:quoted-string% %c:char-sep:,%,'
+
+ln_opts="-ocompileV1"
+execute 'foo x'
+assert_output_json_eq '{ "b": "foo" }'
+
+# v1 quoted-string strips the quotes
+execute '""ab c"" d,e,f'
+assert_output_json_eq '{ "q": "ab c", "c": "d", "r": "e,f" }'
+execute '"ab c" d,'
+assert_output_json_eq '{ "q": "ab c", "c": "d" }'
+
+# the rulebase really went to the v2 engine
+ln_opts="-ocompileV1 -s -"
+execute 'foo x'
+assert_output_contains 'Main PDAG'
+
+# iptables cannot be compiled, so the v1 engine must be used
+reset_rules
+add_rule 'rule=:iptables: %-:iptables%'
+echo 'iptables: IN=eth0 OUT=' | $cmd -ocompileV1 -r tmp.rulebase -e json > test.out 2> test.err
+echo "Out:"
+cat test.out
+assert_output_json_eq '{ "IN": "eth0", "OUT": "" }'
+cat test.err
+grep -F "iptables (field '-') cannot be compiled" test.err
+
+rm -f test.err
+cleanup_tmp_files
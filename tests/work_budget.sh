@@ -0,0 +1,53 @@
+# added 2026-10-14
+# This file is part of the liblognorm project, released under ASL 2.0
+. $srcdir/exec.sh
+
+test_def $0 "per-message work budget"
+add_rule 'version=2'
+add_rule 'rule=:a %n:number% b'
+
+# the message needs three parser calls and a walk depth of four nodes
+ln_opts="--budget=3"
+execute 'a 4711 b'
+assert_output_json_eq '{ "n": "4711" }'
+
+ln_opts="--budget=2"
+execute 'a 4711 b'
+assert_output_json_eq '{ "originalmsg": "a 4711 b", "unparsed-data": " b" }'
+
+ln_opts="--budget=0,4"
+execute 'a 4711 b'
+assert_output_json_eq '{ "n": "4711" }'
+
+# all parsers matched, but the terminal node is too deep
+ln_opts="--budget=0,3"
+execute 'a 4711 b'
+assert_output_json_eq '{ "originalmsg": "a 4711 b", "unparsed-data": "" }'
+
+ln_opts="--budget=0,0,10000000"
+execute 'a 4711 b'
+assert_output_json_eq '{ "n": "4711" }'
+
+# budget hits are counted, including where they happened
+ln_opts="--budget=2 -s -"
+execute 'a 4711 b
+a 12 b'
+assert_output_contains 'messages exceeding budget: 2'
+assert_output_contains '2, a %n:number%'
+
+# running out of budget inside "repeat" is not a mismatch, even if
+# mismatches are permitted
+reset_rules
+add_rule 'version=2'
+add_rule 'rule=:r %{"name":"n", "type":"repeat", "option.permitMismatchInParser":true, "parser":{"type":"number", "name":"."}, "while":{"type":"literal", "text":","}}%'
+
+ln_opts="--budget=18"
+execute 'r 1,2,3,4,5,6,7,8'
+assert_output_json_eq '{ "n": [ "1", "2", "3", "4", "5", "6", "7", "8" ] }'
+
+ln_opts="--budget=10"
+execute 'r 1,2,3,4,5,6,7,8'
+assert_output_json_eq '{ "originalmsg": "r 1,2,3,4,5,6,7,8", "unparsed-data": "1,2,3,4,5,6,7,8" }'
+
+ln_opts=""
+cleanup_tmp_files
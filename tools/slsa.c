@@ -47,7 +47,6 @@
  */
 
 #include "config.h"
-#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -56,11 +55,12 @@
 #include <ctype.h>
 #include <getopt.h>
 #include <limits.h>
+#include <pthread.h>
 
-#include "json_compatibility.h"
+#include <json.h>
 #include "liblognorm.h"
 #include "internal.h"
-#include "parser.h"
+#include "v1_parser.h"
 #include "syntaxes.h"
 
 #define MAXLINE 32*1024
@@ -104,11 +104,15 @@ struct rule_table {
 	int maxEtry; /* max # entries that fit into table */
 	int nxtEtry; /* next free entry */
 	rule_table_etry_t **entries;
+	/* hash index over the rules, only set up when tables are merged */
+	unsigned hashSize; /* always a power of two */
+	rule_table_etry_t **hash;
 };
 
 struct rule_table_etry {
 	int ntimes;
 	char *rule;
+	rule_table_etry_t *hashNext; /* next entry in same hash bucket */
 };
 #define RULE_TABLE_GROWTH 512 /* number of entries rule table grows when too small */
 
@@ -117,6 +121,13 @@ static int displayProgress = 0; /* display progress indicators */
 static int optPrintTree = 0; /* disply internal tree for debugging purposes */
 static int optPrintDebugOutput = 0;
 static int optSortMultivalues = 1;
+static int optChunkSize = 0; /* number of lines per chunk, 0 = all at once */
+static int optThreads = 1; /* number of threads for subword detection */
+static int optLognormalizerInput = 0; /* input is lognormalizer JSON output */
+/* the v1 parsers read their settings from the field node, so they need
+ * one even if it holds none
+ */
+static const ln_fieldList_t noField;
 
 
 /* forward definitions */
@@ -199,9 +210,69 @@ ruleTableDestroy(rule_table_t *const __restrict__ rt)
 		free((void*)rt->entries[i]);
 	}
 	free((void*) rt->entries);
+	free((void*) rt->hash);
 	free((void*) rt);
 }
 
+/* FNV-1a, for the rule table hash index */
+static unsigned
+ruleHash(const char *__restrict__ rule)
+{
+	unsigned h = 2166136261u;
+	for( ; *rule ; ++rule)
+		h = (h ^ (unsigned char) *rule) * 16777619u;
+	return h;
+}
+
+static void
+ruleTableRehash(rule_table_t *const __restrict__ rt)
+{
+	const unsigned newSize = (rt->hashSize == 0) ? 1024 : 2 * rt->hashSize;
+	free((void*) rt->hash);
+	rt->hash = calloc(newSize, sizeof(rule_table_etry_t*));
+	if(rt->hash == NULL) {
+		perror("slsa: malloc error ruletable hash");
+		exit(1);
+	}
+	rt->hashSize = newSize;
+	for(int i = 0 ; i < rt->nxtEtry ; ++i) {
+		rule_table_etry_t *const etry = rt->entries[i];
+		const unsigned h = ruleHash(etry->rule) & (newSize - 1);
+		etry->hashNext = rt->hash[h];
+		rt->hash[h] = etry;
+	}
+}
+
+/* add the rules of src to dst. Counts of rules that are already in
+ * dst are summed up, all others are moved over. So this is what
+ * keeps the statistics of all chunks in streaming mode. src is
+ * empty (but still needs to be destroyed) after the merge.
+ */
+static void
+ruleTableMerge(rule_table_t *const __restrict__ dst,
+	rule_table_t *const __restrict__ src)
+{
+	for(int i = 0 ; i < src->nxtEtry ; ++i) {
+		reportProgress("rule table merge");
+		if((unsigned) dst->nxtEtry >= dst->hashSize)
+			ruleTableRehash(dst);
+		const unsigned h = ruleHash(src->entries[i]->rule) & (dst->hashSize - 1);
+		rule_table_etry_t *etry;
+		for(etry = dst->hash[h] ; etry != NULL ; etry = etry->hashNext) {
+			if(!strcmp(etry->rule, src->entries[i]->rule))
+				break;
+		}
+		if(etry == NULL) {
+			etry = ruleTableEtryCreate(dst);
+			etry->rule = src->entries[i]->rule;
+			src->entries[i]->rule = NULL;
+			etry->hashNext = dst->hash[h];
+			dst->hash[h] = etry;
+		}
+		etry->ntimes += src->entries[i]->ntimes;
+	}
+}
+
 /* function to quicksort rule table */
 static int
 qs_comp_rt_etry(const void *v1, const void *v2)
@@ -236,13 +307,16 @@ wordstackPop(void)
 	return (wordstackPtr < 0) ? NULL : wordStack[wordstackPtr--];
 }
 
+/* may be called from the subword detection threads */
 static void
 reportProgress(const char *const label)
 {
+	static pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
 	static unsigned cnt = 0;
 	static const char *lastlabel = NULL;
 	if(!displayProgress)
 		return;
+	pthread_mutex_lock(&mut);
 	if(lastlabel == NULL)
 		lastlabel = strdup(label);
 	if(label == NULL || strcmp(label, lastlabel)) {
@@ -254,6 +328,7 @@ reportProgress(const char *const label)
 		if(++cnt % 100 == 0)
 			fprintf(stderr, "\r%s: %u", label, cnt);
 	}
+	pthread_mutex_unlock(&mut);
 }
 
 static int
@@ -317,6 +392,18 @@ logrec_delNode(logrec_node_t *const node)
 	free(node);
 }
 
+/* delete node, all of its siblings and all of their children */
+void
+treeDelete(logrec_node_t *node)
+{
+	while(node != NULL) {
+		logrec_node_t *const sibling = node->sibling;
+		treeDelete(node->child);
+		logrec_delNode(node);
+		node = sibling;
+	}
+}
+
 
 /* returns ptr to existing struct wordinfo or NULL, if not found.
  */
@@ -724,12 +811,20 @@ squashTerminalSiblings(logrec_node_t *const __restrict__ node)
 	
 	node->words = realloc(node->words, sizeof(struct wordinfo *)
 				* (node->nwords + nSiblings));
-	for(logrec_node_t *n = node->sibling ; n ; n = n->sibling) {
-if(optPrintDebugOutput) printf("add to idx %d: '%s'\n", node->nwords, n->words[0]->word);fflush(stdout);
+	logrec_node_t *n = node->sibling;
+	while(n != NULL) {
+		logrec_node_t *const sibling = n->sibling;
+		if(optPrintDebugOutput) {
+			printf("add to idx %d: '%s'\n", node->nwords, n->words[0]->word);
+			fflush(stdout);
+		}
 		node->words[node->nwords++] = n->words[0];
-		n->words[0] = NULL;
+		node->nterm += n->nterm;
+		n->nwords = 0;
+		logrec_delNode(n);
+		n = sibling;
 	}
-	node->sibling = NULL; // TODO: fix memory leak
+	node->sibling = NULL;
 }
 
 /* reprocess tree to check subword creation */
@@ -747,6 +842,73 @@ treeDetectSubwords(logrec_node_t *node)
 	}
 }
 
+/* subword detection only ever changes the subtree it works on. So the
+ * subtrees below the root can be processed in parallel. Each thread
+ * takes the next not yet processed subtree until none is left.
+ */
+struct subword_job {
+	logrec_node_t **nodes;
+	int nnodes;
+	int next; /* next subtree to process, taken atomically */
+};
+
+static void *
+subwordWorker(void *const arg)
+{
+	struct subword_job *const job = (struct subword_job*) arg;
+	int i;
+	while((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->nnodes) {
+		checkSubwords(job->nodes[i]);
+		treeDetectSubwords(job->nodes[i]->child);
+	}
+	return NULL;
+}
+
+/* same as treeDetectSubwords(tree), but with optThreads threads */
+void
+treeDetectSubwordsParallel(logrec_node_t *const tree)
+{
+	if(optThreads <= 1 || tree->sibling != NULL) {
+		treeDetectSubwords(tree);
+		return;
+	}
+	reportProgress("subword detection");
+	checkSubwords(tree);
+	if(tree->child == NULL)
+		return;
+	reportProgress("subword detection");
+	squashTerminalSiblings(tree->child);
+
+	struct subword_job job = { NULL, 0, 0 };
+	for(logrec_node_t *n = tree->child ; n != NULL ; n = n->sibling)
+		++job.nnodes;
+	job.nodes = malloc(job.nnodes * sizeof(logrec_node_t*));
+	if(job.nodes == NULL) {
+		perror("slsa: malloc error subword job");
+		exit(1);
+	}
+	int i = 0;
+	for(logrec_node_t *n = tree->child ; n != NULL ; n = n->sibling)
+		job.nodes[i++] = n;
+
+	const int nthreads = (optThreads < job.nnodes) ? optThreads : job.nnodes;
+	pthread_t *const thrds = malloc(nthreads * sizeof(pthread_t));
+	if(thrds == NULL) {
+		perror("slsa: malloc error subword threads");
+		exit(1);
+	}
+	for(i = 0 ; i < nthreads ; ++i) {
+		if(pthread_create(&thrds[i], NULL, subwordWorker, &job) != 0) {
+			perror("slsa: cannot create subword detection thread");
+			exit(1);
+		}
+	}
+	for(i = 0 ; i < nthreads ; ++i)
+		pthread_join(thrds[i], NULL);
+	free(thrds);
+	free(job.nodes);
+}
+
 /* squash a tree, that is combine nodes that point to nodes
  * without siblings to a single node.
  */
@@ -926,7 +1088,7 @@ treeCreateRuleTableNonRoot(logrec_node_t *__restrict__ node,
 		treeCreateRuleTableNonRoot(node->child, rt, msg);
 		node = node->sibling;
 	}
-
+	free((void*)msg);
 }
 
 rule_table_t *
@@ -963,7 +1125,7 @@ wordDetectSyntax(struct wordinfo *const __restrict__ wi, const size_t wordlen,
 		wi->flags.isSpecial = 1;
 		goto done;
 	}
-	if(ln_parseTime24hr(wi->word, wordlen, &constzero, NULL, &nproc, NULL) == 0 &&
+	if(ln_parseTime24hr(wi->word, wordlen, &constzero, &noField, &nproc, NULL) == 0 &&
 	   nproc == wordlen) {
 		free(wi->word);
 		wi->word = strdup("%time-24hr%");
@@ -975,7 +1137,7 @@ wordDetectSyntax(struct wordinfo *const __restrict__ wi, const size_t wordlen,
 	 * digit and so Tim24hr will not pick it. Still we may get false
 	 * detection for durations > 10hrs, but so is it...
 	 */
-	if(ln_parseDuration(wi->word, wordlen, &constzero, NULL, &nproc, NULL) == 0 &&
+	if(ln_parseDuration(wi->word, wordlen, &constzero, &noField, &nproc, NULL) == 0 &&
 	   nproc == wordlen) {
 		free(wi->word);
 		wi->word = strdup("%duration%");
@@ -1013,7 +1175,7 @@ wordDetectSyntax(struct wordinfo *const __restrict__ wi, const size_t wordlen,
 				}
 		}
 	}
-	if(ln_parseKernelTimestamp(wi->word, wordlen, &constzero, NULL, &nproc, NULL) == 0 &&
+	if(ln_parseKernelTimestamp(wi->word, wordlen, &constzero, &noField, &nproc, NULL) == 0 &&
 	   nproc == wordlen) {
 		free(wi->word);
 		wi->word = strdup("%kernel-timestamp%");
@@ -1083,6 +1245,7 @@ treeAddToLevel(logrec_node_t *const level, /* current node */
 		struct wordinfo *wi_val;
 		if((wi_val = logrec_hasWord(existing, wi->word)) != NULL) {
 			wi_val->occurs++;
+			wordinfoDelete(wi);
 			break;
 		}
 		prev = existing;
@@ -1154,21 +1317,21 @@ preprocessLine(const char *const __restrict__ buf,
 		 * words*. Otherwise, it is safer to detect them on a
 		 * word basis.
 		 */
-		if(ln_parseRFC3164Date(buf, buflen, &i, NULL, &nproc, NULL) == 0) {
+		if(ln_parseRFC3164Date(buf, buflen, &i, &noField, &nproc, NULL) == 0) {
 			tocopy = "%date-rfc3164%";
-		} else if(ln_parseRFC5424Date(buf, buflen, &i, NULL, &nproc, NULL) == 0) {
+		} else if(ln_parseRFC5424Date(buf, buflen, &i, &noField, &nproc, NULL) == 0) {
 			tocopy = "%date-rfc5424%";
-		} else if(ln_parseISODate(buf, buflen, &i, NULL, &nproc, NULL) == 0) {
+		} else if(ln_parseISODate(buf, buflen, &i, &noField, &nproc, NULL) == 0) {
 			tocopy = "%date-iso%";
-		} else if(ln_parsev2IPTables(buf, buflen, &i, NULL, &nproc, NULL) == 0) {
+		} else if(ln_parsev2IPTables(buf, buflen, &i, &noField, &nproc, NULL) == 0) {
 			tocopy = "%v2-iptables%";
-		} else if(ln_parseNameValue(buf, buflen, &i, NULL, &nproc, NULL) == 0) {
+		} else if(ln_parseNameValue(buf, buflen, &i, &noField, &nproc, NULL) == 0) {
 			tocopy = "%name-value-list%";
-		} else if(ln_parseCiscoInterfaceSpec(buf, buflen, &i, NULL, &nproc, NULL) == 0) {
+		} else if(ln_parseCiscoInterfaceSpec(buf, buflen, &i, &noField, &nproc, NULL) == 0) {
 			tocopy = "%cisco-interface-spec%";
-		} else if(ln_parseCEESyslog(buf, buflen, &i, NULL, &nproc, NULL) == 0) {
+		} else if(ln_parseCEESyslog(buf, buflen, &i, &noField, &nproc, NULL) == 0) {
 			tocopy = "%cee-syslog%";
-		} else if(ln_parseJSON(buf, buflen, &i, NULL, &nproc, NULL) == 0) {
+		} else if(ln_parseJSON(buf, buflen, &i, &noField, &nproc, NULL) == 0) {
 			tocopy = "%json%";
 		} else {
 			tocopy = NULL;
@@ -1188,35 +1351,114 @@ preprocessLine(const char *const __restrict__ buf,
 	bufout[iout] = '\0';
 	++lnCnt;
 }
+/* extract the message from a record that lognormalizer (-e json) could
+ * not normalize. These are recognized by their "unparsed-data" field or,
+ * if they were output by the span path, by having nothing but the
+ * "originalmsg". All other records are skipped. The message replaces
+ * the record in buf. It always fits, as its JSON encoding is never
+ * shorter than the message itself.
+ * returns length of message, 0 if the record is to be skipped
+ */
+static size_t
+getUnparsedMsg(char *const buf)
+{
+	size_t len = 0;
+	struct json_object *const json = json_tokener_parse(buf);
+	struct json_object *msg;
+	struct json_object *dummy;
+	if(json == NULL || !json_object_is_type(json, json_type_object)) {
+		fprintf(stderr, "slsa: skipping invalid lognormalizer record: %s\n", buf);
+		goto done;
+	}
+	if(!json_object_object_get_ex(json, "originalmsg", &msg))
+		goto done;
+	if(!json_object_object_get_ex(json, "unparsed-data", &dummy)
+	   && json_object_object_length(json) != 1)
+		goto done;
+	const char *const str = json_object_get_string(msg);
+	len = strlen(str);
+	memcpy(buf, str, len + 1);
+done:
+	if(json != NULL)
+		json_object_put(json);
+	return len;
+}
+
+/* read the next line into lnbuf.
+ * returns length of line, which may be 0 for empty lines
+ */
+static size_t
+readLine(FILE *fp, char *const lnbuf)
+{
+	size_t i;
+	for(i = 0 ; i < MAXLINE-1 ; ++i) {
+		const int c = fgetc(fp);
+		if(c == EOF || c == '\n')
+			break;
+		lnbuf[i] = c;
+	}
+	lnbuf[i] = '\0';
+	if(i > 0 && optLognormalizerInput)
+		i = getUnparsedMsg(lnbuf);
+	return i;
+}
+
+/* analyze the tree built so far and create the rules for it */
+static rule_table_t *
+treeAnalyze(void)
+{
+	treePrint(root, 0);
+	treeDetectSubwordsParallel(root);
+	treeSquash(root);
+	treePrint(root, 0);
+	return treeCreateRuleTable(root);
+}
+
+/* In streaming mode (optChunkSize > 0), the tree is analyzed and
+ * discarded after every optChunkSize lines, and only the resulting
+ * rules are kept and merged. So memory is bounded by the chunk size
+ * and the number of different rules, not by the size of the input.
+ * The price is that structure which only shows up across chunks is
+ * not detected. So the chunk size should be large enough to contain
+ * a good number of instances of each message type.
+ */
 int
 processFile(FILE *fp)
 {
 	char lnbuf[MAXLINE];
 	char lnpreproc[MAXLINE];
+	rule_table_t *rt = NULL;
+	int nlines = 0;
 
 	while(!feof(fp)) {
 		reportProgress("reading");
-		size_t i;
-		for(i = 0 ; i < sizeof(lnbuf)-1 ; ++i) {
-			const int c = fgetc(fp);
-			if(c == EOF || c == '\n')
-				break;
-			lnbuf[i] = c;
-		}
-		lnbuf[i] = '\0';
+		const size_t i = readLine(fp, lnbuf);
 		if(i > 0) {
 			//processLine(lnbuf, i, &logrec);
 			//logrecPrint(logrec);
 			preprocessLine(lnbuf, i, lnpreproc);
 			treeAddLine(lnpreproc);
+			++nlines;
+		}
+		if(optChunkSize > 0 && nlines == optChunkSize) {
+			if(rt == NULL)
+				rt = ruleTableCreate();
+			rule_table_t *const chunkrt = treeAnalyze();
+			ruleTableMerge(rt, chunkrt);
+			ruleTableDestroy(chunkrt);
+			treeDelete(root);
+			root = logrec_newNode(wordinfoNew(strdup("[ROOT]")), NULL);
+			nlines = 0;
 		}
 	}
 
-	treePrint(root, 0);
-	treeDetectSubwords(root);
-	treeSquash(root);
-	treePrint(root, 0);
-	rule_table_t *const rt = treeCreateRuleTable(root);
+	if(rt == NULL) {
+		rt = treeAnalyze();
+	} else if(nlines > 0) {
+		rule_table_t *const chunkrt = treeAnalyze();
+		ruleTableMerge(rt, chunkrt);
+		ruleTableDestroy(chunkrt);
+	}
 	reportProgress("sorting rule table");
 	qsort(rt->entries, (size_t) rt->nxtEtry, sizeof(rule_table_etry_t*), qs_comp_rt_etry);
 	ruleTablePrint(rt);
@@ -1230,6 +1472,9 @@ processFile(FILE *fp)
 #define OPT_PRINT_TREE 1000
 #define OPT_PRINT_DEBUG_OUTPUT 1001
 #define OPT_SORT_MULTIVALUES 1002
+#define OPT_CHUNK_SIZE 1003
+#define OPT_THREADS 1004
+#define OPT_LOGNORMALIZER_INPUT 1005
 int
 main(int argc, char *argv[])
 {
@@ -1240,6 +1485,9 @@ main(int argc, char *argv[])
 		{ "print-tree", 	no_argument,	  0, OPT_PRINT_TREE },
 		{ "print-debug-output",	no_argument,	  0, OPT_PRINT_DEBUG_OUTPUT },
 		{ "sort-multivalues",	required_argument,0, OPT_SORT_MULTIVALUES },
+		{ "chunk-size",		required_argument,0, OPT_CHUNK_SIZE },
+		{ "threads",		required_argument,0, OPT_THREADS },
+		{ "lognormalizer-input",no_argument,	  0, OPT_LOGNORMALIZER_INPUT },
 		{ NULL,		0, 0, 0 }
 	};
 
@@ -1267,6 +1515,23 @@ main(int argc, char *argv[])
 				exit(1);
 			}
 			break;
+		case OPT_CHUNK_SIZE:
+			optChunkSize = atoi(optarg);
+			if(optChunkSize < 0) {
+				fprintf(stderr, "invalid value '%s' for --chunk-size\n", optarg);
+				exit(1);
+			}
+			break;
+		case OPT_THREADS:
+			optThreads = atoi(optarg);
+			if(optThreads < 1) {
+				fprintf(stderr, "invalid value '%s' for --threads\n", optarg);
+				exit(1);
+			}
+			break;
+		case OPT_LOGNORMALIZER_INPUT:
+			optLognormalizerInput = 1;
+			break;
 		case '?':
 		default:
 		//	usage(stderr);
@@ -46,7 +46,7 @@ getPosInt(const char *const __restrict__ buf,
 int
 syntax_ipv4(const char *const __restrict__ buf,
 	const size_t buflen,
-	const char *extracted,
+	__attribute__((unused)) const char *extracted,
 	size_t *const __restrict__ nprocessed)
 {
 	int64_t val;
@@ -91,7 +91,7 @@ done:
 int
 syntax_posint(const char *const __restrict__ buf,
 	const size_t buflen,
-	const char *extracted,
+	__attribute__((unused)) const char *extracted,
 	size_t *const __restrict__ nprocessed)
 {
 	int64_t val;